@@ -0,0 +1,159 @@
+#include "announce-list.h"
+#include "sanitize-settings.h"
+#include "torrentbase.h"
+#include "debug.h"
+
+#include <iostream>
+
+extern "C" {
+#include <string.h>
+}
+
+namespace torrent {
+
+static inline uint32_t stringHash(const char *s, size_t len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char) s[i]) * 16777619u;
+	return h;
+}
+
+static inline size_t slotIndex(uint32_t hash, size_t mask) {
+	return (hash ^ (hash >> 15)) & mask;
+}
+
+StringIndex::StringIndex() : m_slots(16) {
+}
+
+void StringIndex::clear() {
+	m_strings.clear();
+	m_entries.clear();
+	m_slots.assign(16, 0);
+}
+
+void StringIndex::grow() {
+	std::vector<uint32_t> slots(2 * m_slots.size());
+	const size_t mask = slots.size() - 1;
+	for (size_t k = 0; k < m_entries.size(); k++) {
+		size_t i = slotIndex(m_entries[k].hash, mask);
+		while (0 != slots[i]) i = (i + 1) & mask;
+		slots[i] = k + 1;
+	}
+	m_slots.swap(slots);
+}
+
+size_t StringIndex::insert(const char *s, size_t len, bool &added) {
+	const uint32_t hash = stringHash(s, len);
+	const size_t mask = m_slots.size() - 1;
+	size_t i = slotIndex(hash, mask);
+	for (; 0 != m_slots[i]; i = (i + 1) & mask) {
+		const Entry &e = m_entries[m_slots[i] - 1];
+		if (e.hash == hash && e.length == len && 0 == memcmp(m_strings.data() + e.offset, s, len)) {
+			added = false;
+			return m_slots[i] - 1;
+		}
+	}
+
+	Entry e;
+	e.hash = hash;
+	e.offset = m_strings.length();
+	e.length = len;
+	m_strings.append(s, len);
+	m_entries.push_back(e);
+	m_slots[i] = m_entries.size();
+	if (2 * m_entries.size() > m_slots.size()) grow();
+	added = true;
+	return m_entries.size() - 1;
+}
+
+AnnounceList::AnnounceList(const TorrentSanitize &san) : m_san(san), m_tiers_valid(true) {
+	m_scratch.trace = getDebugActive() ? &std::cerr : 0;
+	m_tier_start.push_back(0);
+}
+
+void AnnounceList::merge(const std::string &url) {
+	bool added;
+	m_merged.insert(url, added);
+	if (!added) return; /* would add the same urls again */
+
+	m_san.filters().filterUrl(url, m_scratch, m_annurls);
+	for (size_t i = 0; i < m_annurls.size(); i++) add(m_annurls[i].domain, m_annurls[i].url);
+}
+
+void AnnounceList::merge(const std::vector<std::string> &urls) {
+	for (size_t i = 0; i < urls.size(); i++) merge(urls[i]);
+}
+
+void AnnounceList::merge(const std::vector< std::vector<std::string> > &tiers) {
+	for (size_t i = 0; i < tiers.size(); i++) merge(tiers[i]);
+}
+
+void AnnounceList::merge(const TorrentBase &t) {
+	merge(t.t_announce);
+	merge(t.t_announce_list);
+}
+
+void AnnounceList::force_merge(const std::string &url) {
+	AnnounceUrl annurl;
+	if (!m_san.basicUrlCleaner(url, annurl)) return;
+
+	add(annurl.domain, annurl.url);
+}
+
+void AnnounceList::force_merge(const std::vector<std::string> &urls) {
+	for (size_t i = 0; i < urls.size(); i++) merge(urls[i]);
+}
+
+void AnnounceList::add(const std::string &domain, const std::string &url) {
+	bool added;
+	size_t tier = m_domains.insert(domain, added);
+	m_urls.insert(url, added);
+	if (!added) return;
+	m_url_tier.push_back(tier);
+	m_tiers_valid = false;
+}
+
+void AnnounceList::buildTiers() const {
+	if (m_tiers_valid) return;
+
+	m_tier_start.assign(m_domains.size() + 1, 0);
+	for (size_t k = 0; k < m_url_tier.size(); k++) m_tier_start[m_url_tier[k] + 1]++;
+	for (size_t t = 0; t < m_domains.size(); t++) m_tier_start[t + 1] += m_tier_start[t];
+
+	/* stable: urls keep their order within a tier */
+	std::vector<uint32_t> next(m_tier_start.begin(), m_tier_start.end() - 1);
+	m_order.resize(m_url_tier.size());
+	for (size_t k = 0; k < m_url_tier.size(); k++) m_order[next[m_url_tier[k]]++] = k;
+
+	m_tiers_valid = true;
+}
+
+size_t AnnounceList::tierSize(size_t tier) const {
+	buildTiers();
+	return m_tier_start[tier + 1] - m_tier_start[tier];
+}
+
+BufferString AnnounceList::url(size_t tier, size_t i) const {
+	buildTiers();
+	return m_urls.at(m_order[m_tier_start[tier] + i]);
+}
+
+void AnnounceList::copyTo(std::vector< std::vector<std::string> > &list) const {
+	buildTiers();
+	list.resize(tiers());
+	for (size_t t = 0; t < tiers(); t++) {
+		std::vector<std::string> &tier = list[t];
+		tier.resize(m_tier_start[t + 1] - m_tier_start[t]);
+		for (size_t i = 0; i < tier.size(); i++) {
+			BufferString u = m_urls.at(m_order[m_tier_start[t] + i]);
+			tier[i].assign(u.data(), u.length());
+		}
+	}
+}
+
+std::vector< std::vector<std::string> > AnnounceList::list() const {
+	std::vector< std::vector<std::string> > result;
+	copyTo(result);
+	return result;
+}
+
+}
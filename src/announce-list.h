@@ -0,0 +1,102 @@
+#ifndef __TORRENT_SANITIZE_ANNOUNCE_LIST_H
+#define __TORRENT_SANITIZE_ANNOUNCE_LIST_H
+
+#include "buffer.h"
+#include "filter-set.h"
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <stdint.h>
+#include <sys/types.h>
+}
+
+namespace torrent {
+
+class TorrentSanitize;
+class TorrentBase;
+
+/* set of strings, numbered in order of insertion: the strings are stored back
+ * to back in one string, found through an open addressing hash table */
+class StringIndex {
+public:
+	StringIndex();
+
+	void clear();
+
+	/* number of s; added: s wasn't in the set before */
+	size_t insert(const char *s, size_t len, bool &added);
+	size_t insert(const std::string &s, bool &added) { return insert(s.data(), s.length(), added); }
+
+	size_t size() const { return m_entries.size(); }
+	BufferString at(size_t k) const { return BufferString(m_strings.data() + m_entries[k].offset, m_entries[k].length); }
+
+private:
+	struct Entry {
+		uint32_t hash;
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	void grow();
+
+	std::string m_strings;
+	std::vector<Entry> m_entries;
+	std::vector<uint32_t> m_slots; /* entry + 1, 0: empty; power of two, at most half used */
+};
+
+/* announce urls from many sources, grouped in tiers by domain (see
+ * AnnounceUrl::domain): tiers in order of the first url of the domain, urls
+ * in order of appearance, without duplicates.
+ *
+ * urls and domains are StringIndex sets; the tiers are built on demand (a
+ * counting sort of the urls by tier). raw urls merged before are skipped with
+ * one lookup, without running the url filter again.
+ */
+class AnnounceList {
+public:
+	explicit AnnounceList(const TorrentSanitize &san);
+
+	/* urls through the url filter */
+	void merge(const std::string &url);
+	void merge(const std::vector<std::string> &urls);
+	void merge(const std::vector< std::vector<std::string> > &tiers);
+	void merge(const TorrentBase &t);
+
+	/* url only cleaned with basicUrlCleaner() */
+	void force_merge(const std::string &url);
+	/* added trackers ("+" in the url filter config): these still go through
+	 * the url filter, like they always did */
+	void force_merge(const std::vector<std::string> &urls);
+
+	bool empty() const { return 0 == m_urls.size(); }
+	size_t tiers() const { return m_domains.size(); }
+	size_t tierSize(size_t tier) const;
+	BufferString url(size_t tier, size_t i) const;
+
+	/* as announce-list */
+	void copyTo(std::vector< std::vector<std::string> > &list) const;
+	std::vector< std::vector<std::string> > list() const;
+
+private:
+	void add(const std::string &domain, const std::string &url);
+	void buildTiers() const;
+
+	const TorrentSanitize &m_san;
+	FilterScratch m_scratch;
+	std::vector<AnnounceUrl> m_annurls; /* filterUrl() result */
+
+	StringIndex m_merged; /* raw urls passed to merge() */
+	StringIndex m_domains; /* one per tier */
+	StringIndex m_urls;
+	std::vector<uint32_t> m_url_tier;
+
+	mutable bool m_tiers_valid;
+	mutable std::vector<uint32_t> m_order; /* urls ordered by tier */
+	mutable std::vector<uint32_t> m_tier_start; /* tier t: m_order[m_tier_start[t] .. m_tier_start[t+1]) */
+};
+
+}
+
+#endif
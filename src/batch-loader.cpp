@@ -0,0 +1,440 @@
+
+#include "batch-loader.h"
+
+#include <iostream>
+#include <limits>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#endif
+}
+
+namespace torrent {
+
+struct BatchLoader::Slot {
+	enum State { OPEN, STAT, READ };
+
+	size_t id; /* position in m_slots */
+	size_t index; /* file index */
+	State state;
+	int fd;
+	bool ok;
+#ifdef HAVE_IO_URING
+	struct statx stx;
+#endif
+	char *data;
+	size_t len, have;
+};
+
+#ifdef HAVE_IO_URING
+
+/* minimal io_uring wrapper on top of the raw syscalls */
+struct BatchLoader::Ring {
+	int fd;
+	unsigned int entries;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	unsigned int to_submit;
+	unsigned int inflight; /* queued requests without completion */
+
+	Ring() : fd(-1), entries(0), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sq_size(0), cq_size(0), sqes((struct io_uring_sqe*) MAP_FAILED), sqes_size(0), to_submit(0), inflight(0) { }
+
+	~Ring() {
+		if (MAP_FAILED != (void*) sqes) ::munmap(sqes, sqes_size);
+		if (MAP_FAILED != cq_ptr && cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_size);
+		if (MAP_FAILED != sq_ptr) ::munmap(sq_ptr, sq_size);
+		if (-1 != fd) ::close(fd);
+	}
+
+	bool setup(unsigned int depth) {
+		struct io_uring_params p;
+		::memset(&p, 0, sizeof(p));
+		fd = ::syscall(__NR_io_uring_setup, depth, &p);
+		if (-1 == fd) return false;
+		entries = p.sq_entries;
+
+		sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+		cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			sq_size = cq_size = std::max(sq_size, cq_size);
+		}
+
+		sq_ptr = ::mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (MAP_FAILED == sq_ptr) return false;
+		if (p.features & IORING_FEAT_SINGLE_MMAP) {
+			cq_ptr = sq_ptr;
+		} else {
+			cq_ptr = ::mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (MAP_FAILED == cq_ptr) return false;
+		}
+		sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+		sqes = (struct io_uring_sqe*) ::mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (MAP_FAILED == (void*) sqes) return false;
+
+		char *sq = (char*) sq_ptr, *cq = (char*) cq_ptr;
+		sq_head = (unsigned int*) (sq + p.sq_off.head);
+		sq_tail = (unsigned int*) (sq + p.sq_off.tail);
+		sq_mask = (unsigned int*) (sq + p.sq_off.ring_mask);
+		sq_array = (unsigned int*) (sq + p.sq_off.array);
+		cq_head = (unsigned int*) (cq + p.cq_off.head);
+		cq_tail = (unsigned int*) (cq + p.cq_off.tail);
+		cq_mask = (unsigned int*) (cq + p.cq_off.ring_mask);
+		cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+		return supports(IORING_OP_OPENAT) && supports(IORING_OP_STATX) && supports(IORING_OP_READ) && supports(IORING_OP_CLOSE);
+	}
+
+	bool supports(unsigned int op) {
+		const size_t nops = 256;
+		char buf[sizeof(struct io_uring_probe) + nops * sizeof(struct io_uring_probe_op)];
+		::memset(buf, 0, sizeof(buf));
+		struct io_uring_probe *probe = (struct io_uring_probe*) buf;
+		if (0 > ::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, nops)) return false;
+		if (op > probe->last_op || op >= probe->ops_len) return false;
+		return 0 != (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+	}
+
+	bool enter(unsigned int min_complete) {
+		for (;;) {
+			int r = ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+			if (r >= 0) {
+				to_submit -= r;
+				return true;
+			}
+			if (EINTR != errno) return false;
+		}
+	}
+
+	/* there are two entries per slot (a request and a close), so the ring
+	 * shouldn't fill up; if it does anyway submit before queueing more */
+	struct io_uring_sqe* sqe() {
+		unsigned int tail = *sq_tail;
+		if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= entries) enter(0);
+		unsigned int ndx = tail & *sq_mask;
+		struct io_uring_sqe *e = &sqes[ndx];
+		::memset(e, 0, sizeof(*e));
+		sq_array[ndx] = ndx;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		to_submit++;
+		inflight++;
+		return e;
+	}
+};
+
+/* user_data: slot index (+1), 0 for fire-and-forget close requests */
+static const __u64 close_tag = 0;
+
+#else
+
+struct BatchLoader::Ring {
+};
+
+#endif
+
+BatchLoader::BatchLoader(unsigned int depth)
+: m_next_add(0), m_done(0), m_ring(0) {
+#ifdef HAVE_IO_URING
+	if (0 == depth) depth = 1;
+	m_ring = new Ring();
+	if (!m_ring->setup(2*depth)) {
+		delete m_ring;
+		m_ring = 0;
+		return;
+	}
+	for (unsigned int i = 0; i < depth; i++) {
+		Slot *s = new Slot();
+		s->id = i;
+		s->fd = -1;
+		s->data = 0;
+		m_slots.push_back(s);
+		m_free_slots.push_back(s);
+	}
+#else
+	(void) depth;
+#endif
+}
+
+BatchLoader::~BatchLoader() {
+	drain();
+	delete m_ring;
+	for (size_t i = 0; i < m_slots.size(); i++) {
+		if (m_slots[i]->data) delete[] m_slots[i]->data;
+		delete m_slots[i];
+	}
+}
+
+size_t BatchLoader::add(const std::string &filename) {
+	m_filenames.push_back(filename);
+	return m_filenames.size() - 1;
+}
+
+bool BatchLoader::next(Buffer &buffer, size_t &index, bool &ok) {
+	if (m_done >= m_filenames.size()) return false;
+	m_done++;
+
+	if (0 == m_ring) {
+		if (!m_retry.empty()) {
+			index = m_retry.back();
+			m_retry.pop_back();
+		} else {
+			index = m_next_add++;
+		}
+		ok = buffer.load(m_filenames[index]);
+		return true;
+	}
+
+	fill();
+	while (!reap(buffer, index, ok)) { }
+	return true;
+}
+
+#ifdef HAVE_IO_URING
+
+/* start opening files for all free slots */
+void BatchLoader::fill() {
+	while (!m_free_slots.empty() && m_next_add < m_filenames.size()) {
+		struct io_uring_sqe *e = m_ring->sqe();
+		Slot *s = m_free_slots.back();
+		m_free_slots.pop_back();
+		s->index = m_next_add++;
+		s->state = Slot::OPEN;
+		s->fd = -1;
+		s->ok = false;
+		s->data = 0;
+		s->len = s->have = 0;
+
+		e->opcode = IORING_OP_OPENAT;
+		e->fd = AT_FDCWD;
+		e->addr = (__u64) (uintptr_t) m_filenames[s->index].c_str();
+		e->open_flags = O_RDONLY | O_CLOEXEC;
+		e->user_data = (__u64) s->id + 1;
+	}
+}
+
+static void statxToStat(const struct statx &stx, struct stat &st) {
+	::memset(&st, 0, sizeof(st));
+	st.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	st.st_ino = stx.stx_ino;
+	st.st_mode = stx.stx_mode;
+	st.st_nlink = stx.stx_nlink;
+	st.st_uid = stx.stx_uid;
+	st.st_gid = stx.stx_gid;
+	st.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+	st.st_size = stx.stx_size;
+	st.st_blksize = stx.stx_blksize;
+	st.st_blocks = stx.stx_blocks;
+	st.st_atim.tv_sec = stx.stx_atime.tv_sec;
+	st.st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+	st.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+	st.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+	st.st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+	st.st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+}
+
+void BatchLoader::submitRead(Slot *s) {
+	struct io_uring_sqe *e = m_ring->sqe();
+	e->opcode = IORING_OP_READ;
+	e->fd = s->fd;
+	e->addr = (__u64) (uintptr_t) (s->data + s->have);
+	e->len = std::min<size_t>(s->len - s->have, 1u << 30);
+	e->off = s->have;
+	e->user_data = (__u64) s->id + 1;
+}
+
+/* handle a completion for slot s; returns true if the slot is finished */
+bool BatchLoader::complete(Slot *s, int res) {
+	const std::string &filename = m_filenames[s->index];
+
+	switch (s->state) {
+	case Slot::OPEN:
+		if (res < 0) {
+			std::cerr << "Cannot open file '" << filename << "': " << ::strerror(-res) << std::endl;
+			return true;
+		}
+		s->fd = res;
+		s->state = Slot::STAT;
+		{
+			struct io_uring_sqe *e = m_ring->sqe();
+			e->opcode = IORING_OP_STATX;
+			e->fd = s->fd;
+			e->addr = (__u64) (uintptr_t) "";
+			e->statx_flags = AT_EMPTY_PATH;
+			e->len = STATX_BASIC_STATS;
+			e->off = (__u64) (uintptr_t) &s->stx;
+			e->user_data = (__u64) s->id + 1;
+		}
+		return false;
+	case Slot::STAT:
+		if (res < 0) {
+			std::cerr << "Cannot stat file '" << filename << "': " << ::strerror(-res) << std::endl;
+			return true;
+		}
+		if (!S_ISREG(s->stx.stx_mode)) {
+			std::cerr << "Not a regular file: '" << filename << "'" << std::endl;
+			return true;
+		}
+		if (s->stx.stx_size > (__u64) std::numeric_limits<ssize_t>::max()) {
+			std::cerr << "File too big: '" << filename << "': " << s->stx.stx_size << " > " << std::numeric_limits<ssize_t>::max() << std::endl;
+			return true;
+		}
+		s->len = s->stx.stx_size;
+		if (0 == s->len) {
+			s->ok = true;
+			return true;
+		}
+		s->data = new char[s->len];
+		s->state = Slot::READ;
+		submitRead(s);
+		return false;
+	case Slot::READ:
+		if (-EINTR == res || -EAGAIN == res) {
+			submitRead(s);
+			return false;
+		}
+		if (res < 0) {
+			std::cerr << "Cannot read file '" << filename << "': " << ::strerror(-res) << std::endl;
+			return true;
+		}
+		if (0 == res) {
+			std::cerr << "Cannot read file '" << filename << "': file was truncated while reading" << std::endl;
+			return true;
+		}
+		s->have += res;
+		if (s->have < s->len) {
+			submitRead(s);
+			return false;
+		}
+		s->ok = true;
+		return true;
+	}
+	return true;
+}
+
+/* process completions; returns true if a file was handed out */
+bool BatchLoader::reap(Buffer &buffer, size_t &index, bool &ok) {
+	if (m_finished.empty() && !m_ring->enter(1)) {
+		int e = errno;
+		std::cerr << "io_uring failed, loading remaining files without it: " << ::strerror(e) << std::endl;
+		/* the kernel might still write to the in-flight buffers: leak them */
+		for (size_t i = 0; i < m_slots.size(); i++) {
+			Slot *s = m_slots[i];
+			if (m_free_slots.end() != std::find(m_free_slots.begin(), m_free_slots.end(), s)) continue;
+			if (m_finished.end() != std::find(m_finished.begin(), m_finished.end(), s)) continue;
+			m_retry.push_back(s->index);
+			s->data = 0;
+		}
+		delete m_ring;
+		m_ring = 0;
+		m_done--;
+		return next(buffer, index, ok);
+	}
+
+	unsigned int head = *m_ring->cq_head;
+	const unsigned int tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		const struct io_uring_cqe &cqe = m_ring->cqes[head & *m_ring->cq_mask];
+		m_ring->inflight--;
+		if (close_tag == cqe.user_data) continue;
+
+		Slot *s = m_slots[cqe.user_data - 1];
+		if (!complete(s, cqe.res)) continue;
+
+		if (-1 != s->fd) {
+			struct io_uring_sqe *e = m_ring->sqe();
+			e->opcode = IORING_OP_CLOSE;
+			e->fd = s->fd;
+			e->user_data = close_tag;
+			s->fd = -1;
+		}
+		m_finished.push_back(s);
+	}
+	__atomic_store_n(m_ring->cq_head, head, __ATOMIC_RELEASE);
+
+	if (m_finished.empty()) return false;
+
+	Slot *s = m_finished.back();
+	m_finished.pop_back();
+
+	index = s->index;
+	ok = s->ok;
+	buffer.clear();
+	buffer.m_filename = m_filenames[index];
+	if (ok) {
+		statxToStat(s->stx, buffer.filestat);
+		buffer.m_data = s->data;
+		buffer.m_len = buffer.m_loaded = s->len;
+	} else {
+		delete[] s->data;
+	}
+	s->data = 0;
+	m_free_slots.push_back(s);
+
+	fill();
+	return true;
+}
+
+/* wait for all queued requests, the kernel must not write to freed buffers */
+void BatchLoader::drain() {
+	if (0 == m_ring) return;
+	while (m_ring->inflight > 0) {
+		if (!m_ring->enter(1)) return; /* can't wait, leak the buffers */
+		unsigned int head = *m_ring->cq_head;
+		const unsigned int tail = __atomic_load_n(m_ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			const struct io_uring_cqe &cqe = m_ring->cqes[head & *m_ring->cq_mask];
+			m_ring->inflight--;
+			if (close_tag == cqe.user_data) continue;
+			Slot *s = m_slots[cqe.user_data - 1];
+			if (Slot::OPEN == s->state && cqe.res >= 0) s->fd = cqe.res;
+		}
+		__atomic_store_n(m_ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+	for (size_t i = 0; i < m_slots.size(); i++) {
+		Slot *s = m_slots[i];
+		if (-1 != s->fd && m_free_slots.end() == std::find(m_free_slots.begin(), m_free_slots.end(), s)) ::close(s->fd);
+		s->fd = -1;
+	}
+}
+
+#else
+
+void BatchLoader::drain() {
+}
+
+void BatchLoader::fill() {
+}
+
+void BatchLoader::submitRead(Slot *) {
+}
+
+bool BatchLoader::complete(Slot *, int) {
+	return true;
+}
+
+bool BatchLoader::reap(Buffer &, size_t &, bool &) {
+	return true;
+}
+
+#endif
+
+}
@@ -0,0 +1,66 @@
+#ifndef __TORRENT_SANITIZE_BATCH_LOADER_H
+#define __TORRENT_SANITIZE_BATCH_LOADER_H
+
+#include "config.h"
+#include "buffer.h"
+
+#include <string>
+#include <vector>
+
+namespace torrent {
+
+/* loads many files with few syscalls: keeps up to "depth" files in flight
+ * with io_uring (open, statx, read and close are all queued in the ring).
+ * falls back to Buffer::load if io_uring isn't available (build or kernel).
+ *
+ * usage:
+ *   BatchLoader loader;
+ *   loader.add(filename); ...
+ *   Buffer buf; size_t ndx; bool ok;
+ *   while (loader.next(buf, ndx, ok)) { if (ok) torrent.load(buf); }
+ */
+class BatchLoader {
+private:
+	BatchLoader(const BatchLoader &b);
+	BatchLoader& operator=(const BatchLoader &b);
+
+public:
+	explicit BatchLoader(unsigned int depth = BATCH_LOADER_DEPTH);
+	~BatchLoader();
+
+	/* queue a file; returns its index for next() */
+	size_t add(const std::string &filename);
+
+	/* wait for the next finished file (in completion order, not in add order)
+	 * returns false if all queued files were handed out.
+	 * ok is false if the file couldn't be loaded (error was printed),
+	 * otherwise buffer contains the file */
+	bool next(Buffer &buffer, size_t &index, bool &ok);
+
+	/* whether io_uring is used or the fallback */
+	bool usingIoUring() const { return 0 != m_ring; }
+
+private:
+	struct Ring;
+	struct Slot;
+
+	void drain();
+	void fill();
+	void submitRead(Slot *s);
+	bool complete(Slot *s, int res);
+	bool reap(Buffer &buffer, size_t &index, bool &ok);
+
+	std::vector<std::string> m_filenames;
+	size_t m_next_add; /* next file index to submit */
+	size_t m_done; /* number of files handed out */
+
+	Ring *m_ring;
+	std::vector<Slot*> m_slots;
+	std::vector<Slot*> m_free_slots;
+	std::vector<Slot*> m_finished;
+	std::vector<size_t> m_retry; /* files to load without io_uring after it failed */
+};
+
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include "bencode-tape.h"
+
+#include <limits>
+
+extern "C" {
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+}
+
+namespace torrent {
+
+/* number of decimal digits at p */
+static inline size_t digitRun(const char *p, const char *end) {
+	const char *s = p;
+#ifdef __SSE2__
+	/* bias so '0'..'9' become the 10 smallest signed bytes */
+	const __m128i bias = _mm_set1_epi8((char) ('0' + 128));
+	const __m128i limit = _mm_set1_epi8((char) (-128 + 10));
+	while (end - p >= 16) {
+		__m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i*) p), bias);
+		unsigned int nondigit = 0xFFFF ^ (unsigned int) _mm_movemask_epi8(_mm_cmplt_epi8(v, limit));
+		if (0 != nondigit) return (p - s) + __builtin_ctz(nondigit);
+		p += 16;
+	}
+#endif
+	while (p < end && *p >= '0' && *p <= '9') p++;
+	return p - s;
+}
+
+/* same rules as TorrentBase::read_string; pos at the first digit */
+static inline bool scanString(const char *data, size_t len, size_t &pos, size_t &offset, size_t &length) {
+	size_t run = digitRun(data + pos, data + len);
+	if (0 == run) return false;
+	if ('0' == data[pos] && run > 1) return false;
+
+	int64_t slen = data[pos] - '0';
+	for (size_t i = 1; i < run; i++) {
+		if (slen > std::numeric_limits<int32_t>::max()) return false;
+		slen = 10*slen + (data[pos + i] - '0');
+	}
+	pos += run;
+	if (pos >= len || ':' != data[pos]) return false;
+	pos++;
+	if ((uint64_t) slen > len - pos) return false;
+
+	offset = pos;
+	length = slen;
+	pos += slen;
+	return true;
+}
+
+/* same rules as TorrentBase::skip_number; pos at 'i' */
+static inline bool scanNumber(const char *data, size_t len, size_t &pos) {
+	size_t p = pos + 1;
+	if (p + 1 >= len) return false;
+
+	char c = data[p];
+	if ('-' == c) {
+		c = data[++p];
+		if (p + 1 >= len) return false;
+		if (c < '1' || c > '9') return false;
+	} else {
+		if ('0' == c && 'e' != data[p+1]) return false;
+		if (c < '0' || c > '9') return false;
+	}
+	p++;
+
+	p += digitRun(data + p, data + len);
+	if (p >= len || 'e' != data[p]) return false;
+	pos = p + 1;
+	return true;
+}
+
+BencodeTape::BencodeTape() : m_end(0) {
+}
+
+void BencodeTape::clear() {
+	m_keys.clear();
+	m_stack.clear();
+	m_end = 0;
+}
+
+bool BencodeTape::build(const char *data, size_t len, size_t start, size_t max_depth, Progress *progress) {
+	clear();
+
+	size_t pos = start;
+	if (pos >= len) return false;
+
+	size_t report = progress ? start + INFO_HASH_CHUNK : npos;
+	for (;;) {
+		/* pos is at a value (or key) */
+		if (pos >= len) return false;
+		if (pos >= report) {
+			progress->progress(pos);
+			report = pos + INFO_HASH_CHUNK;
+		}
+		char c = data[pos];
+
+		if (!m_stack.empty()) {
+			Frame &f = m_stack.back();
+			if ('e' == c && DICT_VALUE != f.state) {
+				m_stack.pop_back();
+				pos++;
+				if (m_stack.empty()) {
+					m_end = pos;
+					return true;
+				}
+				continue;
+			}
+			if (DICT_KEY == f.state) {
+				Key k;
+				if (!scanString(data, len, pos, k.offset, k.length)) return false;
+				k.prev = f.last_key;
+				f.last_key = m_keys.size();
+				f.state = DICT_VALUE;
+				m_keys.push_back(k);
+				continue;
+			}
+			if (DICT_VALUE == f.state) f.state = DICT_KEY;
+		}
+
+		if (c >= '0' && c <= '9') {
+			size_t offset, length;
+			if (!scanString(data, len, pos, offset, length)) return false;
+		} else if ('i' == c) {
+			if (!scanNumber(data, len, pos)) return false;
+		} else if ('l' == c || 'd' == c) {
+			if (m_stack.size() >= max_depth) return false;
+			Frame f = { 'l' == c ? LIST : DICT_KEY, npos };
+			m_stack.push_back(f);
+			pos++;
+		} else {
+			return false;
+		}
+
+		/* build() only indexes containers */
+		if (m_stack.empty()) return false;
+	}
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef __TORRENT_SANITIZE_BENCODE_TAPE_H
+#define __TORRENT_SANITIZE_BENCODE_TAPE_H
+
+#include "config.h"
+
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+namespace torrent {
+
+/* structural index ("tape") of a bencoded list or dict, built in one pass
+ * without recursion. only the structure is checked (string lengths, numbers,
+ * nesting); the tape records every dict key so the semantic rules (key order,
+ * utf-8 keys) can be checked afterwards without parsing again.
+ *
+ * bencode can't be indexed in parallel like json: string payloads may contain
+ * any byte, so only the digit runs (string lengths, numbers) are scanned with
+ * SSE2 (if available).
+ *
+ * build() accepts exactly the input TorrentBase::skip_value() accepts (apart
+ * from the key rules), but doesn't report errors.
+ */
+class BencodeTape {
+public:
+	struct Key {
+		size_t offset, length;
+		size_t prev; /* index of the previous key in the same dict, or npos */
+	};
+
+	static const size_t npos = (size_t) -1;
+
+	/* told how far build() got, every INFO_HASH_CHUNK bytes */
+	class Progress {
+	public:
+		virtual ~Progress() { }
+		virtual void progress(size_t pos) = 0;
+	};
+
+	BencodeTape();
+
+	/* index the list or dict at data[start]; false if the structure is invalid
+	 * or nested deeper than max_depth */
+	bool build(const char *data, size_t len, size_t start, size_t max_depth, Progress *progress = 0);
+
+	void clear();
+
+	/* offset after the closing 'e' */
+	size_t end() const { return m_end; }
+
+	const std::vector<Key>& keys() const { return m_keys; }
+
+private:
+	enum State { LIST, DICT_KEY, DICT_VALUE };
+	struct Frame {
+		State state;
+		size_t last_key;
+	};
+
+	std::vector<Key> m_keys;
+	std::vector<Frame> m_stack;
+	size_t m_end;
+};
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef __TORRENT_SANITIZE_BENCODE_WRITER_H
+#define __TORRENT_SANITIZE_BENCODE_WRITER_H
+
+#include "buffer.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <stdint.h>
+}
+
+namespace torrent {
+
+/* serialization code is written once as template over the output "Out":
+ *   BencodeSize:    only counts bytes, to get the exact size first
+ *   BencodeOStream: writes to a std::ostream
+ *   OutputSegments: collects memory and source file ranges (output-segments.h)
+ * an output has raw(data, len) and range(buffer, BufferString); the bencode()
+ * functions below format strings, numbers and lists on top of that.
+ */
+
+/* number of decimal digits */
+inline size_t decimalLength(uint64_t num) {
+	size_t len = 1;
+	for (;;) {
+		if (num < 10) return len;
+		if (num < 100) return len + 1;
+		if (num < 1000) return len + 2;
+		if (num < 10000) return len + 3;
+		num /= 10000;
+		len += 4;
+	}
+}
+
+/* write num in decimal, ending just before end; returns first digit */
+inline char* formatDecimal(char *end, uint64_t num) {
+	static const char pairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	while (num >= 100) {
+		const char *p = pairs + 2 * (num % 100);
+		num /= 100;
+		*--end = p[1];
+		*--end = p[0];
+	}
+	if (num >= 10) {
+		const char *p = pairs + 2 * num;
+		*--end = p[1];
+		*--end = p[0];
+	} else {
+		*--end = '0' + (char) num;
+	}
+	return end;
+}
+
+class BencodeSize {
+public:
+	BencodeSize() : m_size(0), m_raw(0) { }
+
+	void raw(const char *data, size_t len) { (void) data; m_size += len; m_raw += len; }
+	void range(const Buffer &buffer, BufferString r) { (void) buffer; m_size += r.length(); }
+
+	/* skip formatting, only count */
+	void rawLength(size_t len) { m_size += len; m_raw += len; }
+
+	/* exact number of bytes written */
+	size_t size() const { return m_size; }
+	/* bytes written with raw() (without ranges) */
+	size_t rawSize() const { return m_raw; }
+
+private:
+	size_t m_size, m_raw;
+};
+
+class BencodeOStream {
+public:
+	explicit BencodeOStream(std::ostream &os) : os(os) { }
+
+	std::ostream &os;
+
+	void raw(const char *data, size_t len) { os.write(data, len); }
+	/* sets failbit if the range cannot be read (lazily loaded buffers) */
+	void range(const Buffer &buffer, BufferString r) { if (!buffer.copyTo(os, r)) os.setstate(std::ios_base::failbit); }
+};
+
+template<typename Out> void bencodeString(Out &out, const char *data, size_t len) {
+	char buf[24];
+	char *end = buf + sizeof(buf);
+	*--end = ':';
+	char *start = formatDecimal(end, len);
+	out.raw(start, buf + sizeof(buf) - start);
+	out.raw(data, len);
+}
+inline void bencodeString(BencodeSize &out, const char *data, size_t len) {
+	(void) data;
+	out.rawLength(decimalLength(len) + 1 + len);
+}
+
+template<typename Out> void bencode(Out &out, const std::string &s) {
+	bencodeString(out, s.data(), s.length());
+}
+template<typename Out> void bencode(Out &out, const BufferString &s) {
+	bencodeString(out, s.data(), s.length());
+}
+template<typename Out, std::size_t n> void bencode(Out &out, const char (&data)[n]) {
+	bencodeString(out, data, n > 0 ? n - 1 : 0);
+}
+
+template<typename Out> void bencode(Out &out, int64_t num) {
+	char buf[24];
+	char *end = buf + sizeof(buf);
+	*--end = 'e';
+	/* negate as unsigned, works for the minimum too */
+	char *start = formatDecimal(end, num < 0 ? -(uint64_t) num : (uint64_t) num);
+	if (num < 0) *--start = '-';
+	*--start = 'i';
+	out.raw(start, buf + sizeof(buf) - start);
+}
+inline void bencode(BencodeSize &out, int64_t num) {
+	out.rawLength(2 + (num < 0 ? 1 : 0) + decimalLength(num < 0 ? -(uint64_t) num : (uint64_t) num));
+}
+
+template<typename Out, typename T> void bencode(Out &out, const std::vector< T > &list) {
+	out.raw("l", 1);
+	for (size_t i = 0; i < list.size(); i++) bencode(out, list[i]);
+	out.raw("e", 1);
+}
+
+}
+
+#endif
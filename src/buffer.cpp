@@ -5,86 +5,268 @@
 
 extern "C" {
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
 #include <openssl/sha.h>
+}
 
-#ifdef USE_MMAP
-# include <sys/mman.h>
+#ifndef MAP_POPULATE
+# define MAP_POPULATE 0
 #endif
-}
 
 namespace torrent {
 
-Buffer::Buffer() :m_data(0), m_len(0), m_pos(0) {
+bool parseLoadMethod(const std::string &name, LoadMethod &method) {
+	if (name == "auto") method = LOAD_AUTO;
+	else if (name == "read") method = LOAD_READ;
+	else if (name == "mmap") method = LOAD_MMAP;
+	else if (name == "pread") method = LOAD_PREAD;
+	else return false;
+	return true;
+}
+
+const char* loadMethodName(LoadMethod method) {
+	switch (method) {
+	case LOAD_AUTO: return "auto";
+	case LOAD_READ: return "read";
+	case LOAD_MMAP: return "mmap";
+	case LOAD_PREAD: return "pread";
+	}
+	return "unknown";
+}
+
+LoadMethod Buffer::s_default_method = DEFAULT_LOAD_METHOD;
+
+void Buffer::setDefaultLoadMethod(LoadMethod method) {
+	s_default_method = method;
+}
+
+LoadMethod Buffer::defaultLoadMethod() {
+	return s_default_method;
+}
+
+Buffer::Buffer() :m_data(0), m_len(0), m_pos(0), m_loaded(0), m_fd(-1), m_mapped(false) {
 }
 
 bool Buffer::load(const std::string &filename) {
+	return load(filename, s_default_method);
+}
+
+/* open and stat file, returns -1 on error */
+int Buffer::openFile(const std::string &filename) {
 	clear();
 	m_filename = filename;
 
 	int fd;
 
-	if (-1 == (fd = ::open(m_filename.c_str(), O_RDONLY))) {
+	if (-1 == (fd = ::open(m_filename.c_str(), O_RDONLY | O_CLOEXEC))) {
 		int e = errno;
 		std::cerr << "Cannot open file '" << m_filename << "': " << ::strerror(e) << std::endl;
-		return false;
+		return -1;
 	}
 	if (-1 == ::fstat(fd, &filestat)) {
 		int e = errno;
 		std::cerr << "Cannot stat file '" << m_filename << "': " << ::strerror(e) << std::endl;
-		close(fd);
-		return false;
+		::close(fd);
+		return -1;
 	}
 	if (!S_ISREG(filestat.st_mode)) {
 		std::cerr << "Not a regular file: '" << m_filename << "'" << std::endl;
-		close(fd);
-		return false;
+		::close(fd);
+		return -1;
 	}
 	if (filestat.st_size > std::numeric_limits<ssize_t>::max()) {
 		std::cerr << "File too big: '" << m_filename << "': " << filestat.st_size << " > " << std::numeric_limits<ssize_t>::max() << std::endl;
-		close(fd);
-		return false;
+		::close(fd);
+		return -1;
 	}
 	m_len = filestat.st_size;
+	return fd;
+}
 
-#ifdef USE_MMAP
+bool Buffer::load(const std::string &filename, LoadMethod method) {
+	int fd = openFile(filename);
+	if (-1 == fd) return false;
 
-#ifndef MAP_POPULATE
-# define MAP_POPULATE 0
-#endif
+	if (LOAD_AUTO == method) method = (m_len >= LOAD_MMAP_THRESHOLD) ? LOAD_MMAP : LOAD_READ;
+	/* can't mmap empty files */
+	if (0 == m_len) method = LOAD_READ;
 
-	m_data = (char*) mmap(NULL, m_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
-	if (0 == m_data) {
-		int e = errno;
-		std::cerr << "Cannot mmap file '" << m_filename << "': " << strerror(e) << std::endl;
-		close(fd);
+	bool ok;
+	switch (method) {
+	case LOAD_MMAP: ok = loadMmap(fd); break;
+	case LOAD_PREAD: ok = loadPread(fd); break;
+	default: ok = loadRead(fd); break;
+	}
+
+	::close(fd);
+	if (!ok) clear();
+	m_loaded = m_len;
+	return ok;
+}
+
+bool Buffer::loadLazy(const std::string &filename) {
+	int fd = openFile(filename);
+	if (-1 == fd) return false;
+
+	/* only reserves address space, pages are allocated when filled */
+	m_data = new char[m_len];
+	m_fd = fd;
+	if (!fill(LOAD_LAZY_HEAD)) {
+		clear();
 		return false;
 	}
-#else
-	ssize_t r;
-	m_data = new char[filestat.st_size];
-	if (-1 == (r = ::read(fd, m_data, m_len))) {
+	return true;
+}
+
+bool Buffer::fillSlow(size_t end) {
+	if (end > m_len) end = m_len;
+	if (end <= m_loaded) return true;
+	if (-1 == m_fd) return false;
+
+	/* read at least twice as much as we have */
+	end = std::min(m_len, std::max(end, std::max<size_t>(2*m_loaded, LOAD_LAZY_HEAD)));
+
+	while (m_loaded < end) {
+		ssize_t r = ::pread(m_fd, m_data + m_loaded, end - m_loaded, m_loaded);
+		if (-1 == r) {
+			int e = errno;
+			if (EINTR == e) continue;
+			std::cerr << "Cannot read file '" << m_filename << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		if (0 == r) {
+			std::cerr << "Cannot read file '" << m_filename << "': file was truncated while reading" << std::endl;
+			return false;
+		}
+		m_loaded += r;
+	}
+	return true;
+}
+
+bool Buffer::copyTo(std::ostream &os, size_t offset, size_t length) const {
+	if (offset > m_len || length > m_len - offset) return false;
+
+	OutputSegments *segments = dynamic_cast<OutputSegments*>(os.rdbuf());
+	if (segments) return segments->appendRange(*this, offset, length);
+
+	if (offset < m_loaded) {
+		size_t inmem = std::min(length, m_loaded - offset);
+		os.write(m_data + offset, inmem);
+		offset += inmem;
+		length -= inmem;
+	}
+	if (0 == length) return true;
+	if (-1 == m_fd) return false;
+
+	char chunk[64*1024];
+	while (length > 0) {
+		ssize_t r = ::pread(m_fd, chunk, std::min(length, sizeof(chunk)), offset);
+		if (-1 == r) {
+			int e = errno;
+			if (EINTR == e) continue;
+			std::cerr << "Cannot read file '" << m_filename << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		if (0 == r) {
+			std::cerr << "Cannot read file '" << m_filename << "': file was truncated while reading" << std::endl;
+			return false;
+		}
+		os.write(chunk, r);
+		offset += r;
+		length -= r;
+	}
+	return true;
+}
+
+bool Buffer::copyTo(std::ostream &os, BufferString range) const {
+	return copyTo(os, range.data() - m_data, range.length());
+}
+
+bool Buffer::loadRead(int fd) {
+	m_data = new char[m_len];
+	size_t have = 0;
+	while (have < m_len) {
+		ssize_t r = ::read(fd, m_data + have, m_len - have);
+		if (-1 == r) {
+			int e = errno;
+			if (EINTR == e) continue;
+			std::cerr << "Cannot read file '" << m_filename << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		if (0 == r) {
+			std::cerr << "Cannot read file '" << m_filename << "': file was truncated while reading" << std::endl;
+			return false;
+		}
+		have += r;
+	}
+	return true;
+}
+
+bool Buffer::loadMmap(int fd) {
+	void *data = ::mmap(NULL, m_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (MAP_FAILED == data) {
 		int e = errno;
-		std::cerr << "Cannot read file '" << m_filename << "': " << strerror(e) << std::endl;
-		close(fd);
+		std::cerr << "Cannot mmap file '" << m_filename << "': " << ::strerror(e) << std::endl;
 		return false;
 	}
-	close(fd);
-#endif
+	m_data = (char*) data;
+	m_mapped = true;
+	/* only hints, failures don't matter */
+	::madvise(data, m_len, MADV_SEQUENTIAL);
+	::madvise(data, m_len, MADV_WILLNEED);
+	return true;
+}
 
+bool Buffer::loadPread(int fd) {
+#ifdef POSIX_FADV_SEQUENTIAL
+	::posix_fadvise(fd, 0, m_len, POSIX_FADV_SEQUENTIAL);
+#endif
+	m_data = new char[m_len];
+	size_t have = 0;
+	while (have < m_len) {
+		size_t chunk = std::min<size_t>(LOAD_PREAD_CHUNK, m_len - have);
+		ssize_t r = ::pread(fd, m_data + have, chunk, have);
+		if (-1 == r) {
+			int e = errno;
+			if (EINTR == e) continue;
+			std::cerr << "Cannot read file '" << m_filename << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		if (0 == r) {
+			std::cerr << "Cannot read file '" << m_filename << "': file was truncated while reading" << std::endl;
+			return false;
+		}
+		have += r;
+	}
 	return true;
 }
 
 void Buffer::clear() {
-#ifdef USE_MMAP
-	if (0 != m_data) munmap(m_data, m_len);
-#else
-	delete m_data;
-#endif
-	m_data = 0; m_len = m_pos = 0;
+	if (m_mapped) {
+		::munmap(m_data, m_len);
+	} else {
+		delete[] m_data;
+	}
+	if (-1 != m_fd) ::close(m_fd);
+	m_data = 0; m_len = m_pos = m_loaded = 0;
+	m_fd = -1;
+	m_mapped = false;
+}
+
+void Buffer::swap(Buffer &other) {
+	std::swap(filestat, other.filestat);
+	m_filename.swap(other.m_filename);
+	std::swap(m_data, other.m_data);
+	std::swap(m_len, other.m_len);
+	std::swap(m_pos, other.m_pos);
+	std::swap(m_loaded, other.m_loaded);
+	std::swap(m_fd, other.m_fd);
+	std::swap(m_mapped, other.m_mapped);
 }
 
 Buffer::~Buffer() {
@@ -103,13 +285,7 @@ pcrecpp::StringPiece BufferString::toStringPiece() const {
 std::string BufferString::sha1() {
 	unsigned char raw[20];
 	::SHA1((const unsigned char*) m_data, m_len, raw);
-	std::string hex(40, '.');
-	const char hexchar[] = "0123456789ABCDEF";
-	for (int i = 0; i < 20; i++) {
-		hex[2*i] = hexchar[raw[i] >> 4];
-		hex[2*i+1] = hexchar[raw[i] & 0xf];
-	}
-	return hex;
+	return sha1Hex(raw);
 }
 
 bool BufferString::validUTF8() {
@@ -164,4 +340,67 @@ const BufferString bs_piece_length("piece length");
 const BufferString bs_pieces("pieces");
 const BufferString bs_private("private");
 
+template<size_t n> static inline bool keyEquals(const char *key, const char (&name)[n]) {
+	return 0 == memcmp(key, name, n - 1);
+}
+
+KeyId keyId(BufferString key) {
+	const char *k = key.data();
+	switch (key.length()) {
+	case 4:
+		if (keyEquals(k, "info")) return KEY_INFO;
+		if (keyEquals(k, "name")) return KEY_NAME;
+		if (keyEquals(k, "path")) return KEY_PATH;
+		break;
+	case 5:
+		if (keyEquals(k, "files")) return KEY_FILES;
+		break;
+	case 6:
+		if (keyEquals(k, "length")) return KEY_LENGTH;
+		if (keyEquals(k, "pieces")) return KEY_PIECES;
+		break;
+	case 7:
+		if (keyEquals(k, "comment")) return KEY_COMMENT;
+		if (keyEquals(k, "private")) return KEY_PRIVATE;
+		break;
+	case 8:
+		if (keyEquals(k, "announce")) return KEY_ANNOUNCE;
+		if (keyEquals(k, "encoding")) return KEY_ENCODING;
+		break;
+	case 10:
+		if (keyEquals(k, "created by")) return KEY_CREATED_BY;
+		break;
+	case 12:
+		if (keyEquals(k, "piece length")) return KEY_PIECE_LENGTH;
+		break;
+	case 13:
+		if (keyEquals(k, "announce-list")) return KEY_ANNOUNCE_LIST;
+		if (keyEquals(k, "creation date")) return KEY_CREATION_DATE;
+		break;
+	}
+	return KEY_UNKNOWN;
+}
+
+BufferString keyName(KeyId id) {
+	static const BufferString names[KEY_COUNT] = {
+		BufferString(),
+		BufferString("announce"),
+		BufferString("announce-list"),
+		BufferString("comment"),
+		BufferString("created by"),
+		BufferString("creation date"),
+		BufferString("encoding"),
+		BufferString("files"),
+		BufferString("info"),
+		BufferString("length"),
+		BufferString("name"),
+		BufferString("path"),
+		BufferString("piece length"),
+		BufferString("pieces"),
+		BufferString("private"),
+	};
+	if (id < 0 || id >= KEY_COUNT) return BufferString();
+	return names[id];
+}
+
 }
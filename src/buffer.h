@@ -12,6 +12,19 @@ extern "C" {
 
 namespace torrent {
 
+class BufferString;
+
+enum LoadMethod {
+	LOAD_AUTO,
+	LOAD_READ,
+	LOAD_MMAP,
+	LOAD_PREAD
+};
+
+/* "auto", "read", "mmap" or "pread" */
+bool parseLoadMethod(const std::string &name, LoadMethod &method);
+const char* loadMethodName(LoadMethod method);
+
 class Buffer {
 private:
 	Buffer(const Buffer &b);
@@ -21,30 +34,52 @@ public:
 	Buffer();
 
 	bool load(const std::string &filename);
+	bool load(const std::string &filename, LoadMethod method);
+
+	/* only read the first LOAD_LAZY_HEAD bytes, fill() reads more on demand
+	 * from the file descriptor, which is kept open until clear() */
+	bool loadLazy(const std::string &filename);
+
+	/* method used by load(filename) */
+	static void setDefaultLoadMethod(LoadMethod method);
+	static LoadMethod defaultLoadMethod();
+
+	/* make sure data()[0..end) is in memory (end is clamped to len()) */
+	bool fill(size_t end) { return end <= m_loaded || fillSlow(end); }
+
+	/* write range [offset, offset+length) of the file; parts not loaded yet are
+	 * streamed from the file descriptor without loading them.
+	 * if os writes to an OutputSegments only the range is remembered */
+	bool copyTo(std::ostream &os, size_t offset, size_t length) const;
+	bool copyTo(std::ostream &os, BufferString range) const;
 
 	template< std::size_t n > bool tryNext( const char (&cstr)[n] ) {
 		size_t len = sizeof(cstr)/sizeof(char);
 		if (0 == len) return false;
 		len--;
 		if (len > m_len - m_pos) return false;
+		if (!fill(m_pos + len)) return false;
 		if (0 != memcmp(cstr, m_data + m_pos, len)) return false;
 		m_pos += len;
 		return true;
 	}
 
-	bool isNext(char c) { return !eof() && (c == m_data[m_pos]); }
+	bool isNext(char c) { return !eof() && fill(m_pos + 1) && (c == m_data[m_pos]); }
 
 	bool eof() const { return m_pos >= m_len; }
 
 	void clear();
 
+	/* exchange content (including filename and stat) with other buffer */
+	void swap(Buffer &other);
+
 	size_t pos() const { return m_pos; }
 	size_t len() const { return m_len; }
 	const char* data() const { return m_data; }
 	const char* c_str() const { return m_data; }
 
 	void next() { if (m_pos < m_len) m_pos++; }
-	char current() const { return !eof() ? m_data[m_pos] : '\0'; }
+	char current() { return (!eof() && fill(m_pos + 1)) ? m_data[m_pos] : '\0'; }
 
 	~Buffer();
 
@@ -53,10 +88,23 @@ public:
 private:
 	friend class Torrent;
 	friend class TorrentBase;
+	friend class BatchLoader;
+	friend class OutputSegments;
+
+	int openFile(const std::string &filename);
+	bool loadRead(int fd);
+	bool loadMmap(int fd);
+	bool loadPread(int fd);
+	bool fillSlow(size_t end);
 
 	std::string m_filename;
 	char *m_data;
 	size_t m_len, m_pos;
+	size_t m_loaded; /* data()[0..m_loaded) is valid, < m_len only for lazy buffers */
+	int m_fd; /* only open for lazy buffers */
+	bool m_mapped;
+
+	static LoadMethod s_default_method;
 };
 
 class BufferString {
@@ -125,6 +173,31 @@ extern const BufferString bs_piece_length;
 extern const BufferString bs_pieces;
 extern const BufferString bs_private;
 
+/* well-known dict keys; keyId() maps a key to its id without building
+ * strings (a switch on the length, then one fixed-size compare) */
+enum KeyId {
+	KEY_UNKNOWN = 0,
+	KEY_ANNOUNCE,
+	KEY_ANNOUNCE_LIST,
+	KEY_COMMENT,
+	KEY_CREATED_BY,
+	KEY_CREATION_DATE,
+	KEY_ENCODING,
+	KEY_FILES,
+	KEY_INFO,
+	KEY_LENGTH,
+	KEY_NAME,
+	KEY_PATH,
+	KEY_PIECE_LENGTH,
+	KEY_PIECES,
+	KEY_PRIVATE,
+	KEY_COUNT
+};
+
+KeyId keyId(BufferString key);
+/* empty for KEY_UNKNOWN */
+BufferString keyName(KeyId id);
+
 }
 
 #endif
@@ -3,12 +3,29 @@
 
 namespace torrent {
 class Buffer;
+class BatchLoader;
+class DaemonMessage;
+class OutputSegments;
+class PieceHasher;
 class BufferString;
-class TorrentOStream;
+class DomainSet;
+class FileList;
+class InfoHash;
+class LiteralScanner;
+class SHA1Batch;
+class BencodeSize;
+class BencodeOStream;
 class PCRE;
+class UrlCache;
+struct CanonicalUrl;
+class FilterScratch;
+class FilterSet;
+class FilterSetRef;
 class TorrentSanitize;
 class TorrentBase;
+class StringIndex;
 class AnnounceList;
+class BatchJobs;
 class Torrent;
 class TorrentAnnounceInfo;
 class TorrentAnnounce;
@@ -19,10 +36,24 @@ class TorrentAnnounce;
 #include "utils.h"
 #include "debug.h"
 #include "buffer.h"
-#include "torrent-ostream.h"
+#include "batch-loader.h"
+#include "daemon-protocol.h"
+#include "output-segments.h"
+#include "piece-hasher.h"
+#include "bencode-writer.h"
+#include "file-list.h"
+#include "info-hash.h"
+#include "literal-scanner.h"
+#include "sha1-batch.h"
+#include "domain-set.h"
 #include "torrent-pcre.h"
+#include "url-cache.h"
+#include "url-canonical.h"
+#include "filter-set.h"
 #include "sanitize-settings.h"
 #include "torrentbase.h"
+#include "announce-list.h"
 #include "torrent.h"
+#include "sanitize-jobs.h"
 
 #endif
\ No newline at end of file
@@ -2,7 +2,14 @@
 #define __TORRENT_SANITIZE_CONFIG_H
 
 
-/* using MMAP is dangerous if files are not updated atomically;
+/* default method to load torrent files, can be overridden at runtime:
+ *   LOAD_READ:  read() the complete file into a heap buffer
+ *   LOAD_MMAP:  mmap() the file, with madvise(SEQUENTIAL | WILLNEED)
+ *   LOAD_PREAD: pread() the file in chunks of LOAD_PREAD_CHUNK bytes
+ *   LOAD_AUTO:  LOAD_READ for small files, LOAD_MMAP for files of at least
+ *               LOAD_MMAP_THRESHOLD bytes
+ *
+ * using MMAP is dangerous if files are not updated atomically;
  * atomic file update works like this:
  *   write to "<filename>.tmp$$"
  *   mv "<filename>.tmp$$" -> "<filename>"
@@ -10,6 +17,129 @@
  * MMAP is only used to read files - it delays reading the actual content until
  *   the code accesses the memory
  */
-#define USE_MMAP
+#ifndef DEFAULT_LOAD_METHOD
+# define DEFAULT_LOAD_METHOD LOAD_AUTO
+#endif
+
+#ifndef LOAD_MMAP_THRESHOLD
+# define LOAD_MMAP_THRESHOLD (1024*1024)
+#endif
+
+#ifndef LOAD_PREAD_CHUNK
+# define LOAD_PREAD_CHUNK (1024*1024)
+#endif
+
+/* Buffer::loadLazy reads this much first; each fill() at least doubles it */
+#ifndef LOAD_LAZY_HEAD
+# define LOAD_LAZY_HEAD (16*1024)
+#endif
+
+/* writing files copies unchanged ranges of at least this size from the source
+ * file in the kernel (copy_file_range/sendfile); smaller ranges are written
+ * from memory with writev. needs HAVE_COPY_FILE_RANGE or HAVE_SENDFILE
+ */
+#ifndef OUTPUT_COPY_RANGE_MIN
+# define OUTPUT_COPY_RANGE_MIN (64*1024)
+#endif
+
+/* skipping bencoded values fails for lists and dicts nested deeper than this
+ * (TorrentBase::setMaxDepth changes it at runtime); the first
+ * BENCODE_INLINE_DEPTH levels don't need heap memory
+ */
+#ifndef BENCODE_MAX_DEPTH
+# define BENCODE_MAX_DEPTH 512
+#endif
+
+#ifndef BENCODE_INLINE_DEPTH
+# define BENCODE_INLINE_DEPTH 32
+#endif
+
+/* the info hash is computed while parsing the info dict, in chunks of at
+ * least this size (small enough to still be in the cache)
+ */
+#ifndef INFO_HASH_CHUNK
+# define INFO_HASH_CHUNK (16*1024)
+#endif
+
+/* torrent-sanitize -h with many files keeps this many parsed files in
+ * memory and hashes their info dicts together (SHA1Batch)
+ */
+#ifndef SHA1_BATCH_FILES
+# define SHA1_BATCH_FILES 64
+#endif
+
+/* SHA1Batch on cpus with the sha extensions: messages of at least this size
+ * are hashed with OpenSSL instead of the multi-buffer kernel
+ */
+#ifndef SHA1_BATCH_EVP_MIN
+# define SHA1_BATCH_EVP_MIN 4096
+#endif
+
+/* PieceHasher (torrent-verify) reads the payload in chunks of this size
+ * (at least one piece), and keeps at most PIECE_READ_MEMORY bytes of
+ * chunks (but at least two)
+ */
+#ifndef PIECE_READ_CHUNK
+# define PIECE_READ_CHUNK (8*1024*1024)
+#endif
+
+#ifndef PIECE_READ_MEMORY
+# define PIECE_READ_MEMORY (256*1024*1024)
+#endif
+
+/* pcre patterns are studied and jit compiled if pcre supports it; matching
+ * uses the jit code with PCRE_USE_JIT (setPCREJit changes it at runtime).
+ * jit matching uses one stack per thread, growing from PCRE_JIT_STACK_MIN
+ * to PCRE_JIT_STACK_MAX bytes
+ */
+#ifndef PCRE_USE_JIT
+# define PCRE_USE_JIT 1
+#endif
+
+#ifndef PCRE_JIT_STACK_MIN
+# define PCRE_JIT_STACK_MIN (32*1024)
+#endif
+
+#ifndef PCRE_JIT_STACK_MAX
+# define PCRE_JIT_STACK_MAX (512*1024)
+#endif
+
+/* TorrentSanitize::filterUrl keeps the results for this many urls in
+ * memory (lru); the optional cache file (shared between processes) has
+ * URL_CACHE_DISK_RECORDS records of URL_CACHE_RECORD bytes (larger
+ * results aren't stored in the file)
+ */
+#ifndef URL_CACHE_ENTRIES
+# define URL_CACHE_ENTRIES 4096
+#endif
+
+#ifndef URL_CACHE_DISK_RECORDS
+# define URL_CACHE_DISK_RECORDS 16384
+#endif
+
+#ifndef URL_CACHE_RECORD
+# define URL_CACHE_RECORD 512
+#endif
+
+/* number of files BatchLoader keeps in flight (io_uring only);
+ * HAVE_IO_URING enables the io_uring backend (needs linux/io_uring.h)
+ */
+#ifndef BATCH_LOADER_DEPTH
+# define BATCH_LOADER_DEPTH 64
+#endif
+
+/* torrent-sanitized rejects messages (requests and replies, including
+ * torrents returned as data) larger than this
+ */
+#ifndef DAEMON_MAX_MESSAGE
+# define DAEMON_MAX_MESSAGE (64*1024*1024)
+#endif
+
+/* seconds torrent-sanitized allows for reading a request once it started,
+ * and again for writing the reply, before dropping the connection
+ */
+#ifndef DAEMON_TIMEOUT
+# define DAEMON_TIMEOUT 10
+#endif
 
 #endif
@@ -0,0 +1,255 @@
+#include "daemon-protocol.h"
+
+#include <iostream>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+}
+
+namespace torrent {
+
+static double now() {
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double daemonDeadline(int seconds) {
+	return now() + seconds;
+}
+
+/* wait until fd is ready for events; false (printed) once deadline passed */
+static bool waitReady(int fd, short events, double deadline, const char *what) {
+	for (;;) {
+		double left = deadline - now();
+		if (left <= 0) {
+			std::cerr << "Timeout " << what << " daemon socket" << std::endl;
+			return false;
+		}
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = events;
+		int r = ::poll(&pfd, 1, (int) (left * 1000) + 1);
+		if (r > 0) return true;
+		if (-1 == r && EINTR != errno) {
+			int e = errno;
+			std::cerr << "Cannot poll daemon socket: " << ::strerror(e) << std::endl;
+			return false;
+		}
+	}
+}
+
+/* with a deadline the reads don't block: a client sending a byte now and
+ * then can't stretch a request beyond it */
+static bool readFull(int fd, char *data, size_t len, size_t &got, double deadline) {
+	got = 0;
+	while (got < len) {
+		ssize_t r = ::recv(fd, data + got, len - got, 0 != deadline ? MSG_DONTWAIT : 0);
+		if (r > 0) {
+			got += r;
+		} else if (0 == r) {
+			return false;
+		} else if (EAGAIN == errno || EWOULDBLOCK == errno) {
+			if (!waitReady(fd, POLLIN, deadline, "reading from")) return false;
+		} else if (EINTR != errno) {
+			int e = errno;
+			std::cerr << "Cannot read from daemon socket: " << ::strerror(e) << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint32_t getUInt32(const char *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+static void putUInt32(std::string &out, uint32_t v) {
+	v = htonl(v);
+	out.append((const char*) &v, 4);
+}
+
+bool readDaemonMessage(int fd, DaemonMessage &msg, bool &eof, double deadline) {
+	char header[4];
+	size_t got;
+	eof = false;
+	if (!readFull(fd, header, 4, got, deadline)) {
+		eof = (0 == got);
+		if (got > 0) std::cerr << "Truncated message on daemon socket" << std::endl;
+		return false;
+	}
+	const uint32_t len = getUInt32(header);
+	if (len < 3 || len > DAEMON_MAX_MESSAGE) {
+		std::cerr << "Invalid message length " << len << " on daemon socket" << std::endl;
+		return false;
+	}
+
+	/* grown as the data arrives, not by what the header claims */
+	std::string body;
+	for (size_t have = 0; have < len; have = body.length()) {
+		const size_t chunk = std::min<size_t>(len - have, std::max<size_t>(64*1024, have));
+		body.resize(have + chunk);
+		if (!readFull(fd, &body[have], chunk, got, deadline)) {
+			std::cerr << "Truncated message on daemon socket" << std::endl;
+			return false;
+		}
+	}
+
+	const char *p = body.data(), *end = p + len;
+	msg.type = p[0];
+	const size_t count = ((unsigned char) p[1] << 8) | (unsigned char) p[2];
+	p += 3;
+	if (4 * count > (size_t) (end - p)) {
+		std::cerr << "Invalid message on daemon socket" << std::endl;
+		return false;
+	}
+	msg.fields.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		if (end - p < 4 || (size_t) (end - p - 4) < getUInt32(p)) {
+			std::cerr << "Invalid message on daemon socket" << std::endl;
+			return false;
+		}
+		const size_t flen = getUInt32(p);
+		msg.fields[i].assign(p + 4, flen);
+		p += 4 + flen;
+	}
+	if (p != end) {
+		std::cerr << "Invalid message on daemon socket" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool writeDaemonMessage(int fd, const DaemonMessage &msg, double deadline) {
+	size_t len = 3;
+	for (size_t i = 0; i < msg.fields.size(); i++) len += 4 + msg.fields[i].length();
+	if (msg.fields.size() > 0xffff || len > DAEMON_MAX_MESSAGE) {
+		std::cerr << "Message too large for daemon socket" << std::endl;
+		return false;
+	}
+
+	/* small messages in one write: header and fields are copied together */
+	std::string frame;
+	frame.reserve(4 + len);
+	putUInt32(frame, len);
+	frame.push_back(msg.type);
+	frame.push_back((char) (msg.fields.size() >> 8));
+	frame.push_back((char) msg.fields.size());
+	for (size_t i = 0; i < msg.fields.size(); i++) {
+		putUInt32(frame, msg.fields[i].length());
+		frame.append(msg.fields[i]);
+	}
+
+	for (size_t done = 0; done < frame.length(); ) {
+		ssize_t w = ::send(fd, frame.data() + done, frame.length() - done, MSG_NOSIGNAL | (0 != deadline ? MSG_DONTWAIT : 0));
+		if (w >= 0) {
+			done += w;
+		} else if (EAGAIN == errno || EWOULDBLOCK == errno) {
+			if (!waitReady(fd, POLLOUT, deadline, "writing to")) return false;
+		} else if (EINTR != errno) {
+			int e = errno;
+			std::cerr << "Cannot write to daemon socket: " << ::strerror(e) << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool socketAddress(const std::string &path, struct sockaddr_un &addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.length() >= sizeof(addr.sun_path)) {
+		std::cerr << "Socket path too long: '" << path << "'" << std::endl;
+		return false;
+	}
+	memcpy(addr.sun_path, path.c_str(), path.length() + 1);
+	return true;
+}
+
+int listenDaemonSocket(const std::string &path) {
+	struct sockaddr_un addr;
+	if (!socketAddress(path, addr)) return -1;
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (-1 == fd) {
+		int e = errno;
+		std::cerr << "Cannot create socket: " << ::strerror(e) << std::endl;
+		return -1;
+	}
+
+	struct stat st;
+	if (0 == ::lstat(path.c_str(), &st) && S_ISSOCK(st.st_mode)) {
+		if (0 == ::connect(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+			std::cerr << "A daemon is already listening on '" << path << "'" << std::endl;
+			::close(fd);
+			return -1;
+		}
+		::unlink(path.c_str()); /* stale */
+		::close(fd);
+		fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (-1 == fd) {
+			int e = errno;
+			std::cerr << "Cannot create socket: " << ::strerror(e) << std::endl;
+			return -1;
+		}
+	}
+
+	/* nobody can connect before listen(), so the mode is set in time */
+	if (-1 == ::bind(fd, (struct sockaddr*) &addr, sizeof(addr)) || -1 == ::chmod(path.c_str(), 0600)
+			|| -1 == ::listen(fd, SOMAXCONN)) {
+		int e = errno;
+		std::cerr << "Cannot listen on '" << path << "': " << ::strerror(e) << std::endl;
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool daemonPeerTrusted(int fd) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	if (-1 == ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+		int e = errno;
+		std::cerr << "Cannot get peer credentials: " << ::strerror(e) << std::endl;
+		return false;
+	}
+	if (cred.uid != ::geteuid() && 0 != cred.uid) {
+		std::cerr << "Rejecting connection from uid " << cred.uid << " (pid " << cred.pid << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int connectDaemonSocket(const std::string &path) {
+	struct sockaddr_un addr;
+	if (!socketAddress(path, addr)) return -1;
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (-1 == fd) {
+		int e = errno;
+		std::cerr << "Cannot create socket: " << ::strerror(e) << std::endl;
+		return -1;
+	}
+	if (-1 == ::connect(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+		int e = errno;
+		std::cerr << "Cannot connect to '" << path << "': " << ::strerror(e) << std::endl;
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef __TORRENT_SANITIZE_DAEMON_PROTOCOL_H
+#define __TORRENT_SANITIZE_DAEMON_PROTOCOL_H
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+namespace torrent {
+
+/* messages between torrent-sanitized and its clients (unix domain stream
+ * socket); every message is one frame:
+ *   uint32 length of the rest of the frame
+ *   uint8 type
+ *   uint16 number of fields; per field: uint32 length, bytes
+ * (all numbers in network byte order). a connection can carry any number
+ * of requests, each answered by one reply before the next is read.
+ *
+ * requests (fields):
+ *   DAEMON_HASH:      file...                   reply: info hash of each file
+ *   DAEMON_SANITIZE:  output, file              reply: info hash [, torrent]
+ *   DAEMON_MERGE:     output, dest, source...   reply: info hash [, torrent]
+ * an empty output returns the resulting torrent in the reply, otherwise it is
+ * written (atomically) to that file; the paths are opened by the daemon.
+ * replies are DAEMON_OK or DAEMON_ERROR with the message as only field.
+ */
+enum DaemonMessageType {
+	DAEMON_HASH = 'h',
+	DAEMON_SANITIZE = 's',
+	DAEMON_MERGE = 'm',
+	DAEMON_OK = 'o',
+	DAEMON_ERROR = 'e'
+};
+
+class DaemonMessage {
+public:
+	explicit DaemonMessage(char type = 0) : type(type) { }
+
+	char type;
+	std::vector<std::string> fields;
+};
+
+/* false on errors (printed) and on end of file before the first byte of a
+ * frame (eof set, nothing printed). deadline (from daemonDeadline(), 0: none)
+ * limits the whole message, not each read or write: past it they fail. */
+bool readDaemonMessage(int fd, DaemonMessage &msg, bool &eof, double deadline = 0);
+bool writeDaemonMessage(int fd, const DaemonMessage &msg, double deadline = 0);
+
+/* seconds from now, on the monotonic clock */
+double daemonDeadline(int seconds);
+
+/* -1 on errors (printed). listen replaces a stale socket file, but fails if
+ * a daemon is still answering on it.
+ *
+ * the daemon reads and writes any path a request names with its own
+ * privileges, so only its own user may talk to it: the socket is created
+ * with mode 0600, and daemonPeerTrusted() checks the user of every
+ * connection (SO_PEERCRED). run it as the user owning the torrent files.
+ */
+int listenDaemonSocket(const std::string &path);
+int connectDaemonSocket(const std::string &path);
+
+/* the peer runs as the same user as this process (or root); false on errors
+ * (printed) */
+bool daemonPeerTrusted(int fd);
+
+}
+
+#endif
@@ -1,15 +1,10 @@
 
 #include "debug.h"
 
-#include <iostream>
-#include <sstream>
-
 namespace torrent {
 
 static bool debugActive = false;
 
-static std::stringstream nullOut;
-
 void setDebugActive(bool active) {
 	debugActive = active;
 }
@@ -18,10 +13,4 @@ bool getDebugActive() {
 	return debugActive;
 }
 
-std::ostream& debug() {
-	if (debugActive) return std::cerr;
-	nullOut.str(std::string());
-	return nullOut;
-}
-
 }
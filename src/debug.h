@@ -1,15 +1,12 @@
 #ifndef __TORRENT_SANITIZE_DEBUG_H
 #define __TORRENT_SANITIZE_DEBUG_H
 
-#include <ostream>
-
 namespace torrent {
 
 void setDebugActive(bool active);
+/* url filter steps are traced to std::cerr (see FilterScratch::trace) */
 bool getDebugActive();
 
-std::ostream& debug();
-
 }
 
 #endif
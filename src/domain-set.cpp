@@ -0,0 +1,141 @@
+#include "domain-set.h"
+
+extern "C" {
+#include <string.h>
+}
+
+namespace torrent {
+
+static const uint32_t FNV_OFFSET = 2166136261u, FNV_PRIME = 16777619u;
+
+/* fnv-1a from the last character to the first */
+static inline uint32_t hashStep(uint32_t h, char c) {
+	return (h ^ (unsigned char) c) * FNV_PRIME;
+}
+
+static inline size_t slotIndex(uint32_t hash, size_t mask) {
+	return (hash ^ (hash >> 15)) & mask;
+}
+
+static inline bool domainChar(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || '-' == c || '_' == c;
+}
+
+DomainSet::DomainSet() : m_slots(16), m_count(0) {
+}
+
+void DomainSet::clear() {
+	m_strings.clear();
+	m_slots.assign(16, Slot());
+	m_count = 0;
+}
+
+bool DomainSet::contains(const char *s, size_t len, uint32_t hash) const {
+	const size_t mask = m_slots.size() - 1;
+	for (size_t i = slotIndex(hash, mask); 0 != m_slots[i].length; i = (i + 1) & mask) {
+		const Slot &slot = m_slots[i];
+		if (slot.hash == hash && slot.length == len && 0 == memcmp(m_strings.data() + slot.offset, s, len)) return true;
+	}
+	return false;
+}
+
+void DomainSet::grow() {
+	std::vector<Slot> old;
+	old.swap(m_slots);
+	m_slots.resize(2 * old.size());
+	const size_t mask = m_slots.size() - 1;
+	for (size_t k = 0; k < old.size(); k++) {
+		if (0 == old[k].length) continue;
+		size_t i = slotIndex(old[k].hash, mask);
+		while (0 != m_slots[i].length) i = (i + 1) & mask;
+		m_slots[i] = old[k];
+	}
+}
+
+void DomainSet::insert(const std::string &domain) {
+	if (domain.empty()) return;
+	uint32_t hash = FNV_OFFSET;
+	for (size_t i = domain.length(); i-- > 0; ) hash = hashStep(hash, domain[i]);
+	if (contains(domain.data(), domain.length(), hash)) return;
+
+	if (2 * (m_count + 1) > m_slots.size()) grow();
+	const size_t mask = m_slots.size() - 1;
+	size_t i = slotIndex(hash, mask);
+	while (0 != m_slots[i].length) i = (i + 1) & mask;
+	m_slots[i].hash = hash;
+	m_slots[i].offset = m_strings.length();
+	m_slots[i].length = domain.length();
+	m_strings += domain;
+	m_count++;
+}
+
+void DomainSet::insert(const DomainSet &other) {
+	for (size_t k = 0; k < other.m_slots.size(); k++) {
+		const Slot &slot = other.m_slots[k];
+		if (0 != slot.length) insert(other.m_strings.substr(slot.offset, slot.length));
+	}
+}
+
+/* uint32 count, uint32 slots, uint32 strings length, strings, slots */
+void DomainSet::save(std::string &out) const {
+	uint32_t header[3] = { (uint32_t) m_count, (uint32_t) m_slots.size(), (uint32_t) m_strings.length() };
+	out.assign((const char*) header, sizeof(header));
+	out += m_strings;
+	out.append((const char*) &m_slots[0], m_slots.size() * sizeof(Slot));
+}
+
+bool DomainSet::load(const char *data, size_t len) {
+	uint32_t header[3];
+	if (len < sizeof(header)) return false;
+	memcpy(header, data, sizeof(header));
+	const size_t count = header[0], slots = header[1], strings = header[2];
+	if (slots < 16 || 0 != (slots & (slots - 1)) || 2 * count > slots) return false;
+	if (len - sizeof(header) < strings || (len - sizeof(header) - strings) != slots * sizeof(Slot)) return false;
+
+	std::vector<Slot> table(slots);
+	memcpy(&table[0], data + sizeof(header) + strings, slots * sizeof(Slot));
+	size_t used = 0;
+	for (size_t k = 0; k < slots; k++) {
+		if (0 == table[k].length) continue;
+		if (table[k].offset > strings || table[k].length > strings - table[k].offset) return false;
+		used++;
+	}
+	if (used != count) return false;
+
+	m_strings.assign(data + sizeof(header), strings);
+	m_slots.swap(table);
+	m_count = count;
+	return true;
+}
+
+bool DomainSet::matches(const char *host, size_t len) const {
+	if (0 == m_count) return false;
+	uint32_t hash = FNV_OFFSET;
+	for (size_t i = len; i-- > 0; ) {
+		hash = hashStep(hash, host[i]);
+		/* host[i..len) is a label suffix: the whole host or a parent domain */
+		if ((0 == i || '.' == host[i-1]) && contains(host + i, len - i, hash)) return true;
+	}
+	return false;
+}
+
+bool DomainSet::literalDomain(const std::string &pattern, std::string &domain) {
+	domain.clear();
+	size_t i = 0, n = pattern.length();
+	for (;;) {
+		size_t label = i;
+		while (i < n && domainChar(pattern[i])) domain += pattern[i++];
+		if (i == label) return false; /* empty label or other characters */
+		if (i == n) return true;
+		if ('.' == pattern[i]) {
+			i++;
+		} else if ('\\' == pattern[i] && i + 1 < n && '.' == pattern[i+1]) {
+			i += 2;
+		} else {
+			return false;
+		}
+		domain += '.';
+	}
+}
+
+}
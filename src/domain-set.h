@@ -0,0 +1,68 @@
+#ifndef __TORRENT_SANITIZE_DOMAIN_SET_H
+#define __TORRENT_SANITIZE_DOMAIN_SET_H
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <stdint.h>
+#include <sys/types.h>
+}
+
+namespace torrent {
+
+/* set of domain names, matching a domain and all its subdomains.
+ *
+ * open addressing hash table over the domain strings (stored back to back in
+ * one string); the hash is computed from the last character to the first, so
+ * matches() gets the hash of every label suffix of a host ("c", "b.c",
+ * "a.b.c") in a single pass and needs one lookup per label, independent of
+ * the number of domains in the set.
+ */
+class DomainSet {
+public:
+	DomainSet();
+
+	void clear();
+
+	/* domain: lowercase, without trailing dot */
+	void insert(const std::string &domain);
+
+	size_t size() const { return m_count; }
+	bool empty() const { return 0 == m_count; }
+
+	/* adds all domains of other */
+	void insert(const DomainSet &other);
+
+	/* the table as bytes (host byte order); load() replaces the set with a
+	 * saved table without hashing the domains again (false if invalid) */
+	void save(std::string &out) const;
+	bool load(const char *data, size_t len);
+
+	/* host or one of its parent domains is in the set */
+	bool matches(const char *host, size_t len) const;
+	bool matches(const std::string &host) const { return matches(host.data(), host.length()); }
+
+	/* a "--" url filter entry which is just a domain: labels of [0-9a-z_-]
+	 * separated by "." or "\."; domain gets the entry with "\." unescaped
+	 */
+	static bool literalDomain(const std::string &pattern, std::string &domain);
+
+private:
+	struct Slot {
+		uint32_t hash;
+		uint32_t offset;
+		uint32_t length; /* 0: empty slot */
+	};
+
+	bool contains(const char *s, size_t len, uint32_t hash) const;
+	void grow();
+
+	std::string m_strings;
+	std::vector<Slot> m_slots; /* size is a power of two, at most half used */
+	size_t m_count;
+};
+
+}
+
+#endif
@@ -0,0 +1,48 @@
+#include "file-list.h"
+
+namespace torrent {
+
+/* the list was checked by the parser: only well-formed strings up to the 'e' */
+static bool nextComponent(const char *data, size_t &pos, BufferString &component) {
+	if ('e' == data[pos]) return false;
+	size_t len = 0;
+	while (':' != data[pos]) len = 10*len + (data[pos++] - '0');
+	pos++;
+	component = BufferString(data + pos, len);
+	pos += len;
+	return true;
+}
+
+FileList::FileList() {
+}
+
+void FileList::clear() {
+	m_lengths.clear();
+	m_paths.clear();
+}
+
+void FileList::add(int64_t length, size_t path_offset) {
+	m_lengths.push_back(length);
+	m_paths.push_back(path_offset);
+}
+
+std::vector<BufferString> FileList::components(const Buffer &buffer, size_t ndx) const {
+	std::vector<BufferString> result;
+	size_t pos = m_paths[ndx] + 1;
+	BufferString c;
+	while (nextComponent(buffer.data(), pos, c)) result.push_back(c);
+	return result;
+}
+
+std::string FileList::path(const Buffer &buffer, size_t ndx) const {
+	std::string result;
+	size_t pos = m_paths[ndx] + 1;
+	BufferString c;
+	for (bool first = true; nextComponent(buffer.data(), pos, c); first = false) {
+		if (!first) result += '/';
+		result.append(c.data(), c.length());
+	}
+	return result;
+}
+
+}
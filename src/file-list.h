@@ -0,0 +1,45 @@
+#ifndef __TORRENT_SANITIZE_FILE_LIST_H
+#define __TORRENT_SANITIZE_FILE_LIST_H
+
+#include "buffer.h"
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <stdint.h>
+#include <sys/types.h>
+}
+
+namespace torrent {
+
+/* file entries of a multi-file torrent as flat arrays: the file lengths, and
+ * the offsets of the (already validated) bencoded path lists in the loaded
+ * buffer. no strings are built while parsing; the path components are
+ * decoded from the buffer on demand.
+ */
+class FileList {
+public:
+	FileList();
+
+	void clear();
+	void add(int64_t length, size_t path_offset);
+
+	size_t size() const { return m_lengths.size(); }
+	bool empty() const { return m_lengths.empty(); }
+
+	int64_t length(size_t ndx) const { return m_lengths[ndx]; }
+
+	/* buffer is the one the entries were parsed from */
+	std::vector<BufferString> components(const Buffer &buffer, size_t ndx) const;
+	/* components joined with '/' */
+	std::string path(const Buffer &buffer, size_t ndx) const;
+
+private:
+	std::vector<int64_t> m_lengths;
+	std::vector<size_t> m_paths;
+};
+
+}
+
+#endif
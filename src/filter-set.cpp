@@ -0,0 +1,610 @@
+#include "filter-set.h"
+#include "utils.h"
+#include "bencode-writer.h"
+#include "output-segments.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+}
+
+namespace torrent {
+
+/* part of the url cache fingerprint: change it with anything that changes
+ * filterUrl() results for the same config, so cached results of older code
+ * aren't used */
+static const char URL_FILTER_VERSION[] = "url-filter 2";
+
+FilterSet::FilterSet() : prefilter_url_replace(true), m_url_config_compiled(false), m_refs(0) {
+	m_url_cache.setFingerprint(URL_FILTER_VERSION);
+}
+
+FilterSet::FilterSet(const FilterSet &o)
+: filter_meta_text(o.filter_meta_text), filter_meta_num(o.filter_meta_num), filter_meta_other(o.filter_meta_other),
+  filter_url_whitelist(o.filter_url_whitelist), filter_url_blacklist(o.filter_url_blacklist),
+  filter_url_blacklist_domains(o.filter_url_blacklist_domains), filter_url_replace(o.filter_url_replace),
+  additional_announce_urls(o.additional_announce_urls), prefilter_url_replace(o.prefilter_url_replace),
+  m_replace_scanner(o.m_replace_scanner), m_replace_always(o.m_replace_always),
+  m_url_config_compiled(o.m_url_config_compiled), m_url_cache(o.m_url_cache.entries()), m_refs(0) {
+	m_url_cache.setFingerprint(o.m_url_cache.fingerprint());
+	if (!o.m_url_cache.filename().empty()) m_url_cache.openFile(o.m_url_cache.filename());
+}
+
+bool FilterSet::basicUrlCleaner(const std::string &url, AnnounceUrl &annurl) const {
+	char stack[512];
+	std::vector<char> heap;
+	char *out = stack;
+	if (url.length() + URL_CANONICAL_EXTRA > sizeof(stack)) {
+		heap.resize(url.length() + URL_CANONICAL_EXTRA);
+		out = &heap[0];
+	}
+
+	CanonicalUrl canonical;
+	if (!canonicalUrl(url.data(), url.length(), out, canonical)) return false;
+
+	annurl.url.assign(out, canonical.length);
+	annurl.domain.assign(out + canonical.domain_start, canonical.domain_length);
+// 	std::cerr << "domain for '" << url << "' (-> '" << annurl.url << "') is '" << annurl.domain << "'\n";
+
+	return true;
+}
+
+/* host part of a cleaned url: between "://" and the port or path */
+static std::string urlHost(const std::string &url) {
+	std::string::size_type start = url.find("://");
+	if (std::string::npos == start) return std::string();
+	start += 3;
+	std::string::size_type end = url.find_first_of(":/", start);
+	return url.substr(start, std::string::npos == end ? std::string::npos : end - start);
+}
+
+/* cache values: url '\0' domain '\0' for each result */
+void FilterSet::filterUrl(const std::string &url, FilterScratch &scratch, std::vector<AnnounceUrl> &result) const {
+	result.clear();
+	std::string &value = scratch.value;
+	if (m_url_cache.lookup(url, value)) {
+		AnnounceUrl annurl;
+		for (size_t pos = 0; pos < value.length(); ) {
+			size_t end = value.find('\0', pos);
+			annurl.url.assign(value, pos, end - pos);
+			pos = end + 1;
+			end = value.find('\0', pos);
+			annurl.domain.assign(value, pos, end - pos);
+			pos = end + 1;
+			result.push_back(annurl);
+		}
+		return;
+	}
+
+	filterUrlUncached(url, scratch, result);
+	value.clear();
+	for (size_t i = 0; i < result.size(); i++) {
+		value.append(result[i].url).push_back('\0');
+		value.append(result[i].domain).push_back('\0');
+	}
+	m_url_cache.store(url, value);
+}
+
+std::vector<AnnounceUrl> FilterSet::filterUrl(const std::string &url) const {
+	FilterScratch scratch;
+	std::vector<AnnounceUrl> result;
+	filterUrl(url, scratch, result);
+	return result;
+}
+
+void FilterSet::filterUrlUncached(const std::string &url, FilterScratch &scratch, std::vector<AnnounceUrl> &urls) const {
+	std::vector<AnnounceUrl> &queue = scratch.queue;
+	std::vector< std::vector<char> > &candidates = scratch.candidates; /* parallel to queue */
+	std::vector<std::string> &rewrites = scratch.rewrites;
+	std::ostream *trace = scratch.trace;
+	AnnounceUrl annurl;
+
+	urls.clear(); /* sorted and made unique at the end */
+	queue.clear();
+	candidates.clear();
+	if (!basicUrlCleaner(url, annurl)) return;
+
+	if (filter_url_whitelist.matches(annurl.url)) {
+		urls.push_back(annurl);
+		if (trace) *trace << "whitelisted entry: " << annurl.url << "\n";
+		return;
+	} else {
+		if (trace) *trace << "processing entry: " << annurl.url << "\n";
+		queue.push_back(annurl);
+	}
+
+	candidates.resize(1);
+	urlReplaceCandidates(annurl.url, candidates[0]);
+
+	for (int r = 0, rlen = filter_url_replace.size(); !queue.empty() && r < rlen; r++) {
+		const PCRE_Replace &rule = filter_url_replace[r];
+		for (int qit = 0, qlen = queue.size(); qit < qlen; qit++) {
+			if (!candidates[qit][r]) continue;
+// 			if (trace) *trace << "trying to match '" << queue[qit].url << "' with '" << rule.pattern() << "'\n";
+			if (rule.replaceFull(queue[qit].url, rewrites)) {
+				/* remove qit */
+				queue.erase(queue.begin() + qit);
+				candidates.erase(candidates.begin() + qit);
+				qit--; qlen--;
+
+				for (int k = 0; k < rewrites.size(); k++) {
+					if (!basicUrlCleaner(rewrites[k], annurl)) continue;
+
+					if (filter_url_whitelist.matches(annurl.url)) {
+						if (trace) *trace << "whitelisted entry: " << annurl.url << "\n";
+						urls.push_back(annurl);
+					} else {
+						if (trace) *trace << "processing entry: " << annurl.url << "\n";
+						queue.push_back(annurl);
+						candidates.push_back(std::vector<char>());
+						urlReplaceCandidates(annurl.url, candidates.back());
+					}
+				}
+			}
+		}
+	}
+
+	for (int k = 0; k < queue.size(); k++) {
+		if (filter_url_blacklist_domains.matches(urlHost(queue[k].url)) || filter_url_blacklist.matches(queue[k].url)) {
+			if (trace) *trace << "blacklisted entry: " << queue[k].url << "\n";
+		} else {
+			if (trace) *trace << "passed entry: " << queue[k].url << "\n";
+			urls.push_back(queue[k]);
+		}
+	}
+
+	std::sort(urls.begin(), urls.end());
+	urls.erase(std::unique(urls.begin(), urls.end()), urls.end());
+}
+
+void FilterSet::buildUrlReplacePrefilter() {
+	m_replace_scanner.clear();
+	m_replace_always.assign(filter_url_replace.size(), 0);
+	std::vector<std::string> literals;
+	for (size_t r = 0; r < filter_url_replace.size(); r++) {
+		if (!requiredLiterals(filter_url_replace[r].pattern(), literals)) {
+			m_replace_always[r] = 1;
+			continue;
+		}
+		for (size_t i = 0; i < literals.size(); i++) m_replace_scanner.add(literals[i], r);
+	}
+	m_replace_scanner.build();
+}
+
+void FilterSet::urlReplaceCandidates(const std::string &url, std::vector<char> &rules) const {
+	if (!prefilter_url_replace || m_replace_always.size() != filter_url_replace.size()) {
+		rules.assign(filter_url_replace.size(), 1);
+		return;
+	}
+	rules = m_replace_always;
+	m_replace_scanner.scan(url.data(), url.length(), rules);
+}
+
+static std::vector<std::string> splitLine(const std::string &line) {
+	std::vector<std::string> cols;
+	int pos = 0;
+	while (pos < line.length() && isspace(line[pos])) pos++;
+
+	if (pos >= line.length()) return cols;
+
+	switch (line[pos]) {
+	case '+':
+	case '*':
+		cols.push_back(line.substr(pos, 1));
+		pos += 1;
+		break;
+	case '-':
+		if ('-' == line[pos+1]) {
+			cols.push_back(line.substr(pos, 2));
+			pos += 2;
+		} else {
+			cols.push_back(line.substr(pos, 1));
+			pos += 1;
+		}
+		break;
+	}
+
+	while (pos < line.length()) {
+		while (pos < line.length() && isspace(line[pos])) pos++;
+		if (pos >= line.length()) return cols;
+
+		if (line[pos] == '#') return cols; /* comment: skip remaining part */
+
+		int pos2 = pos + 1;
+		while (pos2 < line.length() && !isspace(line[pos2])) pos2++;
+
+		cols.push_back(line.substr(pos, pos2 - pos));
+
+		pos = pos2 + 1;
+	}
+
+	return cols;
+}
+
+static std::string patternToRegex(const std::string pattern) {
+	/* maybe add glob support in the future */
+	return pattern;
+}
+
+/* false on errors (printed): an unreadable config is never an empty one */
+static bool readConfigFile(const std::string &filename, std::string &content) {
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	if (file) content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	if (!file || file.bad()) {
+		std::cerr << "Cannot read url filter '" << filename << "'\n";
+		return false;
+	}
+	return true;
+}
+
+bool FilterSet::loadTextUrlConfig(const std::string &content) {
+	std::istringstream urlfile(content);
+	std::string l;
+	std::vector<std::string> cols;
+
+	bool regex_blacklist_domains_empty = true;
+	std::stringstream regex_whitelist, regex_blacklist, regex_blacklist_domains;
+	regex_whitelist << "^(?:";
+	regex_blacklist << "^(?:";
+
+	while (urlfile.good()) {
+		std::getline(urlfile, l);
+		if (l.empty()) continue;
+
+		cols = splitLine(l);
+		if (cols.empty()) continue;
+
+		if (cols[0] == "+") {
+			for (int i = 1; i < cols.size(); i++) {
+				additional_announce_urls.push_back(cols[i]);
+			}
+		} else if (cols[0] == "-") {
+			for (int i = 1; i < cols.size(); i++) {
+				regex_blacklist << "|" << patternToRegex(cols[i]);
+			}
+		} else if (cols[0] == "--") {
+			for (int i = 1; i < cols.size(); i++) {
+				std::string domain;
+				if (DomainSet::literalDomain(cols[i], domain)) {
+					filter_url_blacklist_domains.insert(domain);
+					continue;
+				}
+				if (regex_blacklist_domains_empty) {
+					regex_blacklist_domains_empty = false;
+				} else {
+					regex_blacklist_domains << "|";
+				}
+				regex_blacklist_domains << patternToRegex(cols[i]);
+			}
+		} else if (cols[0] == "*") {
+			for (int i = 1; i < cols.size(); i++) {
+				regex_whitelist << "|" << patternToRegex(cols[i]);
+			}
+		} else {
+			PCRE_Replace rep;
+			std::string pattern = cols.front();
+			cols.erase(cols.begin());
+			if (!rep.load(pattern, cols)) return false;
+			filter_url_replace.push_back(rep);
+		}
+	}
+
+	if (!regex_blacklist_domains_empty) {
+		regex_blacklist << "|[^:]+://(?:[0-9a-z_\\-.]*\\.)?(?:" << regex_blacklist_domains.str() << ")(?:[:/].*)?";
+	}
+
+	regex_whitelist << ")\\z";
+	regex_blacklist << ")\\z";
+// 	std::cerr << "blacklist regex: " << regex_blacklist.str() << "\n";
+
+	if (!filter_url_whitelist.load(regex_whitelist.str().c_str())) return false;
+	if (!filter_url_blacklist.load(regex_blacklist.str().c_str())) return false;
+
+	buildUrlReplacePrefilter();
+
+	m_url_config_compiled = false;
+	addUrlConfigFingerprint(BufferString(content).sha1());
+
+	return true;
+}
+
+void FilterSet::addUrlConfigFingerprint(const std::string &content_sha1) {
+	/* cached results of the previous config are not valid anymore */
+	m_url_cache.setFingerprint(BufferString(m_url_cache.fingerprint() + content_sha1).sha1());
+}
+
+/* compiled url filter config: a header, then everything loadTextUrlConfig()
+ * produces, with the patterns already compiled. host byte order; strings are
+ * a uint32 length and the bytes.
+ *
+ *   "TSFILTER", uint32 version, uint32 byte order mark
+ *   string pcre_version()
+ *   string source (real path), uint64 size, uint64 mtime sec, uint64 mtime nsec,
+ *   string sha1 of the source
+ *   uint32 count, announce url strings
+ *   string whitelist, string blacklist (compiled patterns)
+ *   string blacklist domains (DomainSet::save())
+ *   uint32 count, rules: string pattern, string compiled pattern,
+ *     uint32 count, rewrite strings
+ *   string sha1 of everything before it
+ *
+ * the compiled patterns are run as they are, so a file failing the checksum
+ * (or of another version) is never used: the source is loaded instead.
+ */
+static const char COMPILED_URL_CONFIG_MAGIC[9] = "TSFILTER";
+static const uint32_t COMPILED_URL_CONFIG_VERSION = 2;
+static const size_t COMPILED_URL_CONFIG_CHECKSUM = 4 + 40; /* the last string */
+static const uint32_t COMPILED_URL_CONFIG_BOM = 0x01020304;
+
+namespace {
+class CompiledWriter {
+public:
+	void u32(uint32_t v) { data.append((const char*) &v, sizeof(v)); }
+	void u64(uint64_t v) { data.append((const char*) &v, sizeof(v)); }
+	void str(const std::string &s) { u32(s.length()); data += s; }
+
+	template<typename Out> void serialize(Out &out) const {
+		out.raw(data.data(), data.length());
+	}
+
+	std::string data;
+};
+
+/* reading past the end sets ok = false */
+class CompiledReader {
+public:
+	CompiledReader(const char *data, size_t len) : ok(true), m_pos(data), m_end(data + len) { }
+
+	uint32_t u32() { uint32_t v = 0; read(&v, sizeof(v)); return v; }
+	uint64_t u64() { uint64_t v = 0; read(&v, sizeof(v)); return v; }
+	/* points into the buffer */
+	BufferString view() {
+		size_t len = u32();
+		if (!ok || len > (size_t) (m_end - m_pos)) {
+			ok = false;
+			return BufferString();
+		}
+		BufferString s(m_pos, len);
+		m_pos += len;
+		return s;
+	}
+	std::string str() { return view().toString(); }
+	bool atEnd() const { return m_pos == m_end; }
+
+	bool ok;
+
+private:
+	void read(void *v, size_t len) {
+		if (!ok || len > (size_t) (m_end - m_pos)) {
+			ok = false;
+			return;
+		}
+		memcpy(v, m_pos, len);
+		m_pos += len;
+	}
+
+	const char *m_pos, *m_end;
+};
+}
+
+static bool isCompiledUrlConfig(const std::string &filename) {
+	char magic[sizeof(COMPILED_URL_CONFIG_MAGIC) - 1];
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	return file.read(magic, sizeof(magic)) && 0 == memcmp(magic, COMPILED_URL_CONFIG_MAGIC, sizeof(magic));
+}
+
+bool FilterSet::loadUrlConfig(const std::string &urlconfig) {
+	std::string content;
+	if (!isCompiledUrlConfig(urlconfig)) return readConfigFile(urlconfig, content) && loadTextUrlConfig(content);
+
+	bool stale = false;
+	std::string source;
+	if (loadCompiledUrlConfig(urlconfig, stale, source)) return true;
+	if (!stale) return false;
+	std::cerr << "Loading url filter '" << source << "' instead\n";
+	return readConfigFile(source, content) && loadTextUrlConfig(content);
+}
+
+bool FilterSet::loadCompiledUrlConfig(const std::string &urlconfig, bool &stale, std::string &source) {
+	stale = false;
+	Buffer buf;
+	if (!buf.load(urlconfig, LOAD_MMAP)) return false;
+
+	const size_t body = buf.len() > COMPILED_URL_CONFIG_CHECKSUM ? buf.len() - COMPILED_URL_CONFIG_CHECKSUM : 0;
+	CompiledReader checksum(buf.data() + body, buf.len() - body);
+	const std::string expected_sha1 = checksum.str();
+	const bool intact = checksum.ok && checksum.atEnd() && BufferString(buf.data(), body).sha1() == expected_sha1;
+
+	CompiledReader in(buf.data(), body);
+	in.u64(); /* magic, checked by isCompiledUrlConfig() */
+	const uint32_t version = in.u32(), bom = in.u32();
+	const BufferString pcre_build = in.view();
+	source = in.str();
+	const uint64_t size = in.u64(), mtime_sec = in.u64(), mtime_nsec = in.u64();
+	const std::string content_sha1 = in.str();
+	if (!in.ok) {
+		std::cerr << "Compiled url filter '" << urlconfig << "' is truncated\n";
+		return false;
+	}
+	if (!intact || COMPILED_URL_CONFIG_BOM != bom || COMPILED_URL_CONFIG_VERSION != version) {
+		std::cerr << "Compiled url filter '" << urlconfig << "' is damaged or has another version or byte order\n";
+		stale = true;
+		return false;
+	}
+
+	/* compiled patterns only work with the same pcre build */
+	if (pcre_build != BufferString(pcre_version(), strlen(pcre_version()))) {
+		std::cerr << "Compiled url filter '" << urlconfig << "' is from another pcre build\n";
+		stale = true;
+		return false;
+	}
+	/* the source may be gone (only the compiled config was deployed) */
+	struct stat st;
+	if (0 == ::stat(source.c_str(), &st) && ((uint64_t) st.st_size != size
+			|| (uint64_t) st.st_mtim.tv_sec != mtime_sec || (uint64_t) st.st_mtim.tv_nsec != mtime_nsec)) {
+		/* touched, but maybe not changed */
+		std::string content;
+		if (!readConfigFile(source, content) || BufferString(content).sha1() != content_sha1) {
+			std::cerr << "Compiled url filter '" << urlconfig << "' is out of date\n";
+			stale = true;
+			return false;
+		}
+	}
+
+	std::vector<std::string> announce_urls;
+	for (uint32_t i = 0, n = in.u32(); in.ok && i < n; i++) announce_urls.push_back(in.str());
+
+	PCRE whitelist, blacklist;
+	DomainSet blacklist_domains;
+	const BufferString whitelist_re = in.view(), blacklist_re = in.view(), domains = in.view();
+	if (!in.ok || !whitelist.loadCompiled(whitelist_re.data(), whitelist_re.length())
+			|| !blacklist.loadCompiled(blacklist_re.data(), blacklist_re.length())
+			|| !blacklist_domains.load(domains.data(), domains.length())) {
+		std::cerr << "Compiled url filter '" << urlconfig << "' is corrupt\n";
+		return false;
+	}
+
+	std::vector<PCRE_Replace> rules;
+	for (uint32_t i = 0, n = in.u32(); in.ok && i < n; i++) {
+		const std::string pattern = in.str();
+		const BufferString compiled = in.view();
+		std::vector<std::string> rewrites;
+		for (uint32_t k = 0, m = in.u32(); in.ok && k < m; k++) rewrites.push_back(in.str());
+		PCRE_Replace rep;
+		if (!in.ok || !rep.loadCompiled(pattern, rewrites, compiled.data(), compiled.length())) {
+			in.ok = false;
+			break;
+		}
+		rules.push_back(rep);
+	}
+	if (!in.ok || !in.atEnd()) {
+		std::cerr << "Compiled url filter '" << urlconfig << "' is corrupt\n";
+		return false;
+	}
+
+	/* same result as loadTextUrlConfig() with the source */
+	additional_announce_urls.insert(additional_announce_urls.end(), announce_urls.begin(), announce_urls.end());
+	filter_url_whitelist = whitelist;
+	filter_url_blacklist = blacklist;
+	if (filter_url_blacklist_domains.empty()) {
+		std::swap(filter_url_blacklist_domains, blacklist_domains);
+	} else {
+		filter_url_blacklist_domains.insert(blacklist_domains);
+	}
+	filter_url_replace.insert(filter_url_replace.end(), rules.begin(), rules.end());
+
+	buildUrlReplacePrefilter();
+
+	m_url_config_compiled = true;
+	addUrlConfigFingerprint(content_sha1);
+
+	return true;
+}
+
+bool FilterSet::compileUrlConfig(const std::string &urlconfig, const std::string &output) {
+	struct stat st;
+	char *real = ::realpath(urlconfig.c_str(), 0);
+	if (0 == real || -1 == ::stat(real, &st)) {
+		int e = errno;
+		std::cerr << "Cannot stat url filter '" << urlconfig << "': " << ::strerror(e) << std::endl;
+		::free(real);
+		return false;
+	}
+	const std::string source(real);
+	::free(real);
+	if (isCompiledUrlConfig(source)) {
+		std::cerr << "Url filter '" << urlconfig << "' is already compiled\n";
+		return false;
+	}
+
+	std::string content;
+	if (!readConfigFile(source, content)) return false;
+	FilterSet filters;
+	if (!filters.loadTextUrlConfig(content)) return false;
+
+	CompiledWriter out;
+	out.data.append(COMPILED_URL_CONFIG_MAGIC, sizeof(COMPILED_URL_CONFIG_MAGIC) - 1);
+	out.u32(COMPILED_URL_CONFIG_VERSION);
+	out.u32(COMPILED_URL_CONFIG_BOM);
+	out.str(pcre_version());
+	out.str(source);
+	out.u64(st.st_size);
+	out.u64(st.st_mtim.tv_sec);
+	out.u64(st.st_mtim.tv_nsec);
+	out.str(BufferString(content).sha1());
+
+	out.u32(filters.additional_announce_urls.size());
+	for (size_t i = 0; i < filters.additional_announce_urls.size(); i++) out.str(filters.additional_announce_urls[i]);
+
+	std::string compiled;
+	bool ok = filters.filter_url_whitelist.compiled(compiled);
+	out.str(compiled);
+	ok = ok && filters.filter_url_blacklist.compiled(compiled);
+	out.str(compiled);
+	filters.filter_url_blacklist_domains.save(compiled);
+	out.str(compiled);
+
+	out.u32(filters.filter_url_replace.size());
+	for (size_t i = 0; ok && i < filters.filter_url_replace.size(); i++) {
+		const PCRE_Replace &rule = filters.filter_url_replace[i];
+		ok = rule.compiled(compiled);
+		out.str(rule.pattern());
+		out.str(compiled);
+		out.u32(rule.rewrites().size());
+		for (size_t k = 0; k < rule.rewrites().size(); k++) out.str(rule.rewrites()[k]);
+	}
+	if (!ok) {
+		std::cerr << "Cannot get the compiled pcre patterns of url filter '" << urlconfig << "'\n";
+		return false;
+	}
+	out.str(BufferString(out.data).sha1());
+
+	return writeAtomicFile(output, out);
+}
+
+FilterSet* FilterSetRef::acquire(FilterSet *set) {
+	__sync_add_and_fetch(&set->m_refs, 1);
+	return set;
+}
+
+void FilterSetRef::release(FilterSet *set) {
+	if (0 == __sync_sub_and_fetch(&set->m_refs, 1)) delete set;
+}
+
+FilterSetRef::FilterSetRef() : m_set(acquire(new FilterSet())) {
+}
+
+FilterSetRef::FilterSetRef(const FilterSetRef &o) : m_set(acquire(o.m_set)) {
+}
+
+FilterSetRef& FilterSetRef::operator=(const FilterSetRef &o) {
+	FilterSet *old = m_set;
+	m_set = acquire(o.m_set);
+	release(old);
+	return *this;
+}
+
+FilterSetRef::~FilterSetRef() {
+	release(m_set);
+}
+
+FilterSet& FilterSetRef::edit() {
+	/* only this reference: nobody else can get one while we change it */
+	if (1 != __sync_add_and_fetch(&m_set->m_refs, 0)) {
+		FilterSet *copy = acquire(new FilterSet(*m_set));
+		release(m_set);
+		m_set = copy;
+	}
+	return *m_set;
+}
+
+}
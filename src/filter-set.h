@@ -0,0 +1,150 @@
+#ifndef __TORRENT_SANITIZE_FILTER_SET_H
+#define __TORRENT_SANITIZE_FILTER_SET_H
+
+#include "buffer.h"
+#include "torrent-pcre.h"
+#include "domain-set.h"
+#include "literal-scanner.h"
+#include "url-cache.h"
+#include "url-canonical.h"
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace torrent {
+
+class AnnounceUrl {
+public:
+	std::string url;
+	std::string domain; /* domain + tld, like "example.com" for "udp://tracker.example.com/". full address for ipv4/ipv6 */
+
+
+	bool operator <(const AnnounceUrl &other) const {
+		return (url < other.url);
+		// if the urls are equal, the domains are too
+	}
+
+	bool operator ==(const AnnounceUrl &other) const {
+		return url == other.url;
+	}
+};
+
+/* memory FilterSet::filterUrl works in, reused between calls: one per thread */
+class FilterScratch {
+public:
+	FilterScratch() : trace(0) { }
+
+	std::ostream *trace; /* every step of the url filter is printed here (0: nowhere) */
+
+private:
+	friend class FilterSet;
+
+	std::vector<AnnounceUrl> queue;
+	std::vector< std::vector<char> > candidates; /* parallel to queue */
+	std::vector<std::string> rewrites;
+	std::string value; /* url cache entry */
+};
+
+/* the compiled meta and url filters.
+ *
+ * only built through a non-const reference (TorrentSanitize copies the set
+ * before changing it if it is shared); after that all threads can match
+ * concurrently, each with its own FilterScratch. the url cache locks itself.
+ *
+ * shared by reference count, see FilterSetRef.
+ */
+class FilterSet {
+private:
+	FilterSet& operator=(const FilterSet &o);
+
+public:
+	FilterSet();
+	/* the copy starts with an empty url cache (same size and file) */
+	FilterSet(const FilterSet &o);
+
+	bool validMetaTextKey(BufferString key, KeyId id = KEY_UNKNOWN) const { return filter_meta_text.matches(key, id); }
+	bool validMetaNumKey(BufferString key, KeyId id = KEY_UNKNOWN) const { return filter_meta_num.matches(key, id); }
+	bool validMetaOtherKey(BufferString key, KeyId id = KEY_UNKNOWN) const { return filter_meta_other.matches(key, id); }
+
+	bool basicUrlCleaner(const std::string &url, AnnounceUrl &annurl) const;
+	/* results are cached by url (see setUrlCacheEntries, openUrlCache) */
+	void filterUrl(const std::string &url, FilterScratch &scratch, std::vector<AnnounceUrl> &result) const;
+	std::vector<AnnounceUrl> filterUrl(const std::string &url) const;
+
+	/* a text config, or one compiled with compileUrlConfig(); a compiled
+	 * config is only used if it is up to date (same pcre build, source
+	 * unchanged), otherwise its source is loaded instead */
+	bool loadUrlConfig(const std::string &configpath);
+	/* the last loadUrlConfig() used a compiled config */
+	bool urlConfigCompiled() const { return m_url_config_compiled; }
+
+	/* writes the parsed and compiled text config to output */
+	static bool compileUrlConfig(const std::string &configpath, const std::string &output);
+
+	/* results for this many urls are kept in memory (default URL_CACHE_ENTRIES; 0: none) */
+	void setUrlCacheEntries(size_t entries) { m_url_cache.setEntries(entries); }
+	/* share results with other processes through a file; false on errors (printed) */
+	bool openUrlCache(const std::string &filename) { return m_url_cache.openFile(filename); }
+	const UrlCache& urlCache() const { return m_url_cache; }
+
+	PCRE filter_meta_text, filter_meta_num, filter_meta_other;
+
+	PCRE filter_url_whitelist, filter_url_blacklist;
+	DomainSet filter_url_blacklist_domains; /* literal "--" entries; the others are part of filter_url_blacklist */
+	std::vector<PCRE_Replace> filter_url_replace;
+	std::vector< std::string > additional_announce_urls;
+
+	bool prefilter_url_replace; /* only run rewrite rules whose required literals are in the url */
+
+private:
+	friend class FilterSetRef;
+
+	bool loadTextUrlConfig(const std::string &content);
+	/* false on errors (printed) or if stale; source: the text config */
+	bool loadCompiledUrlConfig(const std::string &configpath, bool &stale, std::string &source);
+	/* fingerprint of the url cache after loading config content with this sha1 */
+	void addUrlConfigFingerprint(const std::string &content_sha1);
+
+	void filterUrlUncached(const std::string &url, FilterScratch &scratch, std::vector<AnnounceUrl> &urls) const;
+
+	void buildUrlReplacePrefilter();
+	/* rules[i]: filter_url_replace[i] may match url */
+	void urlReplaceCandidates(const std::string &url, std::vector<char> &rules) const;
+
+	LiteralScanner m_replace_scanner;
+	std::vector<char> m_replace_always; /* rules without required literals */
+
+	bool m_url_config_compiled;
+
+	/* fingerprint: sha1 of all loaded url filter configs */
+	mutable UrlCache m_url_cache;
+
+	mutable int m_refs; /* FilterSetRef, atomic */
+};
+
+/* shared reference to a FilterSet; only gives const access unless it is the
+ * only reference (copying the set first otherwise) */
+class FilterSetRef {
+public:
+	FilterSetRef();
+	FilterSetRef(const FilterSetRef &o);
+	FilterSetRef& operator=(const FilterSetRef &o);
+	~FilterSetRef();
+
+	const FilterSet& operator*() const { return *m_set; }
+	const FilterSet* operator->() const { return m_set; }
+
+	/* copy on write */
+	FilterSet& edit();
+
+private:
+	static FilterSet* acquire(FilterSet *set);
+	static void release(FilterSet *set);
+
+	FilterSet *m_set;
+};
+
+}
+
+#endif
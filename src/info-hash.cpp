@@ -0,0 +1,41 @@
+#include "common.h"
+
+namespace torrent {
+
+InfoHash::InfoHash(const Buffer &buffer) : m_buffer(buffer), m_ctx(0), m_hashed(0), m_active(false) {
+}
+
+InfoHash::~InfoHash() {
+	if (m_ctx) EVP_MD_CTX_destroy(m_ctx);
+}
+
+void InfoHash::begin(size_t start) {
+	if (!m_ctx) m_ctx = EVP_MD_CTX_create();
+	::EVP_DigestInit_ex(m_ctx, EVP_sha1(), NULL);
+	m_hashed = start;
+	m_active = true;
+}
+
+void InfoHash::update(size_t pos) {
+	if (pos <= m_hashed) return;
+	::EVP_DigestUpdate(m_ctx, m_buffer.data() + m_hashed, pos - m_hashed);
+	m_hashed = pos;
+}
+
+std::string InfoHash::finish(size_t end) {
+	if (!m_active) return std::string();
+	update(end);
+	m_active = false;
+
+	unsigned char raw[SHA_DIGEST_LENGTH];
+	::EVP_DigestFinal_ex(m_ctx, raw, NULL);
+	return sha1Hex(raw);
+}
+
+std::string sha1Hex(const unsigned char digest[SHA_DIGEST_LENGTH]) {
+	std::string hex(2*SHA_DIGEST_LENGTH, '.');
+	hexEncode(digest, SHA_DIGEST_LENGTH, &hex[0]);
+	return hex;
+}
+
+}
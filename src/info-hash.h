@@ -0,0 +1,56 @@
+#ifndef __TORRENT_SANITIZE_INFO_HASH_H
+#define __TORRENT_SANITIZE_INFO_HASH_H
+
+#include "config.h"
+#include "buffer.h"
+#include "bencode-tape.h"
+
+#include <string>
+
+extern "C" {
+#include <sys/types.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+}
+
+namespace torrent {
+
+/* sha1 of a buffer range, computed while the parser moves through it:
+ * progress() hashes everything parsed since the last call once at least
+ * INFO_HASH_CHUNK bytes are waiting, so the data is hashed while it is
+ * still in the cache instead of in a second pass after parsing.
+ * only data up to the current parse position is read, which works for
+ * lazy buffers too.
+ */
+class InfoHash : public BencodeTape::Progress {
+private:
+	InfoHash(const InfoHash &o);
+	InfoHash& operator=(const InfoHash &o);
+
+public:
+	InfoHash(const Buffer &buffer);
+	~InfoHash();
+
+	void begin(size_t start);
+	void progress(size_t pos) { if (m_active && pos - m_hashed >= INFO_HASH_CHUNK) update(pos); }
+	/* hash up to end; returns the hex digest */
+	std::string finish(size_t end);
+	void reset() { m_active = false; }
+
+	bool active() const { return m_active; }
+
+private:
+	void update(size_t pos);
+
+	const Buffer &m_buffer;
+	EVP_MD_CTX *m_ctx; /* EVP: uses the sha extensions of the cpu if available */
+	size_t m_hashed;
+	bool m_active;
+};
+
+/* uppercase hex of a 20 byte sha1 digest */
+std::string sha1Hex(const unsigned char digest[SHA_DIGEST_LENGTH]);
+
+}
+
+#endif
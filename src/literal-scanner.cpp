@@ -0,0 +1,104 @@
+#include "literal-scanner.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <string.h>
+}
+
+namespace torrent {
+
+LiteralScanner::LiteralScanner() : m_classes(1) {
+	memset(m_class, 0, sizeof(m_class));
+}
+
+void LiteralScanner::clear() {
+	m_literals.clear();
+	m_literal_ids.clear();
+	memset(m_class, 0, sizeof(m_class));
+	m_classes = 1;
+	m_next.clear();
+	m_out_link.clear();
+	m_out_start.clear();
+	m_out.clear();
+}
+
+void LiteralScanner::add(const std::string &literal, size_t id) {
+	if (literal.empty()) return;
+	m_literals.push_back(literal);
+	m_literal_ids.push_back(id);
+}
+
+void LiteralScanner::build() {
+	memset(m_class, 0, sizeof(m_class));
+	m_classes = 1; /* class 0: bytes not used in any literal */
+	for (size_t i = 0; i < m_literals.size(); i++) {
+		for (size_t k = 0; k < m_literals[i].length(); k++) {
+			unsigned char b = m_literals[i][k];
+			if (0 == m_class[b]) m_class[b] = m_classes++;
+		}
+	}
+	const size_t m = m_classes;
+
+	/* trie; state 0 is the root, a 0 transition means "no edge" */
+	m_next.assign(m, 0);
+	std::vector< std::vector<size_t> > ids(1);
+	for (size_t i = 0; i < m_literals.size(); i++) {
+		uint32_t s = 0;
+		for (size_t k = 0; k < m_literals[i].length(); k++) {
+			size_t c = m_class[(unsigned char) m_literals[i][k]];
+			if (0 == m_next[s*m + c]) {
+				m_next[s*m + c] = ids.size();
+				ids.push_back(std::vector<size_t>());
+				m_next.resize(ids.size() * m, 0);
+			}
+			s = m_next[s*m + c];
+		}
+		ids[s].push_back(m_literal_ids[i]);
+	}
+	const size_t states = ids.size();
+
+	/* breadth first: failure links, then missing edges follow the failure
+	 * link (the row of the failure state is complete already) */
+	std::vector<uint32_t> fail(states, 0), queue;
+	m_out_link.assign(states, 0);
+	queue.reserve(states);
+	for (size_t c = 0; c < m; c++) if (0 != m_next[c]) queue.push_back(m_next[c]);
+	for (size_t qi = 0; qi < queue.size(); qi++) {
+		uint32_t u = queue[qi];
+		m_out_link[u] = ids[fail[u]].empty() ? m_out_link[fail[u]] : fail[u];
+		for (size_t c = 0; c < m; c++) {
+			uint32_t t = m_next[u*m + c];
+			if (0 != t) {
+				fail[t] = (0 == u) ? 0 : m_next[fail[u]*m + c];
+				queue.push_back(t);
+			} else {
+				m_next[u*m + c] = m_next[fail[u]*m + c];
+			}
+		}
+	}
+
+	m_out_start.assign(states + 1, 0);
+	m_out.clear();
+	for (size_t s = 0; s < states; s++) {
+		std::sort(ids[s].begin(), ids[s].end());
+		ids[s].erase(std::unique(ids[s].begin(), ids[s].end()), ids[s].end());
+		m_out_start[s] = m_out.size();
+		m_out.insert(m_out.end(), ids[s].begin(), ids[s].end());
+	}
+	m_out_start[states] = m_out.size();
+}
+
+void LiteralScanner::scan(const char *text, size_t len, std::vector<char> &hits) const {
+	if (m_out.empty()) return;
+	const size_t m = m_classes;
+	uint32_t s = 0;
+	for (size_t i = 0; i < len; i++) {
+		s = m_next[s*m + m_class[(unsigned char) text[i]]];
+		for (uint32_t o = (m_out_start[s] != m_out_start[s+1]) ? s : m_out_link[s]; 0 != o; o = m_out_link[o]) {
+			for (size_t k = m_out_start[o]; k < m_out_start[o+1]; k++) hits[m_out[k]] = 1;
+		}
+	}
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef __TORRENT_SANITIZE_LITERAL_SCANNER_H
+#define __TORRENT_SANITIZE_LITERAL_SCANNER_H
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <stdint.h>
+#include <sys/types.h>
+}
+
+namespace torrent {
+
+/* finds which of many literals occur in a text, in one pass over the text
+ * (Aho-Corasick). each literal has an id; several literals can share an id.
+ *
+ * build() turns the trie into a dfa: a full transition table over the byte
+ * classes (the bytes used in literals, plus one class for all other bytes).
+ *
+ * usage:
+ *   scanner.add("foo", 0); scanner.add("bar", 1); scanner.build();
+ *   scanner.scan(text, len, hits); // hits[id] = 1 for each literal found
+ */
+class LiteralScanner {
+public:
+	LiteralScanner();
+
+	void clear();
+
+	/* literal must not be empty; call build() after adding literals */
+	void add(const std::string &literal, size_t id);
+	void build();
+
+	bool empty() const { return m_literals.empty(); }
+
+	/* sets hits[id] = 1 for every literal found in text; hits must have
+	 * room for the largest id (other entries are not touched)
+	 */
+	void scan(const char *text, size_t len, std::vector<char> &hits) const;
+
+private:
+	std::vector<std::string> m_literals;
+	std::vector<size_t> m_literal_ids;
+
+	uint16_t m_class[256];
+	size_t m_classes;
+	std::vector<uint32_t> m_next; /* state * m_classes + class -> state */
+	std::vector<uint32_t> m_out_link; /* next state (suffix) with ids, 0: none */
+	std::vector<uint32_t> m_out_start; /* ids of state s: m_out[m_out_start[s] .. m_out_start[s+1]) */
+	std::vector<size_t> m_out;
+};
+
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include "common.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+}
+
+#ifndef IOV_MAX
+# define IOV_MAX 16
+#endif
+
+namespace torrent {
+
+OutputSegments::OutputSegments() : m_size(0), m_failed(false) {
+}
+
+OutputSegments::~OutputSegments() {
+	clear();
+}
+
+void OutputSegments::clear() {
+	for (size_t i = 0; i < m_sources.size(); i++) {
+		if (-1 != m_sources[i].fd) ::close(m_sources[i].fd);
+	}
+	m_sources.clear();
+	m_segments.clear();
+	m_mem.clear();
+	m_size = 0;
+	m_failed = false;
+}
+
+void OutputSegments::raw(const char *data, size_t len) {
+	if (0 == len) return;
+	if (m_segments.empty() || -1 != m_segments.back().fd || 0 != m_segments.back().data) {
+		Segment seg = { -1, 0, m_mem.length(), 0 };
+		m_segments.push_back(seg);
+	}
+	m_mem.append(data, len);
+	m_segments.back().length += len;
+	m_size += len;
+}
+
+std::streamsize OutputSegments::xsputn(const char *s, std::streamsize n) {
+	if (n <= 0) return 0;
+	raw(s, n);
+	return n;
+}
+
+OutputSegments::int_type OutputSegments::overflow(int_type c) {
+	if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+	char ch = traits_type::to_char_type(c);
+	xsputn(&ch, 1);
+	return c;
+}
+
+/* reuse the descriptor of a lazy buffer, otherwise reopen the file; only
+ * use it if it still is the file we loaded. returns -1 if not available */
+int OutputSegments::sourceFd(const Buffer &buffer) {
+	for (size_t i = 0; i < m_sources.size(); i++) {
+		if (&buffer == m_sources[i].buffer) return m_sources[i].fd;
+	}
+
+	int fd = -1;
+	if (-1 != buffer.m_fd) {
+		fd = ::fcntl(buffer.m_fd, F_DUPFD_CLOEXEC, 0);
+	} else if (!buffer.m_filename.empty() && -1 != (fd = ::open(buffer.m_filename.c_str(), O_RDONLY | O_CLOEXEC))) {
+		struct stat st;
+		const struct stat &orig = buffer.filestat;
+		if (-1 == ::fstat(fd, &st) || st.st_dev != orig.st_dev || st.st_ino != orig.st_ino
+		    || st.st_size != orig.st_size || st.st_mtim.tv_sec != orig.st_mtim.tv_sec
+		    || st.st_mtim.tv_nsec != orig.st_mtim.tv_nsec) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+
+	Source src = { &buffer, fd };
+	m_sources.push_back(src);
+	return fd;
+}
+
+bool OutputSegments::appendRange(const Buffer &buffer, size_t offset, size_t length) {
+	if (offset > buffer.m_len || length > buffer.m_len - offset) return false;
+	if (0 == length) return true;
+
+	bool loaded = (offset + length <= buffer.m_loaded);
+	int fd = -1;
+	/* small ranges are cheaper to write from memory */
+	if (!loaded || length >= OUTPUT_COPY_RANGE_MIN) fd = sourceFd(buffer);
+	if (-1 == fd && !loaded) return false;
+
+	Segment seg = { fd, loaded ? buffer.m_data + offset : 0, offset, length };
+	m_segments.push_back(seg);
+	m_size += length;
+	return true;
+}
+
+static bool writeAll(int fd, const std::string &filename, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t r = ::write(fd, data, length);
+		if (-1 == r) {
+			int e = errno;
+			if (EINTR == e) continue;
+			std::cerr << "Cannot write file '" << filename << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		data += r;
+		length -= r;
+	}
+	return true;
+}
+
+/* segments [first, last) are all in memory */
+bool OutputSegments::writeMemory(int fd, const std::string &filename, size_t first, size_t last) {
+	std::vector<struct iovec> iov(last - first);
+	for (size_t i = first; i < last; i++) {
+		const Segment &s = m_segments[i];
+		iov[i - first].iov_base = (void*) (s.data ? s.data : m_mem.data() + s.offset);
+		iov[i - first].iov_len = s.length;
+	}
+
+	size_t cur = 0;
+	while (cur < iov.size()) {
+		ssize_t r = ::writev(fd, &iov[cur], std::min<size_t>(iov.size() - cur, IOV_MAX));
+		if (-1 == r) {
+			int e = errno;
+			if (EINTR == e) continue;
+			std::cerr << "Cannot write file '" << filename << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		/* skip what was written, partial writes can end in the middle of an entry */
+		while (cur < iov.size() && (size_t) r >= iov[cur].iov_len) {
+			r -= iov[cur].iov_len;
+			cur++;
+		}
+		if (cur < iov.size()) {
+			iov[cur].iov_base = (char*) iov[cur].iov_base + r;
+			iov[cur].iov_len -= r;
+		}
+	}
+	return true;
+}
+
+/* try copy_file_range, then sendfile; both fail for some combinations of
+ * filesystems and file types, then continue with the next method */
+bool OutputSegments::copyRange(int fd, const std::string &filename, const Segment &s) {
+	off_t offset = s.offset;
+	size_t left = s.length;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	while (left > 0) {
+		ssize_t r = ::copy_file_range(s.fd, &offset, fd, NULL, left, 0);
+		if (r > 0) {
+			left -= r;
+		} else if (-1 == r && EINTR == errno) {
+			continue;
+		} else {
+			break;
+		}
+	}
+#endif
+
+#ifdef HAVE_SENDFILE
+	while (left > 0) {
+		ssize_t r = ::sendfile(fd, s.fd, &offset, left);
+		if (r > 0) {
+			left -= r;
+		} else if (-1 == r && EINTR == errno) {
+			continue;
+		} else {
+			break;
+		}
+	}
+#endif
+
+	if (0 == left) return true;
+
+	if (s.data) return writeAll(fd, filename, s.data + (offset - s.offset), left);
+
+	char chunk[64*1024];
+	while (left > 0) {
+		ssize_t r = ::pread(s.fd, chunk, std::min(left, sizeof(chunk)), offset);
+		if (-1 == r) {
+			int e = errno;
+			if (EINTR == e) continue;
+			std::cerr << "Cannot read source for '" << filename << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		if (0 == r) {
+			std::cerr << "Cannot read source for '" << filename << "': file was truncated" << std::endl;
+			return false;
+		}
+		if (!writeAll(fd, filename, chunk, r)) return false;
+		offset += r;
+		left -= r;
+	}
+	return true;
+}
+
+bool OutputSegments::writeTo(int fd, const std::string &filename) {
+	size_t i = 0, n = m_segments.size();
+	while (i < n) {
+		if (-1 == m_segments[i].fd) {
+			size_t first = i;
+			while (i < n && -1 == m_segments[i].fd) i++;
+			if (!writeMemory(fd, filename, first, i)) return false;
+		} else {
+			if (!copyRange(fd, filename, m_segments[i])) return false;
+			i++;
+		}
+	}
+	return true;
+}
+
+}
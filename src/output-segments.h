@@ -0,0 +1,85 @@
+#ifndef __TORRENT_SANITIZE_OUTPUT_SEGMENTS_H
+#define __TORRENT_SANITIZE_OUTPUT_SEGMENTS_H
+
+#include "config.h"
+#include "buffer.h"
+
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace torrent {
+
+/* collects output as list of segments: everything written through the
+ * streambuf interface is kept in memory, unchanged ranges of a loaded file
+ * are only remembered (Buffer::copyTo detects an OutputSegments stream buffer).
+ * writeTo() copies those ranges in the kernel (copy_file_range, sendfile) and
+ * falls back to writev with the loaded data.
+ *
+ * also an output for the bencode() templates (bencode-writer.h).
+ *
+ * usage:
+ *   OutputSegments out;
+ *   t.serialize(out); (or: { std::ostream os(&out); t.write(os); })
+ *   out.writeTo(fd, filename);
+ */
+class OutputSegments : public std::streambuf {
+private:
+	OutputSegments(const OutputSegments &o);
+	OutputSegments& operator=(const OutputSegments &o);
+
+public:
+	OutputSegments();
+	~OutputSegments();
+
+	/* remember range [offset, offset+length) of the file loaded in buffer;
+	 * the buffer must stay alive until writeTo() */
+	bool appendRange(const Buffer &buffer, size_t offset, size_t length);
+
+	/* bencode() output interface */
+	void raw(const char *data, size_t len);
+	void range(const Buffer &buffer, BufferString r) { if (!appendRange(buffer, r.data() - buffer.data(), r.length())) m_failed = true; }
+
+	/* a range passed to range() could not be added */
+	bool failed() const { return m_failed; }
+
+	/* preallocate memory for len bytes written with raw() */
+	void reserve(size_t len) { m_mem.reserve(len); }
+
+	/* number of bytes writeTo() will write */
+	size_t size() const { return m_size; }
+
+	/* write everything to fd (at its current position); filename is used for error messages */
+	bool writeTo(int fd, const std::string &filename);
+
+	void clear();
+
+protected:
+	virtual int_type overflow(int_type c);
+	virtual std::streamsize xsputn(const char *s, std::streamsize n);
+
+private:
+	struct Segment {
+		int fd; /* source file, -1 for memory segments */
+		const char *data; /* loaded data (if available); 0 and fd == -1: m_mem at offset */
+		size_t offset, length;
+	};
+	struct Source {
+		const Buffer *buffer;
+		int fd;
+	};
+
+	int sourceFd(const Buffer &buffer);
+	bool writeMemory(int fd, const std::string &filename, size_t first, size_t last);
+	bool copyRange(int fd, const std::string &filename, const Segment &s);
+
+	std::string m_mem;
+	std::vector<Segment> m_segments;
+	std::vector<Source> m_sources;
+	size_t m_size;
+	bool m_failed;
+};
+
+}
+
+#endif
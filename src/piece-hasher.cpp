@@ -0,0 +1,274 @@
+#include "piece-hasher.h"
+
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+}
+
+namespace torrent {
+
+struct PieceHasher::Chunk {
+	std::vector<char> data;
+	int64_t offset;
+	size_t length;
+	size_t pending; /* pieces queued but not hashed yet */
+};
+
+struct PieceHasher::Pool {
+	struct Task {
+		Chunk *chunk;
+		size_t piece;
+	};
+
+	PieceHasher *hasher;
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* tasks queued or stop */
+	pthread_cond_t done; /* a chunk became free */
+	std::deque<Task> tasks;
+	std::vector<Chunk*> free;
+	bool stop;
+};
+
+static double now() {
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+PieceHasher::PieceHasher(const std::vector<File> &files, int64_t piece_length, unsigned int threads)
+: m_files(files), m_piece_length(piece_length), m_total(0), m_threads(threads), m_cur_file((size_t) -1), m_cur_fd(-1), m_cur_size(0), m_bytes_read(0), m_seconds(0) {
+	for (size_t i = 0; i < m_files.size(); i++) {
+		m_offsets.push_back(m_total);
+		m_total += m_files[i].length;
+	}
+	if (0 == m_threads) {
+		long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+		m_threads = cpus > 0 ? cpus : 1;
+	}
+
+	size_t pieces;
+	if (!countPieces(m_files, m_piece_length, pieces)) pieces = 0; /* nothing to hash */
+	m_digests.resize(pieces * DIGEST_LENGTH);
+	m_hashed.resize(pieces, 0);
+	m_bad.resize(pieces, 0);
+	m_found.resize(m_files.size(), 0);
+}
+
+bool PieceHasher::countPieces(const std::vector<File> &files, int64_t piece_length, size_t &pieces) {
+	pieces = 0;
+	if (piece_length <= 0 || piece_length > MAX_PIECE_LENGTH) return false;
+	int64_t total = 0;
+	for (size_t i = 0; i < files.size(); i++) {
+		if (files[i].length < 0 || files[i].length > std::numeric_limits<int64_t>::max() - total) return false;
+		total += files[i].length;
+	}
+	const uint64_t count = (uint64_t) total / piece_length + (0 != total % piece_length ? 1 : 0);
+	if (count > std::numeric_limits<size_t>::max() / DIGEST_LENGTH) return false;
+	pieces = count;
+	return true;
+}
+
+PieceHasher::~PieceHasher() {
+	closeFile();
+}
+
+void PieceHasher::filePieces(size_t ndx, size_t &first, size_t &end) const {
+	if (m_hashed.empty()) {
+		first = end = 0;
+		return;
+	}
+	first = m_offsets[ndx] / m_piece_length;
+	end = (0 == m_files[ndx].length) ? first : (m_offsets[ndx] + m_files[ndx].length - 1) / m_piece_length + 1;
+}
+
+void PieceHasher::closeFile() {
+	if (-1 != m_cur_fd) ::close(m_cur_fd);
+	m_cur_fd = -1;
+	m_cur_file = (size_t) -1;
+}
+
+void PieceHasher::markBad(int64_t offset, int64_t len) {
+	if (len <= 0) return;
+	size_t last = (offset + len - 1) / m_piece_length;
+	for (size_t p = offset / m_piece_length; p <= last; p++) m_bad[p] = 1;
+}
+
+/* read [offset, offset+len) of file ndx; returns the number of bytes read */
+size_t PieceHasher::readFile(size_t ndx, int64_t offset, char *data, size_t len) {
+	if (ndx != m_cur_file) {
+		closeFile();
+		m_cur_file = ndx;
+		const std::string &path = m_files[ndx].path;
+		m_cur_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (-1 == m_cur_fd) {
+			if (ENOENT != errno) std::cerr << "Cannot open file '" << path << "': " << ::strerror(errno) << std::endl;
+			return 0;
+		}
+		struct stat st;
+		if (-1 == ::fstat(m_cur_fd, &st) || !S_ISREG(st.st_mode)) {
+			::close(m_cur_fd);
+			m_cur_fd = -1;
+			return 0;
+		}
+		m_cur_size = st.st_size;
+		m_found[ndx] = (st.st_size == m_files[ndx].length);
+		::posix_fadvise(m_cur_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	if (-1 == m_cur_fd) return 0;
+
+	size_t avail = (offset >= m_cur_size) ? 0 : std::min<int64_t>(len, m_cur_size - offset);
+	size_t have = 0;
+	while (have < avail) {
+		ssize_t r = ::pread(m_cur_fd, data + have, avail - have, offset + have);
+		if (-1 == r) {
+			if (EINTR == errno) continue;
+			std::cerr << "Cannot read file '" << m_files[ndx].path << "': " << ::strerror(errno) << std::endl;
+			break;
+		}
+		if (0 == r) break;
+		have += r;
+	}
+	m_bytes_read += have;
+	return have;
+}
+
+void PieceHasher::readChunk(Chunk &chunk) {
+	/* first file with data in the chunk */
+	size_t f = std::upper_bound(m_offsets.begin(), m_offsets.end(), chunk.offset) - m_offsets.begin() - 1;
+	int64_t pos = chunk.offset, end = chunk.offset + chunk.length;
+	for (; f < m_files.size() && pos < end; f++) {
+		int64_t file_end = m_offsets[f] + m_files[f].length;
+		if (file_end <= pos) continue;
+		size_t len = std::min(end, file_end) - pos;
+		size_t have = readFile(f, pos - m_offsets[f], &chunk.data[pos - chunk.offset], len);
+		markBad(pos + have, len - have);
+		pos += len;
+	}
+}
+
+void* PieceHasher::worker(void *arg) {
+	Pool &pool = *(Pool*) arg;
+	PieceHasher &h = *pool.hasher;
+	EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+
+	for (;;) {
+		::pthread_mutex_lock(&pool.lock);
+		while (pool.tasks.empty() && !pool.stop) ::pthread_cond_wait(&pool.work, &pool.lock);
+		if (pool.tasks.empty()) {
+			::pthread_mutex_unlock(&pool.lock);
+			break;
+		}
+		Pool::Task task = pool.tasks.front();
+		pool.tasks.pop_front();
+		::pthread_mutex_unlock(&pool.lock);
+
+		int64_t start = (int64_t) task.piece * h.m_piece_length;
+		size_t len = std::min(h.m_piece_length, h.m_total - start);
+		::EVP_DigestInit_ex(ctx, EVP_sha1(), NULL);
+		::EVP_DigestUpdate(ctx, &task.chunk->data[start - task.chunk->offset], len);
+		::EVP_DigestFinal_ex(ctx, &h.m_digests[task.piece * DIGEST_LENGTH], NULL);
+		h.m_hashed[task.piece] = 1;
+
+		::pthread_mutex_lock(&pool.lock);
+		if (0 == --task.chunk->pending) {
+			pool.free.push_back(task.chunk);
+			::pthread_cond_signal(&pool.done);
+		}
+		::pthread_mutex_unlock(&pool.lock);
+	}
+
+	EVP_MD_CTX_destroy(ctx);
+	return 0;
+}
+
+bool PieceHasher::run() {
+	double start = now();
+	if (m_piece_length <= 0) return true;
+
+	/* empty files are never read, only check they exist */
+	for (size_t i = 0; i < m_files.size(); i++) {
+		struct stat st;
+		if (0 == m_files[i].length) m_found[i] = (0 == ::stat(m_files[i].path.c_str(), &st) && S_ISREG(st.st_mode) && 0 == st.st_size);
+	}
+
+	size_t chunk_pieces = std::max<int64_t>(1, PIECE_READ_CHUNK / m_piece_length);
+	/* one chunk for each thread, one being read and one spare; fewer for huge pieces */
+	size_t nchunks = std::max<int64_t>(2, std::min<int64_t>(m_threads + 2, PIECE_READ_MEMORY / (chunk_pieces * m_piece_length)));
+	std::vector<Chunk> chunks(nchunks);
+
+	Pool pool;
+	pool.hasher = this;
+	pool.stop = false;
+	::pthread_mutex_init(&pool.lock, NULL);
+	::pthread_cond_init(&pool.work, NULL);
+	::pthread_cond_init(&pool.done, NULL);
+	for (size_t i = 0; i < nchunks; i++) pool.free.push_back(&chunks[i]);
+
+	std::vector<pthread_t> workers;
+	bool ok = true;
+	for (unsigned int i = 0; i < m_threads; i++) {
+		pthread_t t;
+		int e = ::pthread_create(&t, NULL, worker, &pool);
+		if (0 != e) {
+			std::cerr << "Cannot start hash thread: " << ::strerror(e) << std::endl;
+			ok = false;
+			break;
+		}
+		workers.push_back(t);
+	}
+
+	for (size_t piece = 0; ok && piece < m_hashed.size(); piece += chunk_pieces) {
+		::pthread_mutex_lock(&pool.lock);
+		while (pool.free.empty()) ::pthread_cond_wait(&pool.done, &pool.lock);
+		Chunk *chunk = pool.free.back();
+		pool.free.pop_back();
+		::pthread_mutex_unlock(&pool.lock);
+
+		size_t npieces = std::min(chunk_pieces, m_hashed.size() - piece);
+		chunk->offset = (int64_t) piece * m_piece_length;
+		chunk->length = std::min<int64_t>(npieces * m_piece_length, m_total - chunk->offset);
+		if (chunk->data.size() < chunk->length) chunk->data.resize(chunk->length);
+		readChunk(*chunk);
+
+		::pthread_mutex_lock(&pool.lock);
+		chunk->pending = 0;
+		for (size_t p = piece; p < piece + npieces; p++) {
+			if (m_bad[p]) continue;
+			Pool::Task task = { chunk, p };
+			pool.tasks.push_back(task);
+			chunk->pending++;
+		}
+		if (0 == chunk->pending) pool.free.push_back(chunk);
+		::pthread_cond_broadcast(&pool.work);
+		::pthread_mutex_unlock(&pool.lock);
+	}
+	closeFile();
+
+	::pthread_mutex_lock(&pool.lock);
+	while (pool.free.size() < nchunks && !workers.empty()) ::pthread_cond_wait(&pool.done, &pool.lock);
+	pool.stop = true;
+	::pthread_cond_broadcast(&pool.work);
+	::pthread_mutex_unlock(&pool.lock);
+	for (size_t i = 0; i < workers.size(); i++) ::pthread_join(workers[i], NULL);
+
+	::pthread_cond_destroy(&pool.done);
+	::pthread_cond_destroy(&pool.work);
+	::pthread_mutex_destroy(&pool.lock);
+
+	m_seconds = now() - start;
+	return ok;
+}
+
+}
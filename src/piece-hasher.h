@@ -0,0 +1,102 @@
+#ifndef __TORRENT_SANITIZE_PIECE_HASHER_H
+#define __TORRENT_SANITIZE_PIECE_HASHER_H
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <stdint.h>
+#include <sys/types.h>
+}
+
+namespace torrent {
+
+/* sha1 of every piece of the payload of a torrent: the files are read in
+ * order as one stream (pieces span file boundaries), in large sequential
+ * reads of PIECE_READ_CHUNK bytes. the main thread reads, a pool of threads
+ * hashes the pieces of the chunks already read.
+ *
+ * missing files and files shorter than expected don't stop the run: pieces
+ * overlapping data that couldn't be read just get no digest.
+ *
+ * usage:
+ *   PieceHasher hasher(files, piece_length, threads);
+ *   hasher.run();
+ *   hasher.hashed(i), hasher.digest(i), ...
+ */
+class PieceHasher {
+private:
+	PieceHasher(const PieceHasher &o);
+	PieceHasher& operator=(const PieceHasher &o);
+
+public:
+	static const size_t DIGEST_LENGTH = 20;
+	/* a chunk holds at least one piece, and there are at least two chunks */
+	static const int64_t MAX_PIECE_LENGTH = PIECE_READ_MEMORY / 2;
+
+	struct File {
+		std::string path;
+		int64_t length;
+	};
+
+	/* number of pieces for the files; false if a length isn't valid (piece
+	 * length <= 0 or > MAX_PIECE_LENGTH, negative file lengths, total
+	 * overflows). check before trusting lengths from a torrent */
+	static bool countPieces(const std::vector<File> &files, int64_t piece_length, size_t &pieces);
+
+	/* threads: 0 for one per cpu */
+	PieceHasher(const std::vector<File> &files, int64_t piece_length, unsigned int threads = 0);
+	~PieceHasher();
+
+	/* false if the threads couldn't be started (error was printed) */
+	bool run();
+
+	size_t pieceCount() const { return m_hashed.size(); }
+	int64_t totalLength() const { return m_total; }
+
+	/* false if the piece wasn't read completely */
+	bool hashed(size_t piece) const { return 0 != m_hashed[piece]; }
+	const unsigned char* digest(size_t piece) const { return &m_digests[piece * DIGEST_LENGTH]; }
+
+	/* pieces [first, end) containing data of file ndx (empty for empty files) */
+	void filePieces(size_t ndx, size_t &first, size_t &end) const;
+	/* file exists with the expected length */
+	bool fileFound(size_t ndx) const { return 0 != m_found[ndx]; }
+
+	unsigned int threads() const { return m_threads; }
+	int64_t bytesRead() const { return m_bytes_read; }
+	double seconds() const { return m_seconds; }
+
+private:
+	struct Chunk;
+	struct Pool;
+
+	void readChunk(Chunk &chunk);
+	size_t readFile(size_t ndx, int64_t offset, char *data, size_t len);
+	void markBad(int64_t offset, int64_t len);
+	void closeFile();
+
+	static void* worker(void *arg);
+
+	std::vector<File> m_files;
+	std::vector<int64_t> m_offsets; /* start of each file in the stream */
+	int64_t m_piece_length, m_total;
+	unsigned int m_threads;
+
+	std::vector<unsigned char> m_digests;
+	std::vector<char> m_hashed, m_bad, m_found;
+
+	/* file currently open for reading */
+	size_t m_cur_file;
+	int m_cur_fd;
+	int64_t m_cur_size;
+
+	int64_t m_bytes_read;
+	double m_seconds;
+};
+
+}
+
+#endif
@@ -0,0 +1,260 @@
+#include "sanitize-jobs.h"
+#include "sanitize-settings.h"
+#include "announce-list.h"
+#include "torrent.h"
+
+#include <iostream>
+#include <sstream>
+#include <map>
+
+extern "C" {
+#include <sys/types.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+}
+
+namespace torrent {
+
+/* the torrent goes to output, or into data if output is empty */
+template<typename T> static bool finish(T &t, const std::string &output, std::string &hash, std::string &error, std::string *data) {
+	hash = t.infohash();
+	if (output.empty()) {
+		if (0 != data) {
+			std::ostringstream out;
+			t.write(out);
+			if (!out) {
+				error = "Cannot read source data of '" + t.filename() + "'";
+				return false;
+			}
+			*data = out.str();
+		}
+	} else if (!writeAtomicFile(output, t)) {
+		error = "Cannot write '" + output + "'";
+		return false;
+	}
+	return true;
+}
+
+bool hashTorrent(const std::string &file, std::string &hash, std::string &error) {
+	TorrentAnnounceInfo t;
+	if (!t.load(file)) {
+		error = t.filename() + ": " + t.lasterror();
+		return false;
+	}
+	hash = t.infohash();
+	return true;
+}
+
+bool sanitizeTorrent(const TorrentSanitize &san, const std::string &input, const std::string &output, std::string &hash, std::string &error, std::string *data) {
+	Torrent t(san);
+	if (!t.load(input)) {
+		error = t.filename() + ": " + t.lasterror();
+		return false;
+	}
+	t.sanitize_announce_urls(san);
+	return finish(t, output, hash, error, data);
+}
+
+/* like torrent-merge */
+bool mergeTorrents(const TorrentSanitize &san, const std::string &dest, const std::vector<std::string> &sources, const std::string &output, std::string &hash, std::string &error, std::string *data) {
+	TorrentAnnounceInfo t;
+	if (!t.load(dest)) {
+		error = t.filename() + ": " + t.lasterror();
+		return false;
+	}
+
+	AnnounceList list(san);
+	list.force_merge(san.filters().additional_announce_urls);
+	list.merge(t);
+
+	for (size_t i = 0; i < sources.size(); i++) {
+		TorrentAnnounce source;
+		if (!source.load(sources[i])) {
+			error = source.filename() + ": " + source.lasterror();
+			return false;
+		}
+		list.merge(source);
+	}
+
+	if (list.empty()) {
+		std::string upper = t.infohash();
+		for (size_t i = 0; i < upper.length(); i++) upper[i] = ::toupper(upper[i]);
+		t.t_announce = std::string("dht://") + upper;
+		t.t_announce_list.clear();
+	} else {
+		list.copyTo(t.t_announce_list);
+		t.t_announce = t.t_announce_list[0][0];
+	}
+
+	return finish(t, output, hash, error, data);
+}
+
+bool BatchJobs::load(const std::string &filename, const std::string &default_mode) {
+	const bool use_stdin = ("-" == filename);
+	int fd = use_stdin ? 0 : ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (-1 == fd) {
+		int e = errno;
+		std::cerr << "Cannot open job list '" << filename << "': " << ::strerror(e) << std::endl;
+		return false;
+	}
+
+	std::string content;
+	char buf[16*1024];
+	ssize_t r;
+	while (0 != (r = ::read(fd, buf, sizeof(buf)))) {
+		if (-1 == r) {
+			if (EINTR == errno) continue;
+			int e = errno;
+			std::cerr << "Cannot read job list '" << filename << "': " << ::strerror(e) << std::endl;
+			if (!use_stdin) ::close(fd);
+			return false;
+		}
+		content.append(buf, r);
+	}
+	if (!use_stdin) ::close(fd);
+
+	/* the last field may miss its '\0' */
+	std::vector<std::string> fields;
+	for (size_t pos = 0; pos < content.length(); ) {
+		size_t end = content.find('\0', pos);
+		if (std::string::npos == end) end = content.length();
+		fields.push_back(content.substr(pos, end - pos));
+		pos = end + 1;
+	}
+	if (0 != fields.size() % 3) {
+		std::cerr << "Job list '" << filename << "': expected input, output and mode for every job" << std::endl;
+		return false;
+	}
+
+	m_jobs.clear();
+	for (size_t i = 0; i < fields.size(); i += 3) {
+		Job job;
+		job.input = fields[i];
+		job.output = fields[i+1];
+		job.mode = fields[i+2].empty() ? default_mode : fields[i+2];
+		if ("hash" != job.mode && "sanitize" != job.mode && "merge" != job.mode) {
+			std::cerr << "Job list '" << filename << "': job " << m_jobs.size() << " has unknown mode '" << job.mode << "'" << std::endl;
+			return false;
+		}
+		if (("hash" == job.mode || "sanitize" == job.mode) && job.input.empty()) {
+			std::cerr << "Job list '" << filename << "': job " << m_jobs.size() << " has no input" << std::endl;
+			return false;
+		}
+		if ("merge" == job.mode && job.output.empty()) {
+			std::cerr << "Job list '" << filename << "': job " << m_jobs.size() << " has no output to merge into" << std::endl;
+			return false;
+		}
+		m_jobs.push_back(job);
+	}
+	return true;
+}
+
+namespace {
+struct BatchRun {
+	const BatchJobs *jobs;
+	const TorrentSanitize *san;
+	std::vector< std::vector<size_t> > tasks; /* jobs done together */
+
+	pthread_mutex_t lock;
+	size_t next_task; /* first task not started */
+	size_t failed;
+	std::ostream *status;
+};
+}
+
+static void runTask(BatchRun &run, const std::vector<size_t> &task) {
+	const BatchJobs::Job &first = run.jobs->job(task[0]);
+	std::string hash, error;
+	bool ok;
+	if ("hash" == first.mode) {
+		ok = hashTorrent(first.input, hash, error);
+	} else if ("sanitize" == first.mode) {
+		ok = sanitizeTorrent(*run.san, first.input, first.output, hash, error);
+	} else {
+		std::vector<std::string> sources;
+		for (size_t i = 0; i < task.size(); i++) {
+			const std::string &input = run.jobs->job(task[i]).input;
+			if (!input.empty()) sources.push_back(input);
+		}
+		ok = mergeTorrents(*run.san, first.output, sources, first.output, hash, error);
+	}
+
+	/* one line per job */
+	for (size_t i = 0; i < error.length(); i++) {
+		if ('\n' == error[i] || '\r' == error[i]) error[i] = ' ';
+	}
+	std::ostringstream lines;
+	for (size_t i = 0; i < task.size(); i++) {
+		lines << task[i] << (ok ? " ok " : " error ") << (ok ? hash : error) << "\n";
+	}
+
+	::pthread_mutex_lock(&run.lock);
+	if (!ok) run.failed += task.size();
+	*run.status << lines.str() << std::flush;
+	::pthread_mutex_unlock(&run.lock);
+}
+
+static void* batchWorker(void *arg) {
+	BatchRun &run = *(BatchRun*) arg;
+	for (;;) {
+		::pthread_mutex_lock(&run.lock);
+		const size_t t = run.next_task;
+		if (t < run.tasks.size()) run.next_task++;
+		::pthread_mutex_unlock(&run.lock);
+		if (t >= run.tasks.size()) break;
+
+		runTask(run, run.tasks[t]);
+	}
+	return 0;
+}
+
+size_t BatchJobs::run(const TorrentSanitize &san, unsigned int threads, std::ostream &status) const {
+	BatchRun run;
+	run.jobs = this;
+	run.san = &san;
+	run.next_task = 0;
+	run.failed = 0;
+	run.status = &status;
+
+	/* merge jobs are grouped by output, in the position of the first one */
+	std::map<std::string, size_t> merges;
+	for (size_t i = 0; i < m_jobs.size(); i++) {
+		if ("merge" == m_jobs[i].mode) {
+			std::map<std::string, size_t>::iterator it = merges.find(m_jobs[i].output);
+			if (merges.end() != it) {
+				run.tasks[it->second].push_back(i);
+				continue;
+			}
+			merges.insert(std::make_pair(m_jobs[i].output, run.tasks.size()));
+		}
+		run.tasks.push_back(std::vector<size_t>(1, i));
+	}
+
+	if (0 == threads) {
+		long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+	if (threads > run.tasks.size()) threads = run.tasks.size();
+
+	::pthread_mutex_init(&run.lock, NULL);
+	std::vector<pthread_t> workers;
+	for (unsigned int i = 1; i < threads; i++) {
+		pthread_t t;
+		int e = ::pthread_create(&t, NULL, batchWorker, &run);
+		if (0 != e) {
+			std::cerr << "Cannot start worker thread: " << ::strerror(e) << std::endl;
+			break;
+		}
+		workers.push_back(t);
+	}
+	batchWorker(&run); /* the calling thread works too */
+	for (size_t i = 0; i < workers.size(); i++) ::pthread_join(workers[i], NULL);
+	::pthread_mutex_destroy(&run.lock);
+
+	return run.failed;
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef __TORRENT_SANITIZE_SANITIZE_JOBS_H
+#define __TORRENT_SANITIZE_SANITIZE_JOBS_H
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace torrent {
+
+class TorrentSanitize;
+
+/* the work of torrent-sanitize -h / -s and torrent-merge on one torrent,
+ * shared by torrent-sanitized and the batch modes. all return the info hash,
+ * or false with a message in error. the result goes to output (written
+ * atomically); with an empty output it is stored in data (if not 0).
+ */
+bool hashTorrent(const std::string &file, std::string &hash, std::string &error);
+bool sanitizeTorrent(const TorrentSanitize &san, const std::string &input, const std::string &output, std::string &hash, std::string &error, std::string *data = 0);
+/* announce urls of dest and sources, through the url filter */
+bool mergeTorrents(const TorrentSanitize &san, const std::string &dest, const std::vector<std::string> &sources, const std::string &output, std::string &hash, std::string &error, std::string *data = 0);
+
+/* a list of jobs, run on a pool of threads sharing one TorrentSanitize.
+ *
+ * the list is NUL delimited: input '\0' output '\0' mode '\0' per job;
+ * modes are "hash" (output unused), "sanitize" (no output: only check) and
+ * "merge" (input into the torrent output, which is rewritten; an empty
+ * input only runs the url filter on output). an empty mode is the default
+ * mode of the tool. all merge jobs for one output are done together, in one
+ * thread; other jobs run in any order, so they must not write files another
+ * job uses.
+ *
+ * one status line per job (completion order), job numbers from 0:
+ *   "<job> ok <info hash>" or "<job> error <message>"
+ */
+class BatchJobs {
+public:
+	struct Job {
+		std::string input, output, mode;
+	};
+
+	/* filename "-": stdin; false on errors (printed) */
+	bool load(const std::string &filename, const std::string &default_mode);
+
+	size_t size() const { return m_jobs.size(); }
+	const Job& job(size_t ndx) const { return m_jobs[ndx]; }
+
+	/* threads: 0 for one per cpu. returns the number of failed jobs */
+	size_t run(const TorrentSanitize &san, unsigned int threads, std::ostream &status) const;
+
+private:
+	std::vector<Job> m_jobs;
+};
+
+}
+
+#endif
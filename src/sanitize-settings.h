@@ -2,57 +2,33 @@
 #define __TORRENT_SANITIZE_SANITIZE_SETTINGS_H
 
 #include "buffer.h"
-#include "torrent-ostream.h"
-#include "torrent-pcre.h"
+#include "bencode-writer.h"
+#include "filter-set.h"
 
 #include <vector>
 #include <map>
-
-#include <pcrecpp.h>
+#include <sstream>
 
 namespace torrent {
 
 typedef std::map<std::string, std::string> TorrentRawParts;
 
-class AnnounceUrl {
-public:
-	std::string url;
-	std::string domain; /* domain + tld, like "example.com" for "udp://tracker.example.com/". full address for ipv4/ipv6 */
-
-
-	bool operator <(const AnnounceUrl &other) const {
-		return (url < other.url);
-		// if the urls are equal, the domains are too
-	}
-
-	bool operator ==(const AnnounceUrl &other) const {
-		return url == other.url;
-	}
-};
-
-class TorrentSanitize {
-public:
-	TorrentSanitize();
-	bool validMetaKey(BufferString key) const;
-
-	bool validMetaTextKey(BufferString key) const;
-	bool validMetaNumKey(BufferString key) const;
-	bool validMetaOtherKey(BufferString key) const;
-
-	bool basicUrlCleaner(const std::string &url, AnnounceUrl &annurl) const;
-	std::vector<AnnounceUrl> filterUrl(const std::string &url) const;
-
-	bool loadUrlConfig(const std::string &configpath);
+/* what to do with one torrent; cheap to copy, set per job */
+struct SanitizeOptions {
+	SanitizeOptions() : debug(false), show_paths(false), check_info_utf8(false) { }
 
 	template<typename Value> void add_new_meta_entry(const std::string &key, const Value &value) {
 		std::ostringstream raw;
-		TorrentOStream(raw) << key << value;
+		BencodeOStream out(raw);
+		bencode(out, key);
+		bencode(out, value);
 		new_meta_entries.insert(std::make_pair(key, raw.str()));
 	}
 
 	void add_new_raw_meta_entry(const std::string &key, const std::string &value) {
 		std::ostringstream raw;
-		TorrentOStream(raw) << key;
+		BencodeOStream out(raw);
+		bencode(out, key);
 		raw << value;
 		new_meta_entries.insert(std::make_pair(key, raw.str()));
 	}
@@ -60,17 +36,42 @@ public:
 	TorrentRawParts new_meta_entries;
 
 	bool debug;
-	bool show_paths; /* build paths for file entries, joined with '/', show them later */
+	bool show_paths; /* print_details shows the paths of file entries, joined with '/' */
 	bool check_info_utf8; /* as we can't modify the info part, optionally disable struct utf-8 checks */
+};
+
+/* the options and the compiled filters. copies share the filters (see
+ * FilterSetRef): loading filters into a copy doesn't change the others. a
+ * const TorrentSanitize can be used from several threads.
+ */
+class TorrentSanitize : public SanitizeOptions {
+public:
+	const FilterSet& filters() const { return *m_filters; }
+	FilterSet& editFilters() { return m_filters.edit(); }
+
+	bool validMetaKey(BufferString key) const;
+
+	/* id: keyId(key), saves the pcre match for well-known keys */
+	bool validMetaTextKey(BufferString key, KeyId id = KEY_UNKNOWN) const { return m_filters->validMetaTextKey(key, id); }
+	bool validMetaNumKey(BufferString key, KeyId id = KEY_UNKNOWN) const { return m_filters->validMetaNumKey(key, id); }
+	bool validMetaOtherKey(BufferString key, KeyId id = KEY_UNKNOWN) const { return m_filters->validMetaOtherKey(key, id); }
+
+	bool loadMetaTextFilter(const std::string &pattern) { return editFilters().filter_meta_text.load(pattern); }
+	bool loadMetaNumFilter(const std::string &pattern) { return editFilters().filter_meta_num.load(pattern); }
+	bool loadMetaOtherFilter(const std::string &pattern) { return editFilters().filter_meta_other.load(pattern); }
 
-	PCRE filter_meta_text, filter_meta_num, filter_meta_other;
+	bool basicUrlCleaner(const std::string &url, AnnounceUrl &annurl) const { return m_filters->basicUrlCleaner(url, annurl); }
+	std::vector<AnnounceUrl> filterUrl(const std::string &url) const { return m_filters->filterUrl(url); }
 
-	PCRE filter_url_whitelist, filter_url_blacklist;
-	std::vector<PCRE_Replace> filter_url_replace;
-	std::vector< std::string > additional_announce_urls;
+	/* see FilterSet */
+	bool loadUrlConfig(const std::string &configpath) { return editFilters().loadUrlConfig(configpath); }
+	bool urlConfigCompiled() const { return m_filters->urlConfigCompiled(); }
+	void setUrlCacheEntries(size_t entries) { editFilters().setUrlCacheEntries(entries); }
+	bool openUrlCache(const std::string &filename) { return editFilters().openUrlCache(filename); }
+	const UrlCache& urlCache() const { return m_filters->urlCache(); }
 
 private:
-	std::vector< std::string > m_alloced_strings;
+	FilterSetRef m_filters;
 };
 
 }
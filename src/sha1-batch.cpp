@@ -0,0 +1,373 @@
+#include "common.h"
+
+#include <algorithm>
+
+extern "C" {
+#include <stdint.h>
+#include <string.h>
+#include <openssl/evp.h>
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# define HAVE_SHA1_SIMD 1
+extern "C" {
+#include <immintrin.h>
+#include <cpuid.h>
+}
+#endif
+
+namespace torrent {
+
+static const uint32_t sha1Init[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+static const uint32_t sha1K[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+
+static inline uint32_t loadBE32(const unsigned char *p) {
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline void storeBE32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+/* the multi-buffer kernels process one 64 byte block per lane: state is
+ * [5][lanes] (a..e), block is [16][lanes] (message words, already big
+ * endian decoded) */
+
+#ifdef HAVE_SHA1_SIMD
+
+/* one round for vector type V; F computes f(b,c,d) */
+#define SHA1_ROUND(ROL, ADD, F, k, wt) do { \
+		V tmp = ADD(ADD(ROL(a, 5), F), ADD(ADD(e, k), wt)); \
+		e = d; d = c; c = ROL(b, 30); b = a; a = tmp; \
+	} while (0)
+
+__attribute__((target("sse2")))
+static void sha1x4SSE2(uint32_t *state, const uint32_t *block) {
+	typedef __m128i V;
+#define ROL(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+#define ADD(x, y) _mm_add_epi32(x, y)
+#define XOR(x, y) _mm_xor_si128(x, y)
+#define AND(x, y) _mm_and_si128(x, y)
+#define OR(x, y) _mm_or_si128(x, y)
+	V a = _mm_loadu_si128((const V*) (state + 0)), b = _mm_loadu_si128((const V*) (state + 4));
+	V c = _mm_loadu_si128((const V*) (state + 8)), d = _mm_loadu_si128((const V*) (state + 12));
+	V e = _mm_loadu_si128((const V*) (state + 16));
+	const V a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+	V w[16];
+	for (int t = 0; t < 16; t++) w[t] = _mm_loadu_si128((const V*) (block + 4*t));
+#define W(t) ((t) < 16 ? w[t] : (w[(t) & 15] = ROL(XOR(XOR(w[((t) - 3) & 15], w[((t) - 8) & 15]), XOR(w[((t) - 14) & 15], w[(t) & 15])), 1)))
+	V k = _mm_set1_epi32(sha1K[0]);
+	for (int t = 0; t < 20; t++) SHA1_ROUND(ROL, ADD, XOR(d, AND(b, XOR(c, d))), k, W(t));
+	k = _mm_set1_epi32(sha1K[1]);
+	for (int t = 20; t < 40; t++) SHA1_ROUND(ROL, ADD, XOR(XOR(b, c), d), k, W(t));
+	k = _mm_set1_epi32(sha1K[2]);
+	for (int t = 40; t < 60; t++) SHA1_ROUND(ROL, ADD, OR(AND(b, c), AND(d, OR(b, c))), k, W(t));
+	k = _mm_set1_epi32(sha1K[3]);
+	for (int t = 60; t < 80; t++) SHA1_ROUND(ROL, ADD, XOR(XOR(b, c), d), k, W(t));
+#undef W
+	_mm_storeu_si128((V*) (state + 0), ADD(a, a0));
+	_mm_storeu_si128((V*) (state + 4), ADD(b, b0));
+	_mm_storeu_si128((V*) (state + 8), ADD(c, c0));
+	_mm_storeu_si128((V*) (state + 12), ADD(d, d0));
+	_mm_storeu_si128((V*) (state + 16), ADD(e, e0));
+#undef ROL
+#undef ADD
+#undef XOR
+#undef AND
+#undef OR
+}
+
+__attribute__((target("avx2")))
+static void sha1x8AVX2(uint32_t *state, const uint32_t *block) {
+	typedef __m256i V;
+#define ROL(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+#define ADD(x, y) _mm256_add_epi32(x, y)
+#define XOR(x, y) _mm256_xor_si256(x, y)
+#define AND(x, y) _mm256_and_si256(x, y)
+#define OR(x, y) _mm256_or_si256(x, y)
+	V a = _mm256_loadu_si256((const V*) (state + 0)), b = _mm256_loadu_si256((const V*) (state + 8));
+	V c = _mm256_loadu_si256((const V*) (state + 16)), d = _mm256_loadu_si256((const V*) (state + 24));
+	V e = _mm256_loadu_si256((const V*) (state + 32));
+	const V a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+	V w[16];
+	for (int t = 0; t < 16; t++) w[t] = _mm256_loadu_si256((const V*) (block + 8*t));
+#define W(t) ((t) < 16 ? w[t] : (w[(t) & 15] = ROL(XOR(XOR(w[((t) - 3) & 15], w[((t) - 8) & 15]), XOR(w[((t) - 14) & 15], w[(t) & 15])), 1)))
+	V k = _mm256_set1_epi32(sha1K[0]);
+	for (int t = 0; t < 20; t++) SHA1_ROUND(ROL, ADD, XOR(d, AND(b, XOR(c, d))), k, W(t));
+	k = _mm256_set1_epi32(sha1K[1]);
+	for (int t = 20; t < 40; t++) SHA1_ROUND(ROL, ADD, XOR(XOR(b, c), d), k, W(t));
+	k = _mm256_set1_epi32(sha1K[2]);
+	for (int t = 40; t < 60; t++) SHA1_ROUND(ROL, ADD, OR(AND(b, c), AND(d, OR(b, c))), k, W(t));
+	k = _mm256_set1_epi32(sha1K[3]);
+	for (int t = 60; t < 80; t++) SHA1_ROUND(ROL, ADD, XOR(XOR(b, c), d), k, W(t));
+#undef W
+	_mm256_storeu_si256((V*) (state + 0), ADD(a, a0));
+	_mm256_storeu_si256((V*) (state + 8), ADD(b, b0));
+	_mm256_storeu_si256((V*) (state + 16), ADD(c, c0));
+	_mm256_storeu_si256((V*) (state + 24), ADD(d, d0));
+	_mm256_storeu_si256((V*) (state + 32), ADD(e, e0));
+	_mm256_zeroupper();
+#undef ROL
+#undef ADD
+#undef XOR
+#undef AND
+#undef OR
+}
+
+#undef SHA1_ROUND
+
+__attribute__((target("ssse3")))
+static void hexSSSE3(const unsigned char *data, size_t len, char *out) {
+	const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (data + i));
+		__m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+		__m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+		_mm_storeu_si128((__m128i*) (out + 2*i), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i*) (out + 2*i + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+	const char hexchar[] = "0123456789ABCDEF";
+	for (; i < len; i++) {
+		out[2*i] = hexchar[data[i] >> 4];
+		out[2*i+1] = hexchar[data[i] & 0xf];
+	}
+}
+
+#endif
+
+static void hexScalar(const unsigned char *data, size_t len, char *out) {
+	const char hexchar[] = "0123456789ABCDEF";
+	for (size_t i = 0; i < len; i++) {
+		out[2*i] = hexchar[data[i] >> 4];
+		out[2*i+1] = hexchar[data[i] & 0xf];
+	}
+}
+
+struct SHA1Kernel {
+	const char *name;
+	size_t lanes; /* 0: evp, one message after the other */
+	void (*blocks)(uint32_t *state, const uint32_t *block);
+	size_t evp_min; /* messages at least this long are hashed with evp */
+};
+
+static const size_t MAX_LANES = 8;
+static const size_t NEVER = (size_t) -1;
+
+static const SHA1Kernel kernels[] = {
+#ifdef HAVE_SHA1_SIMD
+	{ "avx2+sha", 8, sha1x8AVX2, SHA1_BATCH_EVP_MIN },
+	{ "avx2", 8, sha1x8AVX2, NEVER },
+	{ "sse2", 4, sha1x4SSE2, NEVER },
+#endif
+	{ "evp", 0, 0, 0 },
+};
+
+static bool cpuHasSHA() {
+#ifdef HAVE_SHA1_SIMD
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+	return 0 != (ebx & (1u << 29));
+#else
+	return false;
+#endif
+}
+
+static bool kernelSupported(const SHA1Kernel &k) {
+#ifdef HAVE_SHA1_SIMD
+	__builtin_cpu_init();
+	const std::string name(k.name);
+	if (name == "avx2+sha") return __builtin_cpu_supports("avx2") && cpuHasSHA();
+	if (name == "avx2") return __builtin_cpu_supports("avx2");
+	if (name == "sse2") return __builtin_cpu_supports("sse2");
+#endif
+	(void) k;
+	return true;
+}
+
+static const SHA1Kernel* bestKernel() {
+	for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (kernelSupported(kernels[i])) return &kernels[i];
+	}
+	return &kernels[sizeof(kernels)/sizeof(kernels[0]) - 1];
+}
+
+/* chosen on first use, not during static initialization; threads may both
+ * choose it (with the same result), so the pointer is accessed atomically */
+static const SHA1Kernel *s_kernel = 0;
+
+static inline const SHA1Kernel* kernel() {
+	const SHA1Kernel *k = __atomic_load_n(&s_kernel, __ATOMIC_RELAXED);
+	if (0 == k) {
+		k = bestKernel();
+		__atomic_store_n(&s_kernel, k, __ATOMIC_RELAXED);
+	}
+	return k;
+}
+
+bool setSHA1Kernel(const std::string &name) {
+	for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (name == kernels[i].name) {
+			if (!kernelSupported(kernels[i])) return false;
+			__atomic_store_n(&s_kernel, &kernels[i], __ATOMIC_RELAXED);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* sha1Kernel() {
+	return kernel()->name;
+}
+
+typedef void (*HexFunc)(const unsigned char *data, size_t len, char *out);
+/* like the kernel: chosen on first use, accessed atomically */
+static HexFunc s_hex = 0;
+
+void hexEncode(const unsigned char *data, size_t len, char *out) {
+	HexFunc hex = __atomic_load_n(&s_hex, __ATOMIC_RELAXED);
+	if (0 == hex) {
+		hex = hexScalar;
+#ifdef HAVE_SHA1_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("ssse3")) hex = hexSSSE3;
+#endif
+		__atomic_store_n(&s_hex, hex, __ATOMIC_RELAXED);
+	}
+	hex(data, len, out);
+}
+
+SHA1Batch::SHA1Batch() {
+}
+
+size_t SHA1Batch::add(const char *data, size_t len) {
+	Job job = { data, len };
+	m_jobs.push_back(job);
+	return m_jobs.size() - 1;
+}
+
+void SHA1Batch::clear() {
+	m_jobs.clear();
+	m_digests.clear();
+}
+
+std::string SHA1Batch::hex(size_t ndx) const {
+	std::string s(2*DIGEST_LENGTH, '.');
+	hexEncode(digest(ndx), DIGEST_LENGTH, &s[0]);
+	return s;
+}
+
+namespace {
+	/* message of a lane: the full blocks are read from the data, the
+	 * padding (and the partial last block) from tail */
+	struct Lane {
+		size_t job;
+		const unsigned char *data;
+		size_t full, tail_blocks, tail_pos;
+		unsigned char tail[128];
+
+		void start(size_t ndx, const char *d, size_t len) {
+			job = ndx;
+			data = (const unsigned char*) d;
+			full = len / 64;
+			size_t rest = len % 64;
+			tail_blocks = (rest + 9 <= 64) ? 1 : 2;
+			tail_pos = 0;
+			memset(tail, 0, sizeof(tail));
+			if (rest > 0) memcpy(tail, data + 64*full, rest);
+			tail[rest] = 0x80;
+			uint64_t bits = (uint64_t) len * 8;
+			unsigned char *end = tail + 64*tail_blocks;
+			storeBE32(end - 8, bits >> 32);
+			storeBE32(end - 4, bits);
+		}
+
+		bool done() const { return 0 == full && tail_pos == tail_blocks; }
+
+		const unsigned char* nextBlock() {
+			if (full > 0) {
+				const unsigned char *p = data;
+				data += 64;
+				full--;
+				return p;
+			}
+			return tail + 64*(tail_pos++);
+		}
+	};
+
+	struct LongerFirst {
+		const std::vector<size_t> &lengths;
+		LongerFirst(const std::vector<size_t> &lengths) : lengths(lengths) { }
+		bool operator()(size_t a, size_t b) const { return lengths[a] > lengths[b]; }
+	};
+}
+
+void SHA1Batch::run() {
+	m_digests.resize(m_jobs.size() * DIGEST_LENGTH);
+	const SHA1Kernel *k = kernel();
+
+	/* the lanes only get the messages shorter than evp_min */
+	std::vector<size_t> lengths(m_jobs.size()), order;
+	EVP_MD_CTX *ctx = 0;
+	for (size_t i = 0; i < m_jobs.size(); i++) {
+		lengths[i] = m_jobs[i].len;
+		if (m_jobs[i].len < k->evp_min) {
+			order.push_back(i);
+			continue;
+		}
+		if (!ctx) ctx = EVP_MD_CTX_create();
+		::EVP_DigestInit_ex(ctx, EVP_sha1(), NULL);
+		::EVP_DigestUpdate(ctx, m_jobs[i].data, m_jobs[i].len);
+		::EVP_DigestFinal_ex(ctx, &m_digests[i * DIGEST_LENGTH], NULL);
+	}
+	if (ctx) EVP_MD_CTX_destroy(ctx);
+	if (order.empty()) return;
+
+	const size_t lanes = k->lanes;
+	std::stable_sort(order.begin(), order.end(), LongerFirst(lengths));
+
+	Lane lane[MAX_LANES];
+	bool active[MAX_LANES];
+	uint32_t state[5 * MAX_LANES], block[16 * MAX_LANES];
+	size_t next = 0, running = 0;
+
+	for (size_t l = 0; l < lanes; l++) {
+		active[l] = (next < order.size());
+		if (!active[l]) continue;
+		lane[l].start(order[next], m_jobs[order[next]].data, m_jobs[order[next]].len);
+		next++;
+		running++;
+		for (int i = 0; i < 5; i++) state[i*lanes + l] = sha1Init[i];
+	}
+
+	while (running > 0) {
+		for (size_t l = 0; l < lanes; l++) {
+			if (!active[l]) {
+				for (int t = 0; t < 16; t++) block[t*lanes + l] = 0;
+				continue;
+			}
+			const unsigned char *p = lane[l].nextBlock();
+			for (int t = 0; t < 16; t++) block[t*lanes + l] = loadBE32(p + 4*t);
+		}
+
+		k->blocks(state, block);
+
+		for (size_t l = 0; l < lanes; l++) {
+			if (!active[l] || !lane[l].done()) continue;
+			unsigned char *out = &m_digests[lane[l].job * DIGEST_LENGTH];
+			for (int i = 0; i < 5; i++) storeBE32(out + 4*i, state[i*lanes + l]);
+
+			if (next < order.size()) {
+				lane[l].start(order[next], m_jobs[order[next]].data, m_jobs[order[next]].len);
+				next++;
+				for (int i = 0; i < 5; i++) state[i*lanes + l] = sha1Init[i];
+			} else {
+				active[l] = false;
+				running--;
+			}
+		}
+	}
+}
+
+}
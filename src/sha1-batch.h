@@ -0,0 +1,71 @@
+#ifndef __TORRENT_SANITIZE_SHA1_BATCH_H
+#define __TORRENT_SANITIZE_SHA1_BATCH_H
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+namespace torrent {
+
+/* sha1 of many independent ranges (info dicts of many torrents).
+ * the multi-buffer kernels hash 4 (sse2) or 8 (avx2) messages at once, one
+ * per 32-bit vector lane; a lane gets the next message as soon as its
+ * current one is done. longer messages are started first, so the lanes run
+ * out of work at about the same time.
+ * "evp" hashes one message after the other with OpenSSL (which uses the
+ * sha extensions of the cpu if it has them). that is faster for long
+ * messages, but the setup per message costs more than a lane for short ones:
+ * "avx2+sha" hashes messages from SHA1_BATCH_EVP_MIN bytes on with evp.
+ *
+ * usage:
+ *   SHA1Batch batch;
+ *   batch.add(data, len); ...
+ *   batch.run();
+ *   batch.hex(0), ...
+ *
+ * the ranges must stay valid until run() returns.
+ */
+class SHA1Batch {
+public:
+	static const size_t DIGEST_LENGTH = 20;
+
+	SHA1Batch();
+
+	/* returns the index of the range for digest()/hex() */
+	size_t add(const char *data, size_t len);
+	size_t size() const { return m_jobs.size(); }
+
+	void run();
+
+	const unsigned char* digest(size_t ndx) const { return &m_digests[ndx * DIGEST_LENGTH]; }
+	/* uppercase hex */
+	std::string hex(size_t ndx) const;
+
+	void clear();
+
+private:
+	struct Job {
+		const char *data;
+		size_t len;
+	};
+
+	std::vector<Job> m_jobs;
+	std::vector<unsigned char> m_digests;
+};
+
+/* kernel for SHA1Batch: "avx2+sha", "avx2", "sse2" or "evp"; false if the
+ * cpu doesn't support it. the default is the first supported one */
+bool setSHA1Kernel(const std::string &name);
+const char* sha1Kernel();
+
+/* uppercase hex of len bytes into out (2*len chars, no terminator) */
+void hexEncode(const unsigned char *data, size_t len, char *out);
+
+}
+
+#endif
@@ -0,0 +1,2820 @@
+
+/*
+   micro benchmarks for the building blocks of torrent-sanitize
+
+     torrent-bench load [-n iterations] [-c] file.torrent...
+       compares the Buffer load methods; -c drops the file from the page cache
+       before each load (needs a filesystem honoring POSIX_FADV_DONTNEED)
+
+     torrent-bench batch [-n iterations] [-d depth] [-c] file.torrent...
+       loads all files with BatchLoader and one by one with Buffer::load
+
+     torrent-bench write [-n iterations] [-o outfile] file.torrent...
+       writes each torrent (TorrentAnnounceInfo) through std::ofstream and
+       through OutputSegments, and checks both outputs are identical
+
+     torrent-bench serialize [-n iterations] file.torrent...
+       serializes announce and announce-list with the old stream formatting,
+       with bencode() to a std::ostream and with bencode() into a single
+       allocation of the exact size
+
+     torrent-bench parse [-n iterations] file.torrent...
+       parses each file with Torrent, TorrentAnnounceInfo and TorrentAnnounce,
+       skipping containers with and without BencodeTape (fastest iteration);
+       includes getting the info hash
+
+     torrent-bench utf8 [-n iterations] [-r random-strings]
+       checks validUTF8/validUTF8Text with every supported kernel against the
+       scalar implementation on random strings, then benchmarks them
+
+     torrent-bench sha1 [-n iterations] [-r random-messages]
+       checks SHA1Batch with every supported kernel (and hexEncode) against
+       OpenSSL on random messages, then measures hashes/s for several info
+       dict sizes
+
+     torrent-bench verify [-n iterations] [-f files] [-s MiB] [-p piece-KiB] [-t threads] directory
+       writes a synthetic payload (random data, files of different sizes, one
+       empty) and a torrent for it into directory, checks PieceHasher against
+       sequential hashing with 1..threads threads, then damages the payload
+       and checks exactly the affected pieces fail
+
+     torrent-bench domains [-n iterations] [-d domains] [-u urls]
+       checks DomainSet against the "--" blacklist regex it replaces on random
+       urls (at most 1000 domains in the regex), then measures urls/s for the
+       regex and for DomainSet with 1000 and with -d domains
+
+     torrent-bench rewrite [-n iterations] [-r rules] [-u urls] url-filter
+       prints the required literals of the rewrite rules in url-filter, adds
+       -r generated rewrite rules, checks filterUrl gives the same results
+       with and without the literal prefilter on random urls, and measures
+       both with the rules of url-filter and with the generated ones
+
+     torrent-bench pcre [-n iterations] url-filter urls.txt...
+       runs every url (one per line, like torrent-test-filter) through the
+       url filter with jit compiled patterns and with the pcre interpreter,
+       checks the results are identical and measures urls/s for both
+
+     torrent-bench urlcache [-n iterations] url-filter urls.txt...
+       checks filterUrl results from the in-memory cache and from a cache
+       file (in another TorrentSanitize, like another process would) are
+       the same as without cache, that a changed url-filter doesn't use old
+       results, and measures urls/s without cache, with the lru and with
+       only the file
+
+     torrent-bench filterload [-n iterations] url-filter urls.txt...
+       compiles (a copy of) url-filter like torrent-filter-compile, checks
+       filterUrl gives the same results with the text and the compiled
+       config, that the compiled config survives touching the text config
+       and is ignored after changing it, and measures the load times of both
+
+     torrent-bench canonical [-n iterations] [-r random-urls] url-filter urls.txt...
+       checks basicUrlCleaner (canonicalUrl) against the old std::string
+       based implementation on the urls, the trackers added by url-filter,
+       the results of its rewrite rules and random (mutated) urls, then
+       measures urls/s of both on the urls and rewrite results
+
+     torrent-bench announce [-n iterations] [-s sources] [-t trackers] [url-filter]
+       merges the announce urls of -s generated sources (-t trackers each,
+       mostly shared) with AnnounceList and with the old map/vector based
+       implementation, checks the announce-lists are identical and measures
+       the time and the number of allocations (operator new) of both
+
+     torrent-bench daemon [-n requests] [-c clients] [-e tool-dir] [-f url-filter] file.torrent...
+       starts torrent-sanitized (from tool-dir, default: next to torrent-bench)
+       on a temporary socket, checks its hash, sanitize (data and file) and
+       merge results against in-process hashing, torrent-sanitize -s and
+       torrent-merge, then sends -n sanitize requests from -c client threads
+       to the daemon and fork/execs torrent-sanitize -s for as many, and
+       compares requests/s and latencies
+
+     torrent-bench jobs [-n copies] [-t threads] [-e tool-dir] [-f url-filter] file.torrent...
+       sanitizes -n copies of every file with one torrent-sanitize -s process
+       per file, then with one torrent-sanitize --batch run with 1 and with
+       -t threads (default: one per cpu); checks all runs write the same
+       torrents and measures files/s
+
+     torrent-bench filterset [-n iterations] [-t threads] url-filter urls.txt...
+       checks copies of a TorrentSanitize share the FilterSet until one of
+       them changes it, runs filterUrl on one FilterSet from 1 and -t
+       threads (default: one per cpu, at least 2), each with its own
+       FilterScratch, checks the results against a single thread, and
+       measures urls/s (without url cache) with a new and a reused scratch
+ */
+
+#include "common.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <new>
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+
+extern "C" {
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+}
+
+using namespace torrent;
+
+/* allocations through operator new, for bench_announce (atomic: other modes allocate in threads).
+ * new and delete stay out of line: inlined, gcc sees malloc() paired with
+ * delete or free() paired with new (-Wmismatched-new-delete) */
+static size_t s_allocations = 0;
+
+#if __cplusplus >= 201103L
+__attribute__((noinline)) void* operator new(std::size_t size) {
+#else
+__attribute__((noinline)) void* operator new(std::size_t size) throw(std::bad_alloc) {
+#endif
+	__sync_fetch_and_add(&s_allocations, 1);
+	void *p = ::malloc(0 == size ? 1 : size);
+	if (0 == p) throw std::bad_alloc();
+	return p;
+}
+
+#if __cplusplus >= 201103L
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+#else
+__attribute__((noinline)) void operator delete(void *p) throw() {
+#endif
+	::free(p);
+}
+
+#if __cplusplus >= 201402L
+__attribute__((noinline)) void operator delete(void *p, std::size_t size) noexcept {
+	(void) size;
+	::free(p);
+}
+#endif
+
+static void syntax() {
+	std::cerr << "Syntax: torrent-bench load [-n iterations] [-c] file.torrent...\n"
+		"\tcompares the load methods (read, mmap, pread, auto) for each file\n"
+		"\n"
+		"\ttorrent-bench batch [-n iterations] [-d depth] [-c] file.torrent...\n"
+		"\tcompares BatchLoader with loading the files one by one\n"
+		"\n"
+		"\t\t-n: iterations per file and method (default 100)\n"
+		"\t\t-d: files in flight for BatchLoader (default " << BATCH_LOADER_DEPTH << ")\n"
+		"\t\t-c: drop files from page cache before each load\n";
+	exit(100);
+}
+
+static double now() {
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void dropCache(const std::string &filename) {
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (-1 == fd) return;
+	::fdatasync(fd);
+	::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	::close(fd);
+}
+
+/* touch every byte like the parser would, so lazy methods pay their full cost */
+static unsigned int touch(const Buffer &buf) {
+	unsigned int sum = 0;
+	const unsigned char *d = (const unsigned char*) buf.data();
+	for (size_t i = 0; i < buf.len(); i++) sum += d[i];
+	return sum;
+}
+
+static int bench_load(int argc, char **argv) {
+	int iterations = 100, opt;
+	bool cold = false;
+
+	while (-1 != (opt = getopt(argc, argv, "n:c"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 'c':
+			cold = true;
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (optind >= argc) syntax();
+
+	const LoadMethod methods[] = { LOAD_READ, LOAD_MMAP, LOAD_PREAD, LOAD_AUTO };
+	const size_t nmethods = sizeof(methods)/sizeof(methods[0]);
+	unsigned int sink = 0;
+
+	std::cout << std::left << std::setw(40) << "file" << std::right << std::setw(12) << "bytes"
+		<< std::setw(8) << "method" << std::setw(14) << "us/load" << std::setw(12) << "MB/s" << "\n";
+
+	for (int f = optind; f < argc; f++) {
+		std::string filename(argv[f]);
+		for (size_t m = 0; m < nmethods; m++) {
+			Buffer buf;
+			double total = 0;
+			size_t len = 0;
+			for (int i = 0; i < iterations; i++) {
+				if (cold) dropCache(filename);
+				double start = now();
+				if (!buf.load(filename, methods[m])) return 1;
+				sink += touch(buf);
+				len = buf.len();
+				buf.clear();
+				total += now() - start;
+			}
+			double per_load = total / iterations;
+			std::cout << std::left << std::setw(40) << filename << std::right << std::setw(12) << len
+				<< std::setw(8) << loadMethodName(methods[m])
+				<< std::setw(14) << std::fixed << std::setprecision(1) << per_load * 1e6
+				<< std::setw(12) << std::setprecision(1) << (len / per_load / (1024*1024)) << "\n";
+		}
+	}
+
+	/* keep the compiler from dropping touch() */
+	if (1 == sink) std::cerr << "";
+
+	return 0;
+}
+
+static int bench_batch(int argc, char **argv) {
+	int iterations = 100, opt;
+	unsigned int depth = BATCH_LOADER_DEPTH;
+	bool cold = false;
+
+	while (-1 != (opt = getopt(argc, argv, "n:d:c"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			if (0 == depth) syntax();
+			break;
+		case 'c':
+			cold = true;
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (optind >= argc) syntax();
+
+	std::vector<std::string> filenames(argv + optind, argv + argc);
+	unsigned int sink = 0;
+	size_t bytes = 0;
+	double batch_total = 0, single_total = 0;
+	bool uring = false;
+
+	for (int i = 0; i < iterations; i++) {
+		if (cold) for (size_t f = 0; f < filenames.size(); f++) dropCache(filenames[f]);
+		double start = now();
+		{
+			BatchLoader loader(depth);
+			uring = loader.usingIoUring();
+			for (size_t f = 0; f < filenames.size(); f++) loader.add(filenames[f]);
+			Buffer buf;
+			size_t ndx;
+			bool ok;
+			bytes = 0;
+			while (loader.next(buf, ndx, ok)) {
+				if (!ok) return 1;
+				sink += touch(buf);
+				bytes += buf.len();
+			}
+		}
+		batch_total += now() - start;
+
+		if (cold) for (size_t f = 0; f < filenames.size(); f++) dropCache(filenames[f]);
+		start = now();
+		for (size_t f = 0; f < filenames.size(); f++) {
+			Buffer buf;
+			if (!buf.load(filenames[f])) return 1;
+			sink += touch(buf);
+		}
+		single_total += now() - start;
+	}
+
+	std::cout << filenames.size() << " files, " << bytes << " bytes\n";
+	std::cout << std::left << std::setw(24) << (uring ? "batch (io_uring)" : "batch (fallback)") << std::right << std::fixed << std::setprecision(1)
+		<< std::setw(12) << (filenames.size() * iterations / batch_total) << " files/s"
+		<< std::setw(12) << (bytes * iterations / batch_total / (1024*1024)) << " MB/s\n";
+	std::cout << std::left << std::setw(24) << "one by one" << std::right
+		<< std::setw(12) << (filenames.size() * iterations / single_total) << " files/s"
+		<< std::setw(12) << (bytes * iterations / single_total / (1024*1024)) << " MB/s\n";
+
+	if (1 == sink) std::cerr << "";
+
+	return 0;
+}
+
+static bool readFile(const std::string &filename, std::string &content) {
+	std::ifstream is(filename.c_str(), std::ios_base::binary);
+	std::ostringstream oss;
+	oss << is.rdbuf();
+	content = oss.str();
+	return !is.fail();
+}
+
+static bool writeFile(const std::string &filename, const std::string &content) {
+	std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	out << content;
+	return out.good();
+}
+
+static unsigned int s_random = 2463534242u;
+static unsigned int nextRandom() {
+	s_random ^= s_random << 13;
+	s_random ^= s_random >> 17;
+	s_random ^= s_random << 5;
+	return s_random;
+}
+
+static int bench_write(int argc, char **argv) {
+	int iterations = 100, opt;
+	std::string outfile("/tmp/torrent-bench.out");
+
+	while (-1 != (opt = getopt(argc, argv, "n:o:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (optind >= argc) syntax();
+
+	std::cout << std::left << std::setw(40) << "file" << std::right << std::setw(12) << "bytes"
+		<< std::setw(14) << "ofstream us" << std::setw(14) << "segments us" << "\n";
+
+	int result = 0;
+	for (int f = optind; f < argc; f++) {
+		std::string filename(argv[f]);
+		TorrentAnnounceInfo t;
+		if (!t.load(filename)) {
+			std::cerr << filename << ": " << t.lasterror() << std::endl;
+			return 1;
+		}
+
+		std::string stream_out, segments_out;
+		double stream_total = 0, segments_total = 0;
+		for (int i = 0; i < iterations; i++) {
+			double start = now();
+			{
+				std::ofstream os(outfile.c_str(), std::ios_base::binary | std::ios_base::trunc | std::ios_base::out);
+				t.write(os);
+				if (!os) return 1;
+			}
+			stream_total += now() - start;
+			if (0 == i && !readFile(outfile, stream_out)) return 1;
+
+			start = now();
+			{
+				int fd = ::open(outfile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				if (-1 == fd) return 1;
+				OutputSegments out;
+				{
+					std::ostream os(&out);
+					t.write(os);
+					if (!os) { ::close(fd); return 1; }
+				}
+				bool ok = out.writeTo(fd, outfile);
+				::close(fd);
+				if (!ok) return 1;
+			}
+			segments_total += now() - start;
+			if (0 == i && !readFile(outfile, segments_out)) return 1;
+		}
+		::unlink(outfile.c_str());
+
+		if (stream_out != segments_out) {
+			std::cerr << filename << ": outputs differ\n";
+			result = 1;
+		}
+
+		std::cout << std::left << std::setw(40) << filename << std::right << std::setw(12) << stream_out.length()
+			<< std::fixed << std::setprecision(1)
+			<< std::setw(14) << (stream_total / iterations * 1e6)
+			<< std::setw(14) << (segments_total / iterations * 1e6) << "\n";
+	}
+
+	return result;
+}
+
+/* the serializer before bencode-writer.h, for comparison */
+class OldTorrentOStream {
+public:
+	explicit OldTorrentOStream(std::ostream &os) : os(os) { }
+
+	std::ostream &os;
+
+	OldTorrentOStream& operator<<(const std::string &s) {
+		os << s.length() << ":" << s; return *this;
+	}
+	template<typename T> OldTorrentOStream& operator<<(std::vector< T > list) {
+		os << "l";
+		for (size_t i = 0; i < list.size(); i++) *this << list[i];
+		os << "e";
+		return *this;
+	}
+};
+
+/* exact size output into a single string (like OutputSegments does for the new parts) */
+class StringOut {
+public:
+	explicit StringOut(std::string &s) : s(s) { }
+	std::string &s;
+	void raw(const char *data, size_t len) { s.append(data, len); }
+	void range(const Buffer &buffer, BufferString r) { (void) buffer; s.append(r.data(), r.length()); }
+};
+
+template<typename Out> static void serializeAnnounce(Out &out, const TorrentBase &t) {
+	out.raw("d8:announce", 11);
+	bencode(out, t.t_announce);
+	out.raw("13:announce-list", 16);
+	bencode(out, t.t_announce_list);
+}
+
+static int bench_serialize(int argc, char **argv) {
+	int iterations = 100, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (optind >= argc) syntax();
+
+	std::cout << std::left << std::setw(40) << "file" << std::right << std::setw(10) << "bytes"
+		<< std::setw(12) << "old us" << std::setw(12) << "ostream us" << std::setw(12) << "exact us" << "\n";
+
+	int result = 0;
+	for (int f = optind; f < argc; f++) {
+		std::string filename(argv[f]);
+		TorrentAnnounceInfo t;
+		if (!t.load(filename)) {
+			std::cerr << filename << ": " << t.lasterror() << std::endl;
+			return 1;
+		}
+
+		std::string old_out, ostream_out, exact_out;
+		double old_total = 0, ostream_total = 0, exact_total = 0;
+		for (int i = 0; i < iterations; i++) {
+			double start = now();
+			{
+				std::ostringstream os;
+				OldTorrentOStream tos(os);
+				os << "d8:announce";
+				tos << t.t_announce;
+				os << "13:announce-list";
+				tos << t.t_announce_list;
+				old_out = os.str();
+			}
+			old_total += now() - start;
+
+			start = now();
+			{
+				std::ostringstream os;
+				BencodeOStream out(os);
+				serializeAnnounce(out, t);
+				ostream_out = os.str();
+			}
+			ostream_total += now() - start;
+
+			start = now();
+			{
+				BencodeSize size;
+				serializeAnnounce(size, t);
+				std::string s;
+				s.reserve(size.size());
+				StringOut out(s);
+				serializeAnnounce(out, t);
+				exact_out.swap(s);
+			}
+			exact_total += now() - start;
+			if (0 == i && (old_out != ostream_out || old_out != exact_out)) {
+				std::cerr << filename << ": outputs differ\n";
+				result = 1;
+			}
+		}
+
+		std::cout << std::left << std::setw(40) << filename << std::right << std::setw(10) << old_out.length()
+			<< std::fixed << std::setprecision(2)
+			<< std::setw(12) << (old_total / iterations * 1e6)
+			<< std::setw(12) << (ostream_total / iterations * 1e6)
+			<< std::setw(12) << (exact_total / iterations * 1e6) << "\n";
+	}
+
+	return result;
+}
+
+template<typename T> static T* newParser(const TorrentSanitize &) { return new T(); }
+template<> Torrent* newParser<Torrent>(const TorrentSanitize &san) { return new Torrent(san); }
+
+/* returns seconds of the fastest parse (and infohash()), or -1 on error;
+ * every iteration parses with a new object (Torrent collects the file list) */
+template<typename T> static double timeParse(const std::string &filename, int iterations, const TorrentSanitize &san) {
+	double best = -1;
+	for (int i = 0; i < iterations; i++) {
+		Buffer buf;
+		if (!buf.load(filename)) return -1;
+		T *t = newParser<T>(san);
+		double start = now();
+		bool ok = t->load(buf);
+		if (ok) t->infohash();
+		double elapsed = now() - start;
+		if (!ok) std::cerr << filename << ": " << t->lasterror() << std::endl;
+		delete t;
+		if (!ok) return -1;
+		if (best < 0 || elapsed < best) best = elapsed;
+	}
+	return best;
+}
+
+/* a random bencoded value, often broken: missing 'e', bad lengths and
+ * numbers, unsorted or non-string dict keys, truncated strings */
+static std::string randomBencode(int depth) {
+	static const char *numbers[] = { "i0e", "i-1e", "i42e", "i-0e", "i01e", "ie", "i-e", "i1", "i9223372036854775808e", "i1x2e" };
+	std::ostringstream out;
+	unsigned int kind = nextRandom() % (depth > 0 ? 8 : 4);
+	switch (kind) {
+	case 0:
+		out << numbers[nextRandom() % (sizeof(numbers)/sizeof(numbers[0]))];
+		break;
+	case 1:
+		{
+			size_t len = nextRandom() % 6;
+			out << len << ':' << std::string(len, 'a' + (char) (nextRandom() % 26));
+		}
+		break;
+	case 2:
+		out << (nextRandom() % 6) << ':' << "ab"; /* length often wrong */
+		break;
+	case 3:
+		{
+			static const char *junk[] = { "", "e", "x", "-", ":", "01:a", "l", "d" };
+			out << junk[nextRandom() % (sizeof(junk)/sizeof(junk[0]))];
+		}
+		break;
+	case 4:
+	case 5:
+		out << 'l';
+		for (unsigned int n = nextRandom() % 4; n > 0; n--) out << randomBencode(depth - 1);
+		if (0 != nextRandom() % 8) out << 'e';
+		break;
+	default:
+		out << 'd';
+		{
+			char key = 'a';
+			for (unsigned int n = nextRandom() % 4; n > 0; n--) {
+				switch (nextRandom() % 8) {
+				case 0: out << "1:" << (char) (key - 1); break; /* unsorted / duplicate */
+				case 1: out << "i1e"; break; /* not a string */
+				default: out << "1:" << key++; break;
+				}
+				out << randomBencode(depth - 1);
+			}
+		}
+		if (0 != nextRandom() % 8) out << 'e';
+		break;
+	}
+	return out.str();
+}
+
+static std::string mutateTorrent(const std::string &data) {
+	static const char syntax_chars[] = "ldie0123456789:-";
+	std::string m(data);
+	for (unsigned int n = 1 + nextRandom() % 3; n > 0; n--) {
+		size_t pos = m.empty() ? 0 : nextRandom() % m.length();
+		switch (nextRandom() % 6) {
+		case 0:
+			if (!m.empty()) m[pos] = syntax_chars[nextRandom() % (sizeof(syntax_chars) - 1)];
+			break;
+		case 1:
+			if (!m.empty()) m[pos] = (char) nextRandom();
+			break;
+		case 2:
+			m.erase(pos, 1 + nextRandom() % 8);
+			break;
+		case 3:
+			if (!m.empty()) {
+				size_t from = nextRandom() % m.length();
+				m.insert(pos, m.substr(from, 1 + nextRandom() % 16));
+			}
+			break;
+		case 4:
+			m.resize(pos);
+			break;
+		default:
+			/* an entry the parsers skip: in the info dict or at the end */
+			{
+				size_t at = m.find("4:infod");
+				std::string entry = (0 == nextRandom() % 2 ? "1:x" : "2:zz") + randomBencode(4);
+				if (std::string::npos != at && 0 == nextRandom() % 2) {
+					m.insert(at + 7, entry);
+				} else if (!m.empty()) {
+					m.insert(m.length() - 1, entry);
+				}
+			}
+			break;
+		}
+	}
+	return m;
+}
+
+struct ParseResult {
+	bool ok;
+	std::string error, hash;
+	std::string warnings; /* printed by the parser */
+};
+
+template<typename T> static ParseResult parseWith(const std::string &filename, bool tape, const TorrentSanitize &san) {
+	TorrentBase::setUseTape(tape);
+	T *t = newParser<T>(san);
+	ParseResult r;
+	std::ostringstream warnings;
+	std::streambuf *cerr = std::cerr.rdbuf(warnings.rdbuf());
+	r.ok = t->load(filename);
+	if (r.ok) r.hash = t->infohash(); else r.error = t->lasterror();
+	std::cerr.rdbuf(cerr);
+	r.warnings = warnings.str();
+	delete t;
+	return r;
+}
+
+template<typename T> static bool tapeAgrees(const std::string &filename, const TorrentSanitize &san, const char *name, unsigned int mutation) {
+	ParseResult bytes = parseWith<T>(filename, false, san), tape = parseWith<T>(filename, true, san);
+	if (bytes.ok == tape.ok && bytes.error == tape.error && bytes.hash == tape.hash && bytes.warnings == tape.warnings) return true;
+	std::cerr << name << ", mutation " << mutation << " (depth " << TorrentBase::maxDepth() << "): tape and byte-wise parsing differ\n"
+		<< "  bytes: " << (bytes.ok ? "ok " + bytes.hash : bytes.error) << "\n"
+		<< "  tape:  " << (tape.ok ? "ok " + tape.hash : tape.error) << "\n";
+	if (bytes.warnings != tape.warnings) std::cerr << "  warnings:\n" << bytes.warnings << "  vs:\n" << tape.warnings;
+	return false;
+}
+
+/* parse mutated copies of data with and without the tape: acceptance, error
+ * and info hash must be the same (the byte-wise path only runs when the tape
+ * rejects, so a tape accepting too much would go unnoticed otherwise) */
+static bool checkTapeParse(const std::string &source, const std::string &data, int mutations, const TorrentSanitize &san, size_t &rejected) {
+	char tmp[] = "/tmp/torrent-bench-parse-XXXXXX";
+	int fd = ::mkstemp(tmp);
+	if (-1 == fd) {
+		int e = errno;
+		std::cerr << "Cannot create temporary file: " << ::strerror(e) << std::endl;
+		return false;
+	}
+	::close(fd);
+	const std::string filename(tmp);
+	const size_t depth = TorrentBase::maxDepth();
+	bool agree = true;
+	for (int i = 0; agree && i < mutations; i++) {
+		const std::string m = mutateTorrent(data);
+		if (!writeFile(filename, m)) {
+			std::cerr << "Cannot write '" << filename << "'\n";
+			agree = false;
+			break;
+		}
+		/* the default limit and one the random values reach */
+		for (int d = 0; agree && d < 2; d++) {
+			TorrentBase::setMaxDepth(0 == d ? depth : 2);
+			agree = tapeAgrees<Torrent>(filename, san, "Torrent", i)
+				&& tapeAgrees<TorrentAnnounceInfo>(filename, san, "TorrentAnnounceInfo", i)
+				&& tapeAgrees<TorrentAnnounce>(filename, san, "TorrentAnnounce", i);
+			if (agree && 0 == d && !parseWith<TorrentAnnounceInfo>(filename, true, san).ok) rejected++;
+		}
+		if (!agree) {
+			std::cerr << source << ": mutated input kept in '" << filename << "'\n";
+			break;
+		}
+	}
+	TorrentBase::setMaxDepth(depth);
+	TorrentBase::setUseTape(true);
+	if (agree) ::unlink(filename.c_str());
+	return agree;
+}
+
+static int bench_parse(int argc, char **argv) {
+	int iterations = 100, mutations = 1000, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:m:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 'm':
+			mutations = atoi(optarg);
+			if (mutations < 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (optind >= argc) syntax();
+
+	TorrentSanitize san;
+	san.loadMetaTextFilter(".*");
+	san.loadMetaNumFilter(".*");
+	san.loadMetaOtherFilter("");
+
+	std::cout << std::left << std::setw(40) << "file" << std::setw(22) << "class"
+		<< std::right << std::setw(14) << "bytes us" << std::setw(14) << "tape us" << "\n";
+
+	for (int f = optind; f < argc; f++) {
+		std::string filename(argv[f]);
+		const char *names[] = { "Torrent", "TorrentAnnounceInfo", "TorrentAnnounce" };
+		for (int c = 0; c < 3; c++) {
+			double result[2];
+			for (int tape = 0; tape < 2; tape++) {
+				TorrentBase::setUseTape(1 == tape);
+				if (0 == c) {
+					result[tape] = timeParse<Torrent>(filename, iterations, san);
+				} else if (1 == c) {
+					result[tape] = timeParse<TorrentAnnounceInfo>(filename, iterations, san);
+				} else {
+					result[tape] = timeParse<TorrentAnnounce>(filename, iterations, san);
+				}
+				if (result[tape] < 0) return 1;
+			}
+			std::cout << std::left << std::setw(40) << filename << std::setw(22) << names[c] << std::right
+				<< std::fixed << std::setprecision(1)
+				<< std::setw(14) << (result[0] * 1e6) << std::setw(14) << (result[1] * 1e6) << "\n";
+		}
+	}
+	TorrentBase::setUseTape(true);
+
+	for (int f = optind; f < argc && mutations > 0; f++) {
+		std::string filename(argv[f]), data;
+		size_t rejected = 0;
+		if (!readFile(filename, data)) {
+			std::cerr << "Cannot read '" << filename << "'\n";
+			return 1;
+		}
+		if (!checkTapeParse(filename, data, mutations, san, rejected)) return 1;
+		std::cout << filename << ": tape and byte-wise parsing agree on " << mutations << " mutated copies ("
+			<< rejected << " invalid)\n";
+	}
+
+	return 0;
+}
+
+/* validUTF8 and validUTF8Text before the SIMD ascii runs, as reference */
+static bool referenceUTF8(const char *_s, size_t len) {
+	const unsigned char *s = (const unsigned char*) _s;
+	for (size_t i = 0; i < len; i++) {
+		size_t seqlen = 0;
+		if (0 == (s[i] & 0x80)) { continue; }
+		else if ((0xC0 == s[i]) || (0xC1 == s[i])) { return false; }
+		else if (0xC0 == (s[i] & 0xE0)) { seqlen = 1; }
+		else if (0xE0 == s[i]) {
+			if (2 > len - i) return false;
+			if (0xA0 != (s[++i] & 0xE0)) return false;
+			seqlen = 1;
+		}
+		else if (0xED == s[i]) {
+			if (2 > len - i) return false;
+			if (0x80 != (s[++i] & 0xE0)) return false;
+			seqlen = 1;
+		}
+		else if (0xE0 == (s[i] & 0xF0)) { seqlen = 2; }
+		else if (0xF0 == s[i]) {
+			if (3 > len - i) return false;
+			if (0x00 == (s[i+1] & 0x30)) return false;
+			seqlen = 3;
+		}
+		else if (0xF4 == s[i]) {
+			if (3 > len - i) return false;
+			if (0x80 != (s[++i] & 0xF0)) return false;
+			seqlen = 2;
+		}
+		else if (0xF4 < s[i]) return false;
+		else if (0xF0 == (s[i] & 0xF8)) { seqlen = 3; }
+		else return false;
+		if (seqlen > len - i) return false;
+		for ( ; seqlen > 0; seqlen--) {
+			if (0x80 != (s[++i] & 0xC0)) return false;
+		}
+	}
+	return true;
+}
+
+static bool referenceUTF8Text(const char *_s, size_t len) {
+	const unsigned char *s = (const unsigned char*) _s;
+	for (size_t i = 0; i < len; i++) {
+		unsigned int code;
+		int seqlen = 0;
+		if (0 == (s[i] & 0x80)) { seqlen = 0; code = s[i] & 0x7f; }
+		else if (0xC0 == (s[i] & 0xFE)) { return false; }
+		else if (0xC0 == (s[i] & 0xE0)) { seqlen = 1; code = s[i] & 0x1f; }
+		else if (0xE0 == (s[i] & 0xF0)) { seqlen = 2; code = s[i] & 0x0f; }
+		else if (0xF0 == (s[i] & 0xF8)) { seqlen = 3; code = s[i] & 0x07; }
+		else return false;
+		if (seqlen > len - i) return false;
+		for (int slen = seqlen; slen > 0; slen--) {
+			if (0x80 != (s[++i] & 0xC0)) return false;
+			code = (code << 6) | (s[i] & 0x3f);
+		}
+		if ((seqlen == 2) && (code < 0x800)) return false;
+		if ((seqlen == 3) && (code < 0x1000)) return false;
+		if (code == 0x0a || code == 0x0d || code == 0x09) continue;
+		if (code < 0x20 || (0x7f <= code && code <= 0x9f) ) return false;
+		if (code >= 0xD800 && code <= 0xDFFF) return false;
+		if ((code & 0xFFFE) == 0xFFE || (code >= 0xFDD0 && code <= 0xFDEF)) return false;
+		if (code >= 0xf0000) return false;
+		if ((code >= 0x200B && code <= 0x200F) || (code >= 0x202A && code <= 0x202E)) return false;
+	}
+	return true;
+}
+
+static void appendCodePoint(std::string &s, unsigned int code) {
+	if (code < 0x80) {
+		s += (char) code;
+	} else if (code < 0x800) {
+		s += (char) (0xC0 | (code >> 6));
+		s += (char) (0x80 | (code & 0x3f));
+	} else if (code < 0x10000) {
+		s += (char) (0xE0 | (code >> 12));
+		s += (char) (0x80 | ((code >> 6) & 0x3f));
+		s += (char) (0x80 | (code & 0x3f));
+	} else {
+		s += (char) (0xF0 | (code >> 18));
+		s += (char) (0x80 | ((code >> 12) & 0x3f));
+		s += (char) (0x80 | ((code >> 6) & 0x3f));
+		s += (char) (0x80 | (code & 0x3f));
+	}
+}
+
+/* mostly plain ascii runs with code points near the rule boundaries, raw bytes and truncations */
+static std::string randomString() {
+	static const unsigned int codes[] = {
+		0x00, 0x09, 0x0a, 0x0d, 0x1f, 0x20, 0x7e, 0x7f, 0x80, 0x9f, 0xa0, 0xe9, 0x7ff, 0x800, 0xffd, 0xffe, 0xfff, 0x1000,
+		0x200a, 0x200b, 0x200f, 0x2010, 0x2029, 0x202a, 0x202e, 0x202f, 0xd7ff, 0xd800, 0xdfff, 0xe000,
+		0xfdcf, 0xfdd0, 0xfdef, 0xfdf0, 0xfffd, 0xfffe, 0xffff, 0x10000, 0x1fffe, 0xeffff, 0xf0000, 0x10ffff
+	};
+	std::string s;
+	unsigned int parts = nextRandom() % 8;
+	for (unsigned int p = 0; p < parts; p++) {
+		unsigned int kind = nextRandom() % 10;
+		if (kind < 5) {
+			unsigned int n = nextRandom() % 100;
+			for (unsigned int i = 0; i < n; i++) s += (char) (0x20 + nextRandom() % 0x5f);
+		} else if (kind < 8) {
+			appendCodePoint(s, codes[nextRandom() % (sizeof(codes)/sizeof(codes[0]))]);
+		} else if (kind < 9) {
+			s += (char) (nextRandom() % 256);
+		} else if (!s.empty()) {
+			s.resize(s.length() - 1);
+		}
+	}
+	return s;
+}
+
+static int bench_utf8(int argc, char **argv) {
+	int iterations = 100, strings = 1000000, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:r:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 'r':
+			strings = atoi(optarg);
+			if (strings < 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+
+	const char *names[] = { "scalar", "sse2", "avx2", "avx512bw" };
+	const size_t nnames = sizeof(names)/sizeof(names[0]);
+	std::string best(utf8Kernel());
+	int result = 0;
+
+	/* differential check */
+	size_t accepted = 0;
+	for (int r = 0; r < strings; r++) {
+		std::string s = randomString();
+		bool ref = referenceUTF8(s.c_str(), s.length()), ref_text = referenceUTF8Text(s.c_str(), s.length());
+		if (ref_text) accepted++;
+		for (size_t k = 0; k < nnames; k++) {
+			if (!setUTF8Kernel(names[k])) continue;
+			if (ref != validUTF8(s) || ref_text != validUTF8Text(s)) {
+				std::cerr << "kernel " << names[k] << " differs for string #" << r << " (" << s.length() << " bytes)\n";
+				result = 1;
+			}
+		}
+	}
+	std::cout << strings << " random strings (" << accepted << " valid text) checked\n";
+
+	/* benchmark: short keys, file names with some non-ascii, long ascii text */
+	std::vector<std::string> sets[3];
+	for (int i = 0; i < 1000; i++) {
+		std::ostringstream key, name, text;
+		key << (i % 2 ? "length" : "path");
+		name << "Some Album (" << (1990 + i % 30) << ")/" << (i % 20) << " - Track " << i << (i % 4 ? ".flac" : " caf\xc3\xa9.flac");
+		for (int j = 0; j < 20; j++) text << "The quick brown fox jumps over the lazy dog. ";
+		sets[0].push_back(key.str());
+		sets[1].push_back(name.str());
+		sets[2].push_back(text.str());
+	}
+	const char *set_names[] = { "keys", "file names", "long text" };
+
+	std::cout << std::left << std::setw(12) << "set" << std::setw(10) << "kernel" << std::right << std::setw(14) << "ns/string" << std::setw(12) << "MB/s" << "\n";
+	unsigned int sink = 0;
+	for (size_t set = 0; set < 3; set++) {
+		size_t bytes = 0;
+		for (size_t i = 0; i < sets[set].size(); i++) bytes += sets[set][i].length();
+
+		for (size_t k = 0; k <= nnames; k++) {
+			const char *name = (k == nnames) ? "reference" : names[k];
+			if (k < nnames && !setUTF8Kernel(names[k])) continue;
+			double start = now();
+			for (int it = 0; it < iterations; it++) {
+				for (size_t i = 0; i < sets[set].size(); i++) {
+					const std::string &s = sets[set][i];
+					sink += (k == nnames) ? referenceUTF8Text(s.c_str(), s.length()) : validUTF8Text(s.c_str(), s.length());
+				}
+			}
+			double total = now() - start;
+			std::cout << std::left << std::setw(12) << set_names[set] << std::setw(10) << name << std::right << std::fixed
+				<< std::setprecision(1) << std::setw(14) << (total / iterations / sets[set].size() * 1e9)
+				<< std::setw(12) << (bytes * (double) iterations / total / (1024*1024)) << "\n";
+		}
+	}
+	if (1 == sink) std::cerr << "";
+
+	setUTF8Kernel(best);
+	return result;
+}
+
+/* info hash before SHA1Batch: one ::SHA1 per message, scalar hex */
+static std::string referenceSHA1(const std::string &msg) {
+	unsigned char raw[SHA_DIGEST_LENGTH];
+	::SHA1((const unsigned char*) msg.data(), msg.length(), raw);
+	std::string hex(2*SHA_DIGEST_LENGTH, '.');
+	const char hexchar[] = "0123456789ABCDEF";
+	for (int i = 0; i < SHA_DIGEST_LENGTH; i++) {
+		hex[2*i] = hexchar[raw[i] >> 4];
+		hex[2*i+1] = hexchar[raw[i] & 0xf];
+	}
+	return hex;
+}
+
+static std::string randomBytes(size_t len) {
+	std::string s(len, '\0');
+	for (size_t i = 0; i < len; i++) s[i] = (char) (nextRandom() & 0xff);
+	return s;
+}
+
+static int bench_sha1(int argc, char **argv) {
+	int iterations = 10, messages = 2000, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:r:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 'r':
+			messages = atoi(optarg);
+			if (messages < 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+
+	const char *names[] = { "evp", "sse2", "avx2", "avx2+sha" };
+	const size_t nnames = sizeof(names)/sizeof(names[0]);
+	std::string best(sha1Kernel());
+	int result = 0;
+
+	/* differential check; lengths around the padding boundaries are the interesting ones */
+	std::vector<std::string> msgs;
+	std::vector<std::string> ref;
+	for (int r = 0; r < messages; r++) {
+		size_t len = (r < 200) ? r : nextRandom() % (r % 10 ? 300 : 20000);
+		msgs.push_back(randomBytes(len));
+		ref.push_back(referenceSHA1(msgs.back()));
+	}
+	for (size_t k = 0; k < nnames; k++) {
+		if (!setSHA1Kernel(names[k])) continue;
+		SHA1Batch batch;
+		for (size_t i = 0; i < msgs.size(); i++) batch.add(msgs[i].data(), msgs[i].length());
+		batch.run();
+		for (size_t i = 0; i < msgs.size(); i++) {
+			if (batch.hex(i) != ref[i]) {
+				std::cerr << "kernel " << names[k] << " differs for message #" << i << " (" << msgs[i].length() << " bytes)\n";
+				result = 1;
+				break;
+			}
+		}
+	}
+	for (size_t len = 0; len < 100; len++) {
+		std::string bytes = randomBytes(len), hex(2*len, '.'), hexref;
+		hexEncode((const unsigned char*) bytes.data(), len, &hex[0]);
+		for (size_t i = 0; i < len; i++) {
+			const char hexchar[] = "0123456789ABCDEF";
+			hexref += hexchar[(unsigned char) bytes[i] >> 4];
+			hexref += hexchar[bytes[i] & 0xf];
+		}
+		if (hex != hexref) {
+			std::cerr << "hexEncode differs for " << len << " bytes\n";
+			result = 1;
+		}
+	}
+	std::cout << msgs.size() << " random messages checked (default kernel: " << best << ")\n";
+
+	/* benchmark: same sized messages, about 16 MB per run */
+	const size_t sizes[] = { 256, 1024, 4096, 16384, 65536, 1024*1024 };
+	std::cout << std::left << std::setw(10) << "size" << std::setw(12) << "kernel" << std::right << std::setw(14) << "hashes/s" << std::setw(12) << "MB/s" << "\n";
+	unsigned int sink = 0;
+	for (size_t si = 0; si < sizeof(sizes)/sizeof(sizes[0]); si++) {
+		size_t count = std::max<size_t>(16, (16*1024*1024) / sizes[si]);
+		std::vector<std::string> data;
+		for (size_t i = 0; i < count; i++) data.push_back(randomBytes(sizes[si]));
+
+		for (size_t k = 0; k <= nnames; k++) {
+			const char *name = (k == nnames) ? "reference" : names[k];
+			if (k < nnames && !setSHA1Kernel(names[k])) continue;
+			double bestrun = -1;
+			for (int it = 0; it < iterations; it++) {
+				double start = now();
+				if (k == nnames) {
+					for (size_t i = 0; i < count; i++) sink += referenceSHA1(data[i])[0];
+				} else {
+					SHA1Batch batch;
+					for (size_t i = 0; i < count; i++) batch.add(data[i].data(), data[i].length());
+					batch.run();
+					for (size_t i = 0; i < count; i++) sink += batch.hex(i)[0];
+				}
+				double elapsed = now() - start;
+				if (bestrun < 0 || elapsed < bestrun) bestrun = elapsed;
+			}
+			std::cout << std::left << std::setw(10) << sizes[si] << std::setw(12) << name << std::right << std::fixed
+				<< std::setprecision(0) << std::setw(14) << (count / bestrun)
+				<< std::setprecision(1) << std::setw(12) << (count * (double) sizes[si] / bestrun / (1024*1024)) << "\n";
+		}
+	}
+	if (1 == sink) std::cerr << "";
+
+	setSHA1Kernel(best);
+	return result;
+}
+
+struct PayloadFile {
+	std::string name;
+	int64_t length;
+};
+
+/* random payload files and a torrent (name "payload") describing them;
+ * returns the piece hashes computed in one sequential pass */
+static bool writePayload(const std::string &dir, const std::vector<PayloadFile> &files, int64_t piece_length, std::string &pieces) {
+	::mkdir(dir.c_str(), 0755);
+	::mkdir((dir + "/payload").c_str(), 0755);
+	EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+	::EVP_DigestInit_ex(ctx, EVP_sha1(), NULL);
+	int64_t in_piece = 0;
+	uint64_t x = 88172645463325252ull;
+	std::vector<char> block(1024*1024);
+
+	for (size_t f = 0; f < files.size(); f++) {
+		std::ofstream out((dir + "/payload/" + files[f].name).c_str(), std::ios::binary | std::ios::trunc);
+		for (int64_t left = files[f].length; left > 0; ) {
+			size_t n = std::min<int64_t>(left, block.size());
+			for (size_t i = 0; i < n; i += 8) {
+				x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+				memcpy(&block[i], &x, std::min<size_t>(8, n - i));
+			}
+			out.write(&block[0], n);
+			for (size_t i = 0; i < n; ) {
+				size_t take = std::min<int64_t>(n - i, piece_length - in_piece);
+				::EVP_DigestUpdate(ctx, &block[i], take);
+				i += take;
+				in_piece += take;
+				if (in_piece == piece_length) {
+					unsigned char md[SHA_DIGEST_LENGTH];
+					::EVP_DigestFinal_ex(ctx, md, NULL);
+					pieces.append((const char*) md, sizeof(md));
+					::EVP_DigestInit_ex(ctx, EVP_sha1(), NULL);
+					in_piece = 0;
+				}
+			}
+			left -= n;
+		}
+		if (!out) {
+			std::cerr << "Cannot write payload file '" << files[f].name << "'\n";
+			EVP_MD_CTX_destroy(ctx);
+			return false;
+		}
+	}
+	if (in_piece > 0) {
+		unsigned char md[SHA_DIGEST_LENGTH];
+		::EVP_DigestFinal_ex(ctx, md, NULL);
+		pieces.append((const char*) md, sizeof(md));
+	}
+	EVP_MD_CTX_destroy(ctx);
+
+	std::ofstream t((dir + "/payload.torrent").c_str(), std::ios::binary | std::ios::trunc);
+	BencodeOStream out(t);
+	out.raw("d", 1);
+	bencode(out, "announce");
+	bencode(out, "http://tracker.example.com/announce");
+	bencode(out, "info");
+	out.raw("d", 1);
+	bencode(out, "files");
+	out.raw("l", 1);
+	for (size_t f = 0; f < files.size(); f++) {
+		out.raw("d", 1);
+		bencode(out, "length");
+		bencode(out, files[f].length);
+		bencode(out, "path");
+		std::vector<std::string> path(1, files[f].name);
+		bencode(out, path);
+		out.raw("e", 1);
+	}
+	out.raw("e", 1);
+	bencode(out, "name");
+	bencode(out, "payload");
+	bencode(out, "piece length");
+	bencode(out, piece_length);
+	bencode(out, "pieces");
+	bencode(out, pieces);
+	out.raw("ee", 2);
+	return t.good();
+}
+
+static std::vector<PieceHasher::File> payloadFiles(const std::string &dir, const std::vector<PayloadFile> &files) {
+	std::vector<PieceHasher::File> result;
+	for (size_t f = 0; f < files.size(); f++) {
+		PieceHasher::File pf = { dir + "/payload/" + files[f].name, files[f].length };
+		result.push_back(pf);
+	}
+	return result;
+}
+
+/* number of pieces whose digest doesn't match */
+static size_t badPieces(const PieceHasher &hasher, const std::string &pieces, std::vector<char> *bad = 0) {
+	size_t count = 0;
+	if (bad) bad->assign(hasher.pieceCount(), 0);
+	for (size_t i = 0; i < hasher.pieceCount(); i++) {
+		if (hasher.hashed(i) && 0 == memcmp(hasher.digest(i), pieces.data() + i * PieceHasher::DIGEST_LENGTH, PieceHasher::DIGEST_LENGTH)) continue;
+		count++;
+		if (bad) (*bad)[i] = 1;
+	}
+	return count;
+}
+
+static int bench_verify(int argc, char **argv) {
+	int iterations = 3, nfiles = 20, megabytes = 256, piece_kib = 256, max_threads = 0, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:f:s:p:t:"))) {
+		int v = atoi(optarg);
+		if (v <= 0) syntax();
+		switch (opt) {
+		case 'n': iterations = v; break;
+		case 'f': nfiles = v; break;
+		case 's': megabytes = v; break;
+		case 'p': piece_kib = v; break;
+		case 't': max_threads = v; break;
+		default:
+			syntax();
+		}
+	}
+	if (1 != argc - optind) syntax();
+	std::string dir(argv[optind]);
+	if (0 == max_threads) {
+		long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+		max_threads = cpus > 0 ? cpus : 1;
+	}
+
+	/* sizes around the average, not aligned to pieces; the second file is empty */
+	int64_t piece_length = (int64_t) piece_kib * 1024;
+	int64_t avg = (int64_t) megabytes * 1024 * 1024 / nfiles;
+	std::vector<PayloadFile> files;
+	for (int f = 0; f < nfiles; f++) {
+		std::ostringstream name;
+		name << "file" << f << ".bin";
+		PayloadFile pf = { name.str(), 1 == f ? 0 : avg / 2 + (int64_t) (nextRandom() % (avg + 1)) };
+		files.push_back(pf);
+	}
+
+	std::string pieces;
+	if (!writePayload(dir, files, piece_length, pieces)) return 1;
+
+	TorrentSanitize san;
+	Torrent parsed(san);
+	if (!parsed.load(dir + "/payload.torrent")) {
+		std::cerr << "payload.torrent: " << parsed.lasterror() << std::endl;
+		return 1;
+	}
+	if (parsed.info_pieces().length() != pieces.length() || 0 != memcmp(parsed.info_pieces().data(), pieces.data(), pieces.length())) {
+		std::cerr << "payload.torrent: pieces differ after parsing\n";
+		return 1;
+	}
+
+	std::vector<PieceHasher::File> hfiles = payloadFiles(dir, files);
+	int result = 0;
+	std::cout << std::left << std::setw(10) << "threads" << std::right << std::setw(12) << "MiB/s" << std::setw(12) << "bad pieces" << "\n";
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		double best = -1;
+		size_t bad = 0;
+		for (int it = 0; it < iterations; it++) {
+			PieceHasher hasher(hfiles, piece_length, threads);
+			if (!hasher.run()) return 1;
+			bad = badPieces(hasher, pieces);
+			if (best < 0 || hasher.seconds() < best) best = hasher.seconds();
+		}
+		if (0 != bad) result = 1;
+		std::cout << std::left << std::setw(10) << threads << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(12) << (hfiles.empty() ? 0 : megabytes / best) << std::setw(12) << bad << "\n";
+	}
+
+	/* damage: flip the first byte of the third file (its piece usually
+	 * starts in the file before), truncate the last file by one byte */
+	size_t damaged = 2 % files.size(), truncated = files.size() - 1;
+	std::set<size_t> expect;
+	{
+		PieceHasher layout(hfiles, piece_length, 1);
+		size_t first, end;
+		layout.filePieces(damaged, first, end);
+		if (first < end) expect.insert(first);
+		layout.filePieces(truncated, first, end);
+		if (first < end) expect.insert(end - 1);
+	}
+	std::fstream f(hfiles[damaged].path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	char c;
+	if (f.get(c)) {
+		f.seekp(0);
+		f.put((char) (c ^ 1));
+	}
+	f.close();
+	if (files[truncated].length > 0 && 0 != ::truncate(hfiles[truncated].path.c_str(), files[truncated].length - 1)) return 1;
+
+	PieceHasher hasher(hfiles, piece_length, max_threads);
+	if (!hasher.run()) return 1;
+	std::vector<char> bad;
+	badPieces(hasher, pieces, &bad);
+	std::set<size_t> found;
+	for (size_t i = 0; i < bad.size(); i++) if (bad[i]) found.insert(i);
+	if (found != expect) {
+		std::cerr << "damaged payload: " << found.size() << " bad pieces, expected " << expect.size() << "\n";
+		result = 1;
+	} else {
+		std::cout << "damaged payload: " << found.size() << " bad pieces detected\n";
+	}
+	return result;
+}
+
+static std::string randomLabel() {
+	const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789-_";
+	std::string label(1, chars[nextRandom() % 26]);
+	for (unsigned int n = 2 + nextRandom() % 9; n > 0; n--) label += chars[nextRandom() % 38];
+	return label;
+}
+
+static std::string randomDomain() {
+	const char *tlds[] = { "com", "net", "org", "to", "info", "de" };
+	std::string domain;
+	for (unsigned int n = 1 + nextRandom() % 2; n > 0; n--) domain += randomLabel() + ".";
+	return domain + tlds[nextRandom() % 6];
+}
+
+/* same as the host extraction in filterUrl */
+static std::string urlHost(const std::string &url) {
+	std::string::size_type start = url.find("://") + 3;
+	std::string::size_type end = url.find_first_of(":/", start);
+	return url.substr(start, std::string::npos == end ? std::string::npos : end - start);
+}
+
+/* hits, subdomains and near misses of the blacklisted domains */
+static std::string randomUrl(const std::vector<std::string> &domains) {
+	const std::string &d = domains[nextRandom() % domains.size()];
+	std::string host;
+	switch (nextRandom() % 6) {
+	case 0: host = d; break;
+	case 1: host = randomLabel() + "." + d; break;
+	case 2: host = randomLabel() + "." + randomLabel() + "." + d; break;
+	case 3: host = randomLabel() + d; break; /* no dot: must not match */
+	case 4: host = d + ".xx"; break;
+	default: host = randomDomain(); break;
+	}
+	switch (nextRandom() % 3) {
+	case 0: return "http://" + host + "/announce";
+	case 1: return "udp://" + host + ":6969";
+	default: return "https://" + host + ":8443/" + randomLabel() + "/announce";
+	}
+}
+
+static int bench_domains(int argc, char **argv) {
+	int iterations = 5, ndomains = 100000, nurls = 100000, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:d:u:"))) {
+		int v = atoi(optarg);
+		if (v <= 0) syntax();
+		switch (opt) {
+		case 'n': iterations = v; break;
+		case 'd': ndomains = v; break;
+		case 'u': nurls = v; break;
+		default:
+			syntax();
+		}
+	}
+
+	std::vector<std::string> domains;
+	for (int i = 0; i < ndomains; i++) domains.push_back(randomDomain());
+	std::vector<std::string> small(domains.begin(), domains.begin() + std::min(ndomains, 1000));
+
+	/* the "--" blacklist as loadUrlConfig built it before DomainSet */
+	std::string alternation;
+	for (size_t i = 0; i < small.size(); i++) {
+		if (i > 0) alternation += "|";
+		for (size_t k = 0; k < small[i].length(); k++) {
+			if ('.' == small[i][k] || '-' == small[i][k]) alternation += '\\';
+			alternation += small[i][k];
+		}
+	}
+	PCRE regex;
+	if (!regex.load("[^:]+://(?:[0-9a-z_\\-.]*\\.)?(?:" + alternation + ")(?:[:/].*)?")) return 1;
+
+	double start = now();
+	DomainSet small_set, set;
+	for (size_t i = 0; i < small.size(); i++) small_set.insert(small[i]);
+	for (size_t i = 0; i < domains.size(); i++) set.insert(domains[i]);
+	double build = now() - start;
+
+	std::vector<std::string> urls, small_urls;
+	for (int i = 0; i < nurls; i++) {
+		urls.push_back(randomUrl(domains));
+		small_urls.push_back(randomUrl(small));
+	}
+
+	int result = 0;
+	size_t hits = 0;
+	for (size_t i = 0; i < small_urls.size(); i++) {
+		bool expected = regex.matches(small_urls[i]);
+		if (expected != small_set.matches(urlHost(small_urls[i]))) {
+			std::cerr << "DomainSet differs for '" << small_urls[i] << "' (regex: " << expected << ")\n";
+			result = 1;
+		}
+		if (expected) hits++;
+	}
+	std::cout << small_urls.size() << " random urls checked against " << small.size() << " domains (" << hits << " blacklisted)\n"
+		<< set.size() << " domains inserted in " << std::fixed << std::setprecision(3) << build << " s\n";
+
+	std::cout << std::left << std::setw(22) << "method" << std::right << std::setw(10) << "domains" << std::setw(14) << "urls/s" << "\n";
+	size_t sink = 0;
+	for (int m = 0; m < 3; m++) {
+		const std::vector<std::string> &list = (2 == m) ? urls : small_urls;
+		const DomainSet &dset = (2 == m) ? set : small_set;
+		double bestrun = -1;
+		for (int it = 0; it < iterations; it++) {
+			start = now();
+			for (size_t i = 0; i < list.size(); i++) {
+				if (0 == m) {
+					sink += regex.matches(list[i]);
+				} else {
+					sink += dset.matches(urlHost(list[i]));
+				}
+			}
+			double elapsed = now() - start;
+			if (bestrun < 0 || elapsed < bestrun) bestrun = elapsed;
+		}
+		std::cout << std::left << std::setw(22) << (0 == m ? "regex" : "DomainSet") << std::right << std::setw(10) << (2 == m ? set.size() : small.size())
+			<< std::setw(14) << std::setprecision(0) << (list.size() / bestrun) << "\n";
+	}
+	if (1 == sink) std::cerr << "";
+
+	return result;
+}
+
+/* url-filter followed by generated rewrite rules, in a temporary file */
+static bool loadRewriteConfig(TorrentSanitize &san, const std::string &filter, const std::vector<std::string> &rules) {
+	std::string content;
+	if (!readFile(filter, content)) {
+		std::cerr << "Cannot read '" << filter << "'\n";
+		return false;
+	}
+	char name[] = "/tmp/torrent-bench-XXXXXX";
+	int fd = ::mkstemp(name);
+	if (-1 == fd) {
+		std::cerr << "Cannot create temporary file: " << ::strerror(errno) << "\n";
+		return false;
+	}
+	::close(fd);
+	{
+		std::ofstream out(name);
+		out << content << "\n";
+		for (size_t i = 0; i < rules.size(); i++) out << rules[i] << "\n";
+	}
+	bool ok = san.loadUrlConfig(name);
+	::unlink(name);
+	return ok;
+}
+
+static int bench_rewrite(int argc, char **argv) {
+	int iterations = 5, nrules = 1000, nurls = 20000, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:r:u:"))) {
+		int v = atoi(optarg);
+		if (v < 0 || (0 == v && 'r' != opt)) syntax();
+		switch (opt) {
+		case 'n': iterations = v; break;
+		case 'r': nrules = v; break;
+		case 'u': nurls = v; break;
+		default:
+			syntax();
+		}
+	}
+	if (1 != argc - optind) syntax();
+	std::string filter(argv[optind]);
+
+	/* rules shaped like the ones in url-filter.example */
+	std::vector<std::string> rules, domains;
+	for (int i = 0; i < nrules; i++) {
+		std::string label = randomLabel(), d = label + ".com";
+		domains.push_back(d);
+		if (i % 2) {
+			rules.push_back(".*[./]" + label + "\\.com(?:[:/].*)?    udp://tracker." + d + ":80");
+		} else {
+			rules.push_back("(.+)\\." + label + "\\.com([:/].*)?    \\1." + label + ".net\\2");
+		}
+	}
+
+	TorrentSanitize base, generated;
+	base.setUrlCacheEntries(0);
+	generated.setUrlCacheEntries(0);
+	if (!loadRewriteConfig(base, filter, std::vector<std::string>())) return 1;
+	if (!loadRewriteConfig(generated, filter, rules)) return 1;
+
+	for (size_t r = 0; r < base.filters().filter_url_replace.size(); r++) {
+		std::vector<std::string> literals;
+		std::cout << "rule " << r << ": ";
+		if (!requiredLiterals(base.filters().filter_url_replace[r].pattern(), literals)) std::cout << "(always)";
+		for (size_t i = 0; i < literals.size(); i++) std::cout << (i ? " | " : "") << "'" << literals[i] << "'";
+		std::cout << "\n";
+	}
+
+	const char *known[] = { "tracker.istole.it", "tracker.openbittorrent.com", "denis.stalker.h3q.com", "tracker.demonoid.com", "tracker.torrentbox.com", "tracker.hexagon.cc" };
+	std::vector<std::string> urls;
+	for (int i = 0; i < nurls; i++) {
+		std::string host;
+		switch (nextRandom() % 4) {
+		case 0: host = known[nextRandom() % 6]; break;
+		case 1: host = domains.empty() ? randomDomain() : randomLabel() + "." + domains[nextRandom() % domains.size()]; break;
+		default: host = randomDomain(); break;
+		}
+		const char *paths[] = { "/announce", "/annonce", "/a/announce" };
+		if (nextRandom() % 2) {
+			urls.push_back("udp://" + host + ":" + (nextRandom() % 2 ? "80" : "6969"));
+		} else {
+			urls.push_back("http://" + host + (nextRandom() % 2 ? ":2710" : "") + paths[nextRandom() % 3]);
+		}
+	}
+
+	int result = 0;
+	size_t rewritten = 0;
+	for (int k = 0; k < 2; k++) {
+		TorrentSanitize &san = k ? generated : base;
+		for (size_t i = 0; i < urls.size(); i++) {
+			san.editFilters().prefilter_url_replace = false;
+			std::vector<AnnounceUrl> expected = san.filterUrl(urls[i]);
+			san.editFilters().prefilter_url_replace = true;
+			if (expected != san.filterUrl(urls[i])) {
+				std::cerr << "prefilter changes the result for '" << urls[i] << "'\n";
+				result = 1;
+			}
+			if (1 != expected.size() || expected[0].url != urls[i]) rewritten++;
+		}
+	}
+	std::cout << urls.size() << " random urls checked with " << base.filters().filter_url_replace.size() << " and " << generated.filters().filter_url_replace.size() << " rules ("
+		<< rewritten << " changed or removed)\n";
+
+	std::cout << std::left << std::setw(10) << "rules" << std::setw(12) << "prefilter" << std::right << std::setw(14) << "urls/s" << "\n";
+	size_t sink = 0;
+	for (int k = 0; k < 4; k++) {
+		TorrentSanitize &san = (k / 2) ? generated : base;
+		san.editFilters().prefilter_url_replace = (1 == k % 2);
+		double bestrun = -1;
+		for (int it = 0; it < iterations; it++) {
+			double start = now();
+			for (size_t i = 0; i < urls.size(); i++) sink += san.filterUrl(urls[i]).size();
+			double elapsed = now() - start;
+			if (bestrun < 0 || elapsed < bestrun) bestrun = elapsed;
+		}
+		std::cout << std::left << std::setw(10) << san.filters().filter_url_replace.size() << std::setw(12) << (san.filters().prefilter_url_replace ? "yes" : "no") << std::right
+			<< std::setw(14) << std::fixed << std::setprecision(0) << (urls.size() / bestrun) << "\n";
+	}
+	if (1 == sink) std::cerr << "";
+
+	return result;
+}
+
+static int bench_pcre(int argc, char **argv) {
+	int iterations = 20, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (argc - optind < 2) syntax();
+
+	bool jit = pcreJit();
+	TorrentSanitize san;
+	san.setUrlCacheEntries(0);
+	double start = now();
+	if (!san.loadUrlConfig(argv[optind])) return 1;
+	std::cout << "url filter loaded in " << std::fixed << std::setprecision(3) << (now() - start) << " s (jit " << (jit ? "available" : "not available") << ")\n";
+
+	std::vector<std::string> urls;
+	for (int i = optind + 1; i < argc; i++) {
+		std::ifstream in(argv[i]);
+		std::string l;
+		while (std::getline(in, l)) if (!l.empty()) urls.push_back(l);
+	}
+	if (urls.empty()) syntax();
+
+	int result = 0;
+	std::vector< std::vector<AnnounceUrl> > expected;
+	setPCREJit(false);
+	for (size_t i = 0; i < urls.size(); i++) expected.push_back(san.filterUrl(urls[i]));
+	setPCREJit(true);
+	for (size_t i = 0; i < urls.size(); i++) {
+		if (expected[i] != san.filterUrl(urls[i])) {
+			std::cerr << "jit and interpreter differ for '" << urls[i] << "'\n";
+			result = 1;
+		}
+	}
+	std::cout << urls.size() << " urls checked\n";
+
+	/* the complete filter, and only the whitelist and blacklist patterns */
+	std::cout << std::left << std::setw(14) << "matching" << std::right << std::setw(14) << "filterUrl/s" << std::setw(14) << "patterns/s" << "\n";
+	size_t sink = 0;
+	for (int k = 0; k < 2; k++) {
+		setPCREJit(1 == k);
+		double best[2] = { -1, -1 };
+		for (int it = 0; it < iterations; it++) {
+			for (int m = 0; m < 2; m++) {
+				start = now();
+				for (size_t i = 0; i < urls.size(); i++) {
+					if (0 == m) {
+						sink += san.filterUrl(urls[i]).size();
+					} else {
+						sink += san.filters().filter_url_whitelist.matches(urls[i]) + san.filters().filter_url_blacklist.matches(urls[i]);
+					}
+				}
+				double elapsed = now() - start;
+				if (best[m] < 0 || elapsed < best[m]) best[m] = elapsed;
+			}
+		}
+		std::cout << std::left << std::setw(14) << (k ? "jit" : "interpreter") << std::right << std::setprecision(0)
+			<< std::setw(14) << (urls.size() / best[0]) << std::setw(14) << (urls.size() / best[1]) << "\n";
+	}
+	if (1 == sink) std::cerr << "";
+
+	setPCREJit(jit);
+	return result;
+}
+
+static int bench_urlcache(int argc, char **argv) {
+	int iterations = 20, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (argc - optind < 2) syntax();
+	std::string filter(argv[optind]);
+
+	std::vector<std::string> urls;
+	for (int i = optind + 1; i < argc; i++) {
+		std::ifstream in(argv[i]);
+		std::string l;
+		while (std::getline(in, l)) if (!l.empty()) urls.push_back(l);
+	}
+	if (urls.empty()) syntax();
+
+	char cachefile[] = "/tmp/torrent-bench-cache-XXXXXX";
+	int fd = ::mkstemp(cachefile);
+	if (-1 == fd) {
+		std::cerr << "Cannot create temporary file: " << ::strerror(errno) << "\n";
+		return 1;
+	}
+	::close(fd);
+
+	/* uncached, lru, file only (filled by another instance), file with a changed config */
+	TorrentSanitize plain, lru, writer, reader, changed;
+	plain.setUrlCacheEntries(0);
+	writer.setUrlCacheEntries(0);
+	reader.setUrlCacheEntries(0);
+	changed.setUrlCacheEntries(0);
+	std::vector<std::string> comment(1, "# changed");
+	if (!loadRewriteConfig(plain, filter, std::vector<std::string>()) || !loadRewriteConfig(lru, filter, std::vector<std::string>())
+			|| !loadRewriteConfig(writer, filter, std::vector<std::string>()) || !loadRewriteConfig(reader, filter, std::vector<std::string>())
+			|| !loadRewriteConfig(changed, filter, comment)
+			|| !writer.openUrlCache(cachefile) || !reader.openUrlCache(cachefile) || !changed.openUrlCache(cachefile)) {
+		::unlink(cachefile);
+		return 1;
+	}
+
+	int result = 0;
+	for (size_t i = 0; i < urls.size(); i++) writer.filterUrl(urls[i]);
+	for (size_t i = 0; i < urls.size(); i++) {
+		if (plain.filterUrl(urls[i]) != changed.filterUrl(urls[i])) {
+			std::cerr << "result with changed config differs for '" << urls[i] << "'\n";
+			result = 1;
+		}
+	}
+	size_t changed_hits = changed.urlCache().fileHits();
+	if (0 != changed_hits) {
+		std::cerr << "results of the old config were used\n";
+		result = 1;
+	}
+	for (size_t i = 0; i < urls.size(); i++) {
+		std::vector<AnnounceUrl> expected = plain.filterUrl(urls[i]);
+		for (int pass = 0; pass < 2; pass++) {
+			if (expected != lru.filterUrl(urls[i]) || expected != reader.filterUrl(urls[i])) {
+				std::cerr << "cached result differs for '" << urls[i] << "'\n";
+				result = 1;
+			}
+		}
+	}
+	std::cout << urls.size() << " urls checked; lru: " << lru.urlCache().hits() << " hits, "
+		<< "file: " << reader.urlCache().fileHits() << " hits, " << reader.urlCache().misses() << " misses (collisions or too large); "
+		<< "changed config: " << changed_hits << " hits\n";
+
+	std::cout << std::left << std::setw(14) << "cache" << std::right << std::setw(14) << "urls/s" << "\n";
+	size_t sink = 0;
+	for (int k = 0; k < 3; k++) {
+		TorrentSanitize &san = (0 == k) ? plain : (1 == k) ? lru : reader;
+		double bestrun = -1;
+		for (int it = 0; it < iterations; it++) {
+			double start = now();
+			for (size_t i = 0; i < urls.size(); i++) sink += san.filterUrl(urls[i]).size();
+			double elapsed = now() - start;
+			if (bestrun < 0 || elapsed < bestrun) bestrun = elapsed;
+		}
+		std::cout << std::left << std::setw(14) << (0 == k ? "none" : 1 == k ? "lru" : "file") << std::right
+			<< std::setw(14) << std::fixed << std::setprecision(0) << (urls.size() / bestrun) << "\n";
+	}
+	if (1 == sink) std::cerr << "";
+
+	::unlink(cachefile);
+	return result;
+}
+
+/* basicUrlCleaner before canonicalUrl(), the reference for bench_canonical */
+template<class InputIterator, class T>
+static InputIterator find_last ( InputIterator first, InputIterator last, const T& value ) {
+	for (InputIterator it = last; it-- != first; ) if ( *it==value ) return it;
+	return last;
+}
+
+template<class InputIterator, class Predicate>
+static bool verify_all ( InputIterator first, InputIterator last, Predicate pred ) {
+	for ( ; first!=last ; first++ ) if ( !pred(*first) ) return false;
+	return true;
+}
+
+/* [ protocol, domain, "" | ":"+port, path ] or [] if no protocol was found */
+static bool referenceSplitUrl(const std::string &url, std::string &protocol, std::string &domain, std::string &port, std::string &path) {
+	/* http://stackoverflow.com/questions/2616011/easy-way-to-parse-a-url-in-c-cross-platform */
+	const std::string prot_end("://");
+
+	std::string::const_iterator prot_i = std::search(url.begin(), url.end(), prot_end.begin(), prot_end.end());
+
+	if (url.end() == prot_i) return false;
+
+	/* protocol */
+	protocol.clear();
+	protocol.reserve(distance(url.begin(), prot_i));
+	std::transform(url.begin(), prot_i, std::back_inserter(protocol), tolower);
+
+	std::advance(prot_i, prot_end.length());
+
+	std::string::const_iterator path_i = std::find(prot_i, url.end(), '/');
+	std::string::const_iterator port_i = find_last(prot_i, path_i, ':');
+
+	if (path_i == port_i) {
+		/* domain */
+		domain.clear();
+		domain.reserve(distance(prot_i, path_i));
+		std::transform(prot_i, path_i, std::back_inserter(domain), tolower);
+		/* empty port */
+		port.clear();
+	} else {
+		/* domain */
+		domain.clear();
+		domain.reserve(distance(prot_i, port_i));
+		std::transform(prot_i, port_i, std::back_inserter(domain), tolower);
+
+		/* port */
+		port.clear();
+		port.reserve(distance(port_i, path_i));
+		std::transform(port_i, path_i, std::back_inserter(port), tolower);
+	}
+
+	/* path */
+	path.assign(path_i, url.end());
+
+	return true;
+}
+
+/* check lowercase domains without trailing dot */
+static bool referenceValidDomain(const std::string &domain, std::string &domtld) {
+	const size_t dlen = domain.length();
+	const char *dom = domain.c_str();
+
+	if (0 == dlen) return false;
+	if ('.' == dom[dlen-1]) return false;
+
+	if ('[' == dom[0]) {
+		/* IPv6 address */
+		if (dlen < 4) return false; // minimal v6 addr: [::]
+		if (']' != dom[dlen-1]) return false;
+		for (size_t i = dlen - 2; i > 1; i--) if (':' != dom[i] && !isxdigit(dom[i])) return false;
+
+		domtld = domain;
+		return true;
+	}
+
+	size_t dot;
+	dot = domain.find_last_of('.');
+	if (std::string::npos != dot && isdigit(dom[dot+1])) {
+		/* IPv4 address */
+		long octet;
+		char *domnext = NULL;
+
+		for (size_t i = dlen; i-- > 0; ) if ('.' != dom[i] && !isdigit(dom[i])) return false;
+
+		for (size_t i = 0; i < 3; i++) {
+			octet = strtol(dom, &domnext, 10);
+			if ('.' != *domnext || domnext == dom || domnext - dom > 3 || octet < 0 || octet > 255) return false;
+			dom = domnext + 1;
+		}
+		octet = strtol(dom, &domnext, 10);
+		if ('\0' != *domnext || domnext == dom || domnext - dom > 3 || octet < 0 || octet > 255) return false;
+
+		domtld = domain;
+		return true;
+	}
+
+	/* standard domain name */
+
+	size_t i = 0;
+	while (i < dlen) {
+		if (!isalnum(dom[i]) && '_' != dom[i]) return false; /* labels must start with letter/digit, accept _ too */
+		i++;
+		while (i < dlen && dom[i] != '.') {
+			if (!isalnum(dom[i]) && '-' != dom[i] && '_' != dom[i]) return false;
+			i++;
+		}
+		i++;
+	}
+
+	if (std::string::npos != dot) dot = domain.find_last_of('.', dot-1);
+	if (std::string::npos == dot) { dot = 0; } else { dot++; }
+
+	domtld = domain.substr(dot);
+
+	return true;
+}
+
+static bool referenceUrlCleaner(const std::string &url, AnnounceUrl &annurl) {
+	std::string protocol, domain, port, path;
+	if (stringHasPrefix(url, "dht://")) return false; /* drop dht urls - fallback if no other url is found */
+	if (!referenceSplitUrl(url, protocol, domain, port, path)) return false; /* not an url */
+
+	if (!verify_all(protocol.begin(), protocol.end(), isalnum)) return false; /* protocol only a-z0-9 */
+
+	/* remove trailing dot (the old code read domain[-1] for empty domains) */
+	if (!domain.empty() && '.' == domain[domain.length()-1]) domain.resize(domain.length() - 1);
+
+	long portnum = 0;
+
+	if (port == ":") port.clear();
+	if (port.length() > 6) return false; /* max length: ":65536" */
+	if (!port.empty()) {
+		if (!verify_all(port.begin()+1, port.end(), isdigit)) return false; /* only digits */
+
+		portnum = strtol(port.c_str() + 1, NULL, 10); /* too short for overflow, only digits -> can't fail */
+		if (portnum >= 65536 || portnum < 0) portnum = 0; /* drop invalid port numbers */
+		port.clear();
+	}
+
+	if (protocol == "udp") {
+		path.clear(); /* ignore path */
+		if (0 == portnum) portnum = 80;  /* enforce port info, default to port 80 */
+	} else if (protocol == "http") {
+		if (80 == portnum) portnum = 0; /* remove default port */
+		if (path.empty()) path = "/";
+	} else if (protocol == "https") {
+		if (443 == portnum) portnum = 0; /* remove default port */
+		if (path.empty()) path = "/";
+	}
+
+	/* validate path */
+	while (path.length() > 1 && '/' == path[1]) path = path.substr(1); /* remove doubled leading '/' */
+	for (size_t i = path.length(); i-- > 0; ) {
+		if (!isalnum(path[i])) {
+			switch (path[i]) {
+			case '%':
+			case '&':
+			case '+':
+			case '-':
+			case '.':
+			case '/':
+			case ':':
+			case '=':
+			case '?':
+			case '_':
+				break;
+			default:
+				return false;
+			}
+		}
+	}
+
+	if (!referenceValidDomain(domain, annurl.domain)) return false;
+
+	std::stringstream outurl;
+	outurl << protocol << "://" << domain;
+	if (portnum != 0) outurl << ":" << portnum;
+	outurl << path;
+
+	annurl.url = outurl.str();
+	return true;
+}
+
+/* urls near the edge cases: protocols, ipv4/ipv6 hosts, ports, paths */
+static std::string randomAnnounceUrl() {
+	const char *protocols[] = { "http", "https", "udp", "HTTP", "Udp", "wss", "", "h-t", "dht" };
+	const char *ports[] = { "", ":", ":0", ":80", ":443", ":6969", ":065535", ":65535", ":65536", ":123456", ":8a" };
+	const char *paths[] = { "", "/", "//", "///announce", "/announce", "/announce.php?passkey=", "/a b", "/%41&x=1+2", "/~user", "/#frag" };
+	std::string host;
+	switch (nextRandom() % 6) {
+	case 0:
+	case 1:
+		host = randomDomain();
+		break;
+	case 2:
+		for (int i = 0; i < 4; i++) {
+			static const char *octets[] = { "0", "1", "10", "127", "255", "256", "0001", "" };
+			if (i > 0) host += '.';
+			host += octets[nextRandom() % 8];
+		}
+		break;
+	case 3:
+		{
+			static const char *v6[] = { "[::]", "[::1]", "[2001:DB8::1]", "[x::1]", "[::g]", "[:]", "[]", "::1" };
+			host = v6[nextRandom() % 8];
+		}
+		break;
+	case 4:
+		host = randomLabel();
+		break;
+	default:
+		host = randomDomain() + ".";
+		break;
+	}
+	std::string url = std::string(protocols[nextRandom() % 9]) + "://" + host + ports[nextRandom() % 11] + paths[nextRandom() % 10];
+	if (0 == nextRandom() % 3) url += randomString().substr(0, 24);
+	return url;
+}
+
+/* replaces, inserts or deletes a few bytes */
+static std::string mutateUrl(std::string url) {
+	static const char interesting[] = "Az09.:/[]_-%?=&+#@~ \x80\xff";
+	for (unsigned int n = 1 + nextRandom() % 3; n > 0; n--) {
+		char c = (0 == nextRandom() % 16) ? '\0' : interesting[nextRandom() % (sizeof(interesting) - 1)];
+		size_t pos = url.empty() ? 0 : nextRandom() % url.length();
+		switch (nextRandom() % 3) {
+		case 0:
+			if (!url.empty()) url[pos] = c;
+			break;
+		case 1:
+			url.insert(pos, 1, c);
+			break;
+		default:
+			if (!url.empty()) url.erase(pos, 1);
+			break;
+		}
+	}
+	return url;
+}
+
+static int bench_canonical(int argc, char **argv) {
+	int iterations = 20, random = 200000, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:r:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 'r':
+			random = atoi(optarg);
+			if (random < 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (argc - optind < 2) syntax();
+
+	TorrentSanitize san;
+	san.setUrlCacheEntries(0);
+	if (!san.loadUrlConfig(argv[optind])) return 1;
+
+	/* the corpus, the added trackers and everything the rewrite rules make of the corpus */
+	std::vector<std::string> urls;
+	for (int i = optind + 1; i < argc; i++) {
+		std::ifstream in(argv[i]);
+		std::string l;
+		while (std::getline(in, l)) if (!l.empty()) urls.push_back(l);
+	}
+	if (urls.empty()) syntax();
+	urls.insert(urls.end(), san.filters().additional_announce_urls.begin(), san.filters().additional_announce_urls.end());
+	std::vector<std::string> rewrites;
+	for (size_t i = 0, n = urls.size(); i < n; i++) {
+		for (size_t r = 0; r < san.filters().filter_url_replace.size(); r++) {
+			if (san.filters().filter_url_replace[r].replaceFull(urls[i], rewrites)) urls.insert(urls.end(), rewrites.begin(), rewrites.end());
+		}
+	}
+	const size_t corpus = urls.size();
+
+	std::vector<std::string> checked(urls);
+	for (int i = 0; i < random; i++) {
+		switch (nextRandom() % 3) {
+		case 0: checked.push_back(randomAnnounceUrl()); break;
+		case 1: checked.push_back(mutateUrl(randomAnnounceUrl())); break;
+		default: checked.push_back(mutateUrl(urls[nextRandom() % corpus])); break;
+		}
+	}
+
+	int result = 0;
+	size_t accepted = 0;
+	for (size_t i = 0; i < checked.size(); i++) {
+		AnnounceUrl expected, got;
+		bool ok = referenceUrlCleaner(checked[i], expected);
+		if (ok != san.basicUrlCleaner(checked[i], got) || (ok && (expected.url != got.url || expected.domain != got.domain))) {
+			std::cerr << "canonicalUrl differs for '" << checked[i] << "': '" << expected.url << "' (" << expected.domain << ") != '"
+				<< got.url << "' (" << got.domain << ")\n";
+			result = 1;
+		}
+		if (ok) accepted++;
+	}
+	std::cout << checked.size() << " urls checked (" << corpus << " from the corpus and rewrites), " << accepted << " valid\n";
+
+	std::cout << std::left << std::setw(14) << "cleaner" << std::right << std::setw(14) << "urls/s" << "\n";
+	size_t sink = 0;
+	for (int k = 0; k < 2; k++) {
+		double bestrun = -1;
+		AnnounceUrl annurl;
+		for (int it = 0; it < iterations; it++) {
+			double start = now();
+			for (size_t i = 0; i < corpus; i++) {
+				sink += k ? san.basicUrlCleaner(urls[i], annurl) : referenceUrlCleaner(urls[i], annurl);
+			}
+			double elapsed = now() - start;
+			if (bestrun < 0 || elapsed < bestrun) bestrun = elapsed;
+		}
+		std::cout << std::left << std::setw(14) << (k ? "canonicalUrl" : "old") << std::right
+			<< std::setw(14) << std::fixed << std::setprecision(0) << (corpus / bestrun) << "\n";
+	}
+	if (1 == sink) std::cerr << "";
+
+	return result;
+}
+
+static int bench_filterload(int argc, char **argv) {
+	int iterations = 20, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (argc - optind < 2) syntax();
+
+	std::string content;
+	if (!readFile(argv[optind], content)) {
+		std::cerr << "Cannot read '" << argv[optind] << "'\n";
+		return 1;
+	}
+	std::vector<std::string> urls;
+	for (int i = optind + 1; i < argc; i++) {
+		std::ifstream in(argv[i]);
+		std::string l;
+		while (std::getline(in, l)) if (!l.empty()) urls.push_back(l);
+	}
+	if (urls.empty()) syntax();
+
+	char dir[] = "/tmp/torrent-bench-XXXXXX";
+	if (0 == ::mkdtemp(dir)) {
+		std::cerr << "Cannot create temporary directory: " << ::strerror(errno) << "\n";
+		return 1;
+	}
+	const std::string text = std::string(dir) + "/url-filter", compiled = text + ".compiled";
+	if (!writeFile(text, content) || !FilterSet::compileUrlConfig(text, compiled)) {
+		::unlink(text.c_str());
+		::rmdir(dir);
+		return 1;
+	}
+
+	int result = 0;
+	TorrentSanitize plain, fast;
+	plain.setUrlCacheEntries(0);
+	fast.setUrlCacheEntries(0);
+	if (!plain.loadUrlConfig(text) || !fast.loadUrlConfig(compiled) || !fast.urlConfigCompiled()) {
+		std::cerr << "cannot load the compiled config\n";
+		result = 1;
+	}
+	if (plain.urlCache().fingerprint() != fast.urlCache().fingerprint()) {
+		std::cerr << "the compiled config has another url cache fingerprint\n";
+		result = 1;
+	}
+	for (size_t i = 0; i < urls.size(); i++) {
+		if (plain.filterUrl(urls[i]) != fast.filterUrl(urls[i])) {
+			std::cerr << "compiled config result differs for '" << urls[i] << "'\n";
+			result = 1;
+		}
+	}
+
+	/* new mtime, same content: still valid */
+	TorrentSanitize touched;
+	if (!writeFile(text, content) || !touched.loadUrlConfig(compiled) || !touched.urlConfigCompiled()) {
+		std::cerr << "compiled config not used after touching the text config\n";
+		result = 1;
+	}
+	/* changed content: the text config is loaded instead */
+	TorrentSanitize changed, changed_text;
+	changed.setUrlCacheEntries(0);
+	changed_text.setUrlCacheEntries(0);
+	const std::string rule = "\n(udp://)bench-changed\\.invalid(:.*) \\1tracker.invalid\\2\n";
+	if (!writeFile(text, content + rule) || !changed.loadUrlConfig(compiled) || changed.urlConfigCompiled()
+			|| !changed_text.loadUrlConfig(text)) {
+		std::cerr << "compiled config used after changing the text config\n";
+		result = 1;
+	}
+	urls.push_back("udp://bench-changed.invalid:80/announce");
+	for (size_t i = 0; i < urls.size(); i++) {
+		if (changed.filterUrl(urls[i]) != changed_text.filterUrl(urls[i])) {
+			std::cerr << "result after changing the text config differs for '" << urls[i] << "'\n";
+			result = 1;
+		}
+	}
+	urls.pop_back();
+	writeFile(text, content);
+	FilterSet::compileUrlConfig(text, compiled);
+	std::cout << urls.size() << " urls checked\n";
+
+	std::cout << std::left << std::setw(14) << "config" << std::right << std::setw(14) << "load ms" << "\n";
+	for (int k = 0; k < 2; k++) {
+		double bestrun = -1;
+		for (int it = 0; it < iterations; it++) {
+			TorrentSanitize san;
+			double start = now();
+			if (!san.loadUrlConfig(k ? compiled : text)) result = 1;
+			double elapsed = now() - start;
+			if (bestrun < 0 || elapsed < bestrun) bestrun = elapsed;
+		}
+		std::cout << std::left << std::setw(14) << (k ? "compiled" : "text") << std::right
+			<< std::setw(14) << std::fixed << std::setprecision(3) << (1000 * bestrun) << "\n";
+	}
+
+	::unlink(compiled.c_str());
+	::unlink(text.c_str());
+	::rmdir(dir);
+	return result;
+}
+
+/* AnnounceList before the flat layout, the reference for bench_announce */
+class ReferenceAnnounceList {
+public:
+	ReferenceAnnounceList(const TorrentSanitize &san) : m_san(san) { }
+
+	void merge(std::string url) {
+		std::vector<AnnounceUrl> annurls;
+		annurls = m_san.filterUrl(url);
+
+		for (size_t i = 0; i < annurls.size(); i++)
+			add(annurls[i].domain, annurls[i].url);
+	}
+
+	template<typename T> void merge(std::vector< T > urllist) {
+		for (size_t i = 0; i < urllist.size(); i++) merge(urllist[i]);
+	}
+
+	std::vector< std::vector< std::string > > list;
+
+private:
+	const TorrentSanitize &m_san;
+
+	typedef std::map< std::string, size_t > GroupIndex;
+	GroupIndex m_index;
+
+	void add(const std::string &domain, const std::string &url) {
+		GroupIndex::iterator it;
+		it = m_index.find(domain);
+		if (m_index.end() == it || it->second >= list.size()) {
+			m_index.insert(std::make_pair( domain, list.size() ));
+			std::vector<std::string> l;
+			l.push_back(url);
+			list.push_back(l);
+		} else {
+			std::vector<std::string> &l = list[it->second];
+			if (l.end() == std::find(l.begin(), l.end(), url)) l.push_back(url);
+		}
+	}
+};
+
+struct AnnounceSource {
+	std::string announce;
+	std::vector< std::vector<std::string> > tiers;
+};
+
+static int bench_announce(int argc, char **argv) {
+	int iterations = 20, sources = 50, trackers = 300, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:s:t:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 's':
+			sources = atoi(optarg);
+			if (sources <= 0) syntax();
+			break;
+		case 't':
+			trackers = atoi(optarg);
+			if (trackers <= 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+
+	TorrentSanitize san;
+	if (optind < argc && !san.loadUrlConfig(argv[optind])) return 1;
+
+	/* sources share most of their trackers: 2 * trackers urls on trackers / 3 domains */
+	std::vector<std::string> domains, pool;
+	for (int i = 0; i < trackers / 3 + 1; i++) domains.push_back(randomDomain());
+	for (int i = 0; i < 2 * trackers; i++) {
+		std::ostringstream url;
+		url << (0 == nextRandom() % 2 ? "udp://" : "http://") << "tracker" << (nextRandom() % 3) << "." << domains[nextRandom() % domains.size()]
+			<< ":" << (1000 + nextRandom() % 9000) << "/announce";
+		pool.push_back(url.str());
+	}
+	std::vector<AnnounceSource> input(sources);
+	for (int s = 0; s < sources; s++) {
+		input[s].announce = pool[nextRandom() % pool.size()];
+		for (int n = 0; n < trackers; ) {
+			std::vector<std::string> tier;
+			for (int k = 1 + nextRandom() % 5; k > 0 && n < trackers; k--, n++) tier.push_back(pool[nextRandom() % pool.size()]);
+			input[s].tiers.push_back(tier);
+		}
+	}
+
+	ReferenceAnnounceList reference(san);
+	AnnounceList flat(san);
+	for (int s = 0; s < sources; s++) {
+		reference.merge(input[s].announce);
+		reference.merge(input[s].tiers);
+		flat.merge(input[s].announce);
+		flat.merge(input[s].tiers);
+	}
+	int result = 0;
+	size_t urls = 0;
+	for (size_t t = 0; t < reference.list.size(); t++) urls += reference.list[t].size();
+	if (reference.list != flat.list()) {
+		std::cerr << "announce lists differ\n";
+		result = 1;
+	}
+	std::cout << sources << " sources with " << trackers << " trackers: " << reference.list.size() << " tiers, " << urls << " urls\n";
+
+	/* merging everything and getting the announce-list; the url filter results are cached */
+	std::cout << std::left << std::setw(14) << "list" << std::right << std::setw(14) << "merge ms" << std::setw(14) << "allocations" << "\n";
+	for (int k = 0; k < 2; k++) {
+		double bestrun = -1;
+		size_t allocations = 0;
+		for (int it = 0; it < iterations; it++) {
+			std::vector< std::vector<std::string> > list;
+			size_t before = s_allocations;
+			double start = now();
+			if (0 == k) {
+				ReferenceAnnounceList merged(san);
+				for (int s = 0; s < sources; s++) {
+					merged.merge(input[s].announce);
+					merged.merge(input[s].tiers);
+				}
+				list.swap(merged.list);
+			} else {
+				AnnounceList merged(san);
+				for (int s = 0; s < sources; s++) {
+					merged.merge(input[s].announce);
+					merged.merge(input[s].tiers);
+				}
+				merged.copyTo(list);
+			}
+			double elapsed = now() - start;
+			allocations = s_allocations - before;
+			if (bestrun < 0 || elapsed < bestrun) bestrun = elapsed;
+		}
+		std::cout << std::left << std::setw(14) << (k ? "flat" : "old") << std::right
+			<< std::setw(14) << std::fixed << std::setprecision(3) << (1000 * bestrun) << std::setw(14) << allocations << "\n";
+	}
+
+	return result;
+}
+
+/* directory of the torrent-bench binary: the other tools are built there */
+static std::string toolDirectory() {
+	char path[4096];
+	ssize_t len = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (len <= 0) return ".";
+	std::string dir(path, len);
+	std::string::size_type slash = dir.rfind('/');
+	return (std::string::npos == slash) ? "." : dir.substr(0, slash);
+}
+
+/* fork/exec like a web frontend would, stdout to /dev/null; pid of the child or -1 */
+static pid_t startTool(const std::vector<std::string> &args) {
+	std::vector<char*> argv;
+	for (size_t i = 0; i < args.size(); i++) argv.push_back(const_cast<char*>(args[i].c_str()));
+	argv.push_back(0);
+
+	pid_t pid = ::fork();
+	if (-1 == pid) {
+		int e = errno;
+		std::cerr << "Cannot fork: " << ::strerror(e) << std::endl;
+		return -1;
+	}
+	if (0 == pid) {
+		int null = ::open("/dev/null", O_WRONLY);
+		if (-1 != null) ::dup2(null, 1);
+		::execv(argv[0], &argv[0]);
+		::_exit(127);
+	}
+	return pid;
+}
+
+static bool waitTool(pid_t pid) {
+	int status;
+	while (-1 == ::waitpid(pid, &status, 0)) {
+		if (EINTR != errno) return false;
+	}
+	return WIFEXITED(status) && 0 == WEXITSTATUS(status);
+}
+
+static bool runTool(const std::vector<std::string> &args) {
+	pid_t pid = startTool(args);
+	return -1 != pid && waitTool(pid);
+}
+
+/* one request on a new connection */
+static bool daemonRequest(const std::string &socket, const DaemonMessage &req, DaemonMessage &reply) {
+	int fd = connectDaemonSocket(socket);
+	if (-1 == fd) return false;
+	bool eof, ok = writeDaemonMessage(fd, req) && readDaemonMessage(fd, reply, eof);
+	::close(fd);
+	if (ok && DAEMON_OK != reply.type) {
+		std::cerr << "torrent-sanitized: " << (reply.fields.empty() ? std::string("invalid reply") : reply.fields[0]) << std::endl;
+		ok = false;
+	}
+	return ok;
+}
+
+struct LoadClient {
+	bool use_daemon;
+	std::string socket;
+	std::vector<std::string> command; /* torrent-sanitize -s ... infile output */
+	std::vector<std::string> files;
+	size_t first, requests;
+
+	std::vector<double> latencies;
+	bool ok;
+};
+
+static void* loadClient(void *arg) {
+	LoadClient &c = *(LoadClient*) arg;
+	c.ok = true;
+	std::vector<std::string> command = c.command;
+	DaemonMessage req(DAEMON_SANITIZE), reply;
+	req.fields.push_back(command.back());
+	req.fields.push_back(std::string());
+	for (size_t i = 0; i < c.requests && c.ok; i++) {
+		const std::string &file = c.files[(c.first + i) % c.files.size()];
+		double start = now();
+		if (c.use_daemon) {
+			req.fields[1] = file;
+			c.ok = daemonRequest(c.socket, req, reply);
+		} else {
+			command[command.size() - 2] = file;
+			c.ok = runTool(command);
+		}
+		c.latencies.push_back(now() - start);
+	}
+	return 0;
+}
+
+static int bench_daemon(int argc, char **argv) {
+	int requests = 200, clients = 4, opt;
+	std::string tools = toolDirectory(), filter;
+
+	while (-1 != (opt = getopt(argc, argv, "n:c:e:f:"))) {
+		switch (opt) {
+		case 'n':
+			requests = atoi(optarg);
+			if (requests <= 0) syntax();
+			break;
+		case 'c':
+			clients = atoi(optarg);
+			if (clients <= 0) syntax();
+			break;
+		case 'e':
+			tools = optarg;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (optind >= argc) syntax();
+	std::vector<std::string> files(argv + optind, argv + argc);
+
+	char tmpl[] = "/tmp/torrent-bench.XXXXXX";
+	if (0 == ::mkdtemp(tmpl)) {
+		int e = errno;
+		std::cerr << "Cannot create temporary directory: " << ::strerror(e) << std::endl;
+		return 1;
+	}
+	const std::string dir(tmpl), socket = dir + "/socket";
+
+	std::vector<std::string> daemon_cmd, sanitize_cmd;
+	daemon_cmd.push_back(tools + "/torrent-sanitized");
+	sanitize_cmd.push_back(tools + "/torrent-sanitize");
+	sanitize_cmd.push_back("-s");
+	if (!filter.empty()) {
+		daemon_cmd.push_back("--url-filter");
+		daemon_cmd.push_back(filter);
+		sanitize_cmd.push_back("--url-filter");
+		sanitize_cmd.push_back(filter);
+	}
+	daemon_cmd.push_back(socket);
+
+	pid_t daemon = startTool(daemon_cmd);
+	if (-1 == daemon) return 1;
+	for (int i = 0; i < 1000 && 0 != ::access(socket.c_str(), F_OK); i++) ::usleep(10000);
+	::usleep(10000); /* bind() comes before listen() */
+
+	/* results must be identical to the tools */
+	int result = 0;
+	std::vector<std::string> cleanup;
+	for (size_t i = 0; i < files.size(); i++) {
+		const std::string &file = files[i];
+		const std::string expected = dir + "/expected", written = dir + "/written", merged = dir + "/merged";
+		cleanup.push_back(expected);
+		cleanup.push_back(written);
+		cleanup.push_back(merged);
+
+		std::vector<std::string> cmd = sanitize_cmd;
+		cmd.push_back(file);
+		cmd.push_back(expected);
+		DaemonMessage req(DAEMON_SANITIZE), data, reply;
+		req.fields.push_back(std::string());
+		req.fields.push_back(file);
+		std::string expected_content, written_content;
+		if (!runTool(cmd) || !readFile(expected, expected_content) || !daemonRequest(socket, req, data)) {
+			std::cerr << file << ": sanitize failed" << std::endl;
+			result = 1;
+			continue;
+		}
+		req.fields[0] = written;
+		if (!daemonRequest(socket, req, reply) || !readFile(written, written_content)) {
+			std::cerr << file << ": sanitize to file failed" << std::endl;
+			result = 1;
+			continue;
+		}
+		if (data.fields.size() != 2 || data.fields[1] != expected_content || written_content != expected_content) {
+			std::cerr << file << ": sanitized torrent differs from torrent-sanitize -s" << std::endl;
+			result = 1;
+		}
+
+		TorrentAnnounceInfo t;
+		DaemonMessage hash(DAEMON_HASH);
+		hash.fields.push_back(file);
+		if (!t.load(file) || !daemonRequest(socket, hash, reply) || reply.fields.size() != 1 || reply.fields[0] != t.infohash()) {
+			std::cerr << file << ": info hash differs" << std::endl;
+			result = 1;
+		}
+
+		/* merge all files into this one */
+		cmd.clear();
+		cmd.push_back(tools + "/torrent-merge");
+		if (!filter.empty()) {
+			cmd.push_back("-f");
+			cmd.push_back(filter);
+		}
+		cmd.push_back(merged);
+		DaemonMessage merge(DAEMON_MERGE);
+		merge.fields.push_back(std::string());
+		merge.fields.push_back(file);
+		for (size_t k = 0; k < files.size(); k++) {
+			cmd.push_back(files[k]);
+			merge.fields.push_back(files[k]);
+		}
+		std::string content;
+		if (!readFile(file, content) || !writeFile(merged, content) || !runTool(cmd) || !readFile(merged, content)
+				|| !daemonRequest(socket, merge, reply) || reply.fields.size() != 2 || reply.fields[1] != content) {
+			std::cerr << file << ": merged torrent differs from torrent-merge" << std::endl;
+			result = 1;
+		}
+	}
+
+	/* sanitize requests writing a file, from -c clients at once */
+	if (0 == result) {
+		std::cout << requests << " sanitize requests from " << clients << " clients\n";
+		std::cout << std::left << std::setw(14) << "method" << std::right << std::setw(12) << "req/s"
+			<< std::setw(12) << "mean ms" << std::setw(12) << "p50 ms" << std::setw(12) << "p99 ms" << "\n";
+	}
+	for (int k = 0; k < 2 && 0 == result; k++) {
+		std::vector<LoadClient> load(clients);
+		std::vector<pthread_t> threads(clients);
+		std::vector<double> latencies;
+		double start = now();
+		for (int i = 0; i < clients; i++) {
+			std::ostringstream output;
+			output << dir << "/output." << i;
+			cleanup.push_back(output.str());
+			load[i].use_daemon = (1 == k);
+			load[i].socket = socket;
+			load[i].command = sanitize_cmd;
+			load[i].command.push_back(std::string());
+			load[i].command.push_back(output.str());
+			load[i].files = files;
+			load[i].first = i;
+			load[i].requests = requests / clients + (i < requests % clients ? 1 : 0);
+			if (0 != ::pthread_create(&threads[i], NULL, loadClient, &load[i])) {
+				std::cerr << "Cannot start client thread" << std::endl;
+				return 1;
+			}
+		}
+		for (int i = 0; i < clients; i++) {
+			::pthread_join(threads[i], NULL);
+			if (!load[i].ok) result = 1;
+			latencies.insert(latencies.end(), load[i].latencies.begin(), load[i].latencies.end());
+		}
+		double elapsed = now() - start, sum = 0;
+		std::sort(latencies.begin(), latencies.end());
+		for (size_t i = 0; i < latencies.size(); i++) sum += latencies[i];
+		if (latencies.empty()) continue;
+		std::cout << std::left << std::setw(14) << (k ? "daemon" : "fork/exec") << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(12) << (latencies.size() / elapsed) << std::setprecision(3)
+			<< std::setw(12) << (1000 * sum / latencies.size())
+			<< std::setw(12) << (1000 * latencies[latencies.size() / 2])
+			<< std::setw(12) << (1000 * latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)]) << "\n";
+	}
+
+	::kill(daemon, SIGTERM);
+	if (!waitTool(daemon)) {
+		std::cerr << "torrent-sanitized didn't exit cleanly" << std::endl;
+		result = 1;
+	}
+	for (size_t i = 0; i < cleanup.size(); i++) ::unlink(cleanup[i].c_str());
+	::rmdir(dir.c_str());
+
+	return result;
+}
+
+static int bench_jobs(int argc, char **argv) {
+	int copies = 20, threads = 0, opt;
+	std::string tools = toolDirectory(), filter;
+
+	while (-1 != (opt = getopt(argc, argv, "n:t:e:f:"))) {
+		switch (opt) {
+		case 'n':
+			copies = atoi(optarg);
+			if (copies <= 0) syntax();
+			break;
+		case 't':
+			threads = atoi(optarg);
+			if (threads <= 0) syntax();
+			break;
+		case 'e':
+			tools = optarg;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (optind >= argc) syntax();
+	std::vector<std::string> files(argv + optind, argv + argc);
+	if (0 == threads) {
+		long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+
+	char tmpl[] = "/tmp/torrent-bench.XXXXXX";
+	if (0 == ::mkdtemp(tmpl)) {
+		int e = errno;
+		std::cerr << "Cannot create temporary directory: " << ::strerror(e) << std::endl;
+		return 1;
+	}
+	const std::string dir(tmpl), joblist = dir + "/jobs";
+
+	std::vector<std::string> sanitize_cmd;
+	sanitize_cmd.push_back(tools + "/torrent-sanitize");
+	if (!filter.empty()) {
+		sanitize_cmd.push_back("--url-filter");
+		sanitize_cmd.push_back(filter);
+	}
+
+	/* every file -n times, each job with its own output */
+	const size_t njobs = copies * files.size();
+	std::vector<std::string> cleanup;
+	cleanup.push_back(joblist);
+
+	std::cout << njobs << " sanitize jobs\n";
+	std::cout << std::left << std::setw(24) << "method" << std::right << std::setw(12) << "files/s" << std::setw(12) << "ms" << "\n";
+	int result = 0;
+	std::vector<std::string> expected(njobs);
+	const int runs[] = { 0, 1, threads };
+	for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]) && 0 == result; r++) {
+		if (r > 0 && runs[r] == runs[r-1]) continue;
+		std::vector<std::string> outputs;
+		std::string list;
+		for (size_t i = 0; i < njobs; i++) {
+			std::ostringstream output;
+			output << dir << "/out." << r << "." << i;
+			outputs.push_back(output.str());
+			cleanup.push_back(output.str());
+			list.append(files[i % files.size()]).push_back('\0');
+			list.append(output.str()).push_back('\0');
+			list.append("sanitize").push_back('\0');
+		}
+
+		double start = now();
+		if (0 == runs[r]) {
+			/* one process per file */
+			for (size_t i = 0; i < njobs && 0 == result; i++) {
+				std::vector<std::string> cmd = sanitize_cmd;
+				cmd.push_back("-s");
+				cmd.push_back(files[i % files.size()]);
+				cmd.push_back(outputs[i]);
+				if (!runTool(cmd)) {
+					std::cerr << files[i % files.size()] << ": torrent-sanitize -s failed" << std::endl;
+					result = 1;
+				}
+			}
+		} else {
+			std::ostringstream nthreads;
+			nthreads << runs[r];
+			std::vector<std::string> cmd = sanitize_cmd;
+			cmd.push_back("--batch");
+			cmd.push_back(joblist);
+			cmd.push_back("--threads");
+			cmd.push_back(nthreads.str());
+			if (!writeFile(joblist, list) || !runTool(cmd)) {
+				std::cerr << "torrent-sanitize --batch failed" << std::endl;
+				result = 1;
+			}
+		}
+		double elapsed = now() - start;
+
+		/* all runs must write the same torrents */
+		for (size_t i = 0; i < njobs && 0 == result; i++) {
+			std::string content;
+			if (!readFile(outputs[i], content)) {
+				result = 1;
+			} else if (0 == r) {
+				expected[i] = content;
+			} else if (content != expected[i]) {
+				std::cerr << outputs[i] << ": batch output differs from torrent-sanitize -s" << std::endl;
+				result = 1;
+			}
+		}
+
+		std::ostringstream name;
+		if (0 == runs[r]) name << "process per file"; else name << "batch, " << runs[r] << " thread" << (1 == runs[r] ? "" : "s");
+		std::cout << std::left << std::setw(24) << name.str() << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(12) << (njobs / elapsed) << std::setw(12) << (1000 * elapsed) << "\n";
+	}
+
+	for (size_t i = 0; i < cleanup.size(); i++) ::unlink(cleanup[i].c_str());
+	::rmdir(dir.c_str());
+
+	return result;
+}
+
+namespace {
+struct FilterRun {
+	const FilterSet *filters;
+	const std::vector<std::string> *urls;
+	const std::vector< std::vector<AnnounceUrl> > *expected;
+	int iterations;
+	bool reuse; /* one FilterScratch for all urls */
+	size_t differ;
+};
+}
+
+static void* filterWorker(void *arg) {
+	FilterRun &run = *(FilterRun*) arg;
+	const std::vector<std::string> &urls = *run.urls;
+	FilterScratch scratch;
+	std::vector<AnnounceUrl> annurls;
+	for (int it = 0; it < run.iterations; it++) {
+		for (size_t i = 0; i < urls.size(); i++) {
+			if (run.reuse) {
+				run.filters->filterUrl(urls[i], scratch, annurls);
+			} else {
+				annurls = run.filters->filterUrl(urls[i]);
+			}
+			if (annurls != (*run.expected)[i]) run.differ++;
+		}
+	}
+	return 0;
+}
+
+static int bench_filterset(int argc, char **argv) {
+	int iterations = 20, threads = 0, opt;
+
+	while (-1 != (opt = getopt(argc, argv, "n:t:"))) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0) syntax();
+			break;
+		case 't':
+			threads = atoi(optarg);
+			if (threads <= 0) syntax();
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (argc - optind < 2) syntax();
+	if (0 == threads) {
+		long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 1 ? cpus : 2;
+	}
+
+	std::vector<std::string> urls;
+	for (int i = optind + 1; i < argc; i++) {
+		std::ifstream in(argv[i]);
+		std::string l;
+		while (std::getline(in, l)) if (!l.empty()) urls.push_back(l);
+	}
+	if (urls.empty()) syntax();
+
+	TorrentSanitize san;
+	san.setUrlCacheEntries(0);
+	if (!san.loadUrlConfig(argv[optind])) return 1;
+
+	int result = 0;
+	std::vector< std::vector<AnnounceUrl> > expected;
+	for (size_t i = 0; i < urls.size(); i++) expected.push_back(san.filterUrl(urls[i]));
+
+	/* copy on write */
+	TorrentSanitize copy(san);
+	if (&copy.filters() != &san.filters()) {
+		std::cerr << "copy doesn't share the FilterSet\n";
+		result = 1;
+	}
+	copy.editFilters().additional_announce_urls.push_back("udp://tracker.example.com:80");
+	if (&copy.filters() == &san.filters() || copy.filters().additional_announce_urls.size() == san.filters().additional_announce_urls.size()) {
+		std::cerr << "changing a copy changed the shared FilterSet\n";
+		result = 1;
+	}
+	for (size_t i = 0; i < urls.size(); i++) {
+		if (expected[i] != copy.filterUrl(urls[i])) {
+			std::cerr << "copied FilterSet differs for '" << urls[i] << "'\n";
+			result = 1;
+		}
+	}
+
+	std::cout << urls.size() << " urls, " << threads << " threads\n";
+	std::cout << std::left << std::setw(10) << "threads" << std::setw(10) << "scratch" << std::right << std::setw(14) << "urls/s" << "\n";
+	for (int k = 0; k < 4 && 0 == result; k++) {
+		const int nthreads = (k / 2) ? threads : 1;
+		std::vector<FilterRun> runs(nthreads);
+		for (int t = 0; t < nthreads; t++) {
+			runs[t].filters = &san.filters();
+			runs[t].urls = &urls;
+			runs[t].expected = &expected;
+			runs[t].iterations = iterations;
+			runs[t].reuse = (1 == k % 2);
+			runs[t].differ = 0;
+		}
+
+		double start = now();
+		std::vector<pthread_t> workers;
+		for (int t = 1; t < nthreads; t++) {
+			pthread_t thread;
+			int e = ::pthread_create(&thread, NULL, filterWorker, &runs[t]);
+			if (0 != e) {
+				std::cerr << "Cannot start worker thread: " << ::strerror(e) << std::endl;
+				result = 1;
+				break;
+			}
+			workers.push_back(thread);
+		}
+		filterWorker(&runs[0]);
+		for (size_t t = 0; t < workers.size(); t++) ::pthread_join(workers[t], NULL);
+		double elapsed = now() - start;
+
+		for (int t = 0; t < nthreads; t++) {
+			if (0 != runs[t].differ) {
+				std::cerr << runs[t].differ << " results of thread " << t << " differ from a single thread\n";
+				result = 1;
+			}
+		}
+		std::cout << std::left << std::setw(10) << nthreads << std::setw(10) << (runs[0].reuse ? "reused" : "new") << std::right
+			<< std::setw(14) << std::fixed << std::setprecision(0) << (double(nthreads) * iterations * urls.size() / elapsed) << "\n";
+	}
+
+	return result;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) syntax();
+
+	std::string mode(argv[1]);
+	/* getopt starts at argv[1] == mode */
+	if (mode == "load") return bench_load(argc - 1, argv + 1);
+	if (mode == "batch") return bench_batch(argc - 1, argv + 1);
+	if (mode == "write") return bench_write(argc - 1, argv + 1);
+	if (mode == "serialize") return bench_serialize(argc - 1, argv + 1);
+	if (mode == "parse") return bench_parse(argc - 1, argv + 1);
+	if (mode == "utf8") return bench_utf8(argc - 1, argv + 1);
+	if (mode == "sha1") return bench_sha1(argc - 1, argv + 1);
+	if (mode == "verify") return bench_verify(argc - 1, argv + 1);
+	if (mode == "domains") return bench_domains(argc - 1, argv + 1);
+	if (mode == "rewrite") return bench_rewrite(argc - 1, argv + 1);
+	if (mode == "pcre") return bench_pcre(argc - 1, argv + 1);
+	if (mode == "urlcache") return bench_urlcache(argc - 1, argv + 1);
+	if (mode == "filterload") return bench_filterload(argc - 1, argv + 1);
+	if (mode == "canonical") return bench_canonical(argc - 1, argv + 1);
+	if (mode == "announce") return bench_announce(argc - 1, argv + 1);
+	if (mode == "daemon") return bench_daemon(argc - 1, argv + 1);
+	if (mode == "jobs") return bench_jobs(argc - 1, argv + 1);
+	if (mode == "filterset") return bench_filterset(argc - 1, argv + 1);
+
+	syntax();
+	return 100;
+}
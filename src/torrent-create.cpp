@@ -0,0 +1,316 @@
+/*
+   creates a torrent for a file or directory
+
+   the payload is read once as a stream (PieceHasher: one reader, a pool of
+   hash threads); announce urls go through the url filter like in
+   torrent-sanitize, and the result is checked by parsing it again.
+ */
+
+#include "common.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+}
+
+using namespace torrent;
+
+static void syntax() {
+	std::cerr << "Syntax: torrent-create [-a url]... [-f url-filter] [-c comment] [-p piece-KiB] [-t threads] [-P] [-D] [-n name] [-o out.torrent] path\n"
+		"\tcreates a torrent for a file or a directory (all regular files below it)\n"
+		"\n"
+		"\t\t-a: announce url (repeat for more; filtered with the url filter)\n"
+		"\t\t-f: url filter config\n"
+		"\t\t-c: comment\n"
+		"\t\t-p: piece length in KiB, power of two up to " << PieceHasher::MAX_PIECE_LENGTH / 1024 << " (default: chosen from the size)\n"
+		"\t\t-t: hash threads (default: one per cpu)\n"
+		"\t\t-P: private torrent\n"
+		"\t\t-D: no creation date (same payload gives the same file)\n"
+		"\t\t-n: torrent name (default: last component of path)\n"
+		"\t\t-o: output file (default: name.torrent)\n";
+	exit(100);
+}
+
+struct PayloadEntry {
+	std::vector<std::string> path; /* relative to the torrent root */
+	int64_t length;
+};
+
+struct NewTorrent {
+	std::string announce;
+	std::vector< std::vector< std::string > > announce_list;
+	std::string comment;
+	int64_t creation_date; /* 0: none */
+	std::string info; /* bencoded */
+
+	template<typename Out> void serialize(Out &out) const {
+		out.raw("d", 1);
+		bencode(out, "announce");
+		bencode(out, announce);
+		if (!announce_list.empty()) {
+			bencode(out, "announce-list");
+			bencode(out, announce_list);
+		}
+		if (!comment.empty()) {
+			bencode(out, "comment");
+			bencode(out, comment);
+		}
+		bencode(out, "created by");
+		bencode(out, "torrent-create");
+		if (0 != creation_date) {
+			bencode(out, "creation date");
+			bencode(out, creation_date);
+		}
+		bencode(out, "info");
+		out.raw(info.data(), info.length());
+		out.raw("e", 1);
+	}
+};
+
+/* regular files below dir, sorted by path; symlinks and special files are skipped */
+static bool walk(const std::string &dir, std::vector<std::string> &prefix, std::vector<PayloadEntry> &entries) {
+	DIR *d = ::opendir(dir.c_str());
+	if (0 == d) {
+		int e = errno;
+		std::cerr << "Cannot open directory '" << dir << "': " << ::strerror(e) << std::endl;
+		return false;
+	}
+	std::vector<std::string> names;
+	struct dirent *de;
+	while (0 != (de = ::readdir(d))) {
+		std::string name(de->d_name);
+		if (name != "." && name != "..") names.push_back(name);
+	}
+	::closedir(d);
+	/* bytewise, like the keys of a dict */
+	std::sort(names.begin(), names.end());
+
+	for (size_t i = 0; i < names.size(); i++) {
+		std::string path = dir + "/" + names[i];
+		struct stat st;
+		if (-1 == ::lstat(path.c_str(), &st)) {
+			int e = errno;
+			std::cerr << "Cannot stat '" << path << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		if (!validUTF8Text(names[i])) {
+			std::cerr << "Error: file name '" << path << "' is not valid utf-8 text" << std::endl;
+			return false;
+		}
+		prefix.push_back(names[i]);
+		if (S_ISDIR(st.st_mode)) {
+			if (!walk(path, prefix, entries)) return false;
+		} else if (S_ISREG(st.st_mode)) {
+			PayloadEntry entry = { prefix, st.st_size };
+			entries.push_back(entry);
+		} else {
+			std::cerr << "Skipping '" << path << "' (not a regular file)" << std::endl;
+		}
+		prefix.pop_back();
+	}
+	return true;
+}
+
+/* about 2000 pieces or less, between 16 KiB and 16 MiB */
+static int64_t autoPieceLength(int64_t total) {
+	int64_t piece_length = 16*1024;
+	while (piece_length < 16*1024*1024 && total / piece_length > 2000) piece_length *= 2;
+	return piece_length;
+}
+
+int main(int argc, char **argv) {
+	TorrentSanitize san;
+	std::vector<std::string> urls;
+	std::string comment, name, output;
+	int64_t piece_length = 0;
+	unsigned int threads = 0;
+	bool is_private = false, no_date = false;
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "a:f:c:p:t:PDn:o:"))) {
+		switch (opt) {
+		case 'a':
+			urls.push_back(optarg);
+			break;
+		case 'f':
+			if (!san.loadUrlConfig(optarg)) return 2;
+			break;
+		case 'c':
+			comment = optarg;
+			break;
+		case 'p':
+			piece_length = (int64_t) atoi(optarg) * 1024;
+			if (piece_length < 16*1024 || piece_length > PieceHasher::MAX_PIECE_LENGTH || 0 != (piece_length & (piece_length - 1))) syntax();
+			break;
+		case 't':
+			if (atoi(optarg) <= 0) syntax();
+			threads = atoi(optarg);
+			break;
+		case 'P':
+			is_private = true;
+			break;
+		case 'D':
+			no_date = true;
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (1 != argc - optind) syntax();
+
+	std::string root(argv[optind]);
+	while (root.length() > 1 && '/' == root[root.length() - 1]) root.erase(root.length() - 1);
+	if (name.empty()) {
+		std::string::size_type slash = root.rfind('/');
+		name = (std::string::npos == slash) ? root : root.substr(slash + 1);
+	}
+	if (name.empty() || name == "." || name == ".." || std::string::npos != name.find('/') || !validUTF8Text(name)) {
+		std::cerr << "Error: '" << name << "' can't be used as torrent name, use -n" << std::endl;
+		return 2;
+	}
+	if (!comment.empty() && !validUTF8Text(comment)) {
+		std::cerr << "Error: comment is not valid utf-8 text" << std::endl;
+		return 2;
+	}
+	if (output.empty()) output = name + ".torrent";
+
+	struct stat st;
+	if (-1 == ::stat(root.c_str(), &st)) {
+		int e = errno;
+		std::cerr << "Cannot stat '" << root << "': " << ::strerror(e) << std::endl;
+		return 2;
+	}
+	std::vector<PayloadEntry> entries;
+	bool single = !S_ISDIR(st.st_mode);
+	if (single) {
+		if (!S_ISREG(st.st_mode)) {
+			std::cerr << "Error: '" << root << "' is neither a regular file nor a directory" << std::endl;
+			return 2;
+		}
+		PayloadEntry entry = { std::vector<std::string>(), st.st_size };
+		entries.push_back(entry);
+	} else {
+		std::vector<std::string> prefix;
+		if (!walk(root, prefix, entries)) return 2;
+		if (entries.empty()) {
+			std::cerr << "Error: no files in '" << root << "'" << std::endl;
+			return 2;
+		}
+	}
+
+	std::vector<PieceHasher::File> files;
+	int64_t total = 0;
+	for (size_t i = 0; i < entries.size(); i++) {
+		PieceHasher::File f = { root, entries[i].length };
+		for (size_t c = 0; c < entries[i].path.size(); c++) f.path += "/" + entries[i].path[c];
+		files.push_back(f);
+		total += entries[i].length;
+	}
+	if (0 == piece_length) piece_length = autoPieceLength(total);
+
+	PieceHasher hasher(files, piece_length, threads);
+	if (!hasher.run()) return 2;
+	std::string pieces;
+	for (size_t i = 0; i < files.size(); i++) {
+		if (!hasher.fileFound(i)) {
+			std::cerr << "Error: '" << files[i].path << "' changed while hashing" << std::endl;
+			return 2;
+		}
+	}
+	for (size_t i = 0; i < hasher.pieceCount(); i++) {
+		if (!hasher.hashed(i)) {
+			std::cerr << "Error: couldn't read all files (changed while hashing?)" << std::endl;
+			return 2;
+		}
+		pieces.append((const char*) hasher.digest(i), PieceHasher::DIGEST_LENGTH);
+	}
+
+	NewTorrent t;
+	{
+		/* info keys in dict order: files/length, name, piece length, pieces, private */
+		std::ostringstream raw;
+		BencodeOStream out(raw);
+		out.raw("d", 1);
+		if (single) {
+			bencode(out, "length");
+			bencode(out, total);
+		} else {
+			bencode(out, "files");
+			out.raw("l", 1);
+			for (size_t i = 0; i < entries.size(); i++) {
+				out.raw("d", 1);
+				bencode(out, "length");
+				bencode(out, entries[i].length);
+				bencode(out, "path");
+				bencode(out, entries[i].path);
+				out.raw("e", 1);
+			}
+			out.raw("e", 1);
+		}
+		bencode(out, "name");
+		bencode(out, name);
+		bencode(out, "piece length");
+		bencode(out, piece_length);
+		bencode(out, "pieces");
+		bencode(out, pieces);
+		if (is_private) {
+			bencode(out, "private");
+			bencode(out, (int64_t) 1);
+		}
+		out.raw("e", 1);
+		t.info = raw.str();
+	}
+	std::string hash = BufferString(t.info).sha1();
+
+	AnnounceList list(san);
+	list.force_merge(san.filters().additional_announce_urls);
+	list.merge(urls);
+	if (list.empty()) {
+		if (!urls.empty()) std::cerr << "All announce urls were filtered, using dht" << std::endl;
+		t.announce = std::string("dht://") + hash;
+	} else {
+		t.announce = list.url(0, 0).toString();
+		if (list.tiers() > 1 || list.tierSize(0) > 1) list.copyTo(t.announce_list);
+	}
+	t.comment = comment;
+	t.creation_date = no_date ? 0 : (int64_t) ::time(NULL);
+
+	if (!writeAtomicFile(output, t)) return 2;
+
+	/* the result has to pass our own parser */
+	san.loadMetaTextFilter(".*");
+	san.loadMetaNumFilter(".*");
+	san.loadMetaOtherFilter(".*");
+	Torrent check(san);
+	if (!check.load(output)) {
+		std::cerr << output << ": " << check.lasterror() << std::endl;
+		return 2;
+	}
+
+	double mib = hasher.bytesRead() / (1024.0 * 1024.0);
+	std::cout << hash << " " << output << "\n"
+		<< files.size() << " files, " << hasher.pieceCount() << " pieces of " << piece_length / 1024 << " KiB; hashed "
+		<< std::fixed << std::setprecision(1) << mib << " MiB in " << std::setprecision(2) << hasher.seconds() << " s ("
+		<< std::setprecision(1) << (hasher.seconds() > 0 ? mib / hasher.seconds() : 0) << " MiB/s), " << hasher.threads() << " hash threads" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+/*
+   compiles an url filter config: parses it and stores the compiled pcre
+   patterns, so loading it (torrent-sanitize --url-filter, torrent-merge -f,
+   ...) doesn't need to compile them again.
+
+   the result can be used everywhere the text config is accepted. it is only
+   valid for the pcre build it was compiled with and is ignored (with a
+   warning, the text config is loaded instead) if the text config changed.
+ */
+
+#include "common.h"
+
+#include <iostream>
+
+using namespace torrent;
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		std::cerr << "Syntax: torrent-filter-compile url-filter [output]\n"
+			"\toutput defaults to url-filter.compiled\n";
+		return 100;
+	}
+
+	const std::string config(argv[1]);
+	const std::string output = (3 == argc) ? std::string(argv[2]) : config + ".compiled";
+
+	if (!FilterSet::compileUrlConfig(config, output)) return 1;
+	return 0;
+}
@@ -4,25 +4,36 @@
 #include <fstream>
 
 extern "C" {
+#include <stdlib.h>
 #include <unistd.h>
 }
 
 void syntax() {
-	std::cerr << "Syntax: torrent-merge [-d] [-f url-filter ] destination.torrent [source.torrents...]\n"
+	std::cerr << "Syntax: torrent-merge [-d] [-f url-filter ] [-l load-method] [-c url-cache] destination.torrent [source.torrents...]\n"
+		"\t       torrent-merge [-f url-filter ] [-l load-method] [-c url-cache] [-t threads] -b joblist|-\n"
 		"\tMerges announce urls from source torrents to dest torrent.\n"
 		"\tApplies a filter which can be configured with a file.\n"
 		"\n"
-		"\t\t-d: debug\n";
+		"\t\t-d: debug\n"
+		"\t\t-l: how to read torrent files: auto, read, mmap or pread\n"
+		"\t\t-c: cache file for url filter results (shared with other processes)\n"
+		"\t\t-b: run the jobs in joblist (NUL delimited source, destination, mode; default mode: merge)\n"
+		"\t\t    prints \"<job> ok <info hash>\" or \"<job> error <message>\" per job (jobs numbered from 0);\n"
+		"\t\t    exit code 1 if any job failed\n"
+		"\t\t-t: worker threads for -b (default: one per cpu)\n";
 	exit(100);
 }
 
 int main(int argc, char **argv) {
 	int opt;
 	torrent::TorrentSanitize san;
+	torrent::LoadMethod method;
+	const char *batch = 0;
+	unsigned int threads = 0;
 
 // 	torrent::setDebugActive(true);
 
-	while (-1 != (opt = getopt(argc, argv, "df:"))) {
+	while (-1 != (opt = getopt(argc, argv, "df:l:c:b:t:"))) {
 		switch (opt) {
 		case 'd':
 			san.debug = true;
@@ -30,11 +41,33 @@ int main(int argc, char **argv) {
 		case 'f':
 			if (!san.loadUrlConfig(optarg)) return 2;
 			break;
+		case 'l':
+			if (!torrent::parseLoadMethod(optarg, method)) syntax();
+			torrent::Buffer::setDefaultLoadMethod(method);
+			break;
+		case 'c':
+			if (!san.openUrlCache(optarg)) return 2;
+			break;
+		case 'b':
+			batch = optarg;
+			break;
+		case 't':
+			if (atoi(optarg) <= 0) syntax();
+			threads = atoi(optarg);
+			break;
 		default:
 			syntax();
 		}
 	}
 
+	if (0 != batch) {
+		if (argc != optind) syntax();
+
+		torrent::BatchJobs jobs;
+		if (!jobs.load(batch, "merge")) return 2;
+		return (0 == jobs.run(san, threads, std::cout)) ? 0 : 1;
+	}
+
 	if (argc - optind < 1) syntax();
 
 	torrent::TorrentAnnounceInfo dest;
@@ -48,7 +81,7 @@ int main(int argc, char **argv) {
 	std::cout << "Merging announce urls for " << hash << "\n";
 
 	torrent::AnnounceList list(san);
-	list.force_merge(san.additional_announce_urls);
+	list.force_merge(san.filters().additional_announce_urls);
 	list.merge(dest);
 
 	for (int i = optind + 1; i < argc; i++) {
@@ -61,13 +94,13 @@ int main(int argc, char **argv) {
 		list.merge(source);
 	}
 
-	if (list.list.empty()) {
+	if (list.empty()) {
 		for (size_t i = 0; i < hash.length(); i++) hash[i] = ::toupper(hash[i]);
 		dest.t_announce = std::string("dht://") + hash;
 		dest.t_announce_list.clear();
 	} else {
-		dest.t_announce = list.list[0][0];
-		dest.t_announce_list = list.list;
+		list.copyTo(dest.t_announce_list);
+		dest.t_announce = dest.t_announce_list[0][0];
 	}
 
 	if (san.debug) {
@@ -83,7 +116,7 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	writeAtomicFile(std::string(argv[optind]), dest);
+	if (!writeAtomicFile(std::string(argv[optind]), dest)) return 1;
 
 	return 0;
 }
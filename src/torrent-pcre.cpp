@@ -1,9 +1,16 @@
 
 #include "torrent-pcre.h"
+#include "config.h"
 
 #include <fstream>
 #include <sstream>
 #include <cctype>
+#include <algorithm>
+
+extern "C" {
+#include <pthread.h>
+#include <string.h>
+}
 
 namespace torrent {
 
@@ -41,34 +48,347 @@ std::string globToRegex(const std::string &glob) {
 	return out.str();
 }
 
-PCRE_Replace::PCRE_Replace() : m_re(0) { }
+namespace {
+/* recursive descent over the pattern; each part yields a set of literals one
+ * of which has to occur in a match (empty: no requirement) */
+class LiteralParser {
+public:
+	LiteralParser(const std::string &pattern) : p(pattern), pos(0), failed(false) { }
+
+	bool parse(std::vector<std::string> &literals) {
+		literals = alternation();
+		if (pos != p.length()) failed = true;
+		if (failed) literals.clear();
+		return !literals.empty();
+	}
+
+private:
+	typedef std::vector<std::string> Literals;
+
+	static size_t score(const Literals &l) {
+		if (l.empty()) return 0;
+		size_t shortest = l[0].length();
+		for (size_t i = 1; i < l.size(); i++) shortest = std::min(shortest, l[i].length());
+		return shortest;
+	}
+
+	/* keep the candidate with the longest shortest literal */
+	static void candidate(Literals &best, const Literals &l) {
+		if (score(l) > score(best) || (score(l) == score(best) && !l.empty() && l.size() < best.size())) best = l;
+	}
+
+	static void flush(Literals &best, std::string &run) {
+		if (!run.empty()) candidate(best, Literals(1, run));
+		run.clear();
+	}
+
+	/* branches up to the closing ')' or the end: all need a requirement */
+	Literals alternation() {
+		Literals result = sequence();
+		bool all = !result.empty();
+		while (!failed && pos < p.length() && '|' == p[pos]) {
+			pos++;
+			Literals branch = sequence();
+			if (branch.empty()) all = false;
+			result.insert(result.end(), branch.begin(), branch.end());
+		}
+		if (!all) result.clear();
+		return result;
+	}
+
+	/* minimum repetition of the quantifier at pos (1 if there is none) */
+	size_t quantifier(bool &quantified) {
+		quantified = true;
+		size_t min = 1;
+		if (pos >= p.length()) {
+			quantified = false;
+			return 1;
+		}
+		switch (p[pos]) {
+		case '*':
+		case '?':
+			min = 0;
+			pos++;
+			break;
+		case '+':
+			pos++;
+			break;
+		case '{':
+			{
+				size_t i = pos + 1;
+				min = 0;
+				if (i >= p.length() || !isdigit(p[i])) { failed = true; return 1; }
+				while (i < p.length() && isdigit(p[i])) min = 10*min + (p[i++] - '0');
+				if (i < p.length() && ',' == p[i]) {
+					i++;
+					while (i < p.length() && isdigit(p[i])) i++;
+				}
+				if (i >= p.length() || '}' != p[i]) { failed = true; return 1; }
+				pos = i + 1;
+			}
+			break;
+		default:
+			quantified = false;
+			return 1;
+		}
+		/* lazy or possessive */
+		if (pos < p.length() && ('?' == p[pos] || '+' == p[pos])) pos++;
+		return min;
+	}
+
+	void skipClass() {
+		pos++;
+		if (pos < p.length() && '^' == p[pos]) pos++;
+		if (pos < p.length() && ']' == p[pos]) pos++;
+		while (pos < p.length() && ']' != p[pos]) {
+			if ('\\' == p[pos]) {
+				pos += 2;
+			} else if ('[' == p[pos] && pos + 1 < p.length() && (':' == p[pos+1] || '.' == p[pos+1] || '=' == p[pos+1])) {
+				std::string::size_type end = p.find(std::string(1, p[pos+1]) + "]", pos + 2);
+				if (std::string::npos == end) { failed = true; return; }
+				pos = end + 2;
+			} else {
+				pos++;
+			}
+		}
+		if (pos >= p.length()) { failed = true; return; }
+		pos++;
+	}
+
+	Literals sequence() {
+		Literals best, atom;
+		std::string run;
+		while (!failed && pos < p.length() && '|' != p[pos] && ')' != p[pos]) {
+			char c = p[pos], ch = 0;
+			bool is_char = false;
+			atom.clear();
+			switch (c) {
+			case '\\':
+				if (pos + 1 >= p.length()) { failed = true; break; }
+				c = p[pos+1];
+				pos += 2;
+				if (!isalnum(c)) {
+					is_char = true;
+					ch = c;
+				} else if (0 != strchr("bBAzZG", c)) {
+					flush(best, run); /* assertion, no quantifier */
+					continue;
+				} else if (0 == strchr("dDwWsShHvVRN", c)) {
+					failed = true; /* backreferences, \x.., \p{..}, \Q...\E, ... */
+				}
+				break;
+			case '(':
+				pos++;
+				if (pos < p.length() && '?' == p[pos]) {
+					if (pos + 1 < p.length() && ':' == p[pos+1]) {
+						pos += 2;
+					} else if (pos + 1 < p.length() && ('=' == p[pos+1] || '!' == p[pos+1] || ('<' == p[pos+1] && pos + 2 < p.length() && ('=' == p[pos+2] || '!' == p[pos+2])))) {
+						/* lookaround doesn't consume anything */
+						pos += ('<' == p[pos+1]) ? 3 : 2;
+						alternation();
+						if (pos >= p.length()) { failed = true; break; }
+						pos++;
+						flush(best, run);
+						continue;
+					} else {
+						failed = true; /* options, named groups, ... */
+						break;
+					}
+				} else if (pos < p.length() && '*' == p[pos]) {
+					failed = true;
+					break;
+				}
+				atom = alternation();
+				if (pos >= p.length()) { failed = true; break; }
+				pos++;
+				break;
+			case '[':
+				skipClass();
+				break;
+			case '.':
+				pos++;
+				break;
+			case '^':
+			case '$':
+				pos++;
+				flush(best, run);
+				continue;
+			case '*':
+			case '+':
+			case '?':
+			case '{':
+				failed = true;
+				break;
+			default:
+				is_char = true;
+				ch = c;
+				pos++;
+				break;
+			}
+			if (failed) break;
+
+			bool quantified;
+			size_t min = quantifier(quantified);
+			if (is_char) {
+				if (quantified && 0 == min) {
+					flush(best, run);
+				} else {
+					run += ch;
+					if (quantified) flush(best, run);
+				}
+			} else {
+				flush(best, run);
+				if (min > 0) candidate(best, atom);
+			}
+		}
+		flush(best, run);
+		return best;
+	}
+
+	const std::string &p;
+	size_t pos;
+	bool failed;
+};
+}
+
+bool requiredLiterals(const std::string &pattern, std::vector<std::string> &literals) {
+	return LiteralParser(pattern).parse(literals);
+}
+
+static bool s_use_jit = PCRE_USE_JIT;
+
+void setPCREJit(bool enable) {
+	s_use_jit = enable;
+}
+
+bool pcreJit() {
+#ifdef PCRE_STUDY_JIT_COMPILE
+	int jit = 0;
+	return s_use_jit && 0 == pcre_config(PCRE_CONFIG_JIT, &jit) && jit;
+#else
+	return false;
+#endif
+}
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+/* one jit stack per thread, shared by all patterns; freed when the thread exits */
+static pthread_key_t s_jit_stack_key;
+static pthread_once_t s_jit_stack_once = PTHREAD_ONCE_INIT;
+
+static void freeJitStack(void *stack) {
+	pcre_jit_stack_free((pcre_jit_stack*) stack);
+}
+
+static void createJitStackKey() {
+	pthread_key_create(&s_jit_stack_key, freeJitStack);
+}
+
+static pcre_jit_stack* threadJitStack(void*) {
+	pthread_once(&s_jit_stack_once, createJitStackKey);
+	pcre_jit_stack *stack = (pcre_jit_stack*) pthread_getspecific(s_jit_stack_key);
+	if (0 == stack) {
+		stack = pcre_jit_stack_alloc(PCRE_JIT_STACK_MIN, PCRE_JIT_STACK_MAX);
+		pthread_setspecific(s_jit_stack_key, stack);
+	}
+	return stack;
+}
+#endif
+
+/* 0 if studying found nothing to optimize (or failed: matching works without);
+ * jit compiled whenever pcre supports it, s_use_jit is checked when matching */
+static pcre_extra* studyPattern(pcre *re) {
+	const char *error = 0;
+	int options = 0;
+#ifdef PCRE_STUDY_JIT_COMPILE
+	int jit = 0;
+	if (0 == pcre_config(PCRE_CONFIG_JIT, &jit) && jit) options |= PCRE_STUDY_JIT_COMPILE;
+#endif
+	pcre_extra *extra = pcre_study(re, options, &error);
+	if (0 != error) {
+		std::cerr << "Couldn't study pcre pattern: " << error << "\n";
+		return 0;
+	}
+#ifdef PCRE_STUDY_JIT_COMPILE
+	if (0 != extra && 0 != options) pcre_assign_jit_stack(extra, threadJitStack, 0);
+#endif
+	return extra;
+}
+
+static int execPattern(const pcre *re, const pcre_extra *extra, const char *str, int len, int *ovector, int ovecsize) {
+#ifdef PCRE_EXTRA_EXECUTABLE_JIT
+	if (!s_use_jit && 0 != extra && 0 != (extra->flags & PCRE_EXTRA_EXECUTABLE_JIT)) {
+		/* same study data, but run the interpreter */
+		pcre_extra interpreter = *extra;
+		interpreter.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+		return pcre_exec(re, &interpreter, str, len, 0, 0, ovector, ovecsize);
+	}
+#endif
+	return pcre_exec(re, extra, str, len, 0, 0, ovector, ovecsize);
+}
+
+/* the compiled pattern and its study data are shared between copies; the
+ * reference count is atomic (unlike pcre_refcount()), so copies can be made
+ * and dropped in any thread */
+static int* acquirePattern(int *refs) {
+	if (0 != refs) __sync_add_and_fetch(refs, 1);
+	return refs;
+}
+
+static void releasePattern(pcre *re, pcre_extra *extra, int *refs) {
+	if (0 != refs && 0 == __sync_sub_and_fetch(refs, 1)) {
+		if (0 != extra) pcre_free_study(extra);
+		pcre_free(re);
+		delete refs;
+	}
+}
+
+/* the bytes of a compiled pattern: pcre can run a copy of them (even in
+ * another process) as long as it is the same pcre build */
+static bool compiledPattern(const pcre *re, std::string &out) {
+	size_t size = 0;
+	if (0 == re || 0 != pcre_fullinfo(re, 0, PCRE_INFO_SIZE, &size)) return false;
+	out.assign((const char*) re, size);
+	return true;
+}
+
+static pcre* copyCompiledPattern(const char *data, size_t len) {
+	pcre *re = (pcre*) pcre_malloc(len);
+	if (0 == re) return 0;
+	memcpy(re, data, len);
+	size_t size = 0;
+	/* checks the magic number (and byte order) */
+	if (0 != pcre_fullinfo(re, 0, PCRE_INFO_SIZE, &size) || size != len) {
+		pcre_free(re);
+		std::cerr << "Invalid compiled pcre pattern\n";
+		return 0;
+	}
+	return re;
+}
+
+PCRE_Replace::PCRE_Replace() : m_re(0), m_extra(0), m_refs(0) { }
 PCRE_Replace::~PCRE_Replace() {
 	clear();
 }
-PCRE_Replace::PCRE_Replace(const PCRE_Replace& other) : m_re(0), m_pattern(other.m_pattern), m_rewrites(other.m_rewrites) {
-	if (0 != other.m_re) {
-		pcre_refcount(other.m_re, 1);
-		m_re = other.m_re;
-	}
+PCRE_Replace::PCRE_Replace(const PCRE_Replace& other)
+: m_re(other.m_re), m_extra(other.m_extra), m_refs(acquirePattern(other.m_refs)), m_pattern(other.m_pattern), m_rewrites(other.m_rewrites) {
 }
 PCRE_Replace& PCRE_Replace::operator =(const PCRE_Replace& other) {
 	if (this == &other) return *this;
 	clear();
 
-	if (0 != other.m_re) {
-		pcre_refcount(other.m_re, 1);
-		m_re = other.m_re;
-	}
+	m_re = other.m_re;
+	m_extra = other.m_extra;
+	m_refs = acquirePattern(other.m_refs);
 	m_pattern = other.m_pattern;
 	m_rewrites = other.m_rewrites;
 	return *this;
 }
 
 void PCRE_Replace::clear() {
-	if (0 != m_re && 0 == pcre_refcount(m_re, -1)) {
-		pcre_free(m_re);
-	}
+	releasePattern(m_re, m_extra, m_refs);
 	m_re = 0;
+	m_extra = 0;
+	m_refs = 0;
 	m_pattern.clear();
 	m_rewrites.clear();
 }
@@ -85,19 +405,36 @@ bool PCRE_Replace::load(const std::string &pattern, const std::vector<std::strin
 		std::cerr << "Error in pcre pattern: " << compile_error << " @ position " << (eoffset - 3) << " in '" << pattern << "'\n";
 		return false;
 	}
-	pcre_refcount(m_re, 1);
+	m_refs = new int(1);
+	m_extra = studyPattern(m_re);
 	m_pattern = pattern;
 
 	m_rewrites = rewrites;
 	return true;
 }
 
-static std::string replace(const std::string &text, const std::string &rewrite, int *ovector, int n) {
-	std::string result;
+bool PCRE_Replace::compiled(std::string &out) const {
+	return compiledPattern(m_re, out);
+}
+
+bool PCRE_Replace::loadCompiled(const std::string &pattern, const std::vector<std::string> &rewrites, const char *data, size_t len) {
+	clear();
+
+	m_re = copyCompiledPattern(data, len);
+	if (0 == m_re) return false;
+	m_refs = new int(1);
+	m_extra = studyPattern(m_re);
+	m_pattern = pattern;
+	m_rewrites = rewrites;
+	return true;
+}
+
+static void replace(const std::string &text, const std::string &rewrite, int *ovector, int n, std::string &result) {
+	result.clear();
 	for (const char *s = rewrite.c_str(), *e = s + rewrite.length(); s < e; s++) {
 		if ('\\' == *s) {
 			s++;
-			if (s >= e) return result;
+			if (s >= e) return;
 			if (isdigit(*s)) {
 				int c = *s - '0';
 				if (c <= n && ovector[2*c] >= 0) {
@@ -110,52 +447,52 @@ static std::string replace(const std::string &text, const std::string &rewrite,
 			result += *s;
 		}
 	}
-	return result;
 }
 
 bool PCRE_Replace::replaceFull(const std::string &text, std::vector<std::string> &result) const {
 	if (0 == m_re) return false;
 	int ovector[30];
-	int rc = pcre_exec(m_re, NULL, text.c_str(), text.length(), 0, 0, ovector, 30);
+	int rc = execPattern(m_re, m_extra, text.c_str(), text.length(), ovector, 30);
 	if (rc < 0) {
 		if (PCRE_ERROR_NOMATCH == rc) return false;
 		std::cerr << "Error while executing pcre pattern, code: " << rc << "\n";
 		return false;
 	}
 	if (0 == rc) rc = 10;
-	result.clear();
-	for (size_t i = 0; i < m_rewrites.size(); i++) {
-		result.push_back(replace(text, m_rewrites[i], ovector, rc));
-	}
+	/* keeps the strings of earlier calls: their memory is reused */
+	result.resize(m_rewrites.size());
+	for (size_t i = 0; i < m_rewrites.size(); i++) replace(text, m_rewrites[i], ovector, rc, result[i]);
 	return true;
 }
 
-PCRE::PCRE() : m_re(0) { }
+PCRE::PCRE() : m_re(0), m_extra(0), m_refs(0) {
+	std::fill(m_known, m_known + KEY_COUNT, false);
+}
 PCRE::~PCRE() { clear(); }
-PCRE::PCRE(const PCRE &other) : m_re(0) {
-	if (0 != other.m_re) {
-		pcre_refcount(other.m_re, 1);
-		m_re = other.m_re;
-	}
+PCRE::PCRE(const PCRE &other) : m_re(other.m_re), m_extra(other.m_extra), m_refs(acquirePattern(other.m_refs)) {
+	std::copy(other.m_known, other.m_known + KEY_COUNT, m_known);
 }
 PCRE& PCRE::operator =(const PCRE &other) {
 	if (this == &other) return *this;
 	clear();
 
-	if (0 != other.m_re) {
-		pcre_refcount(other.m_re, 1);
-		m_re = other.m_re;
-	}
+	m_re = other.m_re;
+	m_extra = other.m_extra;
+	m_refs = acquirePattern(other.m_refs);
+	std::copy(other.m_known, other.m_known + KEY_COUNT, m_known);
 	return *this;
 }
 
 void PCRE::clear() {
-	if (0 != m_re && 0 == pcre_refcount(m_re, -1)) {
-		pcre_free(m_re);
-	}
+	releasePattern(m_re, m_extra, m_refs);
 	m_re = 0;
+	m_extra = 0;
+	m_refs = 0;
+	std::fill(m_known, m_known + KEY_COUNT, false);
 }
 
+static bool pcreMatches(pcre *re, pcre_extra *extra, const char *str, int len);
+
 bool PCRE::load(const std::string &pattern) {
 	const char* compile_error;
 	int eoffset, errorcodeptr;
@@ -167,13 +504,37 @@ bool PCRE::load(const std::string &pattern) {
 		std::cerr << "Couldn't parse pcre pattern: " << compile_error << "\n";
 		return false;
 	}
-	pcre_refcount(m_re, 1);
+	m_refs = new int(1);
+	m_extra = studyPattern(m_re);
+	matchKnown();
 	return true;
 }
 
-static bool pcreMatches(pcre *re, const char *str, int len) {
+bool PCRE::compiled(std::string &out) const {
+	return compiledPattern(m_re, out);
+}
+
+bool PCRE::loadCompiled(const char *data, size_t len) {
+	clear();
+
+	m_re = copyCompiledPattern(data, len);
+	if (0 == m_re) return false;
+	m_refs = new int(1);
+	m_extra = studyPattern(m_re);
+	matchKnown();
+	return true;
+}
+
+void PCRE::matchKnown() {
+	for (int id = KEY_UNKNOWN + 1; id < KEY_COUNT; id++) {
+		BufferString name = keyName((KeyId) id);
+		m_known[id] = pcreMatches(m_re, m_extra, name.c_str(), name.length());
+	}
+}
+
+static bool pcreMatches(pcre *re, pcre_extra *extra, const char *str, int len) {
 	int ovector[30];
-	int rc = pcre_exec(re, NULL, str, len, 0, 0, ovector, 30);
+	int rc = execPattern(re, extra, str, len, ovector, 30);
 	if (rc < 0) {
 		if (PCRE_ERROR_NOMATCH == rc) return false;
 		std::cerr << "Error while executing pcre pattern, code: " << rc << "\n";
@@ -184,12 +545,17 @@ static bool pcreMatches(pcre *re, const char *str, int len) {
 
 bool PCRE::matches(BufferString str) const {
 	if (0 == m_re) return false;
-	return pcreMatches(m_re, str.c_str(), str.length());
+	return pcreMatches(m_re, m_extra, str.c_str(), str.length());
+}
+
+bool PCRE::matches(BufferString str, KeyId id) const {
+	if (KEY_UNKNOWN != id) return m_known[id];
+	return matches(str);
 }
 
 bool PCRE::matches(const std::string &str) const {
 	if (0 == m_re) return false;
-	return pcreMatches(m_re, str.c_str(), str.length());
+	return pcreMatches(m_re, m_extra, str.c_str(), str.length());
 }
 
 }
@@ -12,6 +12,20 @@ namespace torrent {
 
 std::string globToRegex(const std::string &glob);
 
+/* patterns are studied and jit compiled (if pcre supports it) when loaded;
+ * this selects jit code or the interpreter for all matches from now on.
+ * the default is PCRE_USE_JIT
+ */
+void setPCREJit(bool enable);
+/* enabled and supported by pcre */
+bool pcreJit();
+
+/* literals of which at least one occurs in every string matching pattern;
+ * false (and no literals) if none were found, or the pattern uses syntax
+ * this doesn't understand (options, backreferences, ...)
+ */
+bool requiredLiterals(const std::string &pattern, std::vector<std::string> &literals);
+
 class PCRE_Replace {
 public:
 	PCRE_Replace();
@@ -22,6 +36,11 @@ public:
 	void clear();
 
 	bool load(const std::string &pattern, const std::vector<std::string> rewrites);
+	/* compiled(): the compiled pattern (only valid for the same pcre build);
+	 * loadCompiled() takes it instead of compiling pattern again */
+	bool compiled(std::string &out) const;
+	bool loadCompiled(const std::string &pattern, const std::vector<std::string> &rewrites, const char *data, size_t len);
+	/* result: one string per rewrite */
 	bool replaceFull(const std::string &text, std::vector<std::string> &result) const;
 
 	const std::string& pattern() const { return m_pattern; }
@@ -29,6 +48,8 @@ public:
 
 private:
 	pcre* m_re;
+	pcre_extra* m_extra;
+	int *m_refs; /* copies share m_re and m_extra */
 	std::string m_pattern;
 	std::vector<std::string> m_rewrites;
 };
@@ -43,12 +64,22 @@ public:
 	void clear();
 
 	bool load(const std::string &pattern);
+	/* see PCRE_Replace::compiled() */
+	bool compiled(std::string &out) const;
+	bool loadCompiled(const char *data, size_t len);
 
 	bool matches(BufferString str) const;
 	bool matches(const std::string &str) const;
+	/* id from keyId(str): well-known keys are matched once in load() */
+	bool matches(BufferString str, KeyId id) const;
 
 private:
+	void matchKnown();
+
 	pcre *m_re;
+	pcre_extra *m_extra;
+	int *m_refs; /* copies share m_re and m_extra */
+	bool m_known[KEY_COUNT];
 };
 
 }
@@ -35,10 +35,6 @@ extern "C" {
 #include <unistd.h>
 #include <stdio.h>
 
-#ifdef USE_MMAP
-# include <sys/mman.h>
-#endif
-
 #include <getopt.h>
 }
 
@@ -60,15 +56,28 @@ void syntax() {
 		"\t\t--meta-add-string key=value   add meta string entry\n"
 		"\t\t--meta-add-raw key=value      add meta raw (bencoded) entry\n"
 		"\n"
-		"\t\t--url-filter configfile       use configfile for announce url filtering\n"
+		"\t\t--url-filter configfile       use configfile for announce url filtering (text or torrent-filter-compile output)\n"
+		"\t\t--url-cache file              cache url filter results in file (shared with other processes)\n"
 		"\n"
 		"\tcalculate info hash / show announce urls:\n"
 		"\t\ttorrent-sanitize [-h] [-u] file.torrent\n"
 		"\n"
+		"\tcalculate info hashes for many files (prints \"hash filename\" in completion order):\n"
+		"\t\ttorrent-sanitize -h file.torrent file.torrent...\n"
+		"\n"
+		"\tbatch: run the jobs in joblist (NUL delimited input, output, mode; default mode: sanitize):\n"
+		"\t\ttorrent-sanitize [options] --batch joblist|- [--threads n]\n"
+		"\t\t  prints \"<job> ok <info hash>\" or \"<job> error <message>\" per job (jobs numbered from 0);\n"
+		"\t\t  exit code 1 if any job failed\n"
+		"\n"
 		"\t\t -h: show info hash\n"
 		"\t\t -f: show files\n"
 		"\t\t -d: debug mode\n"
-		"\t\t -v: verify strict: utf-8 checks (more may come)\n";
+		"\t\t -v: verify strict: utf-8 checks (more may come)\n"
+		"\n"
+		"\t\t--load-method method         how to read torrent files: auto, read, mmap or pread (default: " << loadMethodName(Buffer::defaultLoadMethod()) << ")\n"
+		"\t\t--max-depth n                 reject lists and dicts nested deeper than n (default: " << TorrentBase::maxDepth() << ")\n"
+		"\t\t--pcre-jit on|off             match patterns with pcre jit code or the interpreter (default: " << (pcreJit() ? "on" : "off") << ")\n";
 	exit(100);
 }
 
@@ -84,6 +93,8 @@ void keyvaluesplit(const char *arg, std::string &key, std::string &value) {
 
 int main(int argc, char **argv) {
 	int opt_sanitize = 0, opt_info_hash = 0, opt_show_urls = 0, opt_show_info = -1, opt_show_files = 0, opt_verify = 0;
+	const char *opt_batch = 0;
+	unsigned int opt_threads = 0;
 
 	const struct option longopts[] = {
 		{ "meta-filter-text", 1, 0, 0 },
@@ -91,14 +102,21 @@ int main(int argc, char **argv) {
 		{ "meta-filter-any", 1, 0, 2 },
 		{ "meta-add-string", 1, 0, 3 },
 		{ "meta-add-raw", 1, 0, 4 },
-		{ "url-filter", 1, 0, 5}
+		{ "url-filter", 1, 0, 5},
+		{ "load-method", 1, 0, 6 },
+		{ "max-depth", 1, 0, 7 },
+		{ "pcre-jit", 1, 0, 8 },
+		{ "url-cache", 1, 0, 9 },
+		{ "batch", 1, 0, 10 },
+		{ "threads", 1, 0, 11 },
+		{ 0, 0, 0, 0 }
 	};
 
 	/* only used for sanitize/info */
 	TorrentSanitize san;
-	san.filter_meta_text.load(".*");
-	san.filter_meta_num.load(".*");
-	san.filter_meta_other.load("");
+	san.loadMetaTextFilter(".*");
+	san.loadMetaNumFilter(".*");
+	san.loadMetaOtherFilter("");
 
 	std::string key, value;
 
@@ -106,13 +124,13 @@ int main(int argc, char **argv) {
 	while (-1 != (c = getopt_long(argc, argv, "ifdvshu", longopts, NULL))) {
 		switch (c) {
 		case 0:
-			if (!san.filter_meta_text.load(optarg)) return 2;
+			if (!san.loadMetaTextFilter(optarg)) return 2;
 			break;
 		case 1:
-			if (!san.filter_meta_num.load(optarg)) return 2;
+			if (!san.loadMetaNumFilter(optarg)) return 2;
 			break;
 		case 2:
-			if (!san.filter_meta_other.load(optarg)) return 2;
+			if (!san.loadMetaOtherFilter(optarg)) return 2;
 			break;
 		case 3:
 			keyvaluesplit(optarg, key, value);
@@ -125,6 +143,49 @@ int main(int argc, char **argv) {
 		case 5:
 			if (!san.loadUrlConfig(std::string(optarg))) return 2;
 			break;
+		case 6:
+			{
+				LoadMethod method;
+				if (!parseLoadMethod(optarg, method)) {
+					std::cerr << "Unknown load method: '" << optarg << "'\n\n";
+					syntax();
+				}
+				Buffer::setDefaultLoadMethod(method);
+			}
+			break;
+		case 7:
+			{
+				int depth = atoi(optarg);
+				if (depth <= 0) {
+					std::cerr << "Invalid max depth: '" << optarg << "'\n\n";
+					syntax();
+				}
+				TorrentBase::setMaxDepth(depth);
+			}
+			break;
+		case 8:
+			if (0 == strcmp(optarg, "on")) {
+				setPCREJit(true);
+			} else if (0 == strcmp(optarg, "off")) {
+				setPCREJit(false);
+			} else {
+				std::cerr << "Invalid pcre-jit setting: '" << optarg << "'\n\n";
+				syntax();
+			}
+			break;
+		case 9:
+			if (!san.openUrlCache(optarg)) return 2;
+			break;
+		case 10:
+			opt_batch = optarg;
+			break;
+		case 11:
+			if (atoi(optarg) <= 0) {
+				std::cerr << "Invalid number of threads: '" << optarg << "'\n\n";
+				syntax();
+			}
+			opt_threads = atoi(optarg);
+			break;
 		case 'i':
 			opt_show_info = 1;
 			break;
@@ -157,7 +218,15 @@ int main(int argc, char **argv) {
 
 	int filenames = argc - optind;
 
-	if (opt_sanitize) {
+	if (0 != opt_batch) {
+		if (0 != filenames) syntax();
+
+		san.show_paths = false;
+
+		BatchJobs jobs;
+		if (!jobs.load(opt_batch, "sanitize")) return 2;
+		return (0 == jobs.run(san, opt_threads, std::cout)) ? 0 : 1;
+	} else if (opt_sanitize) {
 		if (1 != filenames && 2 != filenames) syntax();
 
 		san.show_paths = false;
@@ -169,7 +238,7 @@ int main(int argc, char **argv) {
 		}
 		if (opt_info_hash) std::cout << t.infohash() << std::endl;
 		t.sanitize_announce_urls(san);
-		if (2 == filenames) writeAtomicFile(std::string(argv[optind+1]), t);
+		if (2 == filenames && !writeAtomicFile(std::string(argv[optind+1]), t)) return 1;
 		if (opt_show_info > 0) t.print_details();
 	} else if (opt_show_info) {
 		/* show info */;
@@ -185,6 +254,47 @@ int main(int argc, char **argv) {
 		t.print_details();
 	} else if (opt_info_hash) {
 		/* show info hash, optionally urls */;
+		if (filenames > 1 && !opt_show_urls) {
+			/* batch: load all files at once */
+			BatchLoader loader;
+			for (int i = optind; i < argc; i++) loader.add(std::string(argv[i]));
+
+			/* parse SHA1_BATCH_FILES files, then hash their info dicts together */
+			TorrentBase::setHashWhileParsing(false);
+			int result = 0;
+			Buffer buf;
+			size_t ndx;
+			bool ok, more = true;
+			std::vector<TorrentAnnounceInfo*> group;
+			SHA1Batch batch;
+			while (more) {
+				more = loader.next(buf, ndx, ok);
+				if (more && !ok) {
+					std::cerr << argv[optind + ndx] << ": Error: couldn't load file" << std::endl;
+					result = 1;
+				} else if (more) {
+					TorrentAnnounceInfo *t = new TorrentAnnounceInfo();
+					if (t->load(buf)) {
+						group.push_back(t);
+						batch.add(t->rawInfo().data(), t->rawInfo().length());
+					} else {
+						std::cerr << t->filename() << ": " << t->lasterror() << std::endl;
+						result = 1;
+						delete t;
+					}
+				}
+				if (group.size() >= SHA1_BATCH_FILES || (!more && !group.empty())) {
+					batch.run();
+					for (size_t i = 0; i < group.size(); i++) {
+						std::cout << batch.hex(i) << " " << group[i]->filename() << "\n";
+						delete group[i];
+					}
+					group.clear();
+					batch.clear();
+				}
+			}
+			return result;
+		}
 		if (1 != filenames) syntax();
 
 		TorrentAnnounceInfo t;
@@ -0,0 +1,375 @@
+/*
+   torrent-sanitize as daemon: loads the url filter and meta settings once and
+   answers hash, sanitize and merge requests on a unix domain socket (see
+   daemon-protocol.h), with a pool of worker threads.
+
+   the main thread accepts connections and polls the idle ones; a connection
+   with a request goes to a worker, which answers that one request and hands
+   the connection back. idle clients don't keep a worker; reading a request
+   and writing its reply must finish within DAEMON_TIMEOUT seconds, or the
+   connection is dropped. SIGINT/SIGTERM remove the socket and stop the
+   daemon.
+ */
+
+#include "common.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <iostream>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <poll.h>
+
+#include <getopt.h>
+}
+
+using namespace torrent;
+
+static void syntax() {
+	std::cerr << "Syntax: torrent-sanitized [-t threads] [-d] [-v] [options] socket\n"
+		"\tanswers hash, sanitize and merge requests on the unix domain socket\n"
+		"\n"
+		"\t\t-t: worker threads (default: one per cpu)\n"
+		"\t\t-d: debug mode\n"
+		"\t\t-v: verify strict: utf-8 checks\n"
+		"\n"
+		"\t\t--meta-filter-text regex      allow matching keys for text entries (default: '.*')\n"
+		"\t\t--meta-filter-number regex    allow matching keys for numeric entries (default: '.*')\n"
+		"\t\t--meta-filter-any regex       allow matching keys for any entries (default: '', none)\n"
+		"\t\t--meta-add-string key=value   add meta string entry\n"
+		"\t\t--meta-add-raw key=value      add meta raw (bencoded) entry\n"
+		"\t\t--url-filter configfile       use configfile for announce url filtering (text or torrent-filter-compile output)\n"
+		"\t\t--url-cache file              cache url filter results in file (shared with other processes)\n"
+		"\t\t--load-method method         how to read torrent files: auto, read, mmap or pread (default: " << loadMethodName(Buffer::defaultLoadMethod()) << ")\n"
+		"\t\t--max-depth n                 reject lists and dicts nested deeper than n (default: " << TorrentBase::maxDepth() << ")\n"
+		"\t\t--pcre-jit on|off             match patterns with pcre jit code or the interpreter (default: " << (pcreJit() ? "on" : "off") << ")\n";
+	exit(100);
+}
+
+static void keyvaluesplit(const char *arg, std::string &key, std::string &value) {
+	const char *delim = strchr(arg, '=');
+	if (NULL == delim) {
+		std::cerr << "Couldn't parse key-value argument: '" << arg << "'\n\n";
+		syntax();
+	}
+	key = std::string(arg, delim - arg);
+	value = std::string(delim + 1);
+}
+
+/* info hash [, torrent data if output is empty] */
+static void result(DaemonMessage &reply, bool ok, const std::string &output, const std::string &hash, const std::string &error, const std::string &data) {
+	reply.fields.clear();
+	reply.type = ok ? DAEMON_OK : DAEMON_ERROR;
+	reply.fields.push_back(ok ? hash : error);
+	if (ok && output.empty()) reply.fields.push_back(data);
+}
+
+static void handleRequest(const TorrentSanitize &san, const DaemonMessage &req, DaemonMessage &reply) {
+	std::string hash, error, data;
+	switch (req.type) {
+	case DAEMON_HASH:
+		reply.type = DAEMON_OK;
+		for (size_t i = 0; i < req.fields.size(); i++) {
+			if (!hashTorrent(req.fields[i], hash, error)) {
+				result(reply, false, std::string(), hash, error, data);
+				return;
+			}
+			reply.fields.push_back(hash);
+		}
+		break;
+	case DAEMON_SANITIZE:
+		if (2 != req.fields.size()) {
+			result(reply, false, std::string(), hash, "sanitize needs output and file", data);
+			return;
+		}
+		result(reply, sanitizeTorrent(san, req.fields[1], req.fields[0], hash, error, &data), req.fields[0], hash, error, data);
+		break;
+	case DAEMON_MERGE:
+		if (req.fields.size() < 2) {
+			result(reply, false, std::string(), hash, "merge needs output and destination", data);
+			return;
+		}
+		{
+			std::vector<std::string> sources(req.fields.begin() + 2, req.fields.end());
+			result(reply, mergeTorrents(san, req.fields[1], sources, req.fields[0], hash, error, &data), req.fields[0], hash, error, data);
+		}
+		break;
+	default:
+		result(reply, false, std::string(), hash, "unknown request", data);
+		break;
+	}
+}
+
+/* workers are detached: the pool is never freed */
+struct Pool {
+	TorrentSanitize san; /* copied by each worker, sharing the filters */
+
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* connections queued */
+	std::deque<int> connections; /* with a request to read */
+	std::vector<int> served; /* back to the main thread, to wait for the next request */
+	int wake[2]; /* pipe: connections in served */
+};
+
+/* one request; false if the connection is closed, broken or timed out.
+ * the time for handling the request itself is not limited */
+static bool serve(const TorrentSanitize &san, int fd) {
+	DaemonMessage req, reply;
+	bool eof;
+	if (!readDaemonMessage(fd, req, eof, daemonDeadline(DAEMON_TIMEOUT))) return false;
+	handleRequest(san, req, reply);
+	return writeDaemonMessage(fd, reply, daemonDeadline(DAEMON_TIMEOUT));
+}
+
+static void* worker(void *arg) {
+	Pool &pool = *(Pool*) arg;
+	const TorrentSanitize san(pool.san);
+	for (;;) {
+		::pthread_mutex_lock(&pool.lock);
+		while (pool.connections.empty()) ::pthread_cond_wait(&pool.work, &pool.lock);
+		int fd = pool.connections.front();
+		pool.connections.pop_front();
+		::pthread_mutex_unlock(&pool.lock);
+
+		if (!serve(san, fd)) {
+			::close(fd);
+			continue;
+		}
+		::pthread_mutex_lock(&pool.lock);
+		pool.served.push_back(fd);
+		::pthread_mutex_unlock(&pool.lock);
+		/* a full pipe already wakes the main thread */
+		const char c = 0;
+		while (-1 == ::write(pool.wake[1], &c, 1) && EINTR == errno) { }
+	}
+	return 0;
+}
+
+static volatile sig_atomic_t s_stop = 0;
+static int s_wake_fd = -1; /* Pool::wake[1] */
+
+/* the byte in the wake pipe ends a poll() that started after the s_stop check */
+static void stopSignal(int) {
+	int e = errno;
+	s_stop = 1;
+	const char c = 0;
+	(void) ::write(s_wake_fd, &c, 1);
+	errno = e;
+}
+
+int main(int argc, char **argv) {
+	unsigned int threads = 0;
+
+	const struct option longopts[] = {
+		{ "meta-filter-text", 1, 0, 0 },
+		{ "meta-filter-number", 1, 0, 1 },
+		{ "meta-filter-any", 1, 0, 2 },
+		{ "meta-add-string", 1, 0, 3 },
+		{ "meta-add-raw", 1, 0, 4 },
+		{ "url-filter", 1, 0, 5},
+		{ "load-method", 1, 0, 6 },
+		{ "max-depth", 1, 0, 7 },
+		{ "pcre-jit", 1, 0, 8 },
+		{ "url-cache", 1, 0, 9 },
+		{ 0, 0, 0, 0 }
+	};
+
+	TorrentSanitize san;
+	san.loadMetaTextFilter(".*");
+	san.loadMetaNumFilter(".*");
+	san.loadMetaOtherFilter("");
+	san.show_paths = false;
+
+	std::string key, value;
+
+	int c;
+	while (-1 != (c = getopt_long(argc, argv, "t:dv", longopts, NULL))) {
+		switch (c) {
+		case 0:
+			if (!san.loadMetaTextFilter(optarg)) return 2;
+			break;
+		case 1:
+			if (!san.loadMetaNumFilter(optarg)) return 2;
+			break;
+		case 2:
+			if (!san.loadMetaOtherFilter(optarg)) return 2;
+			break;
+		case 3:
+			keyvaluesplit(optarg, key, value);
+			san.add_new_meta_entry(key, value);
+			break;
+		case 4:
+			keyvaluesplit(optarg, key, value);
+			san.add_new_raw_meta_entry(key, value);
+			break;
+		case 5:
+			if (!san.loadUrlConfig(std::string(optarg))) return 2;
+			break;
+		case 6:
+			{
+				LoadMethod method;
+				if (!parseLoadMethod(optarg, method)) {
+					std::cerr << "Unknown load method: '" << optarg << "'\n\n";
+					syntax();
+				}
+				Buffer::setDefaultLoadMethod(method);
+			}
+			break;
+		case 7:
+			{
+				int depth = atoi(optarg);
+				if (depth <= 0) {
+					std::cerr << "Invalid max depth: '" << optarg << "'\n\n";
+					syntax();
+				}
+				TorrentBase::setMaxDepth(depth);
+			}
+			break;
+		case 8:
+			if (0 == strcmp(optarg, "on")) {
+				setPCREJit(true);
+			} else if (0 == strcmp(optarg, "off")) {
+				setPCREJit(false);
+			} else {
+				std::cerr << "Invalid pcre-jit setting: '" << optarg << "'\n\n";
+				syntax();
+			}
+			break;
+		case 9:
+			if (!san.openUrlCache(optarg)) return 2;
+			break;
+		case 't':
+			if (atoi(optarg) <= 0) syntax();
+			threads = atoi(optarg);
+			break;
+		case 'd':
+			san.debug = true;
+			break;
+		case 'v':
+			san.check_info_utf8 = true;
+			break;
+		default:
+			syntax();
+		}
+	}
+
+	if (1 != argc - optind) syntax();
+	const std::string path(argv[optind]);
+
+	if (0 == threads) {
+		long cpus = ::sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+
+	int listen_fd = listenDaemonSocket(path);
+	if (-1 == listen_fd) return 2;
+	::fcntl(listen_fd, F_SETFL, O_NONBLOCK); /* poll() may report a connection that is gone again */
+
+	Pool &pool = *new Pool();
+	pool.san = san;
+	::pthread_mutex_init(&pool.lock, NULL);
+	::pthread_cond_init(&pool.work, NULL);
+	if (-1 == ::pipe2(pool.wake, O_CLOEXEC | O_NONBLOCK)) {
+		int e = errno;
+		std::cerr << "Cannot create pipe: " << ::strerror(e) << std::endl;
+		::unlink(path.c_str());
+		return 2;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	::sigaction(SIGPIPE, &sa, NULL);
+	s_wake_fd = pool.wake[1];
+	sa.sa_handler = stopSignal;
+	::sigaction(SIGINT, &sa, NULL);
+	::sigaction(SIGTERM, &sa, NULL);
+
+	/* only the main thread handles the stop signals */
+	sigset_t stopset, oldset;
+	sigemptyset(&stopset);
+	sigaddset(&stopset, SIGINT);
+	sigaddset(&stopset, SIGTERM);
+	::pthread_sigmask(SIG_BLOCK, &stopset, &oldset);
+	for (unsigned int i = 0; i < threads; i++) {
+		pthread_t t;
+		int e = ::pthread_create(&t, NULL, worker, &pool);
+		if (0 != e) {
+			std::cerr << "Cannot start worker thread: " << ::strerror(e) << std::endl;
+			::unlink(path.c_str());
+			return 2;
+		}
+		::pthread_detach(t);
+	}
+	::pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	std::vector<int> idle; /* connections waiting for a request */
+	std::vector<struct pollfd> fds;
+	while (!s_stop) {
+		fds.resize(2 + idle.size());
+		fds[0].fd = listen_fd;
+		fds[1].fd = pool.wake[0];
+		for (size_t i = 0; i < idle.size(); i++) fds[2 + i].fd = idle[i];
+		for (size_t i = 0; i < fds.size(); i++) fds[i].events = POLLIN;
+		if (-1 == ::poll(&fds[0], fds.size(), -1)) {
+			if (EINTR == errno) continue;
+			int e = errno;
+			std::cerr << "Cannot poll connections: " << ::strerror(e) << std::endl;
+			break;
+		}
+
+		/* requests (or hangups) to the workers */
+		size_t kept = 0;
+		::pthread_mutex_lock(&pool.lock);
+		for (size_t i = 0; i < idle.size(); i++) {
+			if (0 != fds[2 + i].revents) {
+				pool.connections.push_back(idle[i]);
+				::pthread_cond_signal(&pool.work);
+			} else {
+				idle[kept++] = idle[i];
+			}
+		}
+		idle.resize(kept);
+		if (0 != fds[1].revents) {
+			char buf[256];
+			while (::read(pool.wake[0], buf, sizeof(buf)) > 0) { }
+			idle.insert(idle.end(), pool.served.begin(), pool.served.end());
+			pool.served.clear();
+		}
+		::pthread_mutex_unlock(&pool.lock);
+
+		if (0 == fds[0].revents) continue;
+		int fd = ::accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (-1 == fd) {
+			if (EINTR == errno || ECONNABORTED == errno || EAGAIN == errno || EWOULDBLOCK == errno) continue;
+			int e = errno;
+			std::cerr << "Cannot accept connection: " << ::strerror(e) << std::endl;
+			if (EMFILE == e || ENFILE == e || ENOBUFS == e || ENOMEM == e) {
+				::usleep(100000);
+				continue;
+			}
+			break;
+		}
+		if (!daemonPeerTrusted(fd)) {
+			::close(fd);
+			continue;
+		}
+		idle.push_back(fd);
+	}
+
+	::unlink(path.c_str());
+	::close(listen_fd);
+	return s_stop ? 0 : 2;
+}
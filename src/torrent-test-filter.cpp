@@ -19,6 +19,8 @@ int main(int argc, char **argv) {
 
 	std::ifstream urlfile(argv[2]);
 	std::string l;
+	torrent::FilterScratch scratch;
+	scratch.trace = torrent::getDebugActive() ? &std::cerr : 0;
 
 	if (html_output) {
 		std::cout << "<html><head><title>Filter results</title><style type=\"text/css\" media=\"all\">* {font-family: verdana, arial, helvetica, sans-serif;font-size: 10px;} .red{color:red}.green{color:green}.blue{color:blue}</style></head><body><table><tr><th>Status</th><th>Original</th><th>Result</th></tr>\n";
@@ -29,7 +31,7 @@ int main(int argc, char **argv) {
 		if (l.empty()) continue;
 
 		std::vector<torrent::AnnounceUrl> annurls;
-		annurls = san.filterUrl(l);
+		san.filters().filterUrl(l, scratch, annurls);
 		if (annurls.size() == 0) {
 			if (html_output) {
 				std::cout << "<tr><td class=\"red\">REMOVED</td><td>" << l << "</td></tr>\n";
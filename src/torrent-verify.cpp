@@ -0,0 +1,173 @@
+/*
+   checks payload data against the piece hashes of a torrent
+
+   prints which pieces and files are complete and how fast the data was read;
+   exit code 0 if everything is complete, 1 if not, 2 on errors
+ */
+
+#include "common.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+}
+
+using namespace torrent;
+
+static void syntax() {
+	std::cerr << "Syntax: torrent-verify [-d directory] [-t threads] [-q] file.torrent\n"
+		"\tchecks the files of the torrent in directory against its piece hashes\n"
+		"\n"
+		"\t\t-d: directory containing the payload (default: current directory)\n"
+		"\t\t-t: hash threads (default: one per cpu)\n"
+		"\t\t-q: don't print the piece bitmap and the file list\n";
+	exit(100);
+}
+
+/* a path component from the torrent must not leave the payload directory */
+static bool safeComponent(BufferString c) {
+	if (0 == c.length()) return false;
+	if (c == BufferString(".") || c == BufferString("..")) return false;
+	return 0 == memchr(c.data(), '/', c.length()) && 0 == memchr(c.data(), '\0', c.length());
+}
+
+static bool payloadFiles(const Torrent &t, const std::string &dir, std::vector<PieceHasher::File> &files) {
+	BufferString name(t.info_name());
+	if (!safeComponent(name)) {
+		std::cerr << "Error: torrent name '" << t.info_name() << "' isn't usable as file name" << std::endl;
+		return false;
+	}
+	std::string base = dir + "/" + t.info_name();
+
+	const FileList &list = t.info_files();
+	if (list.empty()) {
+		PieceHasher::File f = { base, t.info_complete_length() };
+		files.push_back(f);
+		return true;
+	}
+
+	for (size_t i = 0; i < list.size(); i++) {
+		std::vector<BufferString> components = t.info_file_components(i);
+		PieceHasher::File f = { base, list.length(i) };
+		for (size_t c = 0; c < components.size(); c++) {
+			if (!safeComponent(components[c])) {
+				std::cerr << "Error: file #" << i << " has an unusable path component '" << components[c].toString() << "'" << std::endl;
+				return false;
+			}
+			f.path += "/";
+			f.path.append(components[c].data(), components[c].length());
+		}
+		files.push_back(f);
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	std::string dir(".");
+	unsigned int threads = 0;
+	bool quiet = false;
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "d:t:q"))) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 't':
+			if (atoi(optarg) <= 0) syntax();
+			threads = atoi(optarg);
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			syntax();
+		}
+	}
+	if (1 != argc - optind) syntax();
+
+	TorrentSanitize san;
+	san.loadMetaTextFilter(".*");
+	san.loadMetaNumFilter(".*");
+	san.loadMetaOtherFilter(".*");
+
+	Torrent t(san);
+	if (!t.load(std::string(argv[optind]))) {
+		std::cerr << t.filename() << ": " << t.lasterror() << std::endl;
+		return 2;
+	}
+
+	std::vector<PieceHasher::File> files;
+	if (!payloadFiles(t, dir, files)) return 2;
+
+	/* before the hasher allocates anything for these lengths */
+	size_t npieces;
+	BufferString pieces = t.info_pieces();
+	if (t.info_piece_length() > PieceHasher::MAX_PIECE_LENGTH) {
+		std::cerr << "Error: piece length " << t.info_piece_length() << " is larger than the supported " << PieceHasher::MAX_PIECE_LENGTH << " bytes" << std::endl;
+		return 2;
+	}
+	if (!PieceHasher::countPieces(files, t.info_piece_length(), npieces)) {
+		std::cerr << "Error: no valid piece count for piece length " << t.info_piece_length() << " and " << t.info_complete_length() << " bytes" << std::endl;
+		return 2;
+	}
+	if (npieces * PieceHasher::DIGEST_LENGTH != pieces.length()) {
+		std::cerr << "Error: torrent has " << pieces.length() / PieceHasher::DIGEST_LENGTH << " pieces, expected "
+			<< npieces << " for " << t.info_complete_length() << " bytes" << std::endl;
+		return 2;
+	}
+
+	PieceHasher hasher(files, t.info_piece_length(), threads);
+	if (!hasher.run()) return 2;
+
+	std::vector<char> good(hasher.pieceCount());
+	size_t complete = 0;
+	for (size_t i = 0; i < hasher.pieceCount(); i++) {
+		good[i] = hasher.hashed(i) && 0 == memcmp(hasher.digest(i), pieces.data() + i * PieceHasher::DIGEST_LENGTH, PieceHasher::DIGEST_LENGTH);
+		if (good[i]) complete++;
+	}
+
+	size_t files_complete = 0;
+	std::vector<const char*> status(files.size());
+	for (size_t f = 0; f < files.size(); f++) {
+		size_t first, end, have = 0;
+		hasher.filePieces(f, first, end);
+		for (size_t i = first; i < end; i++) if (good[i]) have++;
+		if (!hasher.fileFound(f) && 0 == have) {
+			status[f] = "missing";
+		} else if (have == end - first && hasher.fileFound(f)) {
+			status[f] = "complete";
+			files_complete++;
+		} else {
+			status[f] = "incomplete";
+		}
+	}
+
+	if (!quiet) {
+		/* '#' complete, '.' wrong or missing; 64 pieces per line */
+		std::cout << "Piece bitmap:\n";
+		for (size_t i = 0; i < good.size(); i += 64) {
+			std::cout << std::setw(8) << i << " ";
+			for (size_t j = i; j < good.size() && j < i + 64; j++) std::cout << (good[j] ? '#' : '.');
+			std::cout << "\n";
+		}
+		std::cout << "Files:\n";
+		for (size_t f = 0; f < files.size(); f++) {
+			std::cout << " " << std::left << std::setw(11) << status[f] << std::right << std::setw(14) << files[f].length << " " << files[f].path << "\n";
+		}
+	}
+
+	double mib = hasher.bytesRead() / (1024.0 * 1024.0);
+	std::cout << "Pieces: " << complete << "/" << hasher.pieceCount() << " complete\n"
+		<< "Files: " << files_complete << "/" << files.size() << " complete\n"
+		<< "Read " << std::fixed << std::setprecision(1) << mib << " MiB in " << std::setprecision(2) << hasher.seconds() << " s ("
+		<< std::setprecision(1) << (hasher.seconds() > 0 ? mib / hasher.seconds() : 0) << " MiB/s), " << hasher.threads() << " hash threads" << std::endl;
+
+	return (complete == hasher.pieceCount() && files_complete == files.size()) ? 0 : 1;
+}
@@ -1,5 +1,7 @@
-
 #include "torrent.h"
+#include "output-segments.h"
+
+#include <limits>
 
 namespace torrent {
 
@@ -9,7 +11,15 @@ Torrent::Torrent(const TorrentSanitize &san) : m_san(san) {
 
 bool Torrent::load(const std::string &filename) {
 	if (!loadfile(filename)) return false;
+	return parse();
+}
+
+bool Torrent::load(Buffer &buffer) {
+	loadbuffer(buffer);
+	return parse();
+}
 
+bool Torrent::parse() {
 	if (!m_buffer.tryNext("d8:announce")) return seterror("doesn't look like a valid torrent, expected 'd8:announce'");
 	if (!read_utf8(t_announce)) return errorcontext("parsing torrent announce failed");
 
@@ -20,36 +30,24 @@ bool Torrent::load(const std::string &filename) {
 		if (curkey <= prevkey) return seterror("wrong key order in torrent dict");
 		prevkey = curkey;
 
-		if (curkey == BufferString("announce-list")) {
+		KeyId id = keyId(curkey);
+		switch (id) {
+		case KEY_ANNOUNCE_LIST:
 			if (!parse_announce_list()) return errorcontext("parsing torrent announce-list failed");
-		} else if (curkey == BufferString("info")) {
+			break;
+		case KEY_INFO:
 			curpos = m_buffer.pos();
+			begin_info_hash(curpos);
 			if (!parse_info()) return errorcontext("parsing torrent info failed");
 			m_raw_info = BufferString(m_buffer.m_data + curpos, m_buffer.pos() - curpos);
-		} else if (curkey == BufferString("encoding")) {
+			m_info_hash = m_info_hasher.finish(m_buffer.pos());
+			break;
+		case KEY_ENCODING:
 			if (!read_utf8(t_encoding)) return errorcontext("parsing torrent encoding failed");
-		} else {
-			std::string content;
-			int64_t number;
-
-			if (!m_san.validMetaKey(curkey)) {
-				if (!skip_value()) return errorcontext("parsing torrent meta entry failed");
-				if (m_san.debug) std::cerr << "Skipped entry '" << curkey.toString() << "'\n";
-			} else if (m_san.validMetaTextKey(curkey) && read_utf8(content)) {
-				if (m_san.debug) std::cerr << "Additional text entry '" << curkey.toString() << "': '" << content << "'\n";
-				m_raw_parts.insert(std::make_pair(curkey.toString(), BufferString(m_buffer.m_data + curpos, m_buffer.pos() - curpos).toString()));
-			} else if (m_san.validMetaNumKey(curkey) && read_number(number)) {
-				if (m_san.debug) std::cerr << "Additional numeric entry '" << curkey.toString() << "': " << number << "\n";
-				m_raw_parts.insert(std::make_pair(curkey.toString(), BufferString(m_buffer.m_data + curpos, m_buffer.pos() - curpos).toString()));
-			} else if (m_san.validMetaOtherKey(curkey)) {
-				if (!skip_value()) return errorcontext("parsing torrent meta entry failed");
-				if (m_san.debug) std::cerr << "Additional raw entry '" << curkey.toString() << "'\n";
-				m_raw_parts.insert(std::make_pair(curkey.toString(), BufferString(m_buffer.m_data + curpos, m_buffer.pos() - curpos).toString()));
-			} else if (skip_value()) {
-				if (m_san.debug) std::cerr << "Skipped entry '" << curkey.toString() << "'\n";
-			} else {
-				return errorcontext("parsing torrent meta entry failed");
-			}
+			break;
+		default:
+			if (!parse_meta_entry(curkey, id, curpos)) return errorcontext("parsing torrent meta entry failed");
+			break;
 		}
 	}
 
@@ -63,35 +61,83 @@ bool Torrent::load(const std::string &filename) {
 	return true;
 }
 
-void Torrent::write(std::ostream &os) const {
-	TorrentOStream tos(os);
+/* additional top-level entries: keep the ones the meta filters allow */
+bool Torrent::parse_meta_entry(BufferString key, KeyId id, size_t keypos) {
+	std::string content;
+	int64_t number;
+
+	if (!m_san.validMetaKey(key)) {
+		if (!skip_value()) return false;
+		if (m_san.debug) std::cerr << "Skipped entry '" << key.toString() << "'\n";
+	} else if (m_san.validMetaTextKey(key, id) && read_utf8(content)) {
+		if (m_san.debug) std::cerr << "Additional text entry '" << key.toString() << "': '" << content << "'\n";
+		m_raw_parts.insert(std::make_pair(key.toString(), BufferString(m_buffer.m_data + keypos, m_buffer.pos() - keypos).toString()));
+	} else if (m_san.validMetaNumKey(key, id) && read_number(number)) {
+		if (m_san.debug) std::cerr << "Additional numeric entry '" << key.toString() << "': " << number << "\n";
+		m_raw_parts.insert(std::make_pair(key.toString(), BufferString(m_buffer.m_data + keypos, m_buffer.pos() - keypos).toString()));
+	} else if (m_san.validMetaOtherKey(key, id)) {
+		if (!skip_value()) return false;
+		if (m_san.debug) std::cerr << "Additional raw entry '" << key.toString() << "'\n";
+		m_raw_parts.insert(std::make_pair(key.toString(), BufferString(m_buffer.m_data + keypos, m_buffer.pos() - keypos).toString()));
+	} else if (skip_value()) {
+		if (m_san.debug) std::cerr << "Skipped entry '" << key.toString() << "'\n";
+	} else {
+		return false;
+	}
+	return true;
+}
 
-	os << "d8:announce";
-	tos << t_announce;
+template<typename Out> void Torrent::writerawkeys(Out &out, BufferString prev, BufferString next) const {
+	std::string ns = next.toString();
+	TorrentRawParts::const_iterator it = m_raw_parts.upper_bound(prev.toString());
+	while (it != m_raw_parts.end() && (0 == next.length() || it->first < ns)) {
+		out.raw(it->second.data(), it->second.length());
+		it++;
+	}
+}
 
-	writerawkeys(os, bs_announce, bs_announce_list);
+template<typename Out> void Torrent::writerawkey(Out &out, BufferString key) const {
+	TorrentRawParts::const_iterator it = m_raw_parts.find(key.toString());
+	if (it != m_raw_parts.end()) out.raw(it->second.data(), it->second.length());
+}
+
+template<typename Out> void Torrent::serialize(Out &out) const {
+	out.raw("d8:announce", 11);
+	bencode(out, t_announce);
+
+	writerawkeys(out, bs_announce, bs_announce_list);
 
 	if (!t_announce_list.empty()) {
-		os << "13:announce-list";
-		tos << t_announce_list;
+		out.raw("13:announce-list", 16);
+		bencode(out, t_announce_list);
 	} else {
-		writerawkey(os, bs_announce_list);
+		writerawkey(out, bs_announce_list);
 	}
 
 	if (!t_encoding.empty()) {
-		writerawkeys(os, bs_announce_list, bs_encoding);
-		os << "8:encoding";
-		tos << bs_encoding;
-		writerawkeys(os, bs_encoding, bs_info);
+		writerawkeys(out, bs_announce_list, bs_encoding);
+		out.raw("8:encoding", 10);
+		bencode(out, bs_encoding);
+		writerawkeys(out, bs_encoding, bs_info);
 	} else {
-		writerawkeys(os, bs_announce_list, bs_info);
+		writerawkeys(out, bs_announce_list, bs_info);
 	}
 
-	os << "4:info" << m_raw_info;
+	out.raw("4:info", 6);
+	out.range(m_buffer, m_raw_info);
 
-	writerawkeys(os, bs_info, BufferString());
+	writerawkeys(out, bs_info, BufferString());
 
-	os << "e";
+	out.raw("e", 1);
+}
+
+template void Torrent::serialize<BencodeSize>(BencodeSize &out) const;
+template void Torrent::serialize<BencodeOStream>(BencodeOStream &out) const;
+template void Torrent::serialize<OutputSegments>(OutputSegments &out) const;
+
+void Torrent::write(std::ostream &os) const {
+	BencodeOStream out(os);
+	serialize(out);
 }
 
 void Torrent::print_details() {
@@ -111,7 +157,7 @@ void Torrent::print_details() {
 	std::cout << "Info files: " << t_info_files.size() << std::endl;
 	if (m_san.show_paths) {
 		for (size_t i = 0; i < t_info_files.size(); i++) {
-			std::cout << " - " << t_info_files[i].second << " bytes: '" << t_info_files[i].first << "'" << std::endl;
+			std::cout << " - " << t_info_files.length(i) << " bytes: '" << t_info_files.path(m_buffer, i) << "'" << std::endl;
 		}
 	}
 	std::cout << "Info complete length: " << t_info_complete_length << " bytes" << std::endl;
@@ -121,27 +167,26 @@ void Torrent::print_details() {
 
 bool Torrent::parse_info() {
 	bool err;
-	BufferString prev;
 	std::string tmps;
 	/* ('length':number | 'files':...) ['name': string] 'piece length':number 'pieces':raw[%20] */
 	if (m_buffer.eof()) return seterror("expected torrent info, found eof");
 	if (!m_buffer.isNext('d')) return seterror("expected 'd' for dict");
 	m_buffer.next();
 
-	if (try_next_dict_entry(bs_files, bs_empty, err)) {
+	DictCursor dict;
+	if (try_next_dict_entry(dict, bs_files, err)) {
 		t_info_complete_length = 0;
 		if (!parse_info_files()) return errorcontext("couldn't parse files in torrent info");
-		prev = bs_files;
 	} else if (err) {
 		return errorcontext("couldn't find torrent info key");
-	} else if (try_next_dict_entry(bs_length, bs_files, err)) {
+	} else if (try_next_dict_entry(dict, bs_length, err)) {
 		if (!read_number(t_info_complete_length)) return errorcontext("couldn't parse length in torrent info");
-		prev = bs_length;
+		if (t_info_complete_length < 0) return seterror("negative length in torrent info");
 	} else if (err) {
 		return errorcontext("couldn't find torrent info key");
 	} else return seterror("expected files or length in torrent info");
 
-	if (try_next_dict_entry(bs_name, prev, err)) {
+	if (try_next_dict_entry(dict, bs_name, err)) {
 		if (!read_info_utf8(t_info_name)) return errorcontext("couldn't parse name in torrent info");
 	} else if (err) {
 		return errorcontext("couldn't find torrent info key");
@@ -149,25 +194,25 @@ bool Torrent::parse_info() {
 		std::cerr << "torrent info has no name entry\n";
 	}
 
-	if (try_next_dict_entry(bs_piece_length, bs_name, err)) {
+	if (try_next_dict_entry(dict, bs_piece_length, err)) {
 		if (!read_number(t_info_piece_length)) return errorcontext("couldn't parse piece length in torrent info");
+		if (t_info_piece_length <= 0) return seterror("piece length in torrent info is not positive");
 	} else if (err) {
 		return errorcontext("couldn't find torrent info key");
 	} else {
 		return seterror("expected piece length in torrent info");
 	}
 
-	if (try_next_dict_entry(bs_pieces, bs_piece_length, err)) {
-		BufferString pieces;
-		if (!read_string(pieces)) return errorcontext("couldn't parse pieces in torrent info");
-		if (0 != pieces.m_len % 20) return seterror("pieces in torrent info has wrong length (not a multiple of 20)");
+	if (try_next_dict_entry(dict, bs_pieces, err)) {
+		if (!read_string(t_info_pieces)) return errorcontext("couldn't parse pieces in torrent info");
+		if (0 != t_info_pieces.m_len % 20) return seterror("pieces in torrent info has wrong length (not a multiple of 20)");
 	} else if (err) {
 		return errorcontext("couldn't find torrent info key");
 	} else {
 		return seterror("expected piece length in torrent info");
 	}
 
-	if (try_next_dict_entry(bs_private, bs_pieces, err)) {
+	if (try_next_dict_entry(dict, bs_private, err)) {
 		int64_t private_flag;
 		if (!read_number(private_flag)) return errorcontext("couldn't parse torrent info private flag");
 		if (0 != private_flag && 1 != private_flag) return seterror("torrent info private flag is neither 0 nor 1");
@@ -175,7 +220,7 @@ bool Torrent::parse_info() {
 		return errorcontext("couldn't find torrent info key");
 	}
 
-	if (!goto_dict_end(bs_private)) return errorcontext("couldn't find torrent info key");
+	if (!goto_dict_end(dict)) return errorcontext("couldn't find torrent info key");
 
 	return true;
 }
@@ -186,6 +231,7 @@ bool Torrent::parse_info_files() {
 
 	while (!m_buffer.eof() && !m_buffer.isNext('e')) {
 		if (!parse_info_file()) return errorcontext("couldn't parse files entry");
+		m_info_hasher.progress(m_buffer.pos());
 	}
 	if (!m_buffer.isNext('e')) return seterror("expected info files entry, found eof");
 	m_buffer.next();
@@ -202,11 +248,13 @@ bool Torrent::parse_info_file() {
 	bool err;
 
 	int64_t length;
-	std::string path;
+	size_t path_offset;
 
-	if (try_next_dict_entry(bs_length, bs_empty, err)) {
+	DictCursor dict;
+	if (try_next_dict_entry(dict, bs_length, err)) {
 		if (!read_number(length)) return seterror("couldn't parse length");
 		if (length < 0) return seterror("negative file length");
+		if (length > std::numeric_limits<int64_t>::max() - t_info_complete_length) return seterror("total file length too large");
 		t_info_complete_length += length;
 	} else if (err) {
 		return errorcontext("couldn't find info file entry key");
@@ -214,60 +262,36 @@ bool Torrent::parse_info_file() {
 		return seterror("expected length in file entry");
 	}
 
-	if (try_next_dict_entry(bs_path, bs_length, err)) {
-		if (!parse_info_file_path(path)) return errorcontext("couldn't parse path in file entry");
+	if (try_next_dict_entry(dict, bs_path, err)) {
+		path_offset = m_buffer.pos();
+		if (!parse_info_file_path()) return errorcontext("couldn't parse path in file entry");
 	} else if (err) {
 		return errorcontext("couldn't find info file entry key");
 	} else {
 		return seterror("expected path in file entry");
 	}
 
-	t_info_files.push_back(File(path, length));
+	t_info_files.add(length, path_offset);
 
-	if (!goto_dict_end(bs_path)) return errorcontext("error while searching end of info files entry");
+	if (!goto_dict_end(dict)) return errorcontext("error while searching end of info files entry");
 
 	return true;
 }
 
-bool Torrent::parse_info_file_path(std::string &path) {
-	int components = 0;
-	std::ostringstream buildpath;
-	std::string part;
+/* only validates; FileList decodes the components again when needed */
+bool Torrent::parse_info_file_path() {
 	if (!m_buffer.isNext('l')) return seterror("expected 'l' for list");
 	m_buffer.next();
 
 	while (!m_buffer.eof() && !m_buffer.isNext('e')) {
-		if (m_san.show_paths) {
-			if (!read_info_utf8(part)) return errorcontext("couldn't parse path component");
-			if (components > 0) buildpath << '/';
-			buildpath << part;
-		} else {
-			if (!skip_info_utf8()) return errorcontext("couldn't parse path component");
-		}
-		components++;
+		if (!skip_info_utf8()) return errorcontext("couldn't parse path component");
 	}
 	if (!m_buffer.isNext('e')) return seterror("expected path component, found eof");
 	m_buffer.next();
 
-	path = buildpath.str();
-
 	return true;
 }
 
-void Torrent::writerawkeys(std::ostream &os, BufferString prev, BufferString next) const {
-	std::string ns = next.toString();
-	TorrentRawParts::const_iterator it = m_raw_parts.upper_bound(prev.toString());
-	while (it != m_raw_parts.end() && (0 == next.length() || it->first < ns)) {
-		os << it->second;
-		it++;
-	}
-}
-
-void Torrent::writerawkey(std::ostream &os, BufferString key) const {
-	TorrentRawParts::const_iterator it = m_raw_parts.find(key.toString());
-	if (it != m_raw_parts.end()) os << it->second;
-}
-
 std::ostream& operator<<(std::ostream &os, const Torrent &t) {
 	t.write(os);
 	return os;
@@ -277,48 +301,69 @@ TorrentAnnounceInfo::TorrentAnnounceInfo() {
 }
 
 bool TorrentAnnounceInfo::load(const std::string &filename) {
-	bool err;
-
 	if (!loadfile(filename)) return false;
+	return parse();
+}
+
+bool TorrentAnnounceInfo::load(Buffer &buffer) {
+	loadbuffer(buffer);
+	return parse();
+}
+
+bool TorrentAnnounceInfo::parse() {
+	bool err;
 
 	if (!m_buffer.tryNext("d8:announce")) return seterror("doesn't look like a valid torrent, expected 'd8:announce'");
 	if (!read_utf8(t_announce)) return errorcontext("parsing torrent announce failed");
 
-	if (try_next_dict_entry(bs_announce_list, bs_announce, err, &m_post_announce)) {
+	DictCursor dict(bs_announce);
+	if (try_next_dict_entry(dict, bs_announce_list, err, &m_post_announce)) {
 		if (!parse_announce_list()) return errorcontext("parsing torrent announce-list failed");
 	} else if (err) {
 		return errorcontext("parsing dict key in torrent failed");
 	}
 
-	if (try_next_dict_entry(bs_info, bs_announce_list, err, &m_post_announce_list)) {
+	if (try_next_dict_entry(dict, bs_info, err, &m_post_announce_list)) {
 		size_t curpos = m_buffer.pos();
+		begin_info_hash(curpos);
 		if (!skip_value()) return errorcontext("parsing torrent info failed");
 		m_raw_info = BufferString(m_buffer.data() + curpos, m_buffer.pos() - curpos);
+		m_info_hash = m_info_hasher.finish(m_buffer.pos());
 	} else if (err) {
 		return errorcontext("parsing dict key in torrent failed");
 	} else {
 		return seterror("no info key in torrent");
 	}
 
-	if (!goto_dict_end(bs_info, &m_post_info)) return seterror("expected end of info files entry");
+	if (!goto_dict_end(dict, &m_post_info)) return seterror("expected end of info files entry");
 
 	return true;
 }
 
-void TorrentAnnounceInfo::write(std::ostream &os) const {
-	TorrentOStream tos(os);
-
-	os << "d8:announce";
-	tos << t_announce;
+template<typename Out> void TorrentAnnounceInfo::serialize(Out &out) const {
+	out.raw("d8:announce", 11);
+	bencode(out, t_announce);
 
-	os << m_post_announce;
+	out.range(m_buffer, m_post_announce);
 
 	if (!t_announce_list.empty()) {
-		os << "13:announce-list";
-		tos << t_announce_list;
+		out.raw("13:announce-list", 16);
+		bencode(out, t_announce_list);
 	}
 
-	os << m_post_announce_list << "4:info" << m_raw_info << m_post_info;
+	out.range(m_buffer, m_post_announce_list);
+	out.raw("4:info", 6);
+	out.range(m_buffer, m_raw_info);
+	out.range(m_buffer, m_post_info);
+}
+
+template void TorrentAnnounceInfo::serialize<BencodeSize>(BencodeSize &out) const;
+template void TorrentAnnounceInfo::serialize<BencodeOStream>(BencodeOStream &out) const;
+template void TorrentAnnounceInfo::serialize<OutputSegments>(OutputSegments &out) const;
+
+void TorrentAnnounceInfo::write(std::ostream &os) const {
+	BencodeOStream out(os);
+	serialize(out);
 }
 
 void TorrentAnnounceInfo::print_details() {
@@ -343,39 +388,56 @@ TorrentAnnounce::TorrentAnnounce() {
 }
 
 bool TorrentAnnounce::load(const std::string &filename) {
-	bool err;
+	if (!loadfile(filename, true)) return false;
+	return parse();
+}
 
-	if (!loadfile(filename)) return false;
+bool TorrentAnnounce::load(Buffer &buffer) {
+	loadbuffer(buffer);
+	return parse();
+}
+
+bool TorrentAnnounce::parse() {
+	bool err;
 
 	if (!m_buffer.tryNext("d8:announce")) return seterror("doesn't look like a valid torrent, expected 'd8:announce'");
 	if (!read_utf8(t_announce)) return errorcontext("parsing torrent announce failed");
 
-	if (try_next_dict_entry(bs_announce_list, bs_announce, err, &m_post_announce)) {
+	DictCursor dict(bs_announce);
+	if (try_next_dict_entry(dict, bs_announce_list, err, &m_post_announce)) {
 		if (!parse_announce_list()) return errorcontext("parsing torrent announce-list failed");
 	} else if (err) {
 		return errorcontext("parsing dict key in torrent failed");
 	}
 
 	/* just remember which part we skipped - this doesn't actually read anything */
+	/* (with a lazy buffer the data isn't even in memory; write() streams it from the file) */
 	m_post_announce_list = BufferString(m_buffer.data() + m_buffer.pos(), m_buffer.len() - m_buffer.pos());
 
 	return true;
 }
 
-void TorrentAnnounce::write(std::ostream &os) const {
-	TorrentOStream tos(os);
-
-	os << "d8:announce";
-	tos << t_announce;
+template<typename Out> void TorrentAnnounce::serialize(Out &out) const {
+	out.raw("d8:announce", 11);
+	bencode(out, t_announce);
 
-	os << m_post_announce;
+	out.range(m_buffer, m_post_announce);
 
 	if (!t_announce_list.empty()) {
-		os << "13:announce-list";
-		tos << t_announce_list;
+		out.raw("13:announce-list", 16);
+		bencode(out, t_announce_list);
 	}
 
-	os << m_post_announce_list;
+	out.range(m_buffer, m_post_announce_list);
+}
+
+template void TorrentAnnounce::serialize<BencodeSize>(BencodeSize &out) const;
+template void TorrentAnnounce::serialize<BencodeOStream>(BencodeOStream &out) const;
+template void TorrentAnnounce::serialize<OutputSegments>(OutputSegments &out) const;
+
+void TorrentAnnounce::write(std::ostream &os) const {
+	BencodeOStream out(os);
+	serialize(out);
 }
 
 void TorrentAnnounce::print_details() {
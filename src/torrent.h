@@ -2,10 +2,12 @@
 #define __TORRENT_SANITIZE_TORRENT_H
 
 #include "torrentbase.h"
+#include "file-list.h"
 
 namespace torrent {
 
 /* all three classes parse torrent files, and all three can write it back again */
+/* (serialize() writes to any bencode output, see bencode-writer.h) */
 /* they differ in which parts they actually try to understand or just verify */
 /* they all parse the announce and announce-list urls */
 
@@ -17,19 +19,34 @@ public:
 	Torrent(const TorrentSanitize &san);
 
 	bool load(const std::string &filename);
+	/* parse an already loaded buffer (takes over its content) */
+	bool load(Buffer &buffer);
 
+	template<typename Out> void serialize(Out &out) const;
 	void write(std::ostream &os) const;
 	void print_details();
 
+	const std::string& info_name() const { return t_info_name; }
+	int64_t info_piece_length() const { return t_info_piece_length; }
+	int64_t info_complete_length() const { return t_info_complete_length; }
+	/* concatenated sha1 digests of the pieces */
+	BufferString info_pieces() const { return t_info_pieces; }
+	/* empty for single file torrents (info_name() is the file then) */
+	const FileList& info_files() const { return t_info_files; }
+	std::vector<BufferString> info_file_components(size_t ndx) const { return t_info_files.components(m_buffer, ndx); }
+
 private:
+	bool parse();
+	bool parse_meta_entry(BufferString key, KeyId id, size_t keypos);
+
 	bool parse_info();
 
 	bool parse_info_files();
 	bool parse_info_file();
-	bool parse_info_file_path(std::string &path);
+	bool parse_info_file_path();
 
-	void writerawkeys(std::ostream &os, BufferString prev, BufferString next) const;
-	void writerawkey(std::ostream &os, BufferString key) const;
+	template<typename Out> void writerawkeys(Out &out, BufferString prev, BufferString next) const;
+	template<typename Out> void writerawkey(Out &out, BufferString key) const;
 
 	const TorrentSanitize &m_san;
 
@@ -38,7 +55,8 @@ private:
 	std::string t_info_name;
 	int64_t t_info_piece_length;
 	int64_t t_info_complete_length;
-	std::vector<File> t_info_files;
+	BufferString t_info_pieces;
+	FileList t_info_files;
 
 	TorrentRawParts m_raw_parts;
 };
@@ -52,12 +70,17 @@ public:
 	TorrentAnnounceInfo();
 
 	bool load(const std::string &filename);
+	/* parse an already loaded buffer (takes over its content) */
+	bool load(Buffer &buffer);
 
+	template<typename Out> void serialize(Out &out) const;
 	void write(std::ostream &os) const;
 
 	void print_details();
 
 private:
+	bool parse();
+
 	BufferString m_post_announce, m_post_announce_list, m_post_info;
 };
 
@@ -65,18 +88,24 @@ std::ostream& operator<<(std::ostream &os, const TorrentAnnounceInfo &t);
 
 /* only read announce urls, don't verify any data after announce-list */
 /* very fast as the load method doesn't read the whole torrent from disk */
-/* the write method will of course need to read the remaining parts from disk */
+/* the write method will of course need to read the remaining parts from disk; */
+/* it streams them from the file opened by load */
 class TorrentAnnounce : public TorrentBase {
 public:
 	TorrentAnnounce();
 
 	bool load(const std::string &filename);
+	/* parse an already loaded buffer (takes over its content) */
+	bool load(Buffer &buffer);
 
+	template<typename Out> void serialize(Out &out) const;
 	void write(std::ostream &os) const;
 
 	void print_details();
 
 private:
+	bool parse();
+
 	BufferString m_post_announce, m_post_announce_list;
 };
 
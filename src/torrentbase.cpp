@@ -1,36 +1,54 @@
 #include "torrentbase.h"
+#include "announce-list.h"
 
 namespace torrent {
 
+bool TorrentBase::s_use_tape = true;
+size_t TorrentBase::s_max_depth = BENCODE_MAX_DEPTH;
+bool TorrentBase::s_hash_while_parsing = true;
+
 TorrentBase::TorrentBase()
-: m_check_info_utf8(true) { }
+: m_check_info_utf8(true), m_info_hasher(m_buffer) { }
+
+void TorrentBase::setUseTape(bool use) { s_use_tape = use; }
+
+void TorrentBase::setMaxDepth(size_t depth) { s_max_depth = depth; }
+size_t TorrentBase::maxDepth() { return s_max_depth; }
+
+void TorrentBase::setHashWhileParsing(bool enable) { s_hash_while_parsing = enable; }
 
 std::string TorrentBase::lasterror() { return m_lasterror; }
 std::string TorrentBase::filename() { return m_buffer.m_filename; }
 
+/* usually computed while parsing already (m_info_hasher) */
 std::string TorrentBase::infohash() { if (m_info_hash.empty() && m_raw_info.length() > 0) m_info_hash = m_raw_info.sha1(); return m_info_hash; }
 
-bool TorrentBase::loadfile(const std::string &filename) {
-	if (!m_buffer.load(filename)) return seterror("couldn't load file");
+bool TorrentBase::loadfile(const std::string &filename, bool lazy) {
+	if (!(lazy ? m_buffer.loadLazy(filename) : m_buffer.load(filename))) return seterror("couldn't load file");
 	return true;
 }
 
+void TorrentBase::loadbuffer(Buffer &buffer) {
+	m_buffer.clear();
+	m_buffer.swap(buffer);
+}
+
 void TorrentBase::sanitize_announce_urls(const TorrentSanitize &san, const TorrentBase *mergefromother) {
 	AnnounceList list(san);
-	list.force_merge(san.additional_announce_urls);
+	list.force_merge(san.filters().additional_announce_urls);
 	list.merge(*this);
 
 	if (0 != mergefromother) list.merge(*mergefromother);
 
 	t_announce_list.clear();
 
-	if (list.list.empty()) {
+	if (list.empty()) {
 		std::string hash = infohash();
 		for (size_t i = 0; i < hash.length(); i++) hash[i] = ::toupper(hash[i]);
 		t_announce = std::string("dht://") + hash;
 	} else {
-		t_announce = list.list[0][0];
-		t_announce_list = list.list;
+		list.copyTo(t_announce_list);
+		t_announce = t_announce_list[0][0];
 	}
 }
 
@@ -80,7 +98,8 @@ bool TorrentBase::errorcontext(const char msg[]) {
 
 bool TorrentBase::seterror(const char msg[]) {
 	std::ostringstream oss;
-	std::string context = std::string(m_buffer.m_data + m_buffer.pos(), std::min<size_t>(16, m_buffer.m_len - m_buffer.pos()));
+	m_buffer.fill(m_buffer.pos() + 16);
+	std::string context = std::string(m_buffer.m_data + m_buffer.pos(), std::min<size_t>(16, m_buffer.m_loaded - std::min(m_buffer.m_loaded, m_buffer.pos())));
 	oss << "Error @[" << m_buffer.pos() << "/" << m_buffer.m_len << " '" << context << "'...]: " << msg;
 	m_lasterror = oss.str();
 	return false;
@@ -93,6 +112,8 @@ bool TorrentBase::read_string(BufferString &str) {
 	str.m_data = 0; str.m_len = 0;
 
 	if (pos >= len) return seterror("expected string length, found eof");
+	/* at most 11 digits and ':' before failing with overflow */
+	if (!m_buffer.fill(pos + 13)) return seterror("couldn't read file");
 
 	c = m_buffer.m_data[pos++];
 	if (c < '0' || c > '9') return seterror("expected digit for string length, found eof");
@@ -111,6 +132,7 @@ bool TorrentBase::read_string(BufferString &str) {
 	}
 
 	if (slen > len || slen > len - pos) return seterror("file not large enough for string length"); /* overflow */
+	if (!m_buffer.fill(pos + slen)) return seterror("couldn't read file");
 
 	str.m_data = m_buffer.m_data + pos;
 	str.m_len = slen;
@@ -165,6 +187,8 @@ bool TorrentBase::read_number(int64_t &number) {
 	number = 0;
 
 	if (pos >= len) return seterror("expected number, found eof");
+	/* 'i', '-', at most 20 digits before failing with overflow, 'e' */
+	if (!m_buffer.fill(pos + 24)) return seterror("couldn't read file");
 
 	c = m_buffer.m_data[pos++];
 	if (c != 'i') return seterror("expected 'i' for number");
@@ -212,6 +236,7 @@ bool TorrentBase::skip_number() {
 	int64_t pos = m_buffer.pos(), len = m_buffer.m_len;
 
 	if (pos >= len) return seterror("expected number, found eof");
+	if (!m_buffer.fill(pos + 24)) return seterror("couldn't read file");
 
 	c = m_buffer.m_data[pos++];
 	if (c != 'i') return seterror("expected 'i' for number");
@@ -231,6 +256,8 @@ bool TorrentBase::skip_number() {
 	}
 
 	for (;;) {
+		/* no overflow check here, numbers can be arbitrary long */
+		if (!m_buffer.fill(pos + 1)) return seterror("couldn't read file");
 		c = m_buffer.m_data[pos++];
 		if (c == 'e') break;
 		if (pos >= len) return seterror("expected digit or 'e' for number, found eof");
@@ -241,68 +268,51 @@ bool TorrentBase::skip_number() {
 	return true;
 }
 
-bool TorrentBase::skip_list() {
-	if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected list, found eof");
-	if (m_buffer.m_data[m_buffer.pos()] != 'l') return seterror("expected 'l' for list");
-
-	m_buffer.next();
-	if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected list entry or 'e', found eof");
-
-	while (m_buffer.m_data[m_buffer.pos()] != 'e') {
-		if (!skip_value()) return errorcontext("parsing list entry failed");;
-		if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected list entry or 'e', found eof");
-	}
-	m_buffer.next();
-
-	return true;
-}
-
-bool TorrentBase::skip_dict() {
-	if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict, found eof");
-	if (m_buffer.m_data[m_buffer.pos()] != 'd') return seterror("expected 'd' for dict");
-
-	m_buffer.next();
-	if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict entry or 'e', found eof");
-
-	BufferString last, cur;
-
-	while (m_buffer.m_data[m_buffer.pos()] != 'e') {
-		if (!read_utf8(cur)) return errorcontext("parsing dict key failed");
-		if (cur <= last) return seterror("(previous) dict entries in wrong order");
-		last = cur;
-		if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict value, found eof");
-		if (!skip_value()) return errorcontext("parsing dict value failed");
-		if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict entry or 'e', found eof");
+/* read a dict key; keys equal to known (always valid utf-8) are not checked again */
+bool TorrentBase::read_dict_key(BufferString &key, BufferString known) {
+	size_t pos = m_buffer.pos();
+	if (!read_string(key)) return errorcontext("parsing dict key failed");
+	if (key != known && !key.validUTF8Text()) {
+		m_buffer.m_pos = pos;
+		seterror("string not valid utf-8");
+		return errorcontext("parsing dict key failed");
 	}
-	m_buffer.next();
-
 	return true;
 }
 
 /* skip entries until found search or dict end. skipped does not include the found key */
-bool TorrentBase::try_next_dict_entry(BufferString search, BufferString prev, bool &error, BufferString *skipped) {
+bool TorrentBase::try_next_dict_entry(DictCursor &dict, BufferString search, bool &error, BufferString *skipped) {
 	size_t start = m_buffer.pos();
 	error = true;
 	if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict, found eof");
 
 	BufferString cur;
 
-	while (m_buffer.m_data[m_buffer.pos()] != 'e') {
-		size_t curpos = m_buffer.pos();;
-		if (!read_utf8(cur)) return errorcontext("parsing dict key failed");
-		if (cur <= prev) return seterror("(previous) dict entries in wrong order");
+	while (dict.has_pending || !m_buffer.isNext('e')) {
+		size_t curpos = m_buffer.pos();
+		if (dict.has_pending) {
+			cur = dict.pending;
+			m_buffer.m_pos = dict.pending_end;
+			dict.has_pending = false;
+		} else {
+			if (!read_dict_key(cur, search)) return false;
+			if (cur <= dict.prev) return seterror("(previous) dict entries in wrong order");
+			dict.prev = cur;
+		}
 		if (cur == search) {
 			error = false;
 			if (0 != skipped) *skipped = BufferString(m_buffer.data() + start, curpos - start);
 			return true;
 		}
 		if (cur > search) {
+			dict.pending = cur;
+			dict.pending_end = m_buffer.pos();
+			dict.has_pending = true;
 			m_buffer.m_pos = curpos;
 			error = false;
 			if (0 != skipped) *skipped = BufferString(m_buffer.data() + start, m_buffer.pos() - start);
 			return false;
 		}
-		prev = cur;
 		if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict value, found eof");
 		if (!skip_value()) return errorcontext("parsing dict value failed");
 		if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict entry or 'e', found eof");
@@ -315,19 +325,24 @@ bool TorrentBase::try_next_dict_entry(BufferString search, BufferString prev, bo
 }
 
 /* skip entries until dict end */
-bool TorrentBase::goto_dict_end(BufferString prev, BufferString *skipped) {
+bool TorrentBase::goto_dict_end(DictCursor &dict, BufferString *skipped) {
 	size_t start = m_buffer.pos();
 	if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict entry or 'e', found eof");
 
 	BufferString cur;
 
-	while (m_buffer.m_data[m_buffer.pos()] != 'e') {
-		if (!read_utf8(cur)) return errorcontext("parsing dict key failed");
-		if (cur <= prev) {
-			std::cerr << "dict entries wrong order: '" << cur << "' <= '" << prev << "'\n";
+	while (dict.has_pending || !m_buffer.isNext('e')) {
+		if (dict.has_pending) {
+			m_buffer.m_pos = dict.pending_end;
+			dict.has_pending = false;
+		} else {
+			if (!read_dict_key(cur, BufferString())) return false;
+			if (cur <= dict.prev) {
+				std::cerr << "dict entries wrong order: '" << cur << "' <= '" << dict.prev << "'\n";
+			}
+			if (cur <= dict.prev) return seterror("(previous) dict entries in wrong order");
+			dict.prev = cur;
 		}
-		if (cur <= prev) return seterror("(previous) dict entries in wrong order");
-		prev = cur;
 		if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict value, found eof");
 		if (!skip_value()) return errorcontext("parsing dict value failed");
 		if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected dict entry or 'e', found eof");
@@ -342,12 +357,174 @@ bool TorrentBase::goto_dict_end(BufferString prev, BufferString *skipped) {
 bool TorrentBase::skip_value() {
 	char c;
 	if (m_buffer.pos() >= m_buffer.m_len) return seterror("expected value, found eof");
-	c = m_buffer.m_data[m_buffer.pos()];
+	c = m_buffer.current();
 	if (c >= '0' && c <= '9') return skip_string();
 	if (c == 'i') return skip_number();
-	if (c == 'l') return skip_list();
-	if (c == 'd') return skip_dict();
+	if (c == 'l' || c == 'd') {
+		if (s_use_tape && skip_tape()) return true;
+
+		/* walk it byte by byte (again) to find the exact error */
+		return skip_container();
+	}
 	return seterror("expected value");
 }
 
+namespace {
+	struct SkipFrame {
+		bool dict;
+		BufferString last; /* last dict key */
+	};
+
+	/* the first BENCODE_INLINE_DEPTH frames live in the object itself */
+	class SkipStack {
+	public:
+		SkipStack() : m_size(0) { }
+
+		size_t size() const { return m_size; }
+		bool empty() const { return 0 == m_size; }
+
+		SkipFrame& operator[](size_t ndx) { return ndx < BENCODE_INLINE_DEPTH ? m_inline[ndx] : m_more[ndx - BENCODE_INLINE_DEPTH]; }
+		SkipFrame& top() { return (*this)[m_size - 1]; }
+
+		void push(bool dict) {
+			SkipFrame f = { dict, BufferString() };
+			if (m_size < BENCODE_INLINE_DEPTH) m_inline[m_size] = f; else m_more.push_back(f);
+			m_size++;
+		}
+		void pop() {
+			m_size--;
+			if (m_size >= BENCODE_INLINE_DEPTH) m_more.pop_back();
+		}
+
+	private:
+		SkipFrame m_inline[BENCODE_INLINE_DEPTH];
+		std::vector<SkipFrame> m_more;
+		size_t m_size;
+	};
+}
+
+/* same checks and error messages as skipping lists and dicts recursively:
+ * when a value fails, every enclosing container adds its error context */
+bool TorrentBase::skip_container() {
+	SkipStack stack;
+	bool enter = true;
+
+	for (;;) {
+		if (enter) {
+			/* at 'l' or 'd' */
+			if (stack.size() >= s_max_depth) {
+				seterror("lists and dicts nested too deep");
+				break;
+			}
+			stack.push('d' == m_buffer.current());
+			m_buffer.next();
+			enter = false;
+			if (m_buffer.pos() >= m_buffer.m_len) {
+				seterror(stack.top().dict ? "expected dict entry or 'e', found eof" : "expected list entry or 'e', found eof");
+				stack.pop();
+				break;
+			}
+		}
+
+		m_info_hasher.progress(m_buffer.pos());
+		SkipFrame &f = stack.top();
+
+		if (m_buffer.isNext('e')) {
+			m_buffer.next();
+			stack.pop();
+			if (stack.empty()) return true;
+			if (m_buffer.pos() >= m_buffer.m_len) {
+				seterror(stack.top().dict ? "expected dict entry or 'e', found eof" : "expected list entry or 'e', found eof");
+				stack.pop();
+				break;
+			}
+			continue;
+		}
+
+		if (f.dict) {
+			BufferString cur;
+			if (!read_utf8(cur)) {
+				errorcontext("parsing dict key failed");
+				stack.pop();
+				break;
+			}
+			if (cur <= f.last) {
+				seterror("(previous) dict entries in wrong order");
+				stack.pop();
+				break;
+			}
+			f.last = cur;
+			if (m_buffer.pos() >= m_buffer.m_len) {
+				seterror("expected dict value, found eof");
+				stack.pop();
+				break;
+			}
+		}
+
+		char c = m_buffer.current();
+		if (c == 'l' || c == 'd') {
+			enter = true;
+			continue;
+		}
+
+		bool ok;
+		if (c >= '0' && c <= '9') ok = skip_string();
+		else if (c == 'i') ok = skip_number();
+		else ok = seterror("expected value");
+		if (!ok) break;
+
+		if (m_buffer.pos() >= m_buffer.m_len) {
+			seterror(f.dict ? "expected dict entry or 'e', found eof" : "expected list entry or 'e', found eof");
+			stack.pop();
+			break;
+		}
+	}
+
+	/* error in a value of each remaining container; same as calling
+	 * errorcontext() for each of them, without copying the message every time */
+	std::string context;
+	for (size_t i = 0; i < stack.size(); i++) {
+		context += "Error: ";
+		context += stack[i].dict ? "parsing dict value failed" : "parsing list entry failed";
+		context += "\n    in ";
+	}
+	m_lasterror = context + m_lasterror;
+	return false;
+}
+
+bool TorrentBase::skip_tape() {
+	/* lazy buffers: don't load everything just to skip */
+	if (m_buffer.m_loaded < m_buffer.m_len) return false;
+
+	if (!m_tape.build(m_buffer.m_data, m_buffer.m_len, m_buffer.pos(), s_max_depth, m_info_hasher.active() ? &m_info_hasher : 0)) return false;
+
+	/* same rules as skip_dict: keys are utf-8 text and strictly increasing.
+	 * keys repeat a lot (every file entry has "length" and "path"), so
+	 * remember some valid keys and don't check their utf-8 again */
+	const std::vector<BencodeTape::Key> &keys = m_tape.keys();
+	const char *data = m_buffer.m_data;
+	BencodeTape::Key valid[16];
+	for (size_t i = 0; i < 16; i++) valid[i].length = BencodeTape::npos;
+
+	for (size_t i = 0; i < keys.size(); i++) {
+		const BencodeTape::Key &cur = keys[i];
+		BencodeTape::Key &cached = valid[(cur.length + (cur.length > 0 ? data[cur.offset] : 0)) & 15];
+		if (cached.length != cur.length || 0 != memcmp(data + cached.offset, data + cur.offset, cur.length)) {
+			if (!validUTF8Text(data + cur.offset, cur.length)) return false;
+			cached = cur;
+		}
+
+		if (BencodeTape::npos == cur.prev) {
+			if (0 == cur.length) return false;
+		} else {
+			const BencodeTape::Key &last = keys[cur.prev];
+			int c = memcmp(data + last.offset, data + cur.offset, std::min(last.length, cur.length));
+			if (c > 0 || (0 == c && cur.length <= last.length)) return false;
+		}
+	}
+
+	m_buffer.m_pos = m_tape.end();
+	return true;
+}
+
 }
@@ -1,9 +1,12 @@
 #ifndef __TORRENT_SANITIZE_TORRENTBASE_H
 #define __TORRENT_SANITIZE_TORRENTBASE_H
 
+#include "config.h"
 #include "sanitize-settings.h"
 
 #include "buffer.h"
+#include "bencode-tape.h"
+#include "info-hash.h"
 
 #include <string>
 #include <vector>
@@ -19,9 +22,6 @@
 
 namespace torrent {
 
-typedef std::pair<std::string, int64_t> File;
-
-
 class TorrentBase {
 public:
 	TorrentBase();
@@ -30,20 +30,40 @@ public:
 	std::string filename();
 
 	std::string infohash();
+	/* the bencoded info dict (empty if parsing didn't get there) */
+	BufferString rawInfo() const { return m_raw_info; }
 
 	std::string t_announce;
 	std::vector< std::vector< std::string > > t_announce_list;
 
 	void sanitize_announce_urls(const TorrentSanitize &san, const TorrentBase *mergefromother = 0);
 
+	/* skip lists and dicts with a BencodeTape (default); off: byte by byte only */
+	static void setUseTape(bool use);
+
+	/* maximum nesting of lists and dicts in skipped values (BENCODE_MAX_DEPTH) */
+	static void setMaxDepth(size_t depth);
+	static size_t maxDepth();
+
+	/* compute the info hash while parsing (default); off: infohash() hashes
+	 * rawInfo() when called, for callers hashing many of them with SHA1Batch */
+	static void setHashWhileParsing(bool enable);
+
 protected:
 	bool m_check_info_utf8;
 
 	Buffer m_buffer;
-	bool loadfile(const std::string &filename);
+	/* lazy: only load what the parser needs (see Buffer::loadLazy) */
+	bool loadfile(const std::string &filename, bool lazy = false);
+	/* take over the content of an already loaded buffer */
+	void loadbuffer(Buffer &buffer);
 
 	BufferString m_raw_info;
 	std::string m_info_hash;
+	/* started by the parser at the info dict, fed while skipping and
+	 * parsing it; finish() sets m_info_hash */
+	InfoHash m_info_hasher;
+	void begin_info_hash(size_t start) { if (s_hash_while_parsing) m_info_hasher.begin(start); }
 
 	std::string m_lasterror;
 
@@ -68,72 +88,43 @@ protected:
 	bool read_number(int64_t &number);
 	bool skip_number();
 
-	bool skip_list();
+	/* walks a dict once: try_next_dict_entry is called with the expected keys
+	 * in order, each key is read and checked only once. a key after a missing
+	 * search stays pending for the next call (the position is left in front of
+	 * it, so errors and skipped ranges look as if it wasn't read yet) */
+	struct DictCursor {
+		DictCursor(BufferString prev = BufferString()) : prev(prev), pending_end(0), has_pending(false) { }
+
+		BufferString prev; /* last key read */
+		BufferString pending;
+		size_t pending_end;
+		bool has_pending;
+	};
 
-	bool skip_dict();
+	/* read a dict key and check it is utf-8 (unless it equals known) */
+	bool read_dict_key(BufferString &key, BufferString known);
 
 	/* skip entries until found search or dict end. skipped does not include the found key */
-	bool try_next_dict_entry(BufferString search, BufferString prev, bool &error, BufferString *skipped = 0);
+	bool try_next_dict_entry(DictCursor &dict, BufferString search, bool &error, BufferString *skipped = 0);
 
 	/* skip entries until dict end */
-	bool goto_dict_end(BufferString prev, BufferString *skipped = 0);
+	bool goto_dict_end(DictCursor &dict, BufferString *skipped = 0);
 
 	bool skip_value();
-};
-
-class AnnounceList {
-public:
-	AnnounceList(const TorrentSanitize &san) : m_san(san) { }
-
-	void merge(std::string url) {
-		std::vector<AnnounceUrl> annurls;
-		annurls = m_san.filterUrl(url);
-
-		for (size_t i = 0; i < annurls.size(); i++)
-			add(annurls[i].domain, annurls[i].url);
-	}
-
-	template<typename T> void merge(std::vector< T > urllist) {
-		for (size_t i = 0; i < urllist.size(); i++) merge(urllist[i]);
-	}
 
-	void force_merge(const std::string &url) {
-		AnnounceUrl annurl;
-		if (!m_san.basicUrlCleaner(url, annurl)) return;
-
-		add(annurl.domain, annurl.url);
-	}
-
-	template<typename T> void force_merge(std::vector< T > urllist) {
-		for (size_t i = 0; i < urllist.size(); i++) merge(urllist[i]);
-	}
+private:
+	/* skip list/dict at current position using the tape; false if it isn't
+	 * valid (the byte-wise skip then reports the error) */
+	bool skip_tape();
 
-	void merge(const TorrentBase &t) {
-		merge(t.t_announce);
-		merge(t.t_announce_list);
-	}
+	/* skip list/dict at current position byte by byte, without recursion */
+	bool skip_container();
 
-	std::vector< std::vector< std::string > > list;
+	BencodeTape m_tape;
 
-private:
-	const TorrentSanitize &m_san;
-
-	typedef std::map< std::string, size_t > GroupIndex;
-	GroupIndex m_index;
-
-	void add(const std::string &domain, const std::string &url) {
-		GroupIndex::iterator it;
-		it = m_index.find(domain);
-		if (m_index.end() == it || it->second >= list.size()) {
-			m_index.insert(std::make_pair( domain, list.size() ));
-			std::vector<std::string> l;
-			l.push_back(url);
-			list.push_back(l);
-		} else {
-			std::vector<std::string> &l = list[it->second];
-			if (l.end() == std::find(l.begin(), l.end(), url)) l.push_back(url);
-		}
-	}
+	static bool s_use_tape;
+	static size_t s_max_depth;
+	static bool s_hash_while_parsing;
 };
 
 }
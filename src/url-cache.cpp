@@ -0,0 +1,249 @@
+#include "url-cache.h"
+
+#include <iostream>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+}
+
+namespace torrent {
+
+/* record 0 is the header; the others:
+ *   uint32 checksum (0: empty), uint32 length, payload of length bytes:
+ *   fingerprint '\0' key '\0' value
+ */
+static const char URL_CACHE_MAGIC[8] = { 'T', 'S', 'U', 'R', 'L', 'C', '1', '\0' };
+static const size_t RECORD_HEADER = 8;
+
+struct UrlCacheHeader {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t records;
+};
+
+static uint32_t checksum(const unsigned char *data, size_t len) {
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) h = (h ^ data[i]) * 16777619u;
+	return (0 == h) ? 1 : h;
+}
+
+static uint64_t slotHash(const std::string &fingerprint, const std::string &key) {
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < fingerprint.length(); i++) h = (h ^ (unsigned char) fingerprint[i]) * 1099511628211ull;
+	h *= 1099511628211ull; /* '\0' between them */
+	for (size_t i = 0; i < key.length(); i++) h = (h ^ (unsigned char) key[i]) * 1099511628211ull;
+	return h;
+}
+
+UrlCache::UrlCache(size_t entries)
+: m_entries(entries), m_map(0), m_map_size(0), m_hits(0), m_file_hits(0), m_misses(0) {
+	::pthread_mutex_init(&m_lock, NULL);
+}
+
+UrlCache::~UrlCache() {
+	closeFile();
+	::pthread_mutex_destroy(&m_lock);
+}
+
+void UrlCache::clear() {
+	m_lru.clear();
+	m_index.clear();
+}
+
+void UrlCache::setEntries(size_t entries) {
+	m_entries = entries;
+	while (m_lru.size() > m_entries) {
+		m_index.erase(m_lru.back().first);
+		m_lru.pop_back();
+	}
+}
+
+void UrlCache::setFingerprint(const std::string &fingerprint) {
+	if (fingerprint == m_fingerprint) return;
+	m_fingerprint = fingerprint;
+	clear();
+}
+
+/* a new file with just the header, renamed over filename. the old file is
+ * never truncated: other processes may still have it mapped (a shrinking
+ * mapping means SIGBUS), they keep using it until they reopen */
+static int replaceCacheFile(const std::string &filename, size_t size) {
+	std::string tmp = filename + ".XXXXXX";
+	int fd = ::mkstemp(&tmp[0]); /* mode 0600 */
+	if (-1 == fd) return -1;
+	::fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	UrlCacheHeader header;
+	memcpy(header.magic, URL_CACHE_MAGIC, sizeof(header.magic));
+	header.record_size = URL_CACHE_RECORD;
+	header.records = URL_CACHE_DISK_RECORDS;
+	if (-1 == ::ftruncate(fd, size) || (ssize_t) sizeof(header) != ::pwrite(fd, &header, sizeof(header), 0)
+			|| -1 == ::rename(tmp.c_str(), filename.c_str())) {
+		int e = errno;
+		::close(fd);
+		::unlink(tmp.c_str());
+		errno = e;
+		return -1;
+	}
+	return fd;
+}
+
+bool UrlCache::openFile(const std::string &filename) {
+	closeFile();
+
+	const size_t size = (URL_CACHE_DISK_RECORDS + 1) * (size_t) URL_CACHE_RECORD;
+	int fd;
+	for (;;) {
+		fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (-1 == fd) {
+			int e = errno;
+			std::cerr << "Cannot open url cache '" << filename << "': " << ::strerror(e) << std::endl;
+			return false;
+		}
+		/* one process at a time checks (and replaces) the file */
+		while (-1 == ::flock(fd, LOCK_EX)) {
+			if (EINTR == errno) continue;
+			int e = errno;
+			std::cerr << "Cannot lock url cache '" << filename << "': " << ::strerror(e) << std::endl;
+			::close(fd);
+			return false;
+		}
+		/* replaced while we waited for the lock: open the new one */
+		struct stat st, path_st;
+		if (0 == ::fstat(fd, &st) && 0 == ::stat(filename.c_str(), &path_st) && st.st_dev == path_st.st_dev && st.st_ino == path_st.st_ino) break;
+		::close(fd);
+	}
+
+	/* replace files of another size or layout (or new, empty ones) */
+	UrlCacheHeader header;
+	struct stat st;
+	if (-1 == ::fstat(fd, &st) || (size_t) st.st_size != size
+			|| (ssize_t) sizeof(header) != ::pread(fd, &header, sizeof(header), 0)
+			|| 0 != memcmp(header.magic, URL_CACHE_MAGIC, sizeof(header.magic))
+			|| URL_CACHE_RECORD != header.record_size || URL_CACHE_DISK_RECORDS != header.records) {
+		int fresh = replaceCacheFile(filename, size);
+		if (-1 == fresh) {
+			int e = errno;
+			std::cerr << "Cannot initialize url cache '" << filename << "': " << ::strerror(e) << std::endl;
+			::close(fd);
+			return false;
+		}
+		::close(fd); /* unlocks: processes waiting for it find the new file */
+		fd = fresh;
+	}
+
+	void *map = ::mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int e = errno;
+	::flock(fd, LOCK_UN); /* the mapping would keep the lock after close() */
+	::close(fd);
+	if (MAP_FAILED == map) {
+		std::cerr << "Cannot map url cache '" << filename << "': " << ::strerror(e) << std::endl;
+		return false;
+	}
+	m_map = (unsigned char*) map;
+	m_map_size = size;
+	m_filename = filename;
+	return true;
+}
+
+void UrlCache::closeFile() {
+	if (0 != m_map) ::munmap(m_map, m_map_size);
+	m_map = 0;
+	m_map_size = 0;
+	m_filename.clear();
+}
+
+unsigned char* UrlCache::record(const std::string &key) const {
+	return m_map + (1 + slotHash(m_fingerprint, key) % URL_CACHE_DISK_RECORDS) * URL_CACHE_RECORD;
+}
+
+void UrlCache::remember(const std::string &key, const std::string &value) {
+	if (0 == m_entries) return;
+	std::map<std::string, Lru::iterator>::iterator i = m_index.find(key);
+	if (m_index.end() != i) {
+		m_lru.erase(i->second);
+		m_index.erase(i);
+	}
+	m_lru.push_front(std::make_pair(key, value));
+	m_index.insert(std::make_pair(key, m_lru.begin()));
+	if (m_lru.size() > m_entries) {
+		m_index.erase(m_lru.back().first);
+		m_lru.pop_back();
+	}
+}
+
+bool UrlCache::lookup(const std::string &key, std::string &value) {
+	::pthread_mutex_lock(&m_lock);
+	bool found = find(key, value);
+	::pthread_mutex_unlock(&m_lock);
+	return found;
+}
+
+void UrlCache::store(const std::string &key, const std::string &value) {
+	::pthread_mutex_lock(&m_lock);
+	insert(key, value);
+	::pthread_mutex_unlock(&m_lock);
+}
+
+bool UrlCache::find(const std::string &key, std::string &value) {
+	std::map<std::string, Lru::iterator>::iterator i = m_index.find(key);
+	if (m_index.end() != i) {
+		/* move to front */
+		m_lru.splice(m_lru.begin(), m_lru, i->second);
+		value = i->second->second;
+		m_hits++;
+		return true;
+	}
+
+	if (0 != m_map) {
+		/* copy first: another process may be writing the record */
+		unsigned char rec[URL_CACHE_RECORD];
+		memcpy(rec, record(key), URL_CACHE_RECORD);
+		uint32_t sum, len;
+		memcpy(&sum, rec, 4);
+		memcpy(&len, rec + 4, 4);
+		const size_t prefix = m_fingerprint.length() + 1 + key.length() + 1;
+		if (0 != sum && len >= prefix && len <= URL_CACHE_RECORD - RECORD_HEADER && sum == checksum(rec + 4, 4 + len)) {
+			const char *payload = (const char*) rec + RECORD_HEADER;
+			if (0 == memcmp(payload, m_fingerprint.c_str(), m_fingerprint.length() + 1)
+					&& 0 == memcmp(payload + m_fingerprint.length() + 1, key.c_str(), key.length() + 1)) {
+				value.assign(payload + prefix, len - prefix);
+				remember(key, value);
+				m_file_hits++;
+				return true;
+			}
+		}
+	}
+
+	m_misses++;
+	return false;
+}
+
+void UrlCache::insert(const std::string &key, const std::string &value) {
+	remember(key, value);
+
+	const uint32_t len = m_fingerprint.length() + 1 + key.length() + 1 + value.length();
+	if (0 == m_map || len > URL_CACHE_RECORD - RECORD_HEADER) return;
+	unsigned char rec[URL_CACHE_RECORD];
+	memcpy(rec + 4, &len, 4);
+	unsigned char *payload = rec + RECORD_HEADER;
+	memcpy(payload, m_fingerprint.c_str(), m_fingerprint.length() + 1);
+	payload += m_fingerprint.length() + 1;
+	memcpy(payload, key.c_str(), key.length() + 1);
+	payload += key.length() + 1;
+	memcpy(payload, value.data(), value.length());
+	uint32_t sum = checksum(rec + 4, 4 + len);
+	memcpy(rec, &sum, 4);
+	memcpy(record(key), rec, RECORD_HEADER + len);
+}
+
+}
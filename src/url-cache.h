@@ -0,0 +1,89 @@
+#ifndef __TORRENT_SANITIZE_URL_CACHE_H
+#define __TORRENT_SANITIZE_URL_CACHE_H
+
+#include "config.h"
+
+#include <string>
+#include <list>
+#include <map>
+
+extern "C" {
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+}
+
+namespace torrent {
+
+/* results of the url filter by raw url: an lru in memory and optionally a
+ * table in a file (mmap()ed, shared by all processes using the same file).
+ *
+ * values are opaque strings. the fingerprint identifies the filter config:
+ * entries stored with another fingerprint are never returned, so processes
+ * with different configs can share a file (they just evict each other).
+ *
+ * the file (mode 0600) is a direct mapped table of fixed size records, each
+ * with a checksum; records aren't locked between processes: a record being
+ * written concurrently fails the checksum and is a miss. openFile() checks the
+ * file under flock(); a file of another layout is replaced through rename(),
+ * never truncated under processes that still map it.
+ *
+ * lookup() and store() can be called from several threads.
+ */
+class UrlCache {
+private:
+	UrlCache(const UrlCache &o);
+	UrlCache& operator=(const UrlCache &o);
+
+public:
+	explicit UrlCache(size_t entries = URL_CACHE_ENTRIES);
+	~UrlCache();
+
+	/* drops the entries in memory */
+	void clear();
+	/* 0 disables the lru */
+	void setEntries(size_t entries);
+	size_t entries() const { return m_entries; }
+
+	/* clears the lru if the fingerprint changed */
+	void setFingerprint(const std::string &fingerprint);
+	const std::string& fingerprint() const { return m_fingerprint; }
+
+	/* creates the file if needed; false on errors (printed) */
+	bool openFile(const std::string &filename);
+	void closeFile();
+	/* empty if no file is open */
+	const std::string& filename() const { return m_filename; }
+
+	bool lookup(const std::string &key, std::string &value);
+	void store(const std::string &key, const std::string &value);
+
+	size_t hits() const { return m_hits; }
+	size_t fileHits() const { return m_file_hits; }
+	size_t misses() const { return m_misses; }
+
+private:
+	typedef std::list< std::pair<std::string, std::string> > Lru;
+
+	bool find(const std::string &key, std::string &value);
+	void insert(const std::string &key, const std::string &value);
+	void remember(const std::string &key, const std::string &value);
+	unsigned char* record(const std::string &key) const;
+
+	size_t m_entries;
+	Lru m_lru; /* most recently used first */
+	std::map<std::string, Lru::iterator> m_index;
+	std::string m_fingerprint;
+
+	unsigned char *m_map;
+	size_t m_map_size;
+	std::string m_filename;
+
+	size_t m_hits, m_file_hits, m_misses;
+
+	pthread_mutex_t m_lock; /* lookup, store */
+};
+
+}
+
+#endif
@@ -0,0 +1,231 @@
+#include "url-canonical.h"
+
+extern "C" {
+#include <string.h>
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# define HAVE_URL_SIMD 1
+extern "C" {
+#include <emmintrin.h>
+}
+#endif
+
+namespace torrent {
+
+enum {
+	C_ALNUM = 1,
+	C_DIGIT = 2,
+	C_HEX = 4, /* 0-9a-f */
+	C_LABEL_START = 8, /* alnum _ */
+	C_LABEL = 16, /* alnum - _ */
+	C_PATH = 32 /* alnum % & + - . / : = ? _ */
+};
+
+/* ascii only: other bytes have no class and are not changed by lower */
+struct CharClasses {
+	unsigned char cls[256];
+	unsigned char lower[256];
+
+	CharClasses() {
+		for (int c = 0; c < 256; c++) {
+			const bool digit = (c >= '0' && c <= '9'), alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+			unsigned char f = 0;
+			if (digit || alpha) f |= C_ALNUM | C_LABEL_START | C_LABEL | C_PATH;
+			if (digit) f |= C_DIGIT;
+			if (digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) f |= C_HEX;
+			if ('_' == c) f |= C_LABEL_START | C_LABEL;
+			if ('-' == c) f |= C_LABEL;
+			if (0 != strchr("%&+-./:=?_", c) && 0 != c) f |= C_PATH;
+			cls[c] = f;
+			lower[c] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+		}
+	}
+};
+
+static const CharClasses s_classes;
+
+static inline bool hasClass(char c, unsigned char f) {
+	return 0 != (s_classes.cls[(unsigned char) c] & f);
+}
+
+static size_t pathScalar(const char *s, size_t len) {
+	size_t i = 0;
+	while (i < len && hasClass(s[i], C_PATH)) i++;
+	return i;
+}
+
+#ifdef HAVE_URL_SIMD
+/* signed compares: bytes >= 0x80 are negative and in none of the ranges */
+static inline __m128i inRange(__m128i v, char lo, char hi) {
+	return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+/* announce paths are mostly passkeys: long alnum runs */
+static size_t pathRun(const char *s, size_t len) {
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (s + i));
+		__m128i ok = _mm_or_si128(inRange(v, '-', ':'), _mm_or_si128(inRange(v, 'a', 'z'), inRange(v, 'A', 'Z')));
+		ok = _mm_or_si128(ok, _mm_or_si128(inRange(v, '%', '&'), _mm_cmpeq_epi8(v, _mm_set1_epi8('+'))));
+		ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('=')),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('?')), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')))));
+		unsigned int bad = 0xFFFF ^ (unsigned int) _mm_movemask_epi8(ok);
+		if (0 != bad) return i + __builtin_ctz(bad);
+	}
+	return i + pathScalar(s + i, len - i);
+}
+#else
+static size_t pathRun(const char *s, size_t len) {
+	return pathScalar(s, len);
+}
+#endif
+
+/* exactly 4 decimal octets of 1-3 digits, each <= 255 (only digits and dots) */
+static bool validIPv4(const char *s, size_t len) {
+	size_t groups = 0, digits = 0;
+	unsigned int octet = 0;
+	for (size_t i = 0; i <= len; i++) {
+		if (i == len || '.' == s[i]) {
+			if (0 == digits || octet > 255) return false;
+			groups++;
+			digits = 0;
+			octet = 0;
+		} else {
+			if (++digits > 3) return false;
+			octet = 10*octet + (s[i] - '0');
+		}
+	}
+	return 4 == groups;
+}
+
+static const char* findProtocolEnd(const char *url, size_t len) {
+	if (len < 3) return 0;
+	const char *end = url + len - 2;
+	for (const char *p = url; p < end && 0 != (p = (const char*) memchr(p, ':', end - p)); p++) {
+		if ('/' == p[1] && '/' == p[2]) return p;
+	}
+	return 0;
+}
+
+bool canonicalUrl(const char *url, size_t len, char *out, CanonicalUrl &result) {
+	if (len >= 6 && 0 == memcmp(url, "dht://", 6)) return false; /* drop dht urls - fallback if no other url is found */
+
+	const char *prot_end = findProtocolEnd(url, len);
+	if (0 == prot_end) return false; /* not an url */
+	const char *end = url + len;
+
+	/* protocol: only a-z0-9 */
+	char *o = out;
+	for (const char *s = url; s < prot_end; s++) {
+		if (!hasClass(*s, C_ALNUM)) return false;
+		*o++ = s_classes.lower[(unsigned char) *s];
+	}
+	const size_t prot_len = o - out;
+	memcpy(o, "://", 3);
+	o += 3;
+
+	/* host [":" port] up to the first '/' */
+	const char *host = prot_end + 3;
+	const char *path = (const char*) memchr(host, '/', end - host);
+	if (0 == path) path = end;
+	const char *port = path;
+	for (const char *s = path; s-- > host; ) {
+		if (':' == *s) {
+			port = s;
+			break;
+		}
+	}
+
+	/* domain: lowercase, without one trailing dot; collect what the checks
+	 * below need in the same pass */
+	size_t dlen = port - host;
+	if (dlen > 0 && '.' == host[dlen-1]) dlen--;
+	if (0 == dlen) return false;
+	char *dom = o;
+	size_t last_dot = ~(size_t) 0, prev_dot = ~(size_t) 0;
+	bool label_start = true, name_ok = true, ipv4_chars = true, ipv6_chars = true;
+	for (size_t i = 0; i < dlen; i++) {
+		const unsigned char c = s_classes.lower[(unsigned char) host[i]];
+		const unsigned char f = s_classes.cls[c];
+		dom[i] = c;
+		if ('.' == c) {
+			if (label_start) name_ok = false; /* empty label */
+			label_start = true;
+			prev_dot = last_dot;
+			last_dot = i;
+		} else {
+			if (0 == (f & (label_start ? C_LABEL_START : C_LABEL))) name_ok = false;
+			if (0 == (f & C_DIGIT)) ipv4_chars = false;
+			label_start = false;
+		}
+		/* the first character after '[' isn't checked */
+		if (i >= 2 && i + 2 <= dlen && ':' != c && 0 == (f & C_HEX)) ipv6_chars = false;
+	}
+	o += dlen;
+
+	if ('.' == dom[dlen-1]) return false;
+	if ('[' == dom[0]) {
+		/* IPv6 address; minimal: [::] */
+		if (dlen < 4 || ']' != dom[dlen-1] || !ipv6_chars) return false;
+		result.domain_start = dom - out;
+		result.domain_length = dlen;
+	} else if (~(size_t) 0 != last_dot && hasClass(dom[last_dot+1], C_DIGIT)) {
+		/* IPv4 address */
+		if (!ipv4_chars || !validIPv4(dom, dlen)) return false;
+		result.domain_start = dom - out;
+		result.domain_length = dlen;
+	} else {
+		/* domain name; registered domain: the last two labels */
+		if (!name_ok) return false;
+		size_t start = (~(size_t) 0 == prev_dot) ? 0 : prev_dot + 1;
+		result.domain_start = dom - out + start;
+		result.domain_length = dlen - start;
+	}
+
+	/* port: up to 5 digits; invalid numbers are dropped */
+	unsigned int portnum = 0;
+	if (path - port > 1) {
+		if (path - port > 6) return false; /* max length: ":65536" */
+		for (const char *s = port + 1; s < path; s++) {
+			if (!hasClass(*s, C_DIGIT)) return false;
+			portnum = 10*portnum + (*s - '0');
+		}
+		if (portnum >= 65536) portnum = 0;
+	}
+
+	bool default_path = false;
+	if (3 == prot_len && 0 == memcmp(out, "udp", 3)) {
+		path = end; /* ignore path */
+		if (0 == portnum) portnum = 80; /* enforce port info, default to port 80 */
+	} else if (4 == prot_len && 0 == memcmp(out, "http", 4)) {
+		if (80 == portnum) portnum = 0; /* remove default port */
+		default_path = true;
+	} else if (5 == prot_len && 0 == memcmp(out, "https", 5)) {
+		if (443 == portnum) portnum = 0; /* remove default port */
+		default_path = true;
+	}
+
+	if (0 != portnum) {
+		char digits[5];
+		size_t n = 0;
+		for (; 0 != portnum; portnum /= 10) digits[n++] = '0' + portnum % 10;
+		*o++ = ':';
+		while (n > 0) *o++ = digits[--n];
+	}
+
+	if (path == end) {
+		if (default_path) *o++ = '/';
+	} else {
+		while (end - path > 1 && '/' == path[1]) path++; /* remove doubled leading '/' */
+		const size_t plen = end - path;
+		if (pathRun(path, plen) != plen) return false;
+		memcpy(o, path, plen);
+		o += plen;
+	}
+
+	result.length = o - out;
+	return true;
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef __TORRENT_SANITIZE_URL_CANONICAL_H
+#define __TORRENT_SANITIZE_URL_CANONICAL_H
+
+extern "C" {
+#include <sys/types.h>
+}
+
+namespace torrent {
+
+/* out needs room for the url length plus this */
+static const size_t URL_CANONICAL_EXTRA = 8;
+
+/* position of the registered domain (domain + tld, or the whole address for
+ * ipv4/ipv6) in the canonical url */
+struct CanonicalUrl {
+	size_t length;
+	size_t domain_start, domain_length;
+};
+
+/* canonical form of an announce url: lowercase protocol ([a-z0-9]*) and
+ * host (without trailing dot), port only if valid and not the default for
+ * http/https (udp always gets one, 80 if missing), path only for non-udp
+ * ("/" if empty; no doubled leading "/").
+ *
+ * false for dht:// urls, urls without "://", invalid hosts (not a domain,
+ * ipv4 or [ipv6] address), ports and path characters.
+ *
+ * one scan over the url, classifying characters with a table; out must not
+ * overlap url.
+ */
+bool canonicalUrl(const char *url, size_t len, char *out, CanonicalUrl &result);
+
+}
+
+#endif
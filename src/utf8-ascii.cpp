@@ -0,0 +1,210 @@
+#include "utils.h"
+
+#include <string>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# define HAVE_UTF8_SIMD 1
+extern "C" {
+#include <immintrin.h>
+}
+#endif
+
+/* kernels return the length of the leading "plain" run:
+ *   ascii: bytes < 0x80
+ *   text:  0x20..0x7e, \t, \n, \r
+ * everything else is left to the scalar decoder in validUTF8/validUTF8Text,
+ * so the kernels can't change which strings are accepted */
+
+namespace torrent {
+
+static inline bool plainText(unsigned char c) {
+	return (c >= 0x20 && c < 0x7f) || c == 0x09 || c == 0x0a || c == 0x0d;
+}
+
+static size_t asciiScalar(const unsigned char *s, size_t len) {
+	size_t i = 0;
+	while (i < len && s[i] < 0x80) i++;
+	return i;
+}
+
+static size_t textScalar(const unsigned char *s, size_t len) {
+	size_t i = 0;
+	while (i < len && plainText(s[i])) i++;
+	return i;
+}
+
+#ifdef HAVE_UTF8_SIMD
+
+__attribute__((target("sse2")))
+static size_t asciiSSE2(const unsigned char *s, size_t len) {
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		unsigned int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (s + i)));
+		if (0 != high) return i + __builtin_ctz(high);
+	}
+	return i + asciiScalar(s + i, len - i);
+}
+
+__attribute__((target("sse2")))
+static size_t textSSE2(const unsigned char *s, size_t len) {
+	/* signed compares: bytes >= 0x80 are negative and fail "> 0x1f" */
+	const __m128i lo = _mm_set1_epi8(0x1f), hi = _mm_set1_epi8(0x7f);
+	const __m128i tab = _mm_set1_epi8(0x09), lf = _mm_set1_epi8(0x0a), cr = _mm_set1_epi8(0x0d);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (s + i));
+		__m128i plain = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+		plain = _mm_or_si128(plain, _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr))));
+		unsigned int bad = 0xFFFF ^ (unsigned int) _mm_movemask_epi8(plain);
+		if (0 != bad) return i + __builtin_ctz(bad);
+	}
+	return i + textScalar(s + i, len - i);
+}
+
+/* the avx kernels don't call the sse2 ones for the tail: mixing legacy sse
+ * and avx code without vzeroupper is very slow on many cpus */
+
+__attribute__((target("avx2")))
+static size_t asciiAVX2(const unsigned char *s, size_t len) {
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		unsigned int high = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*) (s + i)));
+		if (0 != high) {
+			_mm256_zeroupper();
+			return i + __builtin_ctz(high);
+		}
+	}
+	_mm256_zeroupper();
+	return i + asciiScalar(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t textAVX2(const unsigned char *s, size_t len) {
+	const __m256i lo = _mm256_set1_epi8(0x1f), hi = _mm256_set1_epi8(0x7f);
+	const __m256i tab = _mm256_set1_epi8(0x09), lf = _mm256_set1_epi8(0x0a), cr = _mm256_set1_epi8(0x0d);
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (s + i));
+		__m256i plain = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+		plain = _mm256_or_si256(plain, _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr))));
+		unsigned int bad = ~(unsigned int) _mm256_movemask_epi8(plain);
+		if (0 != bad) {
+			_mm256_zeroupper();
+			return i + __builtin_ctz(bad);
+		}
+	}
+	_mm256_zeroupper();
+	return i + textScalar(s + i, len - i);
+}
+
+/* the tail is read with a masked load, which doesn't touch bytes beyond len */
+__attribute__((target("avx512bw")))
+static size_t asciiAVX512(const unsigned char *s, size_t len) {
+	for (size_t i = 0; i < len; i += 64) {
+		__mmask64 valid = (len - i >= 64) ? ~(__mmask64) 0 : (((__mmask64) 1 << (len - i)) - 1);
+		__mmask64 high = _mm512_movepi8_mask(_mm512_maskz_loadu_epi8(valid, s + i)) & valid;
+		if (0 != high) {
+			_mm256_zeroupper();
+			return i + __builtin_ctzll(high);
+		}
+	}
+	_mm256_zeroupper();
+	return len;
+}
+
+__attribute__((target("avx512bw")))
+static size_t textAVX512(const unsigned char *s, size_t len) {
+	const __m512i lo = _mm512_set1_epi8(0x1f), hi = _mm512_set1_epi8(0x7f);
+	const __m512i tab = _mm512_set1_epi8(0x09), lf = _mm512_set1_epi8(0x0a), cr = _mm512_set1_epi8(0x0d);
+	for (size_t i = 0; i < len; i += 64) {
+		__mmask64 valid = (len - i >= 64) ? ~(__mmask64) 0 : (((__mmask64) 1 << (len - i)) - 1);
+		__m512i v = _mm512_maskz_loadu_epi8(valid, s + i);
+		__mmask64 plain = _mm512_cmpgt_epi8_mask(v, lo) & _mm512_cmplt_epi8_mask(v, hi);
+		plain |= _mm512_cmpeq_epi8_mask(v, tab) | _mm512_cmpeq_epi8_mask(v, lf) | _mm512_cmpeq_epi8_mask(v, cr);
+		__mmask64 bad = ~plain & valid;
+		if (0 != bad) {
+			_mm256_zeroupper();
+			return i + __builtin_ctzll(bad);
+		}
+	}
+	_mm256_zeroupper();
+	return len;
+}
+
+#endif
+
+struct UTF8Kernel {
+	const char *name;
+	size_t (*ascii)(const unsigned char *s, size_t len);
+	size_t (*text)(const unsigned char *s, size_t len);
+};
+
+static const UTF8Kernel kernels[] = {
+#ifdef HAVE_UTF8_SIMD
+	{ "avx512bw", asciiAVX512, textAVX512 },
+	{ "avx2", asciiAVX2, textAVX2 },
+	{ "sse2", asciiSSE2, textSSE2 },
+#endif
+	{ "scalar", asciiScalar, textScalar },
+};
+
+static bool kernelSupported(const UTF8Kernel &k) {
+#ifdef HAVE_UTF8_SIMD
+	__builtin_cpu_init();
+	const std::string name(k.name);
+	if (name == "avx512bw") return __builtin_cpu_supports("avx512bw");
+	if (name == "avx2") return __builtin_cpu_supports("avx2");
+	if (name == "sse2") return __builtin_cpu_supports("sse2");
+#endif
+	(void) k;
+	return true;
+}
+
+static const UTF8Kernel* bestKernel() {
+	for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (kernelSupported(kernels[i])) return &kernels[i];
+	}
+	return &kernels[sizeof(kernels)/sizeof(kernels[0]) - 1];
+}
+
+/* chosen on first use, not during static initialization; threads may both
+ * choose it (with the same result), so the pointer is accessed atomically */
+static const UTF8Kernel *s_kernel = 0;
+
+static inline const UTF8Kernel* kernel() {
+	const UTF8Kernel *k = __atomic_load_n(&s_kernel, __ATOMIC_RELAXED);
+	if (0 == k) {
+		k = bestKernel();
+		__atomic_store_n(&s_kernel, k, __ATOMIC_RELAXED);
+	}
+	return k;
+}
+
+bool setUTF8Kernel(const std::string &name) {
+	for (size_t i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (name == kernels[i].name) {
+			if (!kernelSupported(kernels[i])) return false;
+			__atomic_store_n(&s_kernel, &kernels[i], __ATOMIC_RELAXED);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* utf8Kernel() {
+	return kernel()->name;
+}
+
+size_t asciiPrefix(const char *s, size_t len) {
+	return kernel()->ascii((const unsigned char*) s, len);
+}
+
+size_t asciiTextPrefix(const char *s, size_t len) {
+	return kernel()->text((const unsigned char*) s, len);
+}
+
+}
@@ -1,10 +1,12 @@
 
 #include "utils.h"
+#include "output-segments.h"
+#include "bencode-writer.h"
 
 #include <iostream>
-#include <fstream>
 
 extern "C" {
+#include <fcntl.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
@@ -18,7 +20,10 @@ bool validUTF8(const char *_s, size_t len) {
 	const unsigned char *s = (const unsigned char*) _s;
 	for (size_t i = 0; i < len; i++) {
 		size_t seqlen = 0;
-		if (0 == (s[i] & 0x80)) { continue; }
+		if (0 == (s[i] & 0x80)) {
+			i += asciiPrefix(_s + i, len - i) - 1;
+			continue;
+		}
 		else if ((0xC0 == s[i]) || (0xC1 == s[i])) { return false; /* 0xCO / 0xC1 overlong */ }
 		else if (0xC0 == (s[i] & 0xE0)) { seqlen = 1; }
 		else if (0xE0 == s[i]) {
@@ -63,6 +68,10 @@ bool validUTF8Text(const char *_s, size_t len) {
 	for (size_t i = 0; i < len; i++) {
 		unsigned int code;
 		int seqlen = 0;
+		if (s[i] >= 0x20 && s[i] < 0x7f) {
+			i += asciiTextPrefix(_s + i, len - i) - 1;
+			continue;
+		}
 		if (0 == (s[i] & 0x80)) { seqlen = 0; code = s[i] & 0x7f; }
 		else if (0xC0 == (s[i] & 0xFE)) { return false; /* 0xCO / 0xC1 overlong */ }
 		else if (0xC0 == (s[i] & 0xE0)) { seqlen = 1; code = s[i] & 0x1f; }
@@ -120,19 +129,41 @@ bool Writable::writeAtomicFile(const std::string &filename) const {
 		return false;
 	}
 
-	{
-		std::ofstream os(tmpfname, std::ios_base::binary | std::ios_base::trunc | std::ios_base::out);
-		if (os.fail()) {
-			int e = errno;
-			std::cerr << "Cannot open file '" << tmpfname << "': " << ::strerror(e) << std::endl;
-			::close(fd);
-			return false;
-		}
-		write(os);
-		os.close();
+	/* exact size first: one allocation for the new parts, preallocate the file */
+	BencodeSize size;
+	serialize(size);
+#ifdef HAVE_FALLOCATE
+	if (size.size() > 0) ::fallocate(fd, 0, 0, size.size()); /* only a hint */
+#endif
+
+	/* unchanged parts of the source file are copied in the kernel */
+	OutputSegments out;
+	out.reserve(size.rawSize());
+	serialize(out);
+	if (out.failed()) {
+		std::cerr << "Cannot read source data for '" << filename << "'" << std::endl;
+		::close(fd);
+		::unlink(tmpfname);
+		return false;
+	}
+	if (out.size() != size.size()) {
+		std::cerr << "Internal error: computed size " << size.size() << " != written size " << out.size() << " for '" << filename << "'" << std::endl;
+		::close(fd);
+		::unlink(tmpfname);
+		return false;
+	}
+	if (!out.writeTo(fd, tmpfname)) {
+		::close(fd);
+		::unlink(tmpfname);
+		return false;
 	}
 	::fchmod(fd, 0644);
-	::close(fd);
+	if (-1 == ::close(fd)) {
+		int e = errno;
+		std::cerr << "Cannot write file '" << tmpfname << "': " << ::strerror(e) << std::endl;
+		::unlink(tmpfname);
+		return false;
+	}
 	if (-1 == ::rename(tmpfname, filename.c_str())) {
 		int e = errno;
 		std::cerr << "Cannot rename tempfile '" << tmpfname << "' to '" << filename << "': " << ::strerror(e) << std::endl;
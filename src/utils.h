@@ -17,31 +17,49 @@ bool validUTF8(const std::string &s);
 bool validUTF8Text(const char *_s, size_t len);
 bool validUTF8Text(const std::string &s);
 
+/* length of the leading run of plain ascii (text: 0x20..0x7e, \t, \n, \r);
+ * validUTF8 and validUTF8Text skip these runs with SIMD */
+size_t asciiPrefix(const char *s, size_t len);
+size_t asciiTextPrefix(const char *s, size_t len);
+
+/* kernel for the ascii runs: "avx512bw", "avx2", "sse2" or "scalar";
+ * default is the best one the cpu supports. false if not available */
+bool setUTF8Kernel(const std::string &name);
+const char* utf8Kernel();
+
 template<size_t N> bool stringHasPrefix(const std::string &s, const char (&prefix)[N]) {
 	return s.length() >= (N-1) && 0 == memcmp(s.c_str(), prefix, N-1);
 }
 
+class BencodeSize;
+class OutputSegments;
+
+/* T needs template<typename Out> void serialize(Out &out) const */
 class Writable {
 public:
-	virtual void write(std::ostream &os) const = 0;
+	virtual void serialize(BencodeSize &out) const = 0;
+	virtual void serialize(OutputSegments &out) const = 0;
 
 	bool writeAtomicFile(const std::string &filename) const;
 };
 
 template<typename T>
-class OStreamObject : public Writable {
+class SerializeObject : public Writable {
 private:
 	const T &obj;
 public:
-	OStreamObject(const T &obj) : obj(obj) { }
-	virtual void write(std::ostream &os) const {
-		os << obj;
+	SerializeObject(const T &obj) : obj(obj) { }
+	virtual void serialize(BencodeSize &out) const {
+		obj.serialize(out);
+	}
+	virtual void serialize(OutputSegments &out) const {
+		obj.serialize(out);
 	}
 };
 
 template<typename T> bool writeAtomicFile(const std::string &filename, const T &t) {
-	OStreamObject<T> o(t);
-	o.writeAtomicFile(filename);
+	SerializeObject<T> o(t);
+	return o.writeAtomicFile(filename);
 }
 
 }